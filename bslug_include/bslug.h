@@ -33,7 +33,8 @@
 typedef enum bslug_loader_entry_type_t {
     BSLUG_LOADER_ENTRY_FUNCTION,
     BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY,
-    BSLUG_LOADER_ENTRY_EXPORT
+    BSLUG_LOADER_ENTRY_EXPORT,
+    BSLUG_LOADER_ENTRY_HOOK
 } bslug_loader_entry_type_t;
 
 typedef struct bslug_loader_entry_t {
@@ -87,6 +88,35 @@ typedef struct bslug_loader_entry_t {
         } \
     }
 
+/* Call handler just before the instruction offset bytes into the game's
+ * symbol, which must be an integer literal. The handler is given the volatile
+ * registers, and any changes it makes to them take effect when it returns.
+ * Added in BSLUG_LIB_VERSION 0.1.3 */
+#define BSLUG_HOOK_AT(symbol, offset, handler) \
+    extern const bslug_loader_entry_t bslug_hook_ ## symbol ## _ ## offset \
+        BSLUG_SECTION("load"); \
+    const bslug_loader_entry_t bslug_hook_ ## symbol ## _ ## offset = { \
+        .type = BSLUG_LOADER_ENTRY_HOOK, \
+        .data = { \
+            .function = { \
+                .name = #symbol "+" #offset, \
+                .target = &(handler) \
+            } \
+        } \
+    }
+
+/* The registers passed to a BSLUG_HOOK_AT handler. gpr[1] is the game's
+ * stack pointer, and is not restored. */
+typedef struct bslug_hook_context_t {
+    uint32_t gpr[13];
+    uint32_t cr;
+    uint32_t xer;
+    uint32_t ctr;
+    uint32_t lr;
+    uint32_t padding;
+    double fpr[14];
+} bslug_hook_context_t;
+
 #define BSLUG_META(id, value) \
     extern const char bslug_meta_ ## id [] BSLUG_SECTION("meta"); \
     const char bslug_meta_ ## id [] = #id "=" value
@@ -96,6 +126,19 @@ typedef struct bslug_loader_entry_t {
 #define BSLUG_MODULE_AUTHOR(x)  BSLUG_META(author, x)
 #define BSLUG_MODULE_VERSION(x) BSLUG_META(version, x)
 #define BSLUG_MODULE_LICENSE(x) BSLUG_META(license, x)
+/* x is "data" to put all data and bss in MEM2, or "all" to also put code
+ * there. Code in MEM2 must be compiled with -mlongcall. */
+#define BSLUG_MODULE_MEM2(x)    BSLUG_META(mem2, x)
+
+/* Place a single variable in MEM2. BSLUG_MEM2 is for zero initialised
+ * buffers, BSLUG_MEM2_DATA for initialised data and BSLUG_MEM2_CODE for
+ * functions, which must be compiled with -mlongcall. */
+#define BSLUG_MEM2      __attribute__((__section__ (".bss.mem2")))
+#define BSLUG_MEM2_DATA __attribute__((__section__ (".mem2.data")))
+#define BSLUG_MEM2_CODE __attribute__((__section__ (".mem2.text")))
+/* Keep a function in MEM1, ahead of the module's other code, even with
+ * BSLUG_MODULE_MEM2("all"). */
+#define BSLUG_HOT       __attribute__((__section__ (".text.hot")))
 
 /* bslug_game_start - first address that is part of the game's executable.
  * bslug_game_end   - address after the end of the game's executable.
@@ -103,6 +146,62 @@ typedef struct bslug_loader_entry_t {
 extern uint8_t bslug_game_start[];
 extern uint8_t bslug_game_end[];
 
+/* bslug_sym_lookup - address of a game or module symbol, or NULL if it was
+ * not found, for hooks which are optional. Module exports take precedence
+ * over game symbols, as when linking. The loader builds the table in MEM2
+ * only when a module uses it.
+ * Added in BSLUG_LIB_VERSION 0.1.3 */
+typedef struct bslug_sym_t {
+    uint32_t hash;
+    const char *name;
+    void *address;
+} bslug_sym_t;
+
+typedef struct bslug_sym_table_t {
+    /* a power of two. */
+    uint32_t bucket_count;
+    uint32_t count;
+    /* bucket b is symbols[buckets[b]] up to symbols[buckets[b + 1]]. */
+    const uint32_t *buckets;
+    const bslug_sym_t *symbols;
+} bslug_sym_table_t;
+
+extern const bslug_sym_table_t bslug_sym_table;
+
+static inline uint32_t bslug_sym_hash(const char *name) {
+    uint32_t hash = 5381;
+    
+    while (*name != '\0')
+        hash = hash * 33 + (uint8_t)*name++;
+    return hash;
+}
+
+static inline void *bslug_sym_lookup(const char *name) {
+    uint32_t hash, i, end;
+    
+    hash = bslug_sym_hash(name);
+    i = bslug_sym_table.buckets[hash & (bslug_sym_table.bucket_count - 1)];
+    end = bslug_sym_table.buckets[
+        (hash & (bslug_sym_table.bucket_count - 1)) + 1];
+    
+    for (; i < end; i++) {
+        const char *left, *right;
+        
+        if (bslug_sym_table.symbols[i].hash != hash)
+            continue;
+        
+        left = bslug_sym_table.symbols[i].name;
+        right = name;
+        while (*left != '\0' && *left == *right) {
+            left++;
+            right++;
+        }
+        if (*left == *right)
+            return bslug_sym_table.symbols[i].address;
+    }
+    return NULL;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -46,7 +46,14 @@ typedef signed long long s64;
 #include <smn/Dance.h>
 #include <smn/RNG.h>
 
+#include "netcodec.h"
+#include "netdelay.h"
+#include "netframe.h"
+#include "netloop.h"
+#include "netring.h"
 #include "network.h"
+#include "netwindow.h"
+#include "packet.h"
 
 /* Which game to support. ? is a wild card (e.g. RMC? is any version of Mario
  * Kart Wii) */
@@ -65,15 +72,31 @@ BSLUG_MODULE_LICENSE("BSD");
 
 int host = -1;
 int communicationSock = -1;
+// Frames travel over UDP; the TCP socket above is only used to set up.
+int datagramSock = -1;
+struct sockaddr_in peerAddress;
+// Round trip time measured by the loader while setting up, in microseconds.
+int sessionRtt = 0;
 
 BSLUG_EXPORT(host);
 BSLUG_EXPORT(communicationSock);
+BSLUG_EXPORT(datagramSock);
+BSLUG_EXPORT(peerAddress);
+BSLUG_EXPORT(sessionRtt);
 
 static bool MyOSCreateThread(
     OSThread_t *thread, OSThreadEntry_t entry_point, void *argument,
     void *stack_base, size_t stack_size, int priority, bool detached);
-static void* sendThread_main(void *arg);
-static void* recvThread_main(void *arg);
+static void* netThread_main(void *arg);
+static void netRecv(void *arg, unsigned char *datagram, int length);
+static int netSend(void *arg, unsigned char *buffer, size_t size);
+static void netWake(void *arg);
+static void netResend(void *arg);
+static bool netLoopStartRecv(void *context, unsigned char *buffer, size_t size);
+static bool netLoopStartSend(void *context, const unsigned char *buffer, size_t length);
+static long long netLoopNow(void *context);
+static void netLoopWait(void *context, long long until);
+static void netLoopWake(void *context);
 static void* controllerThread_main(void *arg);
 static void MyWPADRead(int wiiremote, WPADData_t *data);
 static void MyWPADInit(void);
@@ -157,19 +180,25 @@ static int autoSamplingBufferCount[4];
 static int autoSamplingBufferIndex[4];
 
 extern int net_ip_top_fd;
-static OSThread_t sendThread;
-static OSThread_t recvThread;
+static OSThread_t netThread;
 static OSThread_t controllerThread;
-static char sendThreadStack[0x4000];
-static char recvThreadStack[0x4000];
-static char controllerThreadStack[0x4000];
+static char netThreadStack[0x4000] BSLUG_MEM2;
+static char controllerThreadStack[0x4000] BSLUG_MEM2;
 static bool canaried;
 
+// Each queue is woken when its condition may have changed, and only then.
+// Sleepers check their condition with interrupts masked, so no wakeup is
+// lost between the check and the sleep.
+// The game moved on a frame, which also frees a ctrlBuffer slot.
 static OSThreadQueue_t framewaitqueue = { };
 static OSThreadQueue_t wpadReadQueue = { };
 static OSThreadQueue_t hangGameQueue = { };
+// An IoctlBuffer entry was freed or called back.
 static OSThreadQueue_t IoctlBufferThreadQueue = { };
-static OSThreadQueue_t SendBufferThreadQueue = { };
+// The network thread's loop was woken; see netLoopWait.
+static OSThreadQueue_t netLoopQueue = { };
+// Guest only: the network thread freed a slot in inputRing or messageRing.
+static OSThreadQueue_t SendRingThreadQueue = { };
 
 static ios_fd_t discFD = -1;
 
@@ -198,53 +227,6 @@ typedef struct fst_t {
 
 static const fst * const * const game_fst = (const fst * const * const)0x80000038;
 
-// Packet sent from guests to host.
-struct sendPacket {
-	int sent; // 0 = invalid, 1 = to be sent, 2 = sent succesfully (may be reused)
-	int type; // 0 = controller, 1 = di_read
-	int clientNumber; // 0 is host
-	union 
-	{
-		struct
-		{
-			int frameNumberToDeliverOn;
-			int wiimote;
-			WPADDataFormat_t format;
-			WPADStatus_t status;
-			WPADExtension_t extension;
-			WPADData_t inputs;
-			WPADAccGravityUnit_t gravityUnit[2];
-		} controller;
-		struct
-		{
-			unsigned int sector;
-		} di_read;
-	} data;
-};
-
-// Packet sent from host to guests.
-struct ctrlPacket {
-	int frameNumber;
-	long long frameSeed;
-	bool haveSentOrRecv;
-	bool haveInput[4];
-	WPADDataFormat_t formats[4];
-	WPADStatus_t status[4];
-	WPADExtension_t extension[4];
-	WPADData_t inputs[4];
-	WPADAccGravityUnit_t gravityUnit[4][2];
-	unsigned int callback_sector;
-	union
-	{
-		struct
-		{
-			unsigned char dance_a6c9;
-			unsigned char dance_a6ca;
-			unsigned char dance_a6cb;
-		} SMN;
-	} game;
-};
-
 #define IOCTL_BUFFER_SIZE 20
 
 #define MAX_PLAYERS 2
@@ -264,20 +246,75 @@ static struct IoctlManager {
 static void ourCallback(ios_ret_t result, usr_t usrdata);
 
 // ******************************************************************************************************
-#define BUFFER_SIZE 5
-
-// Produced by controller thread on host & guest
-// Consumed by send thread on host & guest
-//  - On guest this is genuinely sent over network.
-//  - On host this is just copied to ctrlBuffer.
-static struct sendPacket sendBuffer[BUFFER_SIZE];
+// The most frames ahead of the game that inputs are sampled.
+#ifndef INPUT_DELAY_MAX
+#define INPUT_DELAY_MAX 10
+#endif
+#define INPUT_DELAY_MIN 2
+// Microseconds per retrace at 59.94Hz.
+#define FRAME_US 16683
+#define BUFFER_SIZE (INPUT_DELAY_MAX + 1)
+
+// Guest only: what the network thread sends to the host. Inputs come from the
+// controller thread and DI reads from the game's thread, so each has a ring.
+#define INPUT_RING_SIZE 16
+#define MESSAGE_RING_SIZE 16
+static struct sendPacket inputRingSlots[INPUT_RING_SIZE];
+static struct sendPacket messageRingSlots[MESSAGE_RING_SIZE];
+// Set up statically; the game may read the disc before the threads start.
+static netring_t inputRing = NETRING_INIT(inputRingSlots, INPUT_RING_SIZE);
+static netring_t messageRing = NETRING_INIT(messageRingSlots, MESSAGE_RING_SIZE);
 // Produced by send & recv thread on host
 //  - recv fills in any inputs needed from other machine
-//  - when they've all arrived send thread copies local input from sendBuffer and broadcasts the ctrlPacket to clients
+//  - when they've all arrived send thread broadcasts the ctrlPacket to clients
 // Produced by recv thread on guest
 // Consumed by callbackThread on host & guest
+// Each slot holds frame frameNumber. Every producer writes its fields and
+// then sets its flag (haveInput or haveSentOrRecv) after a barrier; the VI
+// handler clears the flags and then moves frameNumber on after a barrier,
+// which hands the slot back.
 static struct ctrlPacket ctrlBuffer[BUFFER_SIZE];
 
+// Frames not yet acknowledged by the other Wii are resent in every datagram,
+// up to this many.
+#define WINDOW_DEPTH (BUFFER_SIZE * 2)
+
+#if NETWINDOW_DATAGRAM_MAX > NET_BUFFER_SIZE
+#error "Datagrams are built in network buffers; see network.h."
+#endif
+
+// One thread does all the netplay socket's work: it sends, receives and
+// resends from a netloop, with IOS completing each operation from the IPC
+// interrupt. The Wii's OSSleepThread has no timeout, so the retrace wakes
+// the loop when a timer is due, and timers run to the nearest frame.
+static netloop_t netLoop;
+static netloop_backend_t netLoopBackend;
+static volatile bool netLoopWoken;
+static net_async_t netRecvOp;
+static net_async_t netSendOp;
+// Where each datagram came from, so the peer's port can be learnt.
+static struct sockaddr_in netRecvFrom __attribute__((aligned(32)));
+static socklen_t netRecvFromLength;
+
+// Only touched by the network thread, bar the retrace's quick look.
+static netwindow_t window BSLUG_MEM2;
+// The next frame the host composes, and its slot.
+static int nextFrameToSend;
+static int composePos;
+// The guest's slot for the next frame from the host.
+static int deliverPos;
+// When the host pushed each frame, to time the guest's acknowledgement.
+static long long pushTime[NETWINDOW_FRAMES];
+
+// Frames ahead of the game that the controller thread samples inputs. Both
+// Wiis start from the loader's round trip time; after that the host picks it
+// and each frame carries it, so it changes on the same frame for both.
+static int inputDelay;
+// The first frame with inputs; every controller is disconnected before it.
+static int firstInputFrame;
+// Only used on the host after the start; see netdelay.h.
+static netdelay_t netDelay;
+
 #define _CPU_ISR_Disable( _isr_cookie ) \
   { register u32 _disable_mask = 0; \
 	_isr_cookie = 0; \
@@ -390,84 +427,97 @@ static inline void printInt(int value)
 static int ioctlsSent = 0;
 static int ioctlsRecv = 0;
 
-static int IoctlBufferAllocator(unsigned int sector)
+// The entry for sector, allocated if need be, or -1 if the buffer is full.
+// Call with interrupts masked.
+static int IoctlBufferFind(unsigned int sector)
 {
-	int isr;
-	_CPU_ISR_Disable(isr);
-
-	bool hang = false;
-	while (true)
+	int i;
+	// Look for this sector already in the buffer
+	for (i = 0; i < IOCTL_BUFFER_SIZE; i++)
 	{
-		int i;
-		// Look for this sector already in the buffer
-		for (i = 0; i < IOCTL_BUFFER_SIZE; i++)
+		if (IoctlBuffer[i].state >= 1 && IoctlBuffer[i].sector == sector)
 		{
-			if (IoctlBuffer[i].state >= 1 && IoctlBuffer[i].sector == sector)
-			{
-				break;
-			}
+			return i;
 		}
-		
-		if (i == IOCTL_BUFFER_SIZE)
+	}
+	
+	// Allocate a new sector
+	for (i = 0; i < IOCTL_BUFFER_SIZE; i++)
+	{
+		if (IoctlBuffer[i].state == 0)
 		{
-			// Allocate a new sector
-			for (i = 0; i < IOCTL_BUFFER_SIZE; i++)
-			{
-				if (IoctlBuffer[i].state == 0)
-				{
-					break;
-				}
-			}
+			break;
 		}
+	}
+	if (i == IOCTL_BUFFER_SIZE)
+	{
+		return -1;
+	}
 
-		if (i == IOCTL_BUFFER_SIZE)
-		{
-			// Buffer full!
-			if (!hang)
-			{
-				Console_Write("[IOCTL] Hung on full IoctlBuffer.\n");
-				hang = true;
-			}
-			OSSleepThread(&IoctlBufferThreadQueue);
-			continue;
-		}
+	IoctlBuffer[i].state = 1;
+	IoctlBuffer[i].sector = sector;
+	for (int j = 0; j < MAX_PLAYERS; j++)
+		IoctlBuffer[i].haveCallback[j] = false;
+	IoctlBuffer[i].haveSent = false;
+	return i;
+}
 
-		if (IoctlBuffer[i].state == 0)
+static int IoctlBufferAllocator(unsigned int sector)
+{
+	int isr;
+	_CPU_ISR_Disable(isr);
+
+	bool hang = false;
+	int i;
+	while ((i = IoctlBufferFind(sector)) < 0)
+	{
+		// Buffer full!
+		if (!hang)
 		{
-			IoctlBuffer[i].state = 1;
-			IoctlBuffer[i].sector = sector;
-			for (int j = 0; j < MAX_PLAYERS; j++)
-				IoctlBuffer[i].haveCallback[j] = false;
-			IoctlBuffer[i].haveSent = false;
+			Console_Write("[IOCTL] Hung on full IoctlBuffer.\n");
+			hang = true;
 		}
-		
-		_CPU_ISR_Restore(isr);
-		return i;
+		OSSleepThread(&IoctlBufferThreadQueue);
+	}
+	
+	_CPU_ISR_Restore(isr);
+	return i;
+}
+
+// Wakes the network thread to see what has changed; before it is set up
+// there is nothing to wake, and it looks at everything when it starts.
+static void WakeNetwork(void)
+{
+	if (framewaitqueueEnabled)
+	{
+		NetLoop_Wake(&netLoop);
 	}
 }
 
 // On host, uses packet for receivey logicy thingy to populate controllBuffer.. yeah, that's right
-// On client sends message to host (via sendBuffer & sendThread)
+// On client sends message to host (via inputRing or messageRing & the network thread)
 static void ProcessPacket(struct sendPacket *pkt)
 {
 	int isr;
-	_CPU_ISR_Disable(isr);
 	if (pkt->type == 0) // Controller data
 	{
 		int fntdo = pkt->data.controller.frameNumberToDeliverOn;
 		int index = fntdo % BUFFER_SIZE;
 
+		// Masked only so the retrace can't wake the queue between the check
+		// and the sleep; sleeping lets interrupts in again.
+		_CPU_ISR_Disable(isr);
 		while (ctrlBuffer[index].frameNumber != fntdo)
 		{
 			WaitForNextFrame();
 		}
-		ctrlBuffer[index].formats[pkt->data.controller.wiimote] = pkt->data.controller.format;
-		ctrlBuffer[index].status[pkt->data.controller.wiimote] = pkt->data.controller.status;
-		ctrlBuffer[index].extension[pkt->data.controller.wiimote] = pkt->data.controller.extension;
-		ctrlBuffer[index].inputs[pkt->data.controller.wiimote] = pkt->data.controller.inputs;
-		ctrlBuffer[index].gravityUnit[pkt->data.controller.wiimote][0] = pkt->data.controller.gravityUnit[0];
-		ctrlBuffer[index].gravityUnit[pkt->data.controller.wiimote][1] = pkt->data.controller.gravityUnit[1];
-		ctrlBuffer[index].haveInput[pkt->data.controller.wiimote] = true;
+		_CPU_ISR_Restore(isr);
+		NetFrame_MergeInput(&ctrlBuffer[index], pkt);
+		if (host && pkt->data.controller.wiimote == HOSTS_WIIMOTE_NUMBER)
+		{
+			// hostFrameReady waits for this.
+			WakeNetwork();
+		}
 	}
 	if (host)
 	{
@@ -487,25 +537,21 @@ static void ProcessPacket(struct sendPacket *pkt)
 	}
 	else
 	{
-		static int sendBufferPos = 0;
-		
-		while (sendBuffer[sendBufferPos].sent == 1)
+		netring_t *ring = pkt->type == 0 ? &inputRing : &messageRing;
+		struct sendPacket *slot;
+
+		_CPU_ISR_Disable(isr);
+		while ((slot = NetRing_Reserve(ring)) == NULL)
 		{
-			OSSleepThread(&SendBufferThreadQueue);
+			OSSleepThread(&SendRingThreadQueue);
 		}
+		_CPU_ISR_Restore(isr);
 
-		sendBuffer[sendBufferPos] = *pkt;
-		sendBuffer[sendBufferPos].sent = 1;
-		OSWakeupThread(&SendBufferThreadQueue);
+		*slot = *pkt;
+		NetRing_Publish(ring);
+		WakeNetwork();
 		//Console_Write("[PKT] Sent a packet.\n");
-
-		sendBufferPos++;
-		if (sendBufferPos >= BUFFER_SIZE)
-		{
-			sendBufferPos = 0;
-		}
 	}
-	_CPU_ISR_Restore(isr);
 }
 
 static ios_fd_t MyIOS_Open(const char *filepath, ios_mode_t mode)
@@ -676,14 +722,6 @@ static void ourCallback(ios_ret_t result, usr_t usrdata)
 	OSWakeupThread(&IoctlBufferThreadQueue);
 }
 
-static void WAKEUP(void)
-{
-	if (framewaitqueueEnabled)
-	{
-		OSWakeupThread(&framewaitqueue);
-	}
-}
-
 static void WaitForNextFrame(void)
 {
 	OSSleepThread(&framewaitqueue);
@@ -704,18 +742,49 @@ static bool MyOSCreateThread(
 		OSInitThreadQueue(&wpadReadQueue);
 		OSInitThreadQueue(&hangGameQueue);
 		OSInitThreadQueue(&IoctlBufferThreadQueue);
-		OSInitThreadQueue(&SendBufferThreadQueue);
+		OSInitThreadQueue(&netLoopQueue);
+		OSInitThreadQueue(&SendRingThreadQueue);
+		// Mark the first BUFFER_SIZE frames as ready (since they're, by definition, unused).
+		for (int i = 0; i < BUFFER_SIZE; i++)
+		{
+			ctrlBuffer[i].frameNumber = i;
+		}
+		NetDelay_Init(&netDelay, INPUT_DELAY_MIN, INPUT_DELAY_MAX, FRAME_US);
+		if (sessionRtt > 0)
+		{
+			NetDelay_Sample(&netDelay, sessionRtt);
+		}
+		inputDelay = netDelay.delay;
+		firstInputFrame = netDelay.delay;
+		NetWindow_Init(&window, host ? NETCODEC_KIND_CTRL : NETCODEC_KIND_INPUT, host ? NETCODEC_KIND_INPUT : NETCODEC_KIND_CTRL, WINDOW_DEPTH);
+		netLoopBackend.startRecv = netLoopStartRecv;
+		netLoopBackend.startSend = netLoopStartSend;
+		netLoopBackend.now = netLoopNow;
+		netLoopBackend.wait = netLoopWait;
+		netLoopBackend.wake = netLoopWake;
+		// Both buffers are the loop's for good; IOS uses them in place.
+		unsigned char *recvBuffer = Mynet_bufalloc();
+		unsigned char *sendBuffer = Mynet_bufalloc();
+		NetLoop_Init(&netLoop, &netLoopBackend, recvBuffer, sendBuffer, NET_BUFFER_SIZE, netRecv, netSend, NULL);
+		NetLoop_AddTimer(&netLoop, FRAME_US, netResend, NULL);
+		NetLoop_SetWake(&netLoop, netWake);
+		NetLoop_SetBatch(&netLoop, true);
 		framewaitqueueEnabled = true;
-		OSCreateThread(&sendThread, sendThread_main, 0, sendThreadStack + sizeof(sendThreadStack), sizeof(sendThreadStack), THREAD_PRIORITY_HIGHEST, false);
-		OSResumeThread(&sendThread);
-		OSCreateThread(&recvThread, recvThread_main, 0, recvThreadStack + sizeof(recvThreadStack), sizeof(recvThreadStack), THREAD_PRIORITY_HIGHEST, false);
-		OSResumeThread(&recvThread);
+		if (recvBuffer != NULL && sendBuffer != NULL)
+		{
+			OSCreateThread(&netThread, netThread_main, 0, netThreadStack + sizeof(netThreadStack), sizeof(netThreadStack), THREAD_PRIORITY_HIGHEST, false);
+			OSResumeThread(&netThread);
+		}
+		else
+		{
+			Console_Write("[NET] Out of buffers.\n");
+			network_error = 1;
+		}
 		OSCreateThread(&controllerThread, controllerThread_main, 0, controllerThreadStack + sizeof(controllerThreadStack), sizeof(controllerThreadStack), THREAD_PRIORITY_HIGHEST, false);
 		OSResumeThread(&controllerThread);
 		for (int i = 0; i < 100; i++)
 		{
-			sendThreadStack[i] = 0xa5;
-			recvThreadStack[i] = 0xa5;
+			netThreadStack[i] = 0xa5;
 			controllerThreadStack[i] = 0xa5;
 		}
 		canaried = true;
@@ -725,212 +794,352 @@ static bool MyOSCreateThread(
 	return OSCreateThread(thread, entry_point, argument, stack_base, stack_size, priority, detached);
 }
 
-static int reliable_send(int socket, const void *data, int size) {
-	for (int i = 0; i < size; ) {
-		int amt = Mynet_send(socket, (const char *)data + i, size - i, 0);
-		if (amt <= 0) return amt;
-		i += amt;
+static bool hostFrameReady(void)
+{
+	if (ctrlBuffer[composePos].frameNumber != nextFrameToSend)
+	{
+		return false;
 	}
-	return size;
-}
-
-static int reliable_recv(int socket, void *data, int size) {
-	for (int i = 0; i < size; ) {
-		int amt = Mynet_recv(socket, (char *)data + i, size - i, 0);
-		if (amt <= 0) return amt;
-		i += amt;
+	// Wait for all controllers to be available
+	if (nextFrameToSend > firstInputFrame && !ctrlBuffer[composePos].haveInput[HOSTS_WIIMOTE_NUMBER])
+	{
+		return false;
 	}
-	return size;
+	// Until the guest acknowledges enough of the window to make room.
+	return NetWindow_CanPush(&window);
 }
 
-static void* sendThread_main(void *arg)
+static void hostComposeFrames(void)
 {
+	static long long frameSeed = 0;
+	// The host's part of each frame; see netframe.h.
+	static struct ctrlPacket authority;
+	static struct ctrlPacket lastAuthority;
+	static bool haveLastAuthority = false;
 
-	Console_Write("[SEND] Thread started.\n");
-
-	int sendBufferPos = 0;
-	int ctrlBufferPos = 0;
-	int nextFrameToSend = 0;
-	long long frameSeed = 0;
-	
-	// Mark the first BUFFER_SIZE frames as ready (since they're, by definition, unused).
-	for (int i = 0; i < BUFFER_SIZE; i++)
+	while (hostFrameReady())
 	{
-		ctrlBuffer[i].frameNumber = i;
-	}
+		int isr;
+		_CPU_ISR_Disable(isr);
+		// Disconnect ALL controllers until the first input frame.
+		// Then just disconnect the ones we aren't using.
+		for (int i = nextFrameToSend > firstInputFrame ? NUMBER_OF_INPUTS_TO_WAIT_FOR : 0; i < 4; i++)
+		{
+			ctrlBuffer[composePos].status[i] = WPAD_STATUS_DISCONNECTED;
+			ctrlBuffer[composePos].haveInput[i] = true;
+		}
+		frameSeed = frameSeed * 1103515245 + 12345;
+		ctrlBuffer[composePos].frameSeed = frameSeed;
 
-	while (true)
-	{
-		if (host)
+		if (memcmp((char *)0x80000000, "SMN", 3) == 0) 
 		{
-			while (ctrlBuffer[ctrlBufferPos].frameNumber != nextFrameToSend)
-			{
-				WaitForNextFrame();
-			}
+			ctrlBuffer[composePos].game.SMN.dance_a6c9 = SMNDance_GetUnkown_a6c9();
+			ctrlBuffer[composePos].game.SMN.dance_a6ca = SMNDance_GetMask();
+			ctrlBuffer[composePos].game.SMN.dance_a6cb = SMNDance_GetUnkown_a6cb();
+		}
 
-			// Wait for all controllers to be available
-			if (nextFrameToSend > BUFFER_SIZE)
+		ctrlBuffer[composePos].inputDelay = netDelay.delay;
+		ctrlBuffer[composePos].callback_sector = 0;
+		for (int i = 0; i < IOCTL_BUFFER_SIZE; i++)
+		{
+			if (IoctlBuffer[i].state >= 1 && IoctlBuffer[i].haveSent == false)
 			{
-				while (!ctrlBuffer[ctrlBufferPos].haveInput[HOSTS_WIIMOTE_NUMBER])
+				int j;
+				for (j = 0; j < 2; j++)
 				{
-					WaitForNextFrame();
+					if (!IoctlBuffer[i].haveCallback[j]) break;
 				}
-			}
-			int isr;
-			_CPU_ISR_Disable(isr);
-			// Disconnect ALL controllers until frame BUFFER_SIZE.
-			// Then just disconnect the ones we aren't using.
-			for (int i = nextFrameToSend > BUFFER_SIZE ? NUMBER_OF_INPUTS_TO_WAIT_FOR : 0; i < 4; i++)
-			{
-				ctrlBuffer[ctrlBufferPos].status[i] = WPAD_STATUS_DISCONNECTED;
-				ctrlBuffer[ctrlBufferPos].haveInput[i] = true;
-			}
-			frameSeed = frameSeed * 1103515245 + 12345;
-			ctrlBuffer[ctrlBufferPos].frameSeed = frameSeed;
-
-			if (memcmp((char *)0x80000000, "SMN", 3) == 0) 
-			{
-				ctrlBuffer[ctrlBufferPos].game.SMN.dance_a6c9 = SMNDance_GetUnkown_a6c9();
-				ctrlBuffer[ctrlBufferPos].game.SMN.dance_a6ca = SMNDance_GetMask();
-				ctrlBuffer[ctrlBufferPos].game.SMN.dance_a6cb = SMNDance_GetUnkown_a6cb();
-			}
-
-			ctrlBuffer[ctrlBufferPos].callback_sector = 0;
-			for (int i = 0; i < IOCTL_BUFFER_SIZE; i++)
-			{
-				if (IoctlBuffer[i].state >= 1 && IoctlBuffer[i].haveSent == false)
+				if (j == 2)
 				{
-					int j;
-					for (j = 0; j < 2; j++)
-					{
-						if (!IoctlBuffer[i].haveCallback[j]) break;
-					}
-					if (j == 2)
-					{
-						// All have called back!
-						IoctlBuffer[i].haveSent = true;
-						ctrlBuffer[ctrlBufferPos].callback_sector = IoctlBuffer[i].sector;
-					}
+					// All have called back!
+					IoctlBuffer[i].haveSent = true;
+					ctrlBuffer[composePos].callback_sector = IoctlBuffer[i].sector;
 				}
 			}
+		}
 
-			_CPU_ISR_Restore(isr);
+		// Guests send their own input to each other; the host only
+		// sends its own and the slots it disconnected.
+		unsigned slots = 0xf;
+		if (nextFrameToSend > firstInputFrame)
+		{
+			slots = (1 << HOSTS_WIIMOTE_NUMBER) | (0xf & ~((1 << NUMBER_OF_INPUTS_TO_WAIT_FOR) - 1));
+		}
+		NetFrame_Authority(&authority, &ctrlBuffer[composePos], haveLastAuthority ? &lastAuthority : NULL, slots);
+		lastAuthority = authority;
+		haveLastAuthority = true;
 
-			while(reliable_send(communicationSock, &ctrlBuffer[ctrlBufferPos], sizeof(ctrlBuffer[ctrlBufferPos])) <= 0)
-			{
-				Console_Write("[SEND] Failure. OHHHHHH.\n");
-				network_error = 1;
-			}
+		_CPU_ISR_Restore(isr);
 
-			ctrlBuffer[ctrlBufferPos].haveSentOrRecv = true;
-				
-			OSWakeupThread(&wpadReadQueue); // New data for WPADRead
+		// hostFrameReady checked for room.
+		pushTime[nextFrameToSend % NETWINDOW_FRAMES] = gettime();
+		NetWindow_Push(&window, &authority);
 
-			ctrlBufferPos++;
-			if (ctrlBufferPos >= BUFFER_SIZE)
-			{
-				ctrlBufferPos = 0;
-			}
-			nextFrameToSend++;
+		NetRing_Barrier();
+		ctrlBuffer[composePos].haveSentOrRecv = true;
+			
+		OSWakeupThread(&wpadReadQueue); // New data for WPADRead
+
+		composePos++;
+		if (composePos >= BUFFER_SIZE)
+		{
+			composePos = 0;
 		}
-		else // client
+		nextFrameToSend++;
+	}
+}
+
+// Moves what the game's thread and the controller thread queued into the
+// window, until it is full; an acknowledgement pokes the loop to go on.
+static void guestQueuePackets(void)
+{
+	const struct sendPacket *pkt;
+
+	while ((pkt = NetRing_Peek(&messageRing)) != NULL)
+	{
+		if (!NetWindow_PushMessage(&window, pkt))
+		{
+			return;
+		}
+		NetRing_Release(&messageRing);
+		OSWakeupThread(&SendRingThreadQueue);
+	}
+	while ((pkt = NetRing_Peek(&inputRing)) != NULL)
+	{
+		if (!NetWindow_Push(&window, pkt))
 		{
-			while (sendBuffer[sendBufferPos].sent != 1)
+			return;
+		}
+		NetRing_Release(&inputRing);
+		OSWakeupThread(&SendRingThreadQueue);
+	}
+}
+
+// Hands on what the other Wii sent while ctrlBuffer has room for it. The
+// rest stays in the window, which stops acknowledging once it fills, until
+// the retrace frees a slot and pokes the loop.
+static void deliverReceived(void)
+{
+	if (host)
+	{
+		const struct sendPacket *pending;
+		struct sendPacket inPacket;
+
+		while ((pending = NetWindow_PeekMessage(&window)) != NULL)
+		{
+			if (pending->type == 1)
 			{
 				int isr;
 				_CPU_ISR_Disable(isr);
-				if (sendBuffer[sendBufferPos].sent != 1)
+				int i = IoctlBufferFind(pending->data.di_read.sector);
+				if (i >= 0)
 				{
-					OSSleepThread(&SendBufferThreadQueue);
+					IoctlBuffer[i].haveCallback[pending->clientNumber] = true;
 				}
 				_CPU_ISR_Restore(isr);
+				if (i < 0)
+				{
+					break;
+				}
+			}
+			else
+			{
+				Console_Write("[PKT] Unknown packet received!\n");
 			}
+			NetWindow_PopMessage(&window, &inPacket);
+		}
+		while ((pending = NetWindow_PeekFrame(&window)) != NULL)
+		{
+			int fntdo = pending->data.controller.frameNumberToDeliverOn;
+			if (ctrlBuffer[fntdo % BUFFER_SIZE].frameNumber != fntdo)
+			{
+				break;
+			}
+			NetWindow_PopFrame(&window, &inPacket);
+			ProcessPacket(&inPacket);
+		}
+	}
+	else
+	{
+		const struct ctrlPacket *pending;
+		struct ctrlPacket inPacket;
 
-			while(reliable_send(communicationSock, &sendBuffer[sendBufferPos], sizeof(sendBuffer[sendBufferPos])) <= 0)
+		while ((pending = NetWindow_PeekFrame(&window)) != NULL)
+		{
+			if (ctrlBuffer[deliverPos].frameNumber != 0 && ctrlBuffer[deliverPos].frameNumber != pending->frameNumber)
 			{
-				Console_Write("[SEND] Failure. OHHHHHH.\n");
-				network_error = 1;
+				break;
 			}
+			NetWindow_PopFrame(&window, &inPacket);
+
+			// Our own input is already in ctrlBuffer; the host never
+			// sends it back.
+			NetFrame_MergeAuthority(&ctrlBuffer[deliverPos], &inPacket);
 			
-			sendBuffer[sendBufferPos].sent = 2;
-			OSWakeupThread(&SendBufferThreadQueue);
+			OSWakeupThread(&wpadReadQueue); // New data for WPADRead
 
-			sendBufferPos++;
-			if (sendBufferPos >= BUFFER_SIZE)
+			deliverPos++;
+			if (deliverPos >= BUFFER_SIZE)
 			{
-				sendBufferPos = 0;
+				deliverPos = 0;
 			}
 		}
 	}
+}
 
-	return 0;
+static void netRecv(void *arg, unsigned char *datagram, int length)
+{
+	if (length <= 0)
+	{
+		Console_Write("[NET] Receive failure. OHHHHHH.\n");
+		network_error = 1;
+		return;
+	}
+
+	// IOS received into the buffer and the window decodes it in place.
+	unsigned ackedBefore = window.peerNext;
+	int fresh = NetWindow_Receive(&window, datagram, length);
+	unsigned acked = window.peerNext;
+
+	if (host && acked != ackedBefore)
+	{
+		// The newest frame acknowledged is the one least delayed by
+		// waiting for a datagram to carry the acknowledgement.
+		int rtt = ticks_to_microsecs(gettime() - pushTime[(acked - 1) % NETWINDOW_FRAMES]);
+		int isr;
+		_CPU_ISR_Disable(isr);
+		NetDelay_Sample(&netDelay, rtt);
+		_CPU_ISR_Restore(isr);
+	}
+
+	if (fresh < 0)
+	{
+		Console_Write("[NET] Bad packet.\n");
+		return;
+	}
+	// The acknowledgement goes with the next frame; netWake runs next, and
+	// hands on what arrived.
+	NetLoop_Poke(&netLoop);
 }
 
-static void* recvThread_main(void *arg)
+// Each frame goes out as one datagram, sent as soon as the frame is in the
+// window: when the host has composed it, or the guest has queued its input.
+// DI messages and acknowledgements wait to go with it, or with netResend's
+// flush a frame later. netLoopWait can't sleep to a time finer than the
+// retrace, so batching is per frame rather than to a budget.
+static void netWake(void *arg)
 {
-	Console_Write("[RECV] Thread started.\n");
+	unsigned pushed = window.pushed;
+	unsigned messagesPushed = window.messagesPushed;
 
-	int ctrlBufferPos = 0;
+	deliverReceived();
+	if (host)
+	{
+		hostComposeFrames();
+	}
+	else
+	{
+		guestQueuePackets();
+	}
 
-	while (true)
+	if (window.pushed != pushed)
 	{
-		if (host)
-		{
-			struct sendPacket inPacket;
-			
-			while(reliable_recv(communicationSock, &inPacket, sizeof(inPacket)) <= 0)
-			{
-				Console_Write("[RECV] Failure. OHHHHHH.\n");
-				network_error = 1;
-			}
+		NetLoop_Flush(&netLoop);
+	}
+	else if (window.messagesPushed != messagesPushed)
+	{
+		NetLoop_Poke(&netLoop);
+	}
+}
 
-			ProcessPacket(&inPacket);
-		}
-		else
-		{
-			struct ctrlPacket inPacket;
-			
-			while(reliable_recv(communicationSock, &inPacket, sizeof(inPacket)) <= 0)
-			{
-				Console_Write("[RECV] Failure. OHHHHHH.\n");
-				network_error = 1;
-			}
+static int netSend(void *arg, unsigned char *buffer, size_t size)
+{
+	if (!NetWindow_Pending(&window))
+	{
+		return 0;
+	}
+	// Built straight into the buffer IOS sends from.
+	return NetWindow_Build(&window, buffer, size < NETWINDOW_DATAGRAM_MAX ? size : NETWINDOW_DATAGRAM_MAX);
+}
 
-			if (ctrlBuffer[ctrlBufferPos].frameNumber != 0)
-			{
-				while (ctrlBuffer[ctrlBufferPos].frameNumber != inPacket.frameNumber)
-				{
-					WaitForNextFrame();
-				}
-			}
+// Resend what the other Wii hasn't acknowledged once a frame.
+static void netResend(void *arg)
+{
+	if (window.pushed != window.peerNext || window.messagesPushed != window.peerMessageNext)
+	{
+		NetLoop_Flush(&netLoop);
+	}
+}
 
-			int isr;
-			_CPU_ISR_Disable(isr);
-			for (int i = 0; i < 4; i++) {
-				if (!inPacket.haveInput[i] && ctrlBuffer[ctrlBufferPos].haveInput[i])
-				{
-					inPacket.haveInput[i] = ctrlBuffer[ctrlBufferPos].haveInput[i];
-					inPacket.formats[i] = ctrlBuffer[ctrlBufferPos].formats[i];
-					inPacket.status[i] = ctrlBuffer[ctrlBufferPos].status[i];
-					inPacket.extension[i] = ctrlBuffer[ctrlBufferPos].extension[i];
-					inPacket.inputs[i] = ctrlBuffer[ctrlBufferPos].inputs[i];
-					inPacket.gravityUnit[i][0] = ctrlBuffer[ctrlBufferPos].gravityUnit[i][0];
-					inPacket.gravityUnit[i][1] = ctrlBuffer[ctrlBufferPos].gravityUnit[i][1];
-				}
-			}
-			ctrlBuffer[ctrlBufferPos] = inPacket;
-			ctrlBuffer[ctrlBufferPos].haveSentOrRecv = true;
-			_CPU_ISR_Restore(isr);
-			
-			OSWakeupThread(&wpadReadQueue); // New data for WPADRead
+// Called from the IPC interrupt.
+static void netLoopReceived(s32 result, void *arg)
+{
+	// A NAT in the way usually gives the peer's datagrams a different
+	// source port to the one it bound, so reply to wherever they come from.
+	if (result > 0 && netRecvFromLength >= 8 && netRecvFrom.sin_family == AF_INET && netRecvFrom.sin_addr.s_addr == peerAddress.sin_addr.s_addr)
+	{
+		peerAddress.sin_port = netRecvFrom.sin_port;
+	}
+	NetLoop_Received(&netLoop, result);
+}
 
-			ctrlBufferPos++;
-			if (ctrlBufferPos >= BUFFER_SIZE)
-			{
-				ctrlBufferPos = 0;
-			}
-		}
+static void netLoopSent(s32 result, void *arg)
+{
+	if (result < 0)
+	{
+		network_error = 1;
 	}
+	NetLoop_Sent(&netLoop, result);
+}
+
+static bool netLoopStartRecv(void *context, unsigned char *buffer, size_t size)
+{
+	netRecvFromLength = sizeof(netRecvFrom);
+	return Mynet_recvfromasync(datagramSock, buffer, 0, (struct sockaddr *)&netRecvFrom, &netRecvFromLength, &netRecvOp, netLoopReceived, NULL) >= 0;
+}
+
+static bool netLoopStartSend(void *context, const unsigned char *buffer, size_t length)
+{
+	// A lost datagram is covered by the next, so failures are not retried.
+	if (Mynet_sendtoasync(datagramSock, (void *)buffer, length, 0, (struct sockaddr *)&peerAddress, peerAddress.sin_len, &netSendOp, netLoopSent, NULL) < 0)
+	{
+		Console_Write("[NET] Send failure. OHHHHHH.\n");
+		network_error = 1;
+		return false;
+	}
+	return true;
+}
+
+static long long netLoopNow(void *context)
+{
+	return ticks_to_microsecs(gettime());
+}
+
+// The game's alarms aren't in the symbol list, so until is left to the
+// retrace, which wakes the thread once a deadline has passed.
+static void netLoopWait(void *context, long long until)
+{
+	int isr;
+	_CPU_ISR_Disable(isr);
+	if (!netLoopWoken)
+	{
+		OSSleepThread(&netLoopQueue);
+	}
+	netLoopWoken = false;
+	_CPU_ISR_Restore(isr);
+}
+
+static void netLoopWake(void *context)
+{
+	netLoopWoken = true;
+	OSWakeupThread(&netLoopQueue);
+}
+
+static void* netThread_main(void *arg)
+{
+	Console_Write("[NET] Thread started.\n");
+
+	NetLoop_Run(&netLoop);
 
 	return 0;
 }
@@ -938,15 +1147,18 @@ static void* recvThread_main(void *arg)
 static void* controllerThread_main(void* arg)
 {
 	Console_Write("[CTRL] Thread started.\n");
-	// The host skips the first BUFFER_SIZE inputs.
-	unsigned int nextFrameToSend = BUFFER_SIZE;
+	// The host skips the inputs before the first input frame.
+	unsigned int nextFrameToSend = firstInputFrame;
 
 	while (true)
 	{
-		while (frameCount + BUFFER_SIZE <= nextFrameToSend + 1)
+		int isr;
+		_CPU_ISR_Disable(isr);
+		while (frameCount + inputDelay <= nextFrameToSend + 1)
 		{
 			WaitForNextFrame();
 		}
+		_CPU_ISR_Restore(isr);
 		
 		struct sendPacket pkt;
 		pkt.type = 0;
@@ -973,40 +1185,51 @@ static void* controllerThread_main(void* arg)
 	return 0;
 }
 
+// The game's reads of the current frame don't mask interrupts; a read the
+// retrace interrupts is just made again from the next frame. The slot read
+// can't be reused until the game is INPUT_DELAY_MAX frames further on.
 static void MyWPADRead(int wiiremote, WPADData_t *data)
 {
-	int isr;
-	_CPU_ISR_Disable(isr);
-	int fCnt = frameCount;
-	int index = fCnt % BUFFER_SIZE;
-	
-	memset(data, 0, WPADDataFormatSize(currentFormat[wiiremote]));
-	if (ctrlBuffer[index].formats[wiiremote] == currentFormat[wiiremote])
+	int fCnt;
+	do
 	{
-		memcpy(data, &ctrlBuffer[index].inputs[wiiremote], WPADDataFormatSize(currentFormat[wiiremote]));
-	}
-	else
-	{
-		// Copy the fields common to all formats.
-		memcpy(data, &ctrlBuffer[index].inputs[wiiremote], WPADDataFormatSize(WPAD_FORMAT_NONE));
-	}
-	_CPU_ISR_Restore(isr);
+		fCnt = frameCount;
+		NetRing_Barrier();
+		int index = fCnt % BUFFER_SIZE;
+	
+		memset(data, 0, WPADDataFormatSize(currentFormat[wiiremote]));
+		if (ctrlBuffer[index].formats[wiiremote] == currentFormat[wiiremote])
+		{
+			memcpy(data, &ctrlBuffer[index].inputs[wiiremote], WPADDataFormatSize(currentFormat[wiiremote]));
+		}
+		else
+		{
+			// Copy the fields common to all formats.
+			memcpy(data, &ctrlBuffer[index].inputs[wiiremote], WPADDataFormatSize(WPAD_FORMAT_NONE));
+		}
+		NetRing_Barrier();
+	} while (fCnt != frameCount);
 }
 
 static WPADStatus_t MyWPADProbe(int wiimote, WPADExtension_t *extension)
 {
-	int isr;
-	_CPU_ISR_Disable(isr);
-	int fCnt = frameCount;
-	int index = fCnt % BUFFER_SIZE;
+	int fCnt;
 	WPADStatus_t status;
+	WPADExtension_t ext;
+	do
+	{
+		fCnt = frameCount;
+		NetRing_Barrier();
+		int index = fCnt % BUFFER_SIZE;
 	
-	status = ctrlBuffer[index].status[wiimote];
+		status = ctrlBuffer[index].status[wiimote];
+		ext = ctrlBuffer[index].extension[wiimote];
+		NetRing_Barrier();
+	} while (fCnt != frameCount);
 	if (extension != NULL)
 	{
-		*extension = ctrlBuffer[index].extension[wiimote];
+		*extension = ext;
 	}
-	_CPU_ISR_Restore(isr);
 	return status;
 }
 
@@ -1056,25 +1279,28 @@ static int MyWPADGetLatestIndexInBuf(int wiimote)
 
 static void MyWPADGetAccGravityUnit(int wiimote, WPADExtension_t extension, WPADAccGravityUnit_t *result)
 {
-	int isr;
-	_CPU_ISR_Disable(isr);
-	int fCnt = frameCount;
-	int index = fCnt % BUFFER_SIZE;
-	if (extension == WPAD_EXTENSION_NONE)
-	{
-		*result = ctrlBuffer[index].gravityUnit[wiimote][0];
-	}
-	else if (extension == WPAD_EXTENSION_NUNCHUCK)
-	{
-		*result = ctrlBuffer[index].gravityUnit[wiimote][1];
-	}
-	else
+	int fCnt;
+	do
 	{
-		result->acceleration[0] = 0;
-		result->acceleration[1] = 0;
-		result->acceleration[2] = 0;
-	}
-	_CPU_ISR_Restore(isr);
+		fCnt = frameCount;
+		NetRing_Barrier();
+		int index = fCnt % BUFFER_SIZE;
+		if (extension == WPAD_EXTENSION_NONE)
+		{
+			*result = ctrlBuffer[index].gravityUnit[wiimote][0];
+		}
+		else if (extension == WPAD_EXTENSION_NUNCHUCK)
+		{
+			*result = ctrlBuffer[index].gravityUnit[wiimote][1];
+		}
+		else
+		{
+			result->acceleration[0] = 0;
+			result->acceleration[1] = 0;
+			result->acceleration[2] = 0;
+		}
+		NetRing_Barrier();
+	} while (fCnt != frameCount);
 }
 
 static void My__VIRetraceHandler(int isr, void *context)
@@ -1087,14 +1313,9 @@ static void My__VIRetraceHandler(int isr, void *context)
 	{
 		for (int i = 0; i < 100; i++)
 		{
-			if (sendThreadStack[i] != 0xa5)
+			if (netThreadStack[i] != 0xa5)
 			{
-				Console_Write("[CANARY] (send thread) *dies*\n");
-				while (1);
-			}
-			if (recvThreadStack[i] != 0xa5)
-			{
-				Console_Write("[CANARY] (recv thread) *dies*\n");
+				Console_Write("[CANARY] (net thread) *dies*\n");
 				while (1);
 			}
 			if (controllerThreadStack[i] != 0xa5)
@@ -1104,31 +1325,26 @@ static void My__VIRetraceHandler(int isr, void *context)
 			}
 		}
 	}
-	WAKEUP();
+	// Wake the network thread for its timers. The deadline
+	// may be read as the thread moves it; a stale answer only moves it by a
+	// frame.
+	if (framewaitqueueEnabled)
+	{
+		long long due = NetLoop_NextDeadline(&netLoop);
+		if (due >= 0 && due <= netLoopNow(NULL))
+		{
+			netLoopWake(NULL);
+		}
+	}
 
 	int lastFrameIndex = frameCount % BUFFER_SIZE;
 	int nextFrameIndex = (frameCount + 1) % BUFFER_SIZE;
 	bool stall = createdThread && (ctrlBuffer[nextFrameIndex].frameNumber != frameCount + 1);
 	int ioctlBufferIndex = -1;
 
-	if (!stall)
+	if (!stall && !NetFrame_Complete(&ctrlBuffer[nextFrameIndex], NUMBER_OF_INPUTS_TO_WAIT_FOR))
 	{
-		if (!ctrlBuffer[nextFrameIndex].haveSentOrRecv)
-		{
-			stall = true;
-		}
-	}
-
-	if (!stall)
-	{
-		for (int i = 0; i < NUMBER_OF_INPUTS_TO_WAIT_FOR; i++)
-		{
-			if (!ctrlBuffer[nextFrameIndex].haveInput[i])
-			{
-				stall = true;
-				break;
-			}
-		}
+		stall = true;
 	}
 
 	if (!stall && createdThread && ctrlBuffer[nextFrameIndex].callback_sector != 0)
@@ -1149,6 +1365,11 @@ static void My__VIRetraceHandler(int isr, void *context)
 		}
 	}
 
+	if (host && createdThread)
+	{
+		NetDelay_Frame(&netDelay, stall);
+	}
+
 	if (on_frame_advance != 0)
 	{
 #ifndef NDEBUG
@@ -1170,6 +1391,10 @@ static void My__VIRetraceHandler(int isr, void *context)
 		if (createdThread)
 		{
 			frameCount++;
+			if (ctrlBuffer[nextFrameIndex].inputDelay != 0)
+			{
+				inputDelay = ctrlBuffer[nextFrameIndex].inputDelay;
+			}
 
 			if (ioctlBufferIndex != -1)
 			{
@@ -1259,7 +1484,11 @@ static void My__VIRetraceHandler(int isr, void *context)
 			{
 				ctrlBuffer[lastFrameIndex].haveInput[i] = false;
 			}
+			NetRing_Barrier();
 			ctrlBuffer[lastFrameIndex].frameNumber += BUFFER_SIZE;
+			OSWakeupThread(&framewaitqueue);
+			// Received frames and hostFrameReady may be waiting for this slot.
+			NetLoop_Wake(&netLoop);
 		}
 		_CPU_FP_Restore(fp_isr);
 		__VIRetraceHandler(isr, context);
@@ -1492,12 +1721,8 @@ static float MyRNG_RandFloatZeroed(rng_t *rng)
 
 static unsigned char MySMNDance_GetUnkown_a6c9(void)
 {
-	int isr;
-	_CPU_ISR_Disable(isr);
 	int index = frameCount % BUFFER_SIZE;
-	unsigned char result = ctrlBuffer[index].game.SMN.dance_a6c9;
-	_CPU_ISR_Restore(isr);
-	return result;
+	return ctrlBuffer[index].game.SMN.dance_a6c9;
 }
 static bool MySMNDance_GetUnkown_a6c9Mask(unsigned char mask)
 {
@@ -1505,12 +1730,8 @@ static bool MySMNDance_GetUnkown_a6c9Mask(unsigned char mask)
 }
 static unsigned char MySMNDance_GetMask(void)
 {
-	int isr;
-	_CPU_ISR_Disable(isr);
 	int index = frameCount % BUFFER_SIZE;
-	unsigned char result = ctrlBuffer[index].game.SMN.dance_a6ca;
-	_CPU_ISR_Restore(isr);
-	return result;
+	return ctrlBuffer[index].game.SMN.dance_a6ca;
 }
 static bool MySMNDance_Enabled(unsigned char mask)
 {
@@ -1518,12 +1739,8 @@ static bool MySMNDance_Enabled(unsigned char mask)
 }
 static unsigned char MySMNDance_GetUnkown_a6cb(void)
 {
-	int isr;
-	_CPU_ISR_Disable(isr);
 	int index = frameCount % BUFFER_SIZE;
-	unsigned char result = ctrlBuffer[index].game.SMN.dance_a6cb;
-	_CPU_ISR_Restore(isr);
-	return result;
+	return ctrlBuffer[index].game.SMN.dance_a6cb;
 }
 
 #ifndef NDEBUG
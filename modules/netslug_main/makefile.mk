@@ -4,6 +4,12 @@
 # The source files to compile.
 SRC      := main.c
 SRC		 += network_wii.c
+SRC		 += netcodec.c
+SRC		 += netwindow.c
+SRC		 += netframe.c
+SRC		 += netdelay.c
+SRC		 += netring.c
+SRC		 += netloop.c
 # Include directories
 INC_DIRS := 
 # Library directories
@@ -0,0 +1,629 @@
+/* netcodec.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "netcodec.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define NETCODEC_CTRL_FRAME_NEXT 0x01
+#define NETCODEC_CTRL_SEED_NEXT 0x02
+#define NETCODEC_CTRL_SECTOR 0x04
+#define NETCODEC_CTRL_GAME 0x08
+#define NETCODEC_CTRL_DELAY 0x10
+
+#define NETCODEC_INPUT_FRAME_NEXT 0x01
+#define NETCODEC_INPUT_CHANGED 0x02
+
+// Offset of the WPADData_t in the canonical form of a slot.
+#define NETCODEC_SLOT_INPUTS 15
+
+// Run length tokens: 0 ends a slot, 1-127 prefix that many literal bytes and
+// 0x80 | n skips n + 1 unchanged bytes.
+#define NETCODEC_TOKEN_END 0x00
+#define NETCODEC_TOKEN_LITERAL_MAX 0x7f
+#define NETCODEC_TOKEN_SKIP 0x80
+#define NETCODEC_TOKEN_SKIP_MAX 0x80
+
+typedef struct
+{
+	unsigned char *data;
+	size_t size;
+	size_t pos;
+	bool overflow;
+} writer_t;
+
+typedef struct
+{
+	const unsigned char *data;
+	size_t size;
+	size_t pos;
+	bool underflow;
+} reader_t;
+
+static void Write8(writer_t *w, unsigned value)
+{
+	if (w->pos >= w->size)
+	{
+		w->overflow = true;
+		return;
+	}
+	w->data[w->pos++] = value;
+}
+
+static void Write32(writer_t *w, unsigned long value)
+{
+	Write8(w, (value >> 24) & 0xff);
+	Write8(w, (value >> 16) & 0xff);
+	Write8(w, (value >> 8) & 0xff);
+	Write8(w, value & 0xff);
+}
+
+static unsigned Read8(reader_t *r)
+{
+	if (r->pos >= r->size)
+	{
+		r->underflow = true;
+		return 0;
+	}
+	return r->data[r->pos++];
+}
+
+static unsigned long Read32(reader_t *r)
+{
+	unsigned long value = (unsigned long)Read8(r) << 24;
+	value |= Read8(r) << 16;
+	value |= Read8(r) << 8;
+	return value | Read8(r);
+}
+
+static void Put16(unsigned char *p, int value)
+{
+	p[0] = (value >> 8) & 0xff;
+	p[1] = value & 0xff;
+}
+
+static short Get16(const unsigned char *p)
+{
+	return (short)((p[0] << 8) | p[1]);
+}
+
+// The frame seed the host would pick after seed; see sendThread_main.
+static long long NextSeed(long long seed)
+{
+	return (long long)((unsigned long long)seed * 1103515245 + 12345);
+}
+
+static void SlotToCanonical(
+	unsigned char slot[NETCODEC_SLOT_SIZE],
+	WPADDataFormat_t format, WPADStatus_t status, WPADExtension_t extension,
+	const WPADData_t *inputs, const WPADAccGravityUnit_t gravityUnit[2])
+{
+	unsigned char *in = slot + NETCODEC_SLOT_INPUTS;
+	size_t size = WPADDataFormatSize(format);
+
+	memset(slot, 0, NETCODEC_SLOT_SIZE);
+	slot[0] = format;
+	slot[1] = status;
+	slot[2] = extension;
+	for (int i = 0; i < 2; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			Put16(slot + 3 + i * 6 + j * 2, gravityUnit[i].acceleration[j]);
+		}
+	}
+
+	// Mirrors the layout of WPADData_t so that truncating to
+	// WPADDataFormatSize keeps the same fields it does in memory.
+	Put16(in + 0x00, inputs->buttons);
+	for (int j = 0; j < 3; j++)
+	{
+		Put16(in + 0x02 + j * 2, inputs->acceleration[j]);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		Put16(in + 0x08 + i * 8, inputs->ir[i].x);
+		Put16(in + 0x0a + i * 8, inputs->ir[i].y);
+		memcpy(in + 0x0c + i * 8, inputs->ir[i]._unknown04, 4);
+	}
+	in[0x28] = inputs->extension;
+	in[0x29] = inputs->status;
+	memcpy(in + 0x2a, &inputs->extension_data, sizeof(inputs->extension_data));
+	if (size < sizeof(WPADData_t))
+	{
+		memset(in + size, 0, sizeof(WPADData_t) - size);
+	}
+}
+
+static void SlotFromCanonical(
+	const unsigned char slot[NETCODEC_SLOT_SIZE],
+	WPADDataFormat_t *format, WPADStatus_t *status, WPADExtension_t *extension,
+	WPADData_t *inputs, WPADAccGravityUnit_t gravityUnit[2])
+{
+	const unsigned char *in = slot + NETCODEC_SLOT_INPUTS;
+
+	*format = slot[0];
+	*status = (signed char)slot[1];
+	*extension = slot[2];
+	for (int i = 0; i < 2; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			gravityUnit[i].acceleration[j] = Get16(slot + 3 + i * 6 + j * 2);
+		}
+	}
+
+	inputs->buttons = (unsigned short)Get16(in + 0x00);
+	for (int j = 0; j < 3; j++)
+	{
+		inputs->acceleration[j] = Get16(in + 0x02 + j * 2);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		inputs->ir[i].x = Get16(in + 0x08 + i * 8);
+		inputs->ir[i].y = Get16(in + 0x0a + i * 8);
+		memcpy(inputs->ir[i]._unknown04, in + 0x0c + i * 8, 4);
+	}
+	inputs->extension = in[0x28];
+	inputs->status = in[0x29];
+	memcpy(&inputs->extension_data, in + 0x2a, sizeof(inputs->extension_data));
+}
+
+// Writes slot XOR reference as run length tokens. Bytes past the slot's
+// format size are left out, as the decoder clears them anyway.
+static void SlotEncode(
+	writer_t *w, const unsigned char slot[NETCODEC_SLOT_SIZE],
+	const unsigned char reference[NETCODEC_SLOT_SIZE])
+{
+	unsigned char diff[NETCODEC_SLOT_SIZE];
+	size_t end = NETCODEC_SLOT_INPUTS + WPADDataFormatSize(slot[0]);
+	size_t i;
+
+	for (i = 0; i < end; i++)
+	{
+		diff[i] = slot[i] ^ reference[i];
+	}
+	while (end > 0 && diff[end - 1] == 0)
+	{
+		end--;
+	}
+
+	i = 0;
+	while (i < end)
+	{
+		size_t run = 0;
+
+		while (i + run < end && diff[i + run] == 0 && run < NETCODEC_TOKEN_SKIP_MAX)
+		{
+			run++;
+		}
+		if (run >= 2)
+		{
+			Write8(w, NETCODEC_TOKEN_SKIP | (run - 1));
+			i += run;
+			continue;
+		}
+
+		// A literal runs until the next pair of unchanged bytes.
+		run = 0;
+		while (i + run < end && run < NETCODEC_TOKEN_LITERAL_MAX &&
+			!(diff[i + run] == 0 && (i + run + 1 >= end || diff[i + run + 1] == 0)))
+		{
+			run++;
+		}
+		if (run == 0)
+		{
+			run = 1;
+		}
+		Write8(w, run);
+		for (size_t j = 0; j < run; j++)
+		{
+			Write8(w, diff[i + j]);
+		}
+		i += run;
+	}
+	Write8(w, NETCODEC_TOKEN_END);
+}
+
+static bool SlotDecode(
+	reader_t *r, unsigned char slot[NETCODEC_SLOT_SIZE],
+	const unsigned char reference[NETCODEC_SLOT_SIZE])
+{
+	size_t i = 0;
+	size_t size;
+
+	memcpy(slot, reference, NETCODEC_SLOT_SIZE);
+	while (true)
+	{
+		unsigned token = Read8(r);
+
+		if (r->underflow)
+		{
+			return false;
+		}
+		if (token == NETCODEC_TOKEN_END)
+		{
+			break;
+		}
+		if (token & NETCODEC_TOKEN_SKIP)
+		{
+			i += (token & ~NETCODEC_TOKEN_SKIP) + 1;
+			if (i > NETCODEC_SLOT_SIZE)
+			{
+				return false;
+			}
+			continue;
+		}
+		if (i + token > NETCODEC_SLOT_SIZE)
+		{
+			return false;
+		}
+		for (; token > 0; token--, i++)
+		{
+			slot[i] ^= Read8(r);
+		}
+	}
+
+	size = WPADDataFormatSize(slot[0]);
+	if (size < sizeof(WPADData_t))
+	{
+		memset(slot + NETCODEC_SLOT_INPUTS + size, 0, sizeof(WPADData_t) - size);
+	}
+	return !r->underflow;
+}
+
+static void CtrlSlot(
+	unsigned char slot[NETCODEC_SLOT_SIZE],
+	const struct ctrlPacket *packet, int i)
+{
+	if (packet == NULL)
+	{
+		memset(slot, 0, NETCODEC_SLOT_SIZE);
+		return;
+	}
+	SlotToCanonical(
+		slot, packet->formats[i], packet->status[i], packet->extension[i],
+		&packet->inputs[i], packet->gravityUnit[i]);
+}
+
+static void SendSlot(
+	unsigned char slot[NETCODEC_SLOT_SIZE],
+	const struct sendPacket *packet)
+{
+	if (packet == NULL || packet->type != 0)
+	{
+		memset(slot, 0, NETCODEC_SLOT_SIZE);
+		return;
+	}
+	SlotToCanonical(
+		slot, packet->data.controller.format, packet->data.controller.status,
+		packet->data.controller.extension, &packet->data.controller.inputs,
+		packet->data.controller.gravityUnit);
+}
+
+int NetCodec_Kind(const unsigned char *buffer, size_t size)
+{
+	if (size < 2 || buffer[0] != NETCODEC_VERSION)
+	{
+		return -1;
+	}
+	return buffer[1];
+}
+
+int NetCodec_EncodeCtrl(
+	const struct ctrlPacket *packet, const struct ctrlPacket *reference,
+	unsigned char *buffer, size_t size)
+{
+	static const struct ctrlPacket empty;
+	writer_t w = { buffer, size, 0, false };
+	unsigned char slots[4][NETCODEC_SLOT_SIZE];
+	unsigned char referenceSlot[NETCODEC_SLOT_SIZE];
+	unsigned flags = 0;
+	unsigned present = 0;
+	unsigned changed = 0;
+
+	if (reference == NULL)
+	{
+		reference = &empty;
+	}
+
+	if (packet->frameNumber == reference->frameNumber + 1)
+	{
+		flags |= NETCODEC_CTRL_FRAME_NEXT;
+	}
+	if (packet->frameSeed == NextSeed(reference->frameSeed))
+	{
+		flags |= NETCODEC_CTRL_SEED_NEXT;
+	}
+	if (packet->callback_sector != 0)
+	{
+		flags |= NETCODEC_CTRL_SECTOR;
+	}
+	if (memcmp(&packet->game.SMN, &reference->game.SMN, sizeof(packet->game.SMN)) != 0)
+	{
+		flags |= NETCODEC_CTRL_GAME;
+	}
+	if (packet->inputDelay != reference->inputDelay)
+	{
+		flags |= NETCODEC_CTRL_DELAY;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		if (packet->haveInput[i])
+		{
+			present |= 1 << i;
+		}
+		CtrlSlot(slots[i], packet, i);
+		CtrlSlot(referenceSlot, reference, i);
+		if (memcmp(slots[i], referenceSlot, NETCODEC_SLOT_SIZE) != 0)
+		{
+			changed |= 1 << i;
+		}
+	}
+
+	Write8(&w, NETCODEC_VERSION);
+	Write8(&w, NETCODEC_KIND_CTRL);
+	Write8(&w, flags);
+	Write8(&w, present);
+	Write8(&w, changed);
+	if (!(flags & NETCODEC_CTRL_FRAME_NEXT))
+	{
+		Write32(&w, packet->frameNumber);
+	}
+	if (!(flags & NETCODEC_CTRL_SEED_NEXT))
+	{
+		Write32(&w, (unsigned long long)packet->frameSeed >> 32);
+		Write32(&w, packet->frameSeed & 0xffffffff);
+	}
+	if (flags & NETCODEC_CTRL_SECTOR)
+	{
+		Write32(&w, packet->callback_sector);
+	}
+	if (flags & NETCODEC_CTRL_GAME)
+	{
+		Write8(&w, packet->game.SMN.dance_a6c9);
+		Write8(&w, packet->game.SMN.dance_a6ca);
+		Write8(&w, packet->game.SMN.dance_a6cb);
+	}
+	if (flags & NETCODEC_CTRL_DELAY)
+	{
+		Write8(&w, packet->inputDelay);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		if (changed & (1 << i))
+		{
+			CtrlSlot(referenceSlot, reference, i);
+			SlotEncode(&w, slots[i], referenceSlot);
+		}
+	}
+
+	return w.overflow ? -1 : (int)w.pos;
+}
+
+int NetCodec_DecodeCtrl(
+	const unsigned char *buffer, size_t size,
+	const struct ctrlPacket *reference, struct ctrlPacket *packet)
+{
+	static const struct ctrlPacket empty;
+	reader_t r = { buffer, size, 0, false };
+	unsigned char slot[NETCODEC_SLOT_SIZE];
+	unsigned char referenceSlot[NETCODEC_SLOT_SIZE];
+	unsigned flags, present, changed;
+
+	if (NetCodec_Kind(buffer, size) != NETCODEC_KIND_CTRL)
+	{
+		return -1;
+	}
+	if (reference == NULL)
+	{
+		reference = &empty;
+	}
+	r.pos = 2;
+	flags = Read8(&r);
+	present = Read8(&r);
+	changed = Read8(&r);
+
+	memset(packet, 0, sizeof(*packet));
+	if (flags & NETCODEC_CTRL_FRAME_NEXT)
+	{
+		packet->frameNumber = reference->frameNumber + 1;
+	}
+	else
+	{
+		packet->frameNumber = Read32(&r);
+	}
+	if (flags & NETCODEC_CTRL_SEED_NEXT)
+	{
+		packet->frameSeed = NextSeed(reference->frameSeed);
+	}
+	else
+	{
+		unsigned long long seed = (unsigned long long)Read32(&r) << 32;
+		packet->frameSeed = (long long)(seed | Read32(&r));
+	}
+	if (flags & NETCODEC_CTRL_SECTOR)
+	{
+		packet->callback_sector = Read32(&r);
+	}
+	if (flags & NETCODEC_CTRL_GAME)
+	{
+		packet->game.SMN.dance_a6c9 = Read8(&r);
+		packet->game.SMN.dance_a6ca = Read8(&r);
+		packet->game.SMN.dance_a6cb = Read8(&r);
+	}
+	else
+	{
+		packet->game.SMN = reference->game.SMN;
+	}
+	if (flags & NETCODEC_CTRL_DELAY)
+	{
+		packet->inputDelay = Read8(&r);
+	}
+	else
+	{
+		packet->inputDelay = reference->inputDelay;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		packet->haveInput[i] = (present & (1 << i)) != 0;
+		CtrlSlot(referenceSlot, reference, i);
+		if (changed & (1 << i))
+		{
+			if (!SlotDecode(&r, slot, referenceSlot))
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			memcpy(slot, referenceSlot, NETCODEC_SLOT_SIZE);
+		}
+		SlotFromCanonical(
+			slot, &packet->formats[i], &packet->status[i],
+			&packet->extension[i], &packet->inputs[i], packet->gravityUnit[i]);
+	}
+
+	return r.underflow ? -1 : (int)r.pos;
+}
+
+int NetCodec_EncodeSend(
+	const struct sendPacket *packet, const struct sendPacket *reference,
+	unsigned char *buffer, size_t size)
+{
+	writer_t w = { buffer, size, 0, false };
+
+	Write8(&w, NETCODEC_VERSION);
+	if (packet->type == 1)
+	{
+		Write8(&w, NETCODEC_KIND_DI);
+		Write8(&w, packet->clientNumber);
+		Write32(&w, packet->data.di_read.sector);
+	}
+	else
+	{
+		unsigned char slot[NETCODEC_SLOT_SIZE];
+		unsigned char referenceSlot[NETCODEC_SLOT_SIZE];
+		unsigned flags = 0;
+
+		if (reference == NULL || reference->type != 0)
+		{
+			reference = NULL;
+		}
+		else if (packet->data.controller.frameNumberToDeliverOn ==
+			reference->data.controller.frameNumberToDeliverOn + 1)
+		{
+			flags |= NETCODEC_INPUT_FRAME_NEXT;
+		}
+		SendSlot(slot, packet);
+		SendSlot(referenceSlot, reference);
+		if (memcmp(slot, referenceSlot, NETCODEC_SLOT_SIZE) != 0)
+		{
+			flags |= NETCODEC_INPUT_CHANGED;
+		}
+
+		Write8(&w, NETCODEC_KIND_INPUT);
+		Write8(&w, flags);
+		Write8(&w, packet->clientNumber);
+		Write8(&w, packet->data.controller.wiimote);
+		if (!(flags & NETCODEC_INPUT_FRAME_NEXT))
+		{
+			Write32(&w, packet->data.controller.frameNumberToDeliverOn);
+		}
+		if (flags & NETCODEC_INPUT_CHANGED)
+		{
+			SlotEncode(&w, slot, referenceSlot);
+		}
+	}
+
+	return w.overflow ? -1 : (int)w.pos;
+}
+
+int NetCodec_DecodeSend(
+	const unsigned char *buffer, size_t size,
+	const struct sendPacket *reference, struct sendPacket *packet)
+{
+	reader_t r = { buffer, size, 2, false };
+	int kind = NetCodec_Kind(buffer, size);
+
+	memset(packet, 0, sizeof(*packet));
+	if (kind == NETCODEC_KIND_DI)
+	{
+		packet->type = 1;
+		packet->clientNumber = Read8(&r);
+		packet->data.di_read.sector = Read32(&r);
+	}
+	else if (kind == NETCODEC_KIND_INPUT)
+	{
+		unsigned char slot[NETCODEC_SLOT_SIZE];
+		unsigned char referenceSlot[NETCODEC_SLOT_SIZE];
+		unsigned flags = Read8(&r);
+
+		if (reference != NULL && reference->type != 0)
+		{
+			reference = NULL;
+		}
+		packet->type = 0;
+		packet->clientNumber = Read8(&r);
+		packet->data.controller.wiimote = Read8(&r);
+		if (flags & NETCODEC_INPUT_FRAME_NEXT)
+		{
+			if (reference == NULL)
+			{
+				return -1;
+			}
+			packet->data.controller.frameNumberToDeliverOn =
+				reference->data.controller.frameNumberToDeliverOn + 1;
+		}
+		else
+		{
+			packet->data.controller.frameNumberToDeliverOn = Read32(&r);
+		}
+		SendSlot(referenceSlot, reference);
+		if (flags & NETCODEC_INPUT_CHANGED)
+		{
+			if (!SlotDecode(&r, slot, referenceSlot))
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			memcpy(slot, referenceSlot, NETCODEC_SLOT_SIZE);
+		}
+		SlotFromCanonical(
+			slot, &packet->data.controller.format,
+			&packet->data.controller.status,
+			&packet->data.controller.extension,
+			&packet->data.controller.inputs,
+			packet->data.controller.gravityUnit);
+	}
+	else
+	{
+		return -1;
+	}
+
+	return r.underflow ? -1 : (int)r.pos;
+}
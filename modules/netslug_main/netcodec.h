@@ -0,0 +1,83 @@
+/* netcodec.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETCODEC_H_
+#define NETCODEC_H_
+
+#include <stddef.h>
+
+#include "packet.h"
+
+/* Wire encoding of struct ctrlPacket and struct sendPacket.
+ *
+ * Every message starts with NETCODEC_VERSION and a kind byte. Controller
+ * slots are sent as the XOR of their canonical form against a reference
+ * packet the receiver already holds, run length encoded so that an idle
+ * controller costs nothing. Input payloads are truncated to
+ * WPADDataFormatSize of the slot's format, which is all MyWPADRead ever
+ * copies out. Multi byte fields are big endian. */
+
+#define NETCODEC_VERSION 2
+
+#define NETCODEC_KIND_CTRL 'C'
+#define NETCODEC_KIND_INPUT 'I'
+#define NETCODEC_KIND_DI 'D'
+#define NETCODEC_KIND_WINDOW 'W'
+
+// Bytes in the canonical form of one controller slot.
+#define NETCODEC_SLOT_SIZE (3 + 2 * 6 + sizeof(WPADData_t))
+// Worst case encoded size of one slot.
+#define NETCODEC_SLOT_MAX (NETCODEC_SLOT_SIZE + NETCODEC_SLOT_SIZE / 127 + 2)
+// Worst case encoded size of a ctrlPacket.
+#define NETCODEC_CTRL_MAX (5 + 4 + 8 + 4 + 1 + 3 + 4 * NETCODEC_SLOT_MAX)
+// Worst case encoded size of a sendPacket.
+#define NETCODEC_SEND_MAX (5 + 4 + NETCODEC_SLOT_MAX)
+
+/* Returns the kind of the message in buffer, or -1 if it is not a message of
+ * this version. */
+int NetCodec_Kind(const unsigned char *buffer, size_t size);
+
+/* Encodes packet against reference, which may be NULL, into buffer. Returns
+ * the number of bytes written, or -1 if size is too small. haveSentOrRecv is
+ * not sent. */
+int NetCodec_EncodeCtrl(
+	const struct ctrlPacket *packet, const struct ctrlPacket *reference,
+	unsigned char *buffer, size_t size);
+/* Decodes a message made by NetCodec_EncodeCtrl with the same reference.
+ * Returns the number of bytes consumed, or -1 if the message is malformed. */
+int NetCodec_DecodeCtrl(
+	const unsigned char *buffer, size_t size,
+	const struct ctrlPacket *reference, struct ctrlPacket *packet);
+
+/* As above for sendPackets. The reference is only used by controller packets
+ * and should be the previous controller packet from the same client. sent is
+ * not sent. */
+int NetCodec_EncodeSend(
+	const struct sendPacket *packet, const struct sendPacket *reference,
+	unsigned char *buffer, size_t size);
+int NetCodec_DecodeSend(
+	const unsigned char *buffer, size_t size,
+	const struct sendPacket *reference, struct sendPacket *packet);
+
+#endif /* NETCODEC_H_ */
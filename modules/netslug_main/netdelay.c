@@ -0,0 +1,126 @@
+/* netdelay.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "netdelay.h"
+
+static int Clamp(const netdelay_t *delay, int frames)
+{
+	if (frames < delay->min)
+	{
+		return delay->min;
+	}
+	if (frames > delay->max)
+	{
+		return delay->max;
+	}
+	return frames;
+}
+
+void NetDelay_Init(netdelay_t *delay, int min, int max, int frameUs)
+{
+	delay->min = min;
+	delay->max = max;
+	delay->frameUs = frameUs;
+	delay->haveRtt = false;
+	delay->srttUs = 0;
+	delay->rttvarUs = 0;
+	delay->windowFrames = 0;
+	delay->windowStalls = 0;
+	delay->stalled = false;
+	delay->cleanFrames = 0;
+	delay->delay = Clamp(delay, NETDELAY_DEFAULT);
+}
+
+void NetDelay_Sample(netdelay_t *delay, int rttUs)
+{
+	if (rttUs < 0)
+	{
+		return;
+	}
+	if (!delay->haveRtt)
+	{
+		delay->haveRtt = true;
+		delay->srttUs = rttUs;
+		delay->rttvarUs = rttUs / 2;
+		delay->delay = NetDelay_Target(delay);
+		return;
+	}
+
+	// As TCP does (RFC 6298): gains of 1/4 and 1/8.
+	int error = rttUs - delay->srttUs;
+	delay->rttvarUs += ((error < 0 ? -error : error) - delay->rttvarUs) / 4;
+	delay->srttUs += error / 8;
+}
+
+int NetDelay_Target(const netdelay_t *delay)
+{
+	if (!delay->haveRtt)
+	{
+		return delay->delay;
+	}
+	// An input has to cross one way, with some margin for jitter, before the
+	// frame it is for; the extra frame is the one it was sampled in.
+	int oneWayUs = delay->srttUs / 2 + 2 * delay->rttvarUs;
+	return Clamp(delay, (oneWayUs + delay->frameUs - 1) / delay->frameUs + 1);
+}
+
+int NetDelay_Frame(netdelay_t *delay, bool stalled)
+{
+	delay->windowFrames++;
+	if (stalled)
+	{
+		if (!delay->stalled)
+		{
+			delay->windowStalls++;
+		}
+		delay->cleanFrames = 0;
+	}
+	else
+	{
+		delay->cleanFrames++;
+	}
+	delay->stalled = stalled;
+
+	if (delay->windowStalls >= NETDELAY_STALL_LIMIT)
+	{
+		delay->delay = Clamp(delay, delay->delay + 1);
+		delay->windowFrames = 0;
+		delay->windowStalls = 0;
+	}
+	else if (delay->windowFrames >= NETDELAY_STALL_WINDOW)
+	{
+		delay->windowFrames = 0;
+		delay->windowStalls = 0;
+	}
+
+	if (delay->cleanFrames >= NETDELAY_CLEAN_FRAMES)
+	{
+		if (delay->delay > NetDelay_Target(delay))
+		{
+			delay->delay--;
+		}
+		delay->cleanFrames = 0;
+	}
+	return delay->delay;
+}
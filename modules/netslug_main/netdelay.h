@@ -0,0 +1,72 @@
+/* netdelay.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETDELAY_H_
+#define NETDELAY_H_
+
+#include <stdbool.h>
+
+/* Choice of the input delay: how many frames ahead of the game each Wii
+ * samples its controller.
+ *
+ * The delay starts at what the measured round trip time needs, rises by a
+ * frame after repeated stalls and falls by a frame after a long clean run,
+ * never below what the round trip time needs. Only the host runs this; the
+ * delay it picks travels in each frame's authority packet so both Wiis switch
+ * on the same frame. */
+
+// Frames a delay change waits to see stalls in.
+#define NETDELAY_STALL_WINDOW 60
+// Stalls within NETDELAY_STALL_WINDOW frames that add a frame of delay. A run
+// of stalled frames counts once.
+#define NETDELAY_STALL_LIMIT 3
+// Frames without a stall before a frame of delay is taken away.
+#define NETDELAY_CLEAN_FRAMES 600
+// Delay used before the round trip time is known.
+#define NETDELAY_DEFAULT 5
+
+typedef struct netdelay_t {
+	int min;
+	int max;
+	int frameUs;
+	int delay;
+	// Smoothed round trip time and its variation, in microseconds.
+	bool haveRtt;
+	int srttUs;
+	int rttvarUs;
+	int windowFrames;
+	int windowStalls;
+	bool stalled;
+	int cleanFrames;
+} netdelay_t;
+
+void NetDelay_Init(netdelay_t *delay, int min, int max, int frameUs);
+/* Takes a round trip time sample. The first one also sets the delay. */
+void NetDelay_Sample(netdelay_t *delay, int rttUs);
+/* The smallest delay that covers the round trip time. */
+int NetDelay_Target(const netdelay_t *delay);
+/* Counts a frame, which stalled or didn't. Returns the delay to use. */
+int NetDelay_Frame(netdelay_t *delay, bool stalled);
+
+#endif /* NETDELAY_H_ */
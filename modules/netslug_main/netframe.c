@@ -0,0 +1,154 @@
+/* netframe.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "netframe.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "netring.h"
+
+static void CopySlot(struct ctrlPacket *to, const struct ctrlPacket *from, int i)
+{
+	to->haveInput[i] = from->haveInput[i];
+	to->formats[i] = from->formats[i];
+	to->status[i] = from->status[i];
+	to->extension[i] = from->extension[i];
+	to->inputs[i] = from->inputs[i];
+	to->gravityUnit[i][0] = from->gravityUnit[i][0];
+	to->gravityUnit[i][1] = from->gravityUnit[i][1];
+}
+
+void NetFrame_MergeInput(struct ctrlPacket *frame, const struct sendPacket *input)
+{
+	int wiimote = input->data.controller.wiimote;
+
+	frame->formats[wiimote] = input->data.controller.format;
+	frame->status[wiimote] = input->data.controller.status;
+	frame->extension[wiimote] = input->data.controller.extension;
+	frame->inputs[wiimote] = input->data.controller.inputs;
+	frame->gravityUnit[wiimote][0] = input->data.controller.gravityUnit[0];
+	frame->gravityUnit[wiimote][1] = input->data.controller.gravityUnit[1];
+	// The retrace may be reading frame; the flag publishes the input.
+	NetRing_Barrier();
+	frame->haveInput[wiimote] = true;
+}
+
+void NetFrame_Authority(
+	struct ctrlPacket *authority, const struct ctrlPacket *frame,
+	const struct ctrlPacket *previous, unsigned slots)
+{
+	*authority = *frame;
+	for (int i = 0; i < 4; i++)
+	{
+		if (slots & (1 << i))
+		{
+			continue;
+		}
+		if (previous != NULL)
+		{
+			CopySlot(authority, previous, i);
+		}
+		else
+		{
+			memset(&authority->inputs[i], 0, sizeof(authority->inputs[i]));
+			memset(authority->gravityUnit[i], 0, sizeof(authority->gravityUnit[i]));
+			authority->formats[i] = 0;
+			authority->status[i] = 0;
+			authority->extension[i] = 0;
+		}
+		authority->haveInput[i] = false;
+	}
+}
+
+void NetFrame_MergeAuthority(struct ctrlPacket *frame, const struct ctrlPacket *authority)
+{
+	frame->frameNumber = authority->frameNumber;
+	frame->frameSeed = authority->frameSeed;
+	frame->callback_sector = authority->callback_sector;
+	frame->inputDelay = authority->inputDelay;
+	frame->game = authority->game;
+	for (int i = 0; i < 4; i++)
+	{
+		if (authority->haveInput[i])
+		{
+			CopySlot(frame, authority, i);
+		}
+	}
+	NetRing_Barrier();
+	frame->haveSentOrRecv = true;
+}
+
+bool NetFrame_Complete(const struct ctrlPacket *frame, int inputs)
+{
+	if (!frame->haveSentOrRecv)
+	{
+		return false;
+	}
+	for (int i = 0; i < inputs; i++)
+	{
+		if (!frame->haveInput[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+unsigned NetFrame_Predict(struct ctrlPacket *frame, const struct ctrlPacket *previous, int inputs)
+{
+	unsigned slots = 0;
+
+	for (int i = 0; i < inputs; i++)
+	{
+		if (frame->haveInput[i])
+		{
+			continue;
+		}
+		CopySlot(frame, previous, i);
+		frame->haveInput[i] = false;
+		slots |= 1 << i;
+	}
+	return slots;
+}
+
+bool NetFrame_Mispredicted(const struct ctrlPacket *actual, const struct ctrlPacket *guess, unsigned slots)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		if (!(slots & (1 << i)))
+		{
+			continue;
+		}
+		if (actual->formats[i] != guess->formats[i] ||
+			actual->status[i] != guess->status[i] ||
+			actual->extension[i] != guess->extension[i] ||
+			memcmp(&actual->inputs[i], &guess->inputs[i], WPADDataFormatSize(actual->formats[i])) != 0 ||
+			memcmp(actual->gravityUnit[i], guess->gravityUnit[i], sizeof(actual->gravityUnit[i])) != 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,67 @@
+/* netframe.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETFRAME_H_
+#define NETFRAME_H_
+
+#include <stdbool.h>
+
+#include "packet.h"
+
+/* Assembly of a frame's struct ctrlPacket from what each Wii contributes.
+ *
+ * Every Wii sends its own controller's input for a frame straight to every
+ * other Wii, which merges it in with NetFrame_MergeInput. The host alone
+ * decides the frame seed, the game specific values and which DI callback
+ * fires, and sends those with its own input as an authority packet, which is
+ * merged with NetFrame_MergeAuthority. No Wii relays another's input, so a
+ * frame is complete one way trip after its last input was sampled. */
+
+/* Copies the controller in input into its slot of frame. */
+void NetFrame_MergeInput(struct ctrlPacket *frame, const struct sendPacket *input);
+
+/* Builds the authority packet for frame: the host's fields and the slots in
+ * the slots mask. Other slots are copied from previous, the last authority
+ * packet sent, so that they encode to nothing, and are marked absent. */
+void NetFrame_Authority(
+	struct ctrlPacket *authority, const struct ctrlPacket *frame,
+	const struct ctrlPacket *previous, unsigned slots);
+/* Copies the host's fields and the slots present in authority into frame and
+ * marks it as having its authority (haveSentOrRecv). Slots filled in by
+ * NetFrame_MergeInput are kept. */
+void NetFrame_MergeAuthority(struct ctrlPacket *frame, const struct ctrlPacket *authority);
+
+/* Whether frame has its authority and the first inputs controllers. */
+bool NetFrame_Complete(const struct ctrlPacket *frame, int inputs);
+
+/* For rollback, which isn't wired in yet; see netsnap.h.
+ *
+ * Guesses that each of the first inputs controllers missing from frame is
+ * held as it was in previous, so the game can run on before the input
+ * arrives. Returns the mask of slots guessed, which stay marked as missing. */
+unsigned NetFrame_Predict(struct ctrlPacket *frame, const struct ctrlPacket *previous, int inputs);
+/* Whether any slot in the slots mask of actual differs from the guess. */
+bool NetFrame_Mispredicted(const struct ctrlPacket *actual, const struct ctrlPacket *guess, unsigned slots);
+
+#endif /* NETFRAME_H_ */
@@ -0,0 +1,230 @@
+/* netloop.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "netloop.h"
+
+#include <string.h>
+
+#ifdef GEKKO
+#define Load(flag) (flag)
+#define Store(flag, value) ((flag) = (value))
+#else
+// The flags are set from other threads, which on a host may be other cores.
+#define Load(flag) __atomic_load_n(&(flag), __ATOMIC_ACQUIRE)
+#define Store(flag, value) __atomic_store_n(&(flag), (value), __ATOMIC_RELEASE)
+#endif
+
+void NetLoop_Init(
+	netloop_t *loop, const netloop_backend_t *backend,
+	unsigned char *recvBuffer, unsigned char *sendBuffer, size_t size,
+	netloop_recv_t onRecv, netloop_fill_t onSend, void *arg)
+{
+	memset(loop, 0, sizeof(*loop));
+	loop->backend = *backend;
+	loop->recvBuffer = recvBuffer;
+	loop->sendBuffer = sendBuffer;
+	loop->bufferSize = size;
+	loop->onRecv = onRecv;
+	loop->onSend = onSend;
+	loop->arg = arg;
+	// Whatever is pending before the loop starts goes out first.
+	Store(loop->sendWanted, true);
+}
+
+bool NetLoop_AddTimer(netloop_t *loop, long long period, netloop_timer_t callback, void *arg)
+{
+	if (loop->timerCount == NETLOOP_TIMERS)
+	{
+		return false;
+	}
+	netloop_timer_entry_t *timer = &loop->timers[loop->timerCount++];
+	timer->period = period;
+	timer->deadline = loop->backend.now(loop->backend.context) + period;
+	timer->callback = callback;
+	timer->arg = arg;
+	return true;
+}
+
+void NetLoop_SetBatch(netloop_t *loop, bool batch)
+{
+	loop->batch = batch;
+}
+
+void NetLoop_SetWake(netloop_t *loop, netloop_timer_t callback)
+{
+	loop->onWake = callback;
+}
+
+long long NetLoop_NextDeadline(const netloop_t *loop)
+{
+	long long next = -1;
+
+	for (int i = 0; i < loop->timerCount; i++)
+	{
+		if (next < 0 || loop->timers[i].deadline < next)
+		{
+			next = loop->timers[i].deadline;
+		}
+	}
+	return next;
+}
+
+static bool SendDue(const netloop_t *loop)
+{
+	return !loop->batch || Load(loop->flushWanted);
+}
+
+void NetLoop_Run(netloop_t *loop)
+{
+	while (!Load(loop->stop))
+	{
+		NetLoop_RunOnce(loop);
+	}
+}
+
+void NetLoop_RunOnce(netloop_t *loop)
+{
+	if (Load(loop->recvDone))
+	{
+		int length = loop->recvLength;
+
+		Store(loop->recvDone, false);
+		loop->recvBusy = false;
+		if (length < 0)
+		{
+			loop->stats.recvErrors++;
+		}
+		else
+		{
+			loop->stats.received++;
+		}
+		loop->onRecv(loop->arg, loop->recvBuffer, length);
+	}
+	if (Load(loop->sendDone))
+	{
+		Store(loop->sendDone, false);
+		loop->sendBusy = false;
+		if (loop->sendResult < 0)
+		{
+			loop->stats.sendErrors++;
+		}
+		else
+		{
+			loop->stats.sent++;
+		}
+	}
+
+	long long now = loop->backend.now(loop->backend.context);
+	for (int i = 0; i < loop->timerCount; i++)
+	{
+		netloop_timer_entry_t *timer = &loop->timers[i];
+
+		if (timer->deadline > now)
+		{
+			continue;
+		}
+		// Keep to the period, but don't fire again for time already lost.
+		timer->deadline += timer->period;
+		if (timer->deadline <= now)
+		{
+			timer->deadline = now + timer->period;
+		}
+		loop->stats.timersFired++;
+		timer->callback(timer->arg);
+	}
+
+	if (loop->onWake != NULL)
+	{
+		loop->onWake(loop->arg);
+	}
+
+	if (!loop->sendBusy && Load(loop->sendWanted) && SendDue(loop))
+	{
+		Store(loop->flushWanted, false);
+		Store(loop->sendWanted, false);
+		int length = loop->onSend(loop->arg, loop->sendBuffer, loop->bufferSize);
+		if (length > 0)
+		{
+			loop->sendBusy = loop->backend.startSend(loop->backend.context, loop->sendBuffer, length);
+			if (!loop->sendBusy)
+			{
+				loop->stats.sendErrors++;
+			}
+		}
+	}
+	if (!loop->recvBusy)
+	{
+		loop->recvBusy = loop->backend.startRecv(loop->backend.context, loop->recvBuffer, loop->bufferSize);
+		if (!loop->recvBusy)
+		{
+			loop->stats.recvErrors++;
+		}
+	}
+
+	if (Load(loop->recvDone) || Load(loop->sendDone) ||
+		(Load(loop->sendWanted) && !loop->sendBusy && SendDue(loop)) || Load(loop->stop))
+	{
+		return;
+	}
+	loop->stats.waits++;
+	loop->backend.wait(loop->backend.context, NetLoop_NextDeadline(loop));
+}
+
+void NetLoop_Poke(netloop_t *loop)
+{
+	Store(loop->sendWanted, true);
+	loop->backend.wake(loop->backend.context);
+}
+
+void NetLoop_Flush(netloop_t *loop)
+{
+	Store(loop->flushWanted, true);
+	Store(loop->sendWanted, true);
+	loop->backend.wake(loop->backend.context);
+}
+
+void NetLoop_Wake(netloop_t *loop)
+{
+	loop->backend.wake(loop->backend.context);
+}
+
+void NetLoop_Stop(netloop_t *loop)
+{
+	Store(loop->stop, true);
+	loop->backend.wake(loop->backend.context);
+}
+
+void NetLoop_Received(netloop_t *loop, int length)
+{
+	loop->recvLength = length;
+	Store(loop->recvDone, true);
+	loop->backend.wake(loop->backend.context);
+}
+
+void NetLoop_Sent(netloop_t *loop, int result)
+{
+	loop->sendResult = result;
+	Store(loop->sendDone, true);
+	loop->backend.wake(loop->backend.context);
+}
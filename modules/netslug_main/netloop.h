@@ -0,0 +1,151 @@
+/* netloop.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETLOOP_H_
+#define NETLOOP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Event loop for one thread that does all of a datagram socket's work.
+ *
+ * The loop keeps one receive and at most one send in flight through a
+ * backend, runs periodic timers, and asks its owner for the next datagram
+ * whenever the send side is free and something may be due. The backend
+ * starts operations and reports their completion with NetLoop_Received and
+ * NetLoop_Sent, which may be called from an interrupt; on the Wii that is
+ * IOS's asynchronous ioctls, and on a host it can be poll() over a real
+ * socket.
+ *
+ * When batching, pokes are gathered into one datagram, and the owner is
+ * only asked for it at NetLoop_Flush. */
+
+#define NETLOOP_TIMERS 4
+
+typedef struct netloop_t netloop_t;
+
+typedef struct netloop_backend_t {
+	void *context;
+	/* Starts receiving a datagram of up to size bytes into buffer. */
+	bool (*startRecv)(void *context, unsigned char *buffer, size_t size);
+	/* Starts sending length bytes of buffer. */
+	bool (*startSend)(void *context, const unsigned char *buffer, size_t length);
+	/* Microseconds since some fixed point. */
+	long long (*now)(void *context);
+	/* Blocks until woken, or until the time until if it isn't negative. A wake
+	 * since the last wait must make this return at once. A backend that only
+	 * checks the time now and then may return late, so periods set with
+	 * NetLoop_AddTimer should not be shorter than that. */
+	void (*wait)(void *context, long long until);
+	/* Wakes wait. May be called from any thread or an interrupt. */
+	void (*wake)(void *context);
+} netloop_backend_t;
+
+/* A datagram of length bytes arrived, or receiving failed if length < 0. */
+typedef void (*netloop_recv_t)(void *arg, unsigned char *datagram, int length);
+/* Writes the next datagram to send into buffer and returns its length, or 0
+ * if there is none. Called once for each poke, or batch of pokes; poke
+ * again if there is more than one datagram's worth. */
+typedef int (*netloop_fill_t)(void *arg, unsigned char *buffer, size_t size);
+typedef void (*netloop_timer_t)(void *arg);
+
+typedef struct netloop_stats_t {
+	unsigned waits;
+	unsigned received;
+	unsigned sent;
+	unsigned recvErrors;
+	unsigned sendErrors;
+	unsigned timersFired;
+} netloop_stats_t;
+
+typedef struct netloop_timer_entry_t {
+	long long period;
+	long long deadline;
+	netloop_timer_t callback;
+	void *arg;
+} netloop_timer_entry_t;
+
+struct netloop_t {
+	netloop_backend_t backend;
+	netloop_recv_t onRecv;
+	netloop_fill_t onSend;
+	netloop_timer_t onWake;
+	void *arg;
+	unsigned char *recvBuffer;
+	unsigned char *sendBuffer;
+	size_t bufferSize;
+
+	// Only touched by the loop's thread.
+	bool recvBusy;
+	bool sendBusy;
+	netloop_timer_entry_t timers[NETLOOP_TIMERS];
+	int timerCount;
+	bool batch;
+
+	// Set from other threads and interrupts, then the backend is woken.
+	volatile bool recvDone;
+	volatile int recvLength;
+	volatile bool sendDone;
+	volatile int sendResult;
+	volatile bool sendWanted;
+	volatile bool flushWanted;
+	volatile bool stop;
+
+	netloop_stats_t stats;
+};
+
+/* Sets up loop. Each buffer is size bytes, and stays the loop's. */
+void NetLoop_Init(
+	netloop_t *loop, const netloop_backend_t *backend,
+	unsigned char *recvBuffer, unsigned char *sendBuffer, size_t size,
+	netloop_recv_t onRecv, netloop_fill_t onSend, void *arg);
+/* Calls callback every period microseconds, first period from now. Returns
+ * false if there are already NETLOOP_TIMERS. */
+bool NetLoop_AddTimer(netloop_t *loop, long long period, netloop_timer_t callback, void *arg);
+/* Gathers pokes until NetLoop_Flush; by default each poke sends. */
+void NetLoop_SetBatch(netloop_t *loop, bool batch);
+/* Calls callback each time the loop wakes, before it asks for a datagram,
+ * so the owner can look at what other threads have changed. */
+void NetLoop_SetWake(netloop_t *loop, netloop_timer_t callback);
+/* The time the next timer is due, or -1 if there are none. */
+long long NetLoop_NextDeadline(const netloop_t *loop);
+
+/* Runs until NetLoop_Stop. */
+void NetLoop_Run(netloop_t *loop);
+/* Handles whatever has happened, then waits if there is nothing to do. */
+void NetLoop_RunOnce(netloop_t *loop);
+
+/* From any thread: there may be a datagram to send. */
+void NetLoop_Poke(netloop_t *loop);
+/* From any thread: send what the batch has now. */
+void NetLoop_Flush(netloop_t *loop);
+/* From any thread: run the loop's wake callback. */
+void NetLoop_Wake(netloop_t *loop);
+/* From any thread: makes NetLoop_Run return. */
+void NetLoop_Stop(netloop_t *loop);
+/* From the backend, in any context: an operation has completed. */
+void NetLoop_Received(netloop_t *loop, int length);
+void NetLoop_Sent(netloop_t *loop, int result);
+
+#endif /* NETLOOP_H_ */
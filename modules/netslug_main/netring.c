@@ -0,0 +1,94 @@
+/* netring.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "netring.h"
+
+#ifdef GEKKO
+#define Load(index) (index)
+#define Store(index, value) ((index) = (value))
+#else
+// Hosts may have more than one core; these also tell thread checkers what
+// the barriers are for.
+#define Load(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define Store(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+#endif
+
+bool NetRing_Init(netring_t *ring, void *storage, size_t slotSize, unsigned count)
+{
+	if (count == 0 || (count & (count - 1)) != 0)
+	{
+		return false;
+	}
+	ring->slots = storage;
+	ring->slotSize = slotSize;
+	ring->mask = count - 1;
+	ring->tail = 0;
+	ring->head = 0;
+	return true;
+}
+
+void *NetRing_Reserve(netring_t *ring)
+{
+	unsigned tail = ring->tail;
+
+	if (tail - Load(ring->head) > ring->mask)
+	{
+		return NULL;
+	}
+	// The consumer's reads of the slot are done before it moved head.
+	NetRing_Barrier();
+	return ring->slots + (tail & ring->mask) * ring->slotSize;
+}
+
+void NetRing_Publish(netring_t *ring)
+{
+	// The slot is written before the consumer can see it.
+	NetRing_Barrier();
+	Store(ring->tail, ring->tail + 1);
+}
+
+void *NetRing_Peek(netring_t *ring)
+{
+	unsigned head = ring->head;
+
+	if (Load(ring->tail) == head)
+	{
+		return NULL;
+	}
+	// The producer's writes to the slot are seen before it moved tail.
+	NetRing_Barrier();
+	return ring->slots + (head & ring->mask) * ring->slotSize;
+}
+
+void NetRing_Release(netring_t *ring)
+{
+	// The slot is read before the producer can reuse it.
+	NetRing_Barrier();
+	Store(ring->head, ring->head + 1);
+}
+
+unsigned NetRing_Count(const netring_t *ring)
+{
+	return ring->tail - ring->head;
+}
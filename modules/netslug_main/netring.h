@@ -0,0 +1,79 @@
+/* netring.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETRING_H_
+#define NETRING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Single producer, single consumer ring of fixed size slots.
+ *
+ * The producer fills a slot and then advances tail; the consumer reads a slot
+ * and then advances head. Each index is only written by one side, and a
+ * barrier orders the slot contents against the index, so neither side needs
+ * a lock or to mask interrupts. Indices run freely and wrap; the slot count
+ * is a power of two so they can be masked. */
+
+/* Orders every memory access before it against every access after it. The
+ * Wii has one core, so this matters for the compiler and for an interrupt
+ * handler reading what a thread wrote; sync also drains the store queue. */
+#ifdef GEKKO
+#define NetRing_Barrier() __asm__ __volatile__ ("sync" : : : "memory")
+#else
+#define NetRing_Barrier() __sync_synchronize()
+#endif
+
+typedef struct netring_t {
+	unsigned char *slots;
+	size_t slotSize;
+	unsigned mask;
+	// Written only by the producer: slots ever published.
+	volatile unsigned tail;
+	// Written only by the consumer: slots ever released.
+	volatile unsigned head;
+} netring_t;
+
+/* Static initialiser for a ring over the array slots of count elements. */
+#define NETRING_INIT(slots, count) \
+	{ (unsigned char *)(slots), sizeof((slots)[0]), (count) - 1, 0, 0 }
+
+/* Sets up ring over count slots of slotSize bytes in storage. Returns false
+ * if count is not a power of two. */
+bool NetRing_Init(netring_t *ring, void *storage, size_t slotSize, unsigned count);
+
+/* Producer: the next empty slot, or NULL if the ring is full. */
+void *NetRing_Reserve(netring_t *ring);
+/* Producer: hands the slot from NetRing_Reserve to the consumer. */
+void NetRing_Publish(netring_t *ring);
+
+/* Consumer: the oldest full slot, or NULL if the ring is empty. */
+void *NetRing_Peek(netring_t *ring);
+/* Consumer: hands the slot from NetRing_Peek back to the producer. */
+void NetRing_Release(netring_t *ring);
+
+/* Slots full. Exact for either side's own view of the ring. */
+unsigned NetRing_Count(const netring_t *ring);
+
+#endif /* NETRING_H_ */
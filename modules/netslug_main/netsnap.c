@@ -0,0 +1,245 @@
+/* netsnap.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "netsnap.h"
+
+#include <string.h>
+
+static long long Now(const netsnap_t *snap)
+{
+	return snap->clock != NULL ? snap->clock() : 0;
+}
+
+static void Timed(long long *last, long long *max, long long time)
+{
+	*last = time;
+	if (time > *max)
+	{
+		*max = time;
+	}
+}
+
+static size_t PageLength(const netsnap_region_t *region, unsigned page)
+{
+	size_t offset = (size_t)page * NETSNAP_PAGE_SIZE;
+	size_t length = region->size - offset;
+	return length < NETSNAP_PAGE_SIZE ? length : NETSNAP_PAGE_SIZE;
+}
+
+static unsigned PageCount(const netsnap_region_t *region)
+{
+	return (region->size + NETSNAP_PAGE_SIZE - 1) / NETSNAP_PAGE_SIZE;
+}
+
+static unsigned char *RecordPage(const netsnap_t *snap, unsigned record)
+{
+	return snap->pages + (size_t)record * NETSNAP_PAGE_SIZE;
+}
+
+static unsigned RecordIndex(const netsnap_t *snap, unsigned first, unsigned n)
+{
+	return (first + n) % snap->capacity;
+}
+
+// Forgets the log of the oldest frame, so base moves on one.
+static void DropOldest(netsnap_t *snap)
+{
+	snap->base++;
+	const netsnap_log_t *log = &snap->logs[snap->base % NETSNAP_FRAMES];
+	if (log->count != 0)
+	{
+		snap->recordHead = RecordIndex(snap, log->first, log->count);
+		snap->recordCount -= log->count;
+	}
+}
+
+void NetSnap_Init(
+	netsnap_t *snap, void *shadow, size_t shadowSize, void *pool,
+	size_t poolSize, long long (*clock)(void))
+{
+	memset(snap, 0, sizeof(*snap));
+	snap->shadow = shadow;
+	snap->shadowSize = shadowSize;
+	snap->capacity = poolSize / (sizeof(netsnap_record_t) + NETSNAP_PAGE_SIZE);
+	snap->records = pool;
+	snap->pages = (unsigned char *)pool + snap->capacity * sizeof(netsnap_record_t);
+	snap->clock = clock;
+}
+
+bool NetSnap_AddRegion(netsnap_t *snap, void *base, size_t size)
+{
+	if (snap->captured || snap->regionCount == NETSNAP_REGIONS || size > snap->shadowSize - snap->shadowUsed)
+	{
+		return false;
+	}
+	netsnap_region_t *region = &snap->regions[snap->regionCount++];
+	region->base = base;
+	region->size = size;
+	region->shadow = snap->shadow + snap->shadowUsed;
+	snap->shadowUsed += size;
+	return true;
+}
+
+bool NetSnap_Capture(netsnap_t *snap, int frame)
+{
+	long long start = Now(snap);
+
+	if (!snap->captured)
+	{
+		for (int i = 0; i < snap->regionCount; i++)
+		{
+			memcpy(snap->regions[i].shadow, snap->regions[i].base, snap->regions[i].size);
+		}
+		snap->captured = true;
+		snap->base = frame;
+		snap->latest = frame;
+		snap->stats.captures++;
+		Timed(&snap->stats.captureTime, &snap->stats.captureTimeMax, Now(snap) - start);
+		return true;
+	}
+	if (frame != snap->latest + 1)
+	{
+		return false;
+	}
+	if (snap->latest - snap->base == NETSNAP_FRAMES - 1)
+	{
+		DropOldest(snap);
+	}
+
+	netsnap_log_t *log = &snap->logs[frame % NETSNAP_FRAMES];
+	log->first = snap->capacity != 0 ? RecordIndex(snap, snap->recordHead, snap->recordCount) : 0;
+	log->count = 0;
+	bool overflowed = false;
+
+	for (int i = 0; i < snap->regionCount; i++)
+	{
+		netsnap_region_t *region = &snap->regions[i];
+		unsigned pages = PageCount(region);
+
+		for (unsigned page = 0; page < pages; page++)
+		{
+			size_t offset = (size_t)page * NETSNAP_PAGE_SIZE;
+			size_t length = PageLength(region, page);
+
+			if (memcmp(region->base + offset, region->shadow + offset, length) == 0)
+			{
+				continue;
+			}
+			if (!overflowed)
+			{
+				while (snap->recordCount == snap->capacity && snap->base < snap->latest)
+				{
+					DropOldest(snap);
+					snap->stats.framesDropped++;
+				}
+				if (snap->recordCount == snap->capacity)
+				{
+					// This frame alone does not fit; it becomes the oldest.
+					overflowed = true;
+					snap->recordCount = 0;
+					log->count = 0;
+					snap->stats.framesDropped++;
+				}
+				else
+				{
+					unsigned record = RecordIndex(snap, log->first, log->count);
+					snap->recordCount++;
+					snap->records[record].region = i;
+					snap->records[record].page = page;
+					memcpy(RecordPage(snap, record), region->shadow + offset, length);
+					log->count++;
+					snap->stats.pagesSaved++;
+				}
+			}
+			memcpy(region->shadow + offset, region->base + offset, length);
+		}
+	}
+
+	snap->latest = frame;
+	if (overflowed)
+	{
+		snap->base = frame;
+	}
+	snap->stats.captures++;
+	Timed(&snap->stats.captureTime, &snap->stats.captureTimeMax, Now(snap) - start);
+	return true;
+}
+
+bool NetSnap_Restore(netsnap_t *snap, int frame)
+{
+	if (!NetSnap_Has(snap, frame))
+	{
+		return false;
+	}
+
+	long long start = Now(snap);
+
+	// Back to the latest capture.
+	for (int i = 0; i < snap->regionCount; i++)
+	{
+		netsnap_region_t *region = &snap->regions[i];
+		unsigned pages = PageCount(region);
+
+		for (unsigned page = 0; page < pages; page++)
+		{
+			size_t offset = (size_t)page * NETSNAP_PAGE_SIZE;
+			size_t length = PageLength(region, page);
+
+			if (memcmp(region->base + offset, region->shadow + offset, length) != 0)
+			{
+				memcpy(region->base + offset, region->shadow + offset, length);
+				snap->stats.pagesRestored++;
+			}
+		}
+	}
+
+	// Then back through each later frame's log.
+	for (; snap->latest > frame; snap->latest--)
+	{
+		netsnap_log_t *log = &snap->logs[snap->latest % NETSNAP_FRAMES];
+
+		for (unsigned n = 0; n < log->count; n++)
+		{
+			unsigned record = RecordIndex(snap, log->first, n);
+			const netsnap_record_t *header = &snap->records[record];
+			netsnap_region_t *region = &snap->regions[header->region];
+			size_t offset = (size_t)header->page * NETSNAP_PAGE_SIZE;
+			size_t length = PageLength(region, header->page);
+
+			memcpy(region->base + offset, RecordPage(snap, record), length);
+			memcpy(region->shadow + offset, RecordPage(snap, record), length);
+			snap->stats.pagesRestored++;
+		}
+		snap->recordCount -= log->count;
+	}
+
+	snap->stats.restores++;
+	Timed(&snap->stats.restoreTime, &snap->stats.restoreTimeMax, Now(snap) - start);
+	return true;
+}
+
+bool NetSnap_Has(const netsnap_t *snap, int frame)
+{
+	return snap->captured && frame >= snap->base && frame <= snap->latest;
+}
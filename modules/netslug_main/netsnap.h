@@ -0,0 +1,128 @@
+/* netsnap.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETSNAP_H_
+#define NETSNAP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Snapshots of the game's memory, for rolling back to an earlier frame.
+ *
+ * A full copy of each region is kept as it was at the last capture. Each
+ * capture compares the regions against that copy a page at a time, and keeps
+ * the old contents of the pages that changed as that frame's log. Restoring
+ * puts back what changed since the last capture, then applies the logs of
+ * each later frame in reverse. Logs share one pool of pages; when it fills,
+ * the oldest frames are forgotten. The Wii exposes no dirty bits, so the
+ * comparison is the cost of a capture; see netsnap_stats_t.
+ *
+ * Nothing in the module captures or restores yet, so it isn't in makefile.mk.
+ * Re-running the frames after a restore needs the module to step the game's
+ * main loop, and today My__VIRetraceHandler can only hold the retrace back
+ * until a frame's input arrives; until it can, play stays in lockstep and
+ * this is only exercised by the host tests. */
+
+// Granularity of the comparison and of the logs.
+#define NETSNAP_PAGE_SIZE 1024
+#define NETSNAP_REGIONS 8
+// Most frames that can be rolled back over.
+#define NETSNAP_FRAMES 16
+
+typedef struct netsnap_region_t {
+	unsigned char *base;
+	size_t size;
+	// The region as it was at the last capture.
+	unsigned char *shadow;
+} netsnap_region_t;
+
+typedef struct netsnap_record_t {
+	unsigned region;
+	unsigned page;
+} netsnap_record_t;
+
+typedef struct netsnap_log_t {
+	// Index of the first record in the pool.
+	unsigned first;
+	unsigned count;
+} netsnap_log_t;
+
+typedef struct netsnap_stats_t {
+	unsigned captures;
+	unsigned restores;
+	unsigned pagesSaved;
+	unsigned pagesRestored;
+	// Frames forgotten early because the pool was full.
+	unsigned framesDropped;
+	// In the units of the clock given to NetSnap_Init.
+	long long captureTime;
+	long long captureTimeMax;
+	long long restoreTime;
+	long long restoreTimeMax;
+} netsnap_stats_t;
+
+typedef struct netsnap_t {
+	netsnap_region_t regions[NETSNAP_REGIONS];
+	int regionCount;
+	unsigned char *shadow;
+	size_t shadowSize;
+	size_t shadowUsed;
+
+	netsnap_record_t *records;
+	unsigned char *pages;
+	unsigned capacity;
+	// The records in use, oldest first, wrapping around the pool.
+	unsigned recordHead;
+	unsigned recordCount;
+
+	netsnap_log_t logs[NETSNAP_FRAMES];
+	bool captured;
+	// Frames base to latest can be restored; the log of frame f is in
+	// logs[f % NETSNAP_FRAMES] for base < f <= latest.
+	int base;
+	int latest;
+
+	long long (*clock)(void);
+	netsnap_stats_t stats;
+} netsnap_t;
+
+/* Sets up snap to use shadow to copy the regions and pool for the logs. clock
+ * times captures and restores, and may be NULL. */
+void NetSnap_Init(
+	netsnap_t *snap, void *shadow, size_t shadowSize, void *pool,
+	size_t poolSize, long long (*clock)(void));
+/* Adds a region to the snapshots. Returns false if there is no room. Regions
+ * may only be added before the first capture. */
+bool NetSnap_AddRegion(netsnap_t *snap, void *base, size_t size);
+
+/* Captures the regions as frame. After the first, frames must follow on from
+ * the latest captured or restored. Returns false if frame does not. */
+bool NetSnap_Capture(netsnap_t *snap, int frame);
+/* Puts the regions back as they were when frame was captured, and forgets
+ * later frames. Returns false if frame is not held. */
+bool NetSnap_Restore(netsnap_t *snap, int frame);
+/* Whether NetSnap_Restore would succeed. */
+bool NetSnap_Has(const netsnap_t *snap, int frame);
+
+#endif /* NETSNAP_H_ */
@@ -0,0 +1,418 @@
+/* netwindow.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "netwindow.h"
+
+#include <string.h>
+
+#include "netcodec.h"
+
+// The first frame in the datagram is coded against nothing.
+#define NETWINDOW_BASE_EMPTY 0x01
+
+// version, kind, flags, next, messageNext, first, count
+#define NETWINDOW_HEADER_SIZE (3 + 4 + 4 + 4 + 1)
+// firstMessage, messageCount
+#define NETWINDOW_MESSAGE_HEADER_SIZE (4 + 1)
+
+static void Put32(unsigned char *p, unsigned value)
+{
+	p[0] = (value >> 24) & 0xff;
+	p[1] = (value >> 16) & 0xff;
+	p[2] = (value >> 8) & 0xff;
+	p[3] = value & 0xff;
+}
+
+static unsigned Get32(const unsigned char *p)
+{
+	return ((unsigned)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static size_t ItemSize(int kind)
+{
+	return kind == NETCODEC_KIND_CTRL ?
+		sizeof(struct ctrlPacket) : sizeof(struct sendPacket);
+}
+
+static int ItemEncode(
+	int kind, const netwindow_item_t *item, const netwindow_item_t *reference,
+	unsigned char *buffer, size_t size)
+{
+	if (kind == NETCODEC_KIND_CTRL)
+	{
+		return NetCodec_EncodeCtrl(
+			&item->ctrl, reference ? &reference->ctrl : NULL, buffer, size);
+	}
+	return NetCodec_EncodeSend(
+		&item->send, reference ? &reference->send : NULL, buffer, size);
+}
+
+static int ItemDecode(
+	int kind, const unsigned char *buffer, size_t size,
+	const netwindow_item_t *reference, netwindow_item_t *item)
+{
+	if (kind == NETCODEC_KIND_CTRL)
+	{
+		if (NetCodec_Kind(buffer, size) != NETCODEC_KIND_CTRL)
+		{
+			return -1;
+		}
+		return NetCodec_DecodeCtrl(
+			buffer, size, reference ? &reference->ctrl : NULL, &item->ctrl);
+	}
+	if (NetCodec_Kind(buffer, size) != NETCODEC_KIND_INPUT)
+	{
+		return -1;
+	}
+	return NetCodec_DecodeSend(
+		buffer, size, reference ? &reference->send : NULL, &item->send);
+}
+
+void NetWindow_Init(netwindow_t *window, int sendKind, int recvKind, int depth)
+{
+	memset(window, 0, sizeof(*window));
+	window->sendKind = sendKind;
+	window->recvKind = recvKind;
+	if (depth < 1)
+	{
+		depth = 1;
+	}
+	if (depth > NETWINDOW_DEPTH_MAX)
+	{
+		depth = NETWINDOW_DEPTH_MAX;
+	}
+	window->depth = depth;
+}
+
+bool NetWindow_CanPush(const netwindow_t *window)
+{
+	// Keep the frame before peerNext, which the window is coded against.
+	return window->pushed - window->peerNext < NETWINDOW_FRAMES - 1;
+}
+
+bool NetWindow_Push(netwindow_t *window, const void *frame)
+{
+	if (!NetWindow_CanPush(window))
+	{
+		return false;
+	}
+	memcpy(
+		&window->sent[window->pushed % NETWINDOW_FRAMES], frame,
+		ItemSize(window->sendKind));
+	window->pushed++;
+	return true;
+}
+
+bool NetWindow_PushMessage(netwindow_t *window, const struct sendPacket *message)
+{
+	if (window->messagesPushed - window->peerMessageNext >= NETWINDOW_MESSAGES)
+	{
+		return false;
+	}
+	window->messages[window->messagesPushed % NETWINDOW_MESSAGES] = *message;
+	window->messagesPushed++;
+	return true;
+}
+
+bool NetWindow_Pending(const netwindow_t *window)
+{
+	return window->ackDirty ||
+		window->pushed != window->peerNext ||
+		window->messagesPushed != window->peerMessageNext;
+}
+
+int NetWindow_Build(netwindow_t *window, unsigned char *buffer, size_t size)
+{
+	unsigned first = window->peerNext;
+	unsigned count = 0;
+	unsigned messageCount = 0;
+	size_t pos = NETWINDOW_HEADER_SIZE;
+	const netwindow_item_t *reference = NULL;
+
+	if (size < NETWINDOW_HEADER_SIZE + NETWINDOW_MESSAGE_HEADER_SIZE)
+	{
+		return -1;
+	}
+	if (first > 0)
+	{
+		reference = &window->sent[(first - 1) % NETWINDOW_FRAMES];
+	}
+
+	// Oldest first, so the peer can always take them in order.
+	while (first + count < window->pushed && count < (unsigned)window->depth)
+	{
+		const netwindow_item_t *item =
+			&window->sent[(first + count) % NETWINDOW_FRAMES];
+		size_t room = size - NETWINDOW_MESSAGE_HEADER_SIZE;
+		int length;
+
+		if (pos + 2 >= room)
+		{
+			break;
+		}
+		length = ItemEncode(
+			window->sendKind, item, reference, buffer + pos + 2, room - pos - 2);
+		if (length < 0)
+		{
+			break;
+		}
+		buffer[pos] = (length >> 8) & 0xff;
+		buffer[pos + 1] = length & 0xff;
+		pos += 2 + length;
+		reference = item;
+		count++;
+	}
+
+	buffer[0] = NETCODEC_VERSION;
+	buffer[1] = NETCODEC_KIND_WINDOW;
+	buffer[2] = first == 0 ? NETWINDOW_BASE_EMPTY : 0;
+	Put32(buffer + 3, window->next);
+	Put32(buffer + 7, window->messageNext);
+	Put32(buffer + 11, first);
+	buffer[15] = count;
+
+	size_t messageHeader = pos;
+	pos += NETWINDOW_MESSAGE_HEADER_SIZE;
+	while (window->peerMessageNext + messageCount < window->messagesPushed &&
+		messageCount < NETWINDOW_MESSAGES)
+	{
+		const struct sendPacket *message = &window->messages[
+			(window->peerMessageNext + messageCount) % NETWINDOW_MESSAGES];
+		int length;
+
+		if (pos + 1 >= size)
+		{
+			break;
+		}
+		length = NetCodec_EncodeSend(message, NULL, buffer + pos + 1, size - pos - 1);
+		if (length < 0)
+		{
+			break;
+		}
+		buffer[pos] = length;
+		pos += 1 + length;
+		messageCount++;
+	}
+	Put32(buffer + messageHeader, window->peerMessageNext);
+	buffer[messageHeader + 4] = messageCount;
+
+	if (first + count > window->sentThrough)
+	{
+		window->stats.framesResent += window->sentThrough - first;
+		window->sentThrough = first + count;
+	}
+	else
+	{
+		window->stats.framesResent += count;
+	}
+	window->stats.framesSent += count;
+	window->stats.datagramsSent++;
+	window->ackDirty = false;
+	return (int)pos;
+}
+
+int NetWindow_Receive(netwindow_t *window, const unsigned char *buffer, size_t size)
+{
+	netwindow_item_t items[2];
+	const netwindow_item_t *reference = NULL;
+	unsigned peerNext, peerMessageNext, first, count;
+	unsigned firstMessage, messageCount;
+	size_t pos = NETWINDOW_HEADER_SIZE;
+	int fresh = 0;
+	bool decodable = true;
+
+	if (size < NETWINDOW_HEADER_SIZE + NETWINDOW_MESSAGE_HEADER_SIZE ||
+		NetCodec_Kind(buffer, size) != NETCODEC_KIND_WINDOW)
+	{
+		window->stats.datagramsDropped++;
+		return -1;
+	}
+	peerNext = Get32(buffer + 3);
+	peerMessageNext = Get32(buffer + 7);
+	first = Get32(buffer + 11);
+	count = buffer[15];
+
+	// Acknowledgements never cover more than was sent, but can arrive out
+	// of order, in which case the newer one stands.
+	if ((int)(peerNext - window->pushed) > 0 ||
+		(int)(peerMessageNext - window->messagesPushed) > 0)
+	{
+		window->stats.datagramsDropped++;
+		return -1;
+	}
+	if ((int)(peerNext - window->peerNext) < 0)
+	{
+		peerNext = window->peerNext;
+	}
+	if ((int)(peerMessageNext - window->peerMessageNext) < 0)
+	{
+		peerMessageNext = window->peerMessageNext;
+	}
+	window->stats.datagramsReceived++;
+
+	if (!(buffer[2] & NETWINDOW_BASE_EMPTY))
+	{
+		// The frame before first must still be in the ring.
+		if (first == 0 || first > window->next ||
+			window->next - (first - 1) > NETWINDOW_FRAMES)
+		{
+			decodable = false;
+		}
+		else
+		{
+			reference = &window->received[(first - 1) % NETWINDOW_FRAMES];
+		}
+	}
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		netwindow_item_t *item = &items[i & 1];
+		unsigned seq = first + i;
+		size_t length;
+
+		if (pos + 2 > size)
+		{
+			window->stats.datagramsDropped++;
+			return -1;
+		}
+		length = (buffer[pos] << 8) | buffer[pos + 1];
+		pos += 2;
+		if (pos + length > size)
+		{
+			window->stats.datagramsDropped++;
+			return -1;
+		}
+		if (decodable)
+		{
+			if (ItemDecode(window->recvKind, buffer + pos, length, reference, item) != (int)length)
+			{
+				window->stats.datagramsDropped++;
+				return -1;
+			}
+			reference = item;
+			if (seq < window->next)
+			{
+				window->stats.framesDuplicate++;
+			}
+			else if (seq == window->next &&
+				window->next - window->popped < NETWINDOW_FRAMES)
+			{
+				memcpy(
+					&window->received[seq % NETWINDOW_FRAMES], item,
+					ItemSize(window->recvKind));
+				window->next++;
+				window->ackDirty = true;
+				fresh++;
+			}
+		}
+		pos += length;
+	}
+
+	if (pos + NETWINDOW_MESSAGE_HEADER_SIZE > size)
+	{
+		window->stats.datagramsDropped++;
+		return -1;
+	}
+	firstMessage = Get32(buffer + pos);
+	messageCount = buffer[pos + 4];
+	pos += NETWINDOW_MESSAGE_HEADER_SIZE;
+	for (unsigned i = 0; i < messageCount; i++)
+	{
+		unsigned seq = firstMessage + i;
+		struct sendPacket message;
+		size_t length;
+
+		if (pos + 1 > size || pos + 1 + buffer[pos] > size)
+		{
+			window->stats.datagramsDropped++;
+			return -1;
+		}
+		length = buffer[pos];
+		pos++;
+		if (NetCodec_DecodeSend(buffer + pos, length, NULL, &message) != (int)length)
+		{
+			window->stats.datagramsDropped++;
+			return -1;
+		}
+		pos += length;
+		if (seq == window->messageNext &&
+			window->messageNext - window->messagePopped < NETWINDOW_MESSAGES)
+		{
+			window->inbox[seq % NETWINDOW_MESSAGES] = message;
+			window->messageNext++;
+			window->ackDirty = true;
+			fresh++;
+		}
+	}
+
+	window->peerNext = peerNext;
+	window->peerMessageNext = peerMessageNext;
+	if (!decodable && count > 0)
+	{
+		window->stats.datagramsDropped++;
+	}
+	return fresh;
+}
+
+bool NetWindow_PopFrame(netwindow_t *window, void *frame)
+{
+	if (window->popped == window->next)
+	{
+		return false;
+	}
+	memcpy(
+		frame, &window->received[window->popped % NETWINDOW_FRAMES],
+		ItemSize(window->recvKind));
+	window->popped++;
+	return true;
+}
+
+bool NetWindow_PopMessage(netwindow_t *window, struct sendPacket *message)
+{
+	if (window->messagePopped == window->messageNext)
+	{
+		return false;
+	}
+	*message = window->inbox[window->messagePopped % NETWINDOW_MESSAGES];
+	window->messagePopped++;
+	return true;
+}
+
+const void *NetWindow_PeekFrame(const netwindow_t *window)
+{
+	if (window->popped == window->next)
+	{
+		return NULL;
+	}
+	return &window->received[window->popped % NETWINDOW_FRAMES];
+}
+
+const struct sendPacket *NetWindow_PeekMessage(const netwindow_t *window)
+{
+	if (window->messagePopped == window->messageNext)
+	{
+		return NULL;
+	}
+	return &window->inbox[window->messagePopped % NETWINDOW_MESSAGES];
+}
@@ -0,0 +1,120 @@
+/* netwindow.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETWINDOW_H_
+#define NETWINDOW_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "packet.h"
+
+/* Protocol for exchanging frames over an unreliable datagram socket.
+ *
+ * Each datagram carries every frame the peer has not acknowledged, up to the
+ * window depth, delta coded against the last frame the peer acknowledged, so
+ * a lost datagram is covered by the next one without a retransmit round
+ * trip. Unordered messages such as DI notifications ride along until they are
+ * acknowledged too. Acknowledgements are the count of frames and messages
+ * received in order. No locking is done; callers share a window between
+ * threads under their own lock. */
+
+// Frames held in each direction. The peer may fall this far behind.
+#define NETWINDOW_FRAMES 32
+// Messages held in each direction.
+#define NETWINDOW_MESSAGES 16
+// The largest window depth; one frame is kept back as the delta reference.
+#define NETWINDOW_DEPTH_MAX (NETWINDOW_FRAMES - 1)
+// Datagrams are kept below a typical path MTU.
+#define NETWINDOW_DATAGRAM_MAX 1400
+
+typedef union netwindow_item_t {
+	struct ctrlPacket ctrl;
+	struct sendPacket send;
+} netwindow_item_t;
+
+typedef struct netwindow_stats_t {
+	unsigned datagramsSent;
+	unsigned datagramsReceived;
+	// Malformed, or too far ahead to decode.
+	unsigned datagramsDropped;
+	unsigned framesSent;
+	unsigned framesResent;
+	unsigned framesDuplicate;
+} netwindow_stats_t;
+
+typedef struct netwindow_t {
+	// NETCODEC_KIND_CTRL or NETCODEC_KIND_INPUT for each direction.
+	int sendKind;
+	int recvKind;
+	int depth;
+
+	netwindow_item_t sent[NETWINDOW_FRAMES];
+	unsigned pushed;
+	unsigned sentThrough;
+	unsigned peerNext;
+	struct sendPacket messages[NETWINDOW_MESSAGES];
+	unsigned messagesPushed;
+	unsigned peerMessageNext;
+
+	netwindow_item_t received[NETWINDOW_FRAMES];
+	unsigned next;
+	unsigned popped;
+	struct sendPacket inbox[NETWINDOW_MESSAGES];
+	unsigned messageNext;
+	unsigned messagePopped;
+	// next or messageNext have changed since the last datagram.
+	bool ackDirty;
+
+	netwindow_stats_t stats;
+} netwindow_t;
+
+void NetWindow_Init(netwindow_t *window, int sendKind, int recvKind, int depth);
+
+/* Whether NetWindow_Push would succeed. */
+bool NetWindow_CanPush(const netwindow_t *window);
+/* Queues the next frame, a struct ctrlPacket or struct sendPacket according to
+ * sendKind. Returns false if the peer is NETWINDOW_FRAMES behind. */
+bool NetWindow_Push(netwindow_t *window, const void *frame);
+/* Queues a message. Returns false if NETWINDOW_MESSAGES are unacknowledged. */
+bool NetWindow_PushMessage(netwindow_t *window, const struct sendPacket *message);
+
+/* Whether there is anything the peer has not acknowledged, or an
+ * acknowledgement it has not been sent. */
+bool NetWindow_Pending(const netwindow_t *window);
+/* Writes the next datagram to buffer. Returns its length, or -1 if size is
+ * too small for even an empty datagram. */
+int NetWindow_Build(netwindow_t *window, unsigned char *buffer, size_t size);
+/* Takes in a datagram from the peer. Returns the number of new frames and
+ * messages, or -1 if it was dropped. */
+int NetWindow_Receive(netwindow_t *window, const unsigned char *buffer, size_t size);
+
+/* Takes the next frame or message received in order, if there is one. */
+bool NetWindow_PopFrame(netwindow_t *window, void *frame);
+bool NetWindow_PopMessage(netwindow_t *window, struct sendPacket *message);
+/* What those would take, left in place, or NULL. */
+const void *NetWindow_PeekFrame(const netwindow_t *window);
+const struct sendPacket *NetWindow_PeekMessage(const netwindow_t *window);
+
+#endif /* NETWINDOW_H_ */
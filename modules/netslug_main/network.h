@@ -257,6 +257,49 @@ s32 Mynet_shutdown(s32 s, u32 how);
 
 struct hostent * Mynet_gethostbyname(char *addrString);
 
+/*
+ * Datagram buffers that IOS reads and writes in place, so the netplay
+ * threads encode into and decode from them with no copy. The largest UDP
+ * payload on a 1500 byte link fits, rounded to IOS's 32 byte lines.
+ */
+#define NET_BUFFER_SIZE		1472
+#define NET_BUFFER_COUNT	8
+
+typedef struct net_buffer_stats_t {
+	u32 hits;       /* buffers handed out */
+	u32 exhausted;  /* requests that found none free */
+	u32 inUseMax;   /* most ever out at once */
+} net_buffer_stats_t;
+
+/* A free buffer of NET_BUFFER_SIZE bytes, or NULL if all are in use. */
+void *Mynet_bufalloc(void);
+void Mynet_buffree(void *buffer);
+void Mynet_bufstats(net_buffer_stats_t *stats);
+/* As Mynet_sendto and Mynet_recvfrom, but buffer must be from Mynet_bufalloc;
+ * it is used in place. */
+s32 Mynet_sendtobuf(s32 s,void *buffer,s32 len,u32 flags,struct sockaddr *to,socklen_t tolen);
+s32 Mynet_recvfrombuf(s32 s,void *buffer,u32 flags,struct sockaddr *from,socklen_t *fromlen);
+
+/*
+ * The same, but they return once IOS has the request and the callback gets
+ * the result later, from the IPC interrupt. The op is IOS's copy of the
+ * arguments, so must stay put and unused until then.
+ */
+typedef void (*net_async_cb_t)(s32 result, void *arg);
+
+typedef struct net_async_t {
+	u8 params[64] __attribute__((aligned(32)));
+	u8 vectors[32] __attribute__((aligned(32)));
+	struct sockaddr *from;
+	socklen_t *fromlen;
+	net_async_cb_t callback;
+	void *arg;
+} net_async_t;
+
+/* 0 once the request is queued, else a negative error and no callback. */
+s32 Mynet_sendtoasync(s32 s,void *buffer,s32 len,u32 flags,struct sockaddr *to,socklen_t tolen,net_async_t *op,net_async_cb_t callback,void *arg);
+s32 Mynet_recvfromasync(s32 s,void *buffer,u32 flags,struct sockaddr *from,socklen_t *fromlen,net_async_t *op,net_async_cb_t callback,void *arg);
+
 #ifdef __cplusplus
 	}
 #endif
@@ -228,6 +228,14 @@ static char __kd_fs[] ATTRIBUTE_ALIGN(32) = "/dev/net/kd/request";
 
 BSLUG_EXPORT(net_ip_top_fd);
 
+// Datagram buffers handed to IOS as they are. IOS wants whole cache lines, so
+// each is 32 byte aligned and NET_BUFFER_SIZE is a multiple of 32.
+static u8 _net_buffers[NET_BUFFER_COUNT][NET_BUFFER_SIZE] ATTRIBUTE_ALIGN(32);
+// Bit i set when _net_buffers[i] is free.
+static volatile u32 _net_buffers_free = (1u << NET_BUFFER_COUNT) - 1;
+static volatile u32 _net_buffers_out = 0;
+static net_buffer_stats_t _net_buffer_stats;
+
 static void usleep(long ticks)
 {
 	while(ticks > 0)
@@ -584,6 +592,143 @@ s32 Mynet_sendto(s32 s, const void *data, s32 len, u32 flags, struct sockaddr *t
 	return ret;
 }
 
+void *Mynet_bufalloc(void)
+{
+	u32 free, bit;
+
+	do
+	{
+		free = _net_buffers_free;
+		if (free == 0)
+		{
+			__sync_fetch_and_add(&_net_buffer_stats.exhausted, 1);
+			return NULL;
+		}
+		bit = free & -free;
+	} while (__sync_val_compare_and_swap(&_net_buffers_free, free, free & ~bit) != free);
+
+	__sync_fetch_and_add(&_net_buffer_stats.hits, 1);
+	u32 inUse = __sync_add_and_fetch(&_net_buffers_out, 1);
+	if (inUse > _net_buffer_stats.inUseMax)
+	{
+		_net_buffer_stats.inUseMax = inUse;
+	}
+	return _net_buffers[__builtin_ctz(bit)];
+}
+
+void Mynet_buffree(void *buffer)
+{
+	u32 index = ((u8 *)buffer - _net_buffers[0]) / NET_BUFFER_SIZE;
+
+	__sync_fetch_and_sub(&_net_buffers_out, 1);
+	__sync_fetch_and_or(&_net_buffers_free, 1u << index);
+}
+
+void Mynet_bufstats(net_buffer_stats_t *stats)
+{
+	*stats = _net_buffer_stats;
+}
+
+static s32 _net_sendto_setup(struct sendto_params *params, ioctlv *parms, s32 s, void *buffer, s32 len, u32 flags, struct sockaddr *to, socklen_t tolen)
+{
+	if (net_ip_top_fd < 0) return -ENXIO;
+	if (tolen > 28) return -EOVERFLOW;
+	if (len > NET_BUFFER_SIZE) return -EINVAL;
+
+	memset(params, 0, sizeof(struct sendto_params));
+	params->socket = s;
+	params->flags = flags;
+	if (to) {
+		params->has_destaddr = 1;
+		memcpy(params->destaddr, to, tolen);
+	}
+
+	parms[0].data = buffer;
+	parms[0].len = len;
+	parms[1].data = params;
+	parms[1].len = sizeof(struct sendto_params);
+	return 0;
+}
+
+static s32 _net_recvfrom_setup(u32 *params, ioctlv *parms, s32 s, void *buffer, u32 flags, struct sockaddr *from, socklen_t *fromlen)
+{
+	if (net_ip_top_fd < 0) return -ENXIO;
+
+	params[0] = s;
+	params[1] = flags;
+
+	parms[0].data = params;
+	parms[0].len = 8;
+	parms[1].data = buffer;
+	parms[1].len = NET_BUFFER_SIZE;
+	parms[2].data = from;
+	parms[2].len = (fromlen?*fromlen:0);
+	return 0;
+}
+
+s32 Mynet_sendtobuf(s32 s, void *buffer, s32 len, u32 flags, struct sockaddr *to, socklen_t tolen)
+{
+	STACK_ALIGN(struct sendto_params,params,1,32);
+	STACK_ALIGN(ioctlv, parms, 2, 32);
+
+	s32 ret = _net_sendto_setup(params, parms, s, buffer, len, flags, to, tolen);
+	if (ret < 0) return ret;
+
+	return _net_convert_error(IOS_Ioctlv(net_ip_top_fd, IOCTLV_SO_SENDTO, 2, 0, parms));
+}
+
+s32 Mynet_recvfrombuf(s32 s, void *buffer, u32 flags, struct sockaddr *from, socklen_t *fromlen)
+{
+	STACK_ALIGN(u32, params, 2, 32);
+	STACK_ALIGN(ioctlv, parms, 3, 32);
+
+	s32 ret = _net_recvfrom_setup(params, parms, s, buffer, flags, from, fromlen);
+	if (ret < 0) return ret;
+
+	ret = _net_convert_error(IOS_Ioctlv(net_ip_top_fd, IOCTLV_SO_RECVFROM, 1, 2, parms));
+
+	if (fromlen && from) *fromlen = from->sa_len;
+	return ret;
+}
+
+// Called from the IPC interrupt.
+static void _net_async_done(ios_ret_t result, usr_t usrdata)
+{
+	net_async_t *op = usrdata;
+
+	if (op->fromlen && op->from) *op->fromlen = op->from->sa_len;
+	op->callback(_net_convert_error(result), op->arg);
+}
+
+s32 Mynet_sendtoasync(s32 s, void *buffer, s32 len, u32 flags, struct sockaddr *to, socklen_t tolen, net_async_t *op, net_async_cb_t callback, void *arg)
+{
+	struct sendto_params *params = (struct sendto_params *)op->params;
+	ioctlv *parms = (ioctlv *)op->vectors;
+
+	s32 ret = _net_sendto_setup(params, parms, s, buffer, len, flags, to, tolen);
+	if (ret < 0) return ret;
+
+	op->from = NULL;
+	op->fromlen = NULL;
+	op->callback = callback;
+	op->arg = arg;
+	return _net_convert_error(IOS_IoctlvAsync(net_ip_top_fd, IOCTLV_SO_SENDTO, 2, 0, parms, _net_async_done, op));
+}
+
+s32 Mynet_recvfromasync(s32 s, void *buffer, u32 flags, struct sockaddr *from, socklen_t *fromlen, net_async_t *op, net_async_cb_t callback, void *arg)
+{
+	ioctlv *parms = (ioctlv *)op->vectors;
+
+	s32 ret = _net_recvfrom_setup((u32 *)op->params, parms, s, buffer, flags, from, fromlen);
+	if (ret < 0) return ret;
+
+	op->from = from;
+	op->fromlen = fromlen;
+	op->callback = callback;
+	op->arg = arg;
+	return _net_convert_error(IOS_IoctlvAsync(net_ip_top_fd, IOCTLV_SO_RECVFROM, 1, 2, parms, _net_async_done, op));
+}
+
 s32 Mynet_recv(s32 s, void *mem, s32 len, u32 flags)
 {
     return Mynet_recvfrom(s, mem, len, flags, NULL, NULL);	
@@ -0,0 +1,81 @@
+/* packet.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PACKET_H_
+#define PACKET_H_
+
+#include <stdbool.h>
+#include <rvl/WPAD.h>
+
+// Packet sent from each Wii to the others.
+struct sendPacket {
+	int sent; // 0 = invalid, 1 = to be sent, 2 = sent succesfully (may be reused)
+	int type; // 0 = controller, 1 = di_read
+	int clientNumber; // 0 is host
+	union 
+	{
+		struct
+		{
+			int frameNumberToDeliverOn;
+			int wiimote;
+			WPADDataFormat_t format;
+			WPADStatus_t status;
+			WPADExtension_t extension;
+			WPADData_t inputs;
+			WPADAccGravityUnit_t gravityUnit[2];
+		} controller;
+		struct
+		{
+			unsigned int sector;
+		} di_read;
+	} data;
+};
+
+// Everything the game reads for one frame. The host sends guests the parts it
+// decides; see netframe.h.
+struct ctrlPacket {
+	int frameNumber;
+	long long frameSeed;
+	bool haveSentOrRecv;
+	bool haveInput[4];
+	WPADDataFormat_t formats[4];
+	WPADStatus_t status[4];
+	WPADExtension_t extension[4];
+	WPADData_t inputs[4];
+	WPADAccGravityUnit_t gravityUnit[4][2];
+	unsigned int callback_sector;
+	// Frames of input delay from this frame on, chosen by the host.
+	int inputDelay;
+	union
+	{
+		struct
+		{
+			unsigned char dance_a6c9;
+			unsigned char dance_a6ca;
+			unsigned char dance_a6cb;
+		} SMN;
+	} game;
+};
+
+#endif /* PACKET_H_ */
@@ -39,3 +39,15 @@ BSLUG_MODULE_AUTHOR("Chadderz");
  */
 BSLUG_MODULE_LICENSE("BSD");
 
+/* An example export: other modules can call Template_Example as they would a
+ * game function. Rename or remove it in your own module; the regression tests
+ * link this file to check the loader against powerpc-eabi-ld. */
+static int example_calls;
+static const int example_steps[4] = { 1, 2, 4, 8 };
+
+int Template_Example(int x) {
+    example_calls++;
+    return example_steps[x & 3] * example_calls;
+}
+BSLUG_EXPORT(Template_Example);
+
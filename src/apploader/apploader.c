@@ -24,30 +24,21 @@
 
 #include "apploader.h"
 
-#include <errno.h>
 #include <ogc/cache.h>
-#include <ogc/lwp.h>
 #include <ogc/lwp_watchdog.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "apploader/apploader_image.h"
 #include "di/di.h"
+#include "di/di_queue.h"
 #include "library/dolphin_os.h"
 #include "library/event.h"
+#include "library/sched.h"
+#include "library/trace.h"
 #include "modules/module.h"
-#include "threads.h"
-
-typedef struct {
-    uint32_t boot_info_count;
-    uint32_t partition_info_offset;
-} contents_t;
-
-typedef struct {
-    uint32_t offset;
-    uint32_t type;
-} partition_info_t;
 
 // types for the four methods called on the game's apploader
 typedef void (*apploader_report_t)(const char *format, ...);
@@ -60,7 +51,9 @@ typedef void (*apploader_entry_t)(
     apploader_final_t *final);
 
 event_t apploader_event_disk_id;
-event_t apploader_event_complete;
+sched_task_t *apploader_task_disk_id;
+sched_task_t *apploader_task_game;
+sched_task_t *apploader_task_complete;
 apploader_game_entry_t apploader_game_entry_fn = NULL;
 uint8_t *apploader_app0_start = NULL;
 uint8_t *apploader_app0_end = NULL;
@@ -71,28 +64,63 @@ uint8_t *apploader_app1_end = NULL;
 #define APPLOADER_APP1_BOUNDARY ((void *)0x81400000)
 
 static u32 apploader_ipc_tmd[0x4A00 / 4] ATTRIBUTE_ALIGN(32);
+static di_queue_t apploader_di_queue;
+
+/* Loading is a chain of tasks: the disc, the game's apploader, the game
+ * (once the modules' size is known) and the final setup. The apploader hands
+ * out one request at a time and may parse each before asking for the next,
+ * so the game's reads stay within the one task. */
+static sched_t *apploader_sched = NULL;
+static sched_task_t *apploader_task_load;
 
-static void *Aploader_Main(void *arg);
+static apploader_main_t apploader_fn_main;
+static apploader_final_t apploader_fn_final;
 
-bool Apploader_Init(void) {
+static bool Apploader_Disc(void *arg);
+static bool Apploader_Load(void *arg);
+static bool Apploader_Game(void *arg);
+static bool Apploader_Final(void *arg);
+static s32 Apploader_ReadCallback(s32 result, void *usrdata);
+static int Apploader_ReadStart(di_request_t *request);
+static int Apploader_ReadUnencryptedStart(di_request_t *request);
+
+/* The drive, through IOS. */
+static const apploader_image_t apploader_image = {
+    &Apploader_ReadUnencryptedStart, &Apploader_ReadStart,
+    &DCInvalidateRange, &DCFlushRange
+};
+
+bool Apploader_Init(sched_t *sched) {
+    apploader_sched = sched;
+    apploader_task_disk_id = Sched_Task(sched, &Apploader_Disc, NULL);
+    apploader_task_load = Sched_Task(sched, &Apploader_Load, NULL);
+    apploader_task_game = Sched_Task(sched, &Apploader_Game, NULL);
+    apploader_task_complete = Sched_Task(sched, &Apploader_Final, NULL);
+    
     return 
-        Event_Init(&apploader_event_disk_id) &&
-        Event_Init(&apploader_event_complete);
+        Event_Init(&apploader_event_disk_id, "apploader_disk_id") &&
+        apploader_task_disk_id != NULL &&
+        apploader_task_load != NULL &&
+        apploader_task_game != NULL &&
+        apploader_task_complete != NULL;
 }
 
-bool Apploader_RunBackground(void) {
-    int ret;
-    lwp_t thread;
-    
-    ret = LWP_CreateThread(
-        &thread, &Aploader_Main,
-        NULL, NULL, 32 * 1024, THREAD_PRIO_IO);
-        
-    if (ret) {
-        errno = ENOMEM;
+bool Apploader_Schedule(void) {
+    /* the game is placed below the modules, so needs their size. */
+    if (!Sched_Depend(
+            apploader_sched, apploader_task_load, apploader_task_disk_id) ||
+        !Sched_Depend(
+            apploader_sched, apploader_task_game, apploader_task_load) ||
+        !Sched_Depend(
+            apploader_sched, apploader_task_game, module_task_list_loaded) ||
+        !Sched_Depend(
+            apploader_sched, apploader_task_complete, apploader_task_game))
         return false;
-    }
     
+    Sched_Submit(apploader_sched, apploader_task_disk_id);
+    Sched_Submit(apploader_sched, apploader_task_load);
+    Sched_Submit(apploader_sched, apploader_task_game);
+    Sched_Submit(apploader_sched, apploader_task_complete);
     return true;
 }
 
@@ -107,16 +135,8 @@ void Apploader_Report(const char *format, ...) {
 #endif
 }
     
-static void *Aploader_Main(void *arg) {
-    int ret, i;
-    contents_t ipc_toc[4] ATTRIBUTE_ALIGN(32);
-    partition_info_t ipc_partition_info[4] ATTRIBUTE_ALIGN(32);
-    uint32_t ipc_buffer[8] ATTRIBUTE_ALIGN(32);
-    partition_info_t *boot_partition;
-    apploader_init_t fn_init;
-    apploader_main_t fn_main;
-    apploader_final_t fn_final;
-    apploader_entry_t fn_entry;
+static bool Apploader_Disc(void *arg) {
+    int ret;
     
     do {
         ret = DI_Init();
@@ -136,27 +156,26 @@ static void *Aploader_Main(void *arg) {
     } while (ret < 0);
     
     Event_Trigger(&apploader_event_disk_id);
+    return true;
+}
+
+static bool Apploader_Load(void *arg) {
+    int ret;
+    uint32_t boot_partition, entry;
+    apploader_init_t fn_init;
+    apploader_entry_t fn_entry;
+    uint64_t clock_before;
     
     do {
-        ret = DI_ReadUnencrypted(ipc_toc, sizeof(ipc_toc), 0x00010000);
-    } while (ret < 0);
-    DCInvalidateRange(ipc_toc, sizeof(ipc_toc));
-    do {
-        ret = DI_ReadUnencrypted(
-            ipc_partition_info, sizeof(ipc_partition_info),
-            ipc_toc->partition_info_offset);
-    } while (ret < 0);
-    
-    boot_partition = NULL;
-    for (i = 0; i < ipc_toc->boot_info_count; i++) {
-        if (ipc_partition_info[i].type == 0) {
-            boot_partition = &ipc_partition_info[i];
-        }
-    }
+        ret = DIQueue_Init(
+            &apploader_di_queue, apploader_image.read_unencrypted);
+    } while (!ret);
+    boot_partition = ApploaderImage_BootPartition(
+        &apploader_di_queue, &apploader_image);
+    DIQueue_Destroy(&apploader_di_queue);
     
     do {
-        ret = DI_PartitionOpen(
-            boot_partition->offset, (void *)apploader_ipc_tmd);
+        ret = DI_PartitionOpen(boot_partition, (void *)apploader_ipc_tmd);
     } while (ret < 0);
     
 #if 0
@@ -174,74 +193,62 @@ static void *Aploader_Main(void *arg) {
 #endif
     
     do {
-        ret = DI_Read(ipc_buffer, sizeof(ipc_buffer), 0x2440 / 4);
-    } while (ret < 0);
+        ret = DIQueue_Init(&apploader_di_queue, apploader_image.read);
+    } while (!ret);
     
-    do {
-        ret = DI_Read(
-            (void*)0x81200000, (ipc_buffer[5] + 31) & ~31, 0x2460 / 4);
-    } while (ret < 0);
+    Trace_Begin("dvd", "read apploader");
+    entry = ApploaderImage_ReadApploader(
+        &apploader_di_queue, APPLOADER_APP0_BOUNDARY,
+        (uint8_t *)APPLOADER_APP1_BOUNDARY -
+            (uint8_t *)APPLOADER_APP0_BOUNDARY);
+    Trace_End("dvd", "read apploader");
     
-    fn_entry = (apploader_entry_t)ipc_buffer[4];
+    fn_entry = (apploader_entry_t)entry;
     
-    fn_entry(&fn_init, &fn_main, &fn_final);   
+    fn_entry(&fn_init, &apploader_fn_main, &apploader_fn_final);   
     fn_init(&Apploader_Report);
     
+    clock_before = gettime();
     settime(secs_to_ticks(time(NULL) - 946684800));
+    Trace_ClockChanged(clock_before, gettime());
+    return true;
+}
 
-    Event_Wait(&module_event_list_loaded);
+static bool Apploader_Game(void *arg) {
+    int ret;
     
     while (1) {
         void* destination = 0;
         int length = 0, offset = 0;
         
-        ret = fn_main(&destination, &length, &offset);
+        ret = apploader_fn_main(&destination, &length, &offset);
         if (!ret)
             break;
         
         if (destination < APPLOADER_APP0_BOUNDARY) {
-            uint8_t *range_start, *range_end;
-
-            range_start = destination;
-            range_end = range_start + length;
-            
-            if (apploader_app0_start == NULL ||
-                range_start < apploader_app0_start) {
-                
-                apploader_app0_start = range_start;
-            }
-            if (apploader_app0_end == NULL ||
-                range_end > apploader_app0_end) {
-                
-                apploader_app0_end = range_end;
-            }
+            ApploaderImage_Extend(
+                &apploader_app0_start, &apploader_app0_end,
+                destination, length);
         } else if (destination > APPLOADER_APP1_BOUNDARY) {
-            uint8_t *range_start, *range_end;
-            
             destination = (char *)destination - module_list_size;
-            
-            range_start = destination;
-            range_end = range_start + length;
-            
-            if (apploader_app1_start == NULL ||
-                range_start < apploader_app1_start) {
-                
-                apploader_app1_start = range_start;
-            }
-            if (apploader_app1_end == NULL ||
-                range_end > apploader_app1_end) {
-                
-                apploader_app1_end = range_end;
-            }
+            ApploaderImage_Extend(
+                &apploader_app1_start, &apploader_app1_end,
+                destination, length);
         }
 
-        do {
-            ret = DI_Read(destination, length, offset & ~3);
-        } while (ret < 0);
-        
-        DCFlushRange(destination, length);
+        /* the apploader may parse what it just asked for, so each region
+         * has to arrive before it is called again. */
+        Trace_Begin("dvd", "read game");
+        ApploaderImage_ReadGame(
+            &apploader_di_queue, &apploader_image, destination, length,
+            offset & ~3);
+        Trace_End("dvd", "read game");
     }
-        
+    DIQueue_Destroy(&apploader_di_queue);
+    return true;
+}
+
+static bool Apploader_Final(void *arg) {
     switch (os0->disc.gamename[3]) {
         case 'E':
         case 'J':
@@ -275,13 +282,29 @@ static void *Aploader_Main(void *arg) {
     os1->ios_revision = os1->expected_ios_revision;
 
     os1->fst = os0->info.fst;
+    if (module_list_mem2_size > 0 && module_mem2_start < os1->arena2_high)
+        os1->arena2_high = module_mem2_start;
     memcpy(os1->application_name, os0->disc.gamename, 4);
 
     DCFlushRange(os0, 0x3f00);
     
-    apploader_game_entry_fn = fn_final();
+    apploader_game_entry_fn = apploader_fn_final();
+    return true;
+}
 
-    Event_Trigger(&apploader_event_complete);
-    
-    return NULL;
+static s32 Apploader_ReadCallback(s32 result, void *usrdata) {
+    DIQueue_Complete(usrdata, result);
+    return 0;
+}
+
+static int Apploader_ReadStart(di_request_t *request) {
+    return DI_ReadAsync(
+        request->buffer, request->length, request->offset,
+        request->command, &Apploader_ReadCallback, request);
+}
+
+static int Apploader_ReadUnencryptedStart(di_request_t *request) {
+    return DI_ReadUnencryptedAsync(
+        request->buffer, request->length, request->offset,
+        request->command, &Apploader_ReadCallback, request);
 }
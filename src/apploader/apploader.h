@@ -29,18 +29,28 @@
 #include <stdint.h>
 
 #include "library/event.h"
+#include "library/sched.h"
 
 typedef void (*apploader_game_entry_t)(void);
 
+/* the disc is in and os0 has its ID, for the UI. */
 extern event_t apploader_event_disk_id;
-extern event_t apploader_event_complete;
+/* as apploader_event_disk_id, for other tasks. */
+extern sched_task_t *apploader_task_disk_id;
+/* the game has been read, so the apploader_app* ranges are final. */
+extern sched_task_t *apploader_task_game;
+/* the game is ready to run from apploader_game_entry_fn. */
+extern sched_task_t *apploader_task_complete;
 extern apploader_game_entry_t apploader_game_entry_fn;
 extern uint8_t *apploader_app0_start;
 extern uint8_t *apploader_app0_end;
 extern uint8_t *apploader_app1_start;
 extern uint8_t *apploader_app1_end;
 
-bool Apploader_Init(void);
-bool Apploader_RunBackground(void);
+/* Make the apploader's tasks on sched, for the other subsystems to depend
+ * on. */
+bool Apploader_Init(sched_t *sched);
+/* Give them their inputs and submit them, once every subsystem is Init. */
+bool Apploader_Schedule(void);
 
 #endif /* APPLOADER_H_ */
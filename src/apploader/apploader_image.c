@@ -0,0 +1,156 @@
+/* apploader_image.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "apploader_image.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Word offset of the partition info on every disc seen so far, read before
+ * the table of contents that says where it is has arrived. */
+#define APPLOADER_PARTITION_INFO_OFFSET 0x00010008
+/* At most this many partitions are read from the first group. */
+#define APPLOADER_PARTITIONS 4
+/* Read the start of the apploader alongside its header, which gives the
+ * size of the rest. */
+#define APPLOADER_PREFETCH_SIZE 0x20000
+/* Game reads are split into chunks of this many bytes, so each can be
+ * flushed while the ones after it are still in flight. */
+#define APPLOADER_CHUNK_SIZE 0x40000
+
+/* The disc is big endian, whatever the host is. */
+static uint32_t ApploaderImage_Word(const uint8_t *address) {
+    return
+        ((uint32_t)address[0] << 24) | ((uint32_t)address[1] << 16) |
+        ((uint32_t)address[2] << 8) | (uint32_t)address[3];
+}
+
+uint32_t ApploaderImage_BootPartition(
+        di_queue_t *queue, const apploader_image_t *image) {
+    /* the first of the four partition groups: a count and an offset. */
+    uint8_t toc[32] __attribute__((aligned(32)));
+    /* an offset and a type for each partition in the group. */
+    uint8_t info[8 * APPLOADER_PARTITIONS] __attribute__((aligned(32)));
+    di_request_t *request, *request_next;
+    uint32_t count, info_offset, partition = 0;
+    size_t i;
+    
+    request = DIQueue_Read(queue, toc, sizeof(toc), 0x00010000);
+    request_next = DIQueue_Read(
+        queue, info, sizeof(info), APPLOADER_PARTITION_INFO_OFFSET);
+    DIQueue_Wait(queue, request);
+    if (image->invalidate != NULL)
+        image->invalidate(toc, sizeof(toc));
+    DIQueue_Wait(queue, request_next);
+    
+    count = ApploaderImage_Word(toc);
+    info_offset = ApploaderImage_Word(toc + 4);
+    if (info_offset != APPLOADER_PARTITION_INFO_OFFSET) {
+        request = DIQueue_Read(queue, info, sizeof(info), info_offset);
+        DIQueue_Wait(queue, request);
+    }
+    if (image->invalidate != NULL)
+        image->invalidate(info, sizeof(info));
+    
+    if (count > APPLOADER_PARTITIONS)
+        count = APPLOADER_PARTITIONS;
+    for (i = 0; i < count; i++) {
+        if (ApploaderImage_Word(info + i * 8 + 4) == 0)
+            partition = ApploaderImage_Word(info + i * 8);
+    }
+    
+    return partition;
+}
+
+uint32_t ApploaderImage_ReadApploader(
+        di_queue_t *queue, uint8_t *destination, uint32_t capacity) {
+    /* the date, entry point, size and trailer size. */
+    uint8_t header[32] __attribute__((aligned(32)));
+    di_request_t *request, *request_next;
+    uint32_t size;
+    
+    if (capacity < APPLOADER_PREFETCH_SIZE)
+        return 0;
+    
+    request = DIQueue_Read(queue, header, sizeof(header), 0x2440 / 4);
+    request_next = DIQueue_Read(
+        queue, destination, APPLOADER_PREFETCH_SIZE, 0x2460 / 4);
+    DIQueue_Wait(queue, request);
+    DIQueue_Wait(queue, request_next);
+    
+    size = (ApploaderImage_Word(header + 0x14) + 31) & ~31;
+    if (size > capacity)
+        return 0;
+    if (size > APPLOADER_PREFETCH_SIZE) {
+        request = DIQueue_Read(
+            queue, destination + APPLOADER_PREFETCH_SIZE,
+            size - APPLOADER_PREFETCH_SIZE,
+            (0x2460 + APPLOADER_PREFETCH_SIZE) / 4);
+        DIQueue_Wait(queue, request);
+    }
+    
+    return ApploaderImage_Word(header + 0x10);
+}
+
+void ApploaderImage_ReadGame(
+        di_queue_t *queue, const apploader_image_t *image,
+        uint8_t *destination, uint32_t length, uint32_t offset) {
+    di_request_t *requests[DI_QUEUE_DEPTH];
+    uint8_t *chunks[DI_QUEUE_DEPTH];
+    uint32_t sizes[DI_QUEUE_DEPTH];
+    size_t head = 0, count = 0;
+    uint32_t done = 0;
+
+    while (done < length || count > 0) {
+        if (done < length && count < DI_QUEUE_DEPTH) {
+            size_t slot = (head + count) % DI_QUEUE_DEPTH;
+            uint32_t size = length - done;
+
+            if (size > APPLOADER_CHUNK_SIZE)
+                size = APPLOADER_CHUNK_SIZE;
+            chunks[slot] = destination + done;
+            sizes[slot] = size;
+            requests[slot] = DIQueue_Read(
+                queue, chunks[slot], size, offset + done / 4);
+            done += size;
+            count++;
+        } else {
+            DIQueue_Wait(queue, requests[head]);
+            if (image->flush != NULL)
+                image->flush(chunks[head], sizes[head]);
+            head = (head + 1) % DI_QUEUE_DEPTH;
+            count--;
+        }
+    }
+}
+
+void ApploaderImage_Extend(
+        uint8_t **start, uint8_t **end,
+        uint8_t *destination, uint32_t length) {
+    if (*start == NULL || destination < *start)
+        *start = destination;
+    if (*end == NULL || destination + length > *end)
+        *end = destination + length;
+}
@@ -0,0 +1,73 @@
+/* apploader_image.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* This file should ideally avoid Wii specific methods so unit testing can be
+ * conducted elsewhere. */
+
+/* The reads the loader makes from a game disc: the partition table, the
+ * game's apploader, then each region the apploader asks for, in that order.
+ *
+ * The disc is reached through an image backend, which starts the reads: the
+ * drive on the Wii, a synthetic or dumped image in the tests.
+ */
+
+#ifndef APPLOADER_IMAGE_H_
+#define APPLOADER_IMAGE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../di/di_queue.h"
+
+typedef struct {
+    /* start a read from the disc itself, or from the open partition. */
+    di_queue_start_t read_unencrypted;
+    di_queue_start_t read;
+    /* make a buffer the drive just wrote visible to the CPU, and write a
+     * region of the game back to memory before it runs; either may be NULL
+     * where there are no caches to manage. */
+    void (*invalidate)(void *buffer, uint32_t length);
+    void (*flush)(void *buffer, uint32_t length);
+} apploader_image_t;
+
+/* The word offset of the boot partition, or 0 if there isn't one. queue must
+ * have been set up with image->read_unencrypted. */
+uint32_t ApploaderImage_BootPartition(
+    di_queue_t *queue, const apploader_image_t *image);
+/* Read the apploader out of the open partition into destination, which has
+ * room for capacity bytes, and return its entry point (0 if it doesn't fit).
+ * queue must have been set up with image->read. */
+uint32_t ApploaderImage_ReadApploader(
+    di_queue_t *queue, uint8_t *destination, uint32_t capacity);
+/* Read length bytes from word offset in the partition to destination, in
+ * chunks so each is flushed while the next is still in flight. */
+void ApploaderImage_ReadGame(
+    di_queue_t *queue, const apploader_image_t *image,
+    uint8_t *destination, uint32_t length, uint32_t offset);
+/* Widen [*start, *end), which is empty while *start is NULL, to cover a
+ * region the apploader has read. */
+void ApploaderImage_Extend(
+    uint8_t **start, uint8_t **end, uint8_t *destination, uint32_t length);
+
+#endif /* APPLOADER_IMAGE_H_ */
@@ -1,4 +1,5 @@
 WD           := $(dir $(lastword $(MAKEFILE_LIST)))
 WD_APPLOADER := $(WD)
 
-SRC += $(WD)apploader.c
\ No newline at end of file
+SRC += $(WD)apploader.c
+SRC += $(WD)apploader_image.c
\ No newline at end of file
@@ -130,6 +130,34 @@ int DI_Read(void *buffer, uint32_t length, uint32_t offset) {
     return ret;
 }
 
+int DI_ReadAsync(
+        void *buffer, uint32_t length, uint32_t offset,
+        uint32_t *command, ipccallback callback, void *usrdata) {
+    int ret;
+    
+    assert(di_fd != -1);
+    assert(buffer);
+    assert(di_has_partition);
+    assert(((int)buffer & 0x1f) == 0);
+    assert(((int)command & 0x1f) == 0);
+
+    command[0] = DI_IOCTL_READ << 24;
+    command[1] = length;
+    command[2] = offset;
+    ret = IOS_IoctlAsync(
+        di_fd, DI_IOCTL_READ,
+        command, sizeof(di_ipc_in),
+        buffer, length,
+        callback, usrdata);
+    
+    if (ret < 0) {
+        errno = IOS_Errno(ret);
+        return -1;
+    }
+    
+    return 0;
+}
+
 int DI_DiscWait(void) {
     int ret;
     
@@ -319,6 +347,33 @@ int DI_ReadUnencrypted(void *buffer, uint32_t length, uint32_t offset) {
     return ret;
 }
 
+int DI_ReadUnencryptedAsync(
+        void *buffer, uint32_t length, uint32_t offset,
+        uint32_t *command, ipccallback callback, void *usrdata) {
+    int ret;
+    
+    assert(di_fd != -1);
+    assert(buffer);
+    assert(((int)buffer & 0x1f) == 0);
+    assert(((int)command & 0x1f) == 0);
+
+    command[0] = DI_IOCTL_READ_UNENCRYPTED << 24;
+    command[1] = length;
+    command[2] = offset;
+    ret = IOS_IoctlAsync(
+        di_fd, DI_IOCTL_READ_UNENCRYPTED,
+        command, sizeof(di_ipc_in),
+        buffer, length,
+        callback, usrdata);
+    
+    if (ret < 0) {
+        errno = IOS_Errno(ret);
+        return -1;
+    }
+    
+    return 0;
+}
+
 int DI_MotorStop(void) {
     int ret;
     
@@ -26,17 +26,26 @@
 #define DI_H_
 
 #include <ogc/es.h>
+#include <ogc/ipc.h>
 #include <stdint.h>
 
 int DI_Init(void);
 int DI_Close(void);
 int DI_Read(void *buffer, uint32_t length, uint32_t offset);
+/* Start a read, calling callback from the IOS interrupt when it completes.
+ * command must be 32 bytes, 32 byte aligned, and left alone until then. */
+int DI_ReadAsync(
+    void *buffer, uint32_t length, uint32_t offset,
+    uint32_t *command, ipccallback callback, void *usrdata);
 int DI_DiscWait(void);
 int DI_DiscInserted(void);
 int DI_Reset(void);
 int DI_PartitionOpen(uint32_t offset, signed_blob *tmd);
 int DI_PartitionClose(void);
 int DI_ReadUnencrypted(void *buffer, uint32_t length, uint32_t offset);
+int DI_ReadUnencryptedAsync(
+    void *buffer, uint32_t length, uint32_t offset,
+    uint32_t *command, ipccallback callback, void *usrdata);
 int DI_MotorStop(void);
 
 #endif /* DVD_H_ */
\ No newline at end of file
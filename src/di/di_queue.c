@@ -0,0 +1,194 @@
+/* di_queue.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "di_queue.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef GEKKO
+
+#include <ogc/lwp.h>
+#include <ogc/machine/processor.h>
+
+/* DIQueue_Complete runs in the IOS interrupt, so the waiting side masks
+ * interrupts rather than taking a lock. */
+
+static bool DIQueue_SyncInit(di_queue_t *queue) {
+    return LWP_InitQueue(&queue->wait) == 0;
+}
+static void DIQueue_SyncDestroy(di_queue_t *queue) {
+    LWP_CloseQueue(queue->wait);
+}
+static void DIQueue_Sleep(di_queue_t *queue, di_request_t *request) {
+    uint32_t level;
+    
+    _CPU_ISR_Disable(level);
+    while (!request->done)
+        LWP_ThreadSleep(queue->wait);
+    _CPU_ISR_Restore(level);
+}
+static void DIQueue_Wake(di_queue_t *queue, di_request_t *request, int result) {
+    request->result = result;
+    request->done = true;
+    LWP_ThreadBroadcast(queue->wait);
+}
+
+#else
+
+static bool DIQueue_SyncInit(di_queue_t *queue) {
+    if (pthread_mutex_init(&queue->mutex, NULL))
+        return false;
+    if (pthread_cond_init(&queue->cond, NULL)) {
+        pthread_mutex_destroy(&queue->mutex);
+        return false;
+    }
+    return true;
+}
+static void DIQueue_SyncDestroy(di_queue_t *queue) {
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->mutex);
+}
+static void DIQueue_Sleep(di_queue_t *queue, di_request_t *request) {
+    pthread_mutex_lock(&queue->mutex);
+    while (!request->done)
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    pthread_mutex_unlock(&queue->mutex);
+}
+static void DIQueue_Wake(di_queue_t *queue, di_request_t *request, int result) {
+    pthread_mutex_lock(&queue->mutex);
+    request->result = result;
+    request->done = true;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+#endif
+
+static void DIQueue_Start(di_queue_t *queue, di_request_t *request);
+
+bool DIQueue_Init(di_queue_t *queue, di_queue_start_t start) {
+    size_t i;
+    
+    assert(queue != NULL);
+    assert(start != NULL);
+    
+    for (i = 0; i < DI_QUEUE_DEPTH; i++) {
+        queue->requests[i].queue = queue;
+        queue->requests[i].in_use = false;
+    }
+    queue->start = start;
+    queue->sequence = 0;
+    
+    return DIQueue_SyncInit(queue);
+}
+
+void DIQueue_Destroy(di_queue_t *queue) {
+    assert(queue != NULL);
+    
+    DIQueue_WaitAll(queue);
+    DIQueue_SyncDestroy(queue);
+}
+
+di_request_t *DIQueue_Read(
+        di_queue_t *queue, void *buffer, uint32_t length, uint32_t offset) {
+    di_request_t *request, *oldest;
+    size_t i;
+    
+    assert(queue != NULL);
+    
+    request = NULL;
+    oldest = NULL;
+    for (i = 0; i < DI_QUEUE_DEPTH; i++) {
+        di_request_t *candidate = queue->requests + i;
+        
+        if (!candidate->in_use) {
+            request = candidate;
+            break;
+        }
+        if (oldest == NULL ||
+            (int)(candidate->sequence - oldest->sequence) < 0)
+            oldest = candidate;
+    }
+    if (request == NULL) {
+        DIQueue_Wait(queue, oldest);
+        request = oldest;
+    }
+    
+    request->buffer = buffer;
+    request->length = length;
+    request->offset = offset;
+    request->in_use = true;
+    request->sequence = queue->sequence++;
+    DIQueue_Start(queue, request);
+    
+    return request;
+}
+
+int DIQueue_Wait(di_queue_t *queue, di_request_t *request) {
+    assert(queue != NULL);
+    assert(request != NULL);
+    assert(request->queue == queue);
+    assert(request->in_use);
+    
+    while (1) {
+        DIQueue_Sleep(queue, request);
+        if (request->result >= 0)
+            break;
+        DIQueue_Start(queue, request);
+    }
+    
+    request->in_use = false;
+    return request->result;
+}
+
+void DIQueue_WaitAll(di_queue_t *queue) {
+    size_t i;
+    
+    assert(queue != NULL);
+    
+    for (i = 0; i < DI_QUEUE_DEPTH; i++) {
+        if (queue->requests[i].in_use)
+            DIQueue_Wait(queue, queue->requests + i);
+    }
+}
+
+void DIQueue_Complete(di_request_t *request, int result) {
+    assert(request != NULL);
+    
+    DIQueue_Wake(request->queue, request, result);
+}
+
+static void DIQueue_Start(di_queue_t *queue, di_request_t *request) {
+    int ret;
+    
+    request->done = false;
+    ret = queue->start(request);
+    if (ret < 0) {
+        /* DIQueue_Wait will try again. */
+        request->result = ret;
+        request->done = true;
+    }
+}
@@ -0,0 +1,97 @@
+/* di_queue.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* This file should ideally avoid Wii specific methods so unit testing can be
+ * conducted elsewhere. */
+
+/* A queue of disc reads, up to DI_QUEUE_DEPTH of them in flight at once, so
+ * the next region can be on its way while the CPU works on the current one.
+ *
+ * The backend starts each read and calls DIQueue_Complete when it finishes,
+ * which on the Wii happens in the IOS interrupt. A read that fails is started
+ * again by DIQueue_Wait, as the synchronous reads always were.
+ */
+
+#ifndef DI_QUEUE_H_
+#define DI_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef GEKKO
+#include <ogc/lwp.h>
+#else
+#include <pthread.h>
+#endif
+
+#define DI_QUEUE_DEPTH 4
+
+typedef struct di_queue_t di_queue_t;
+typedef struct di_request_t di_request_t;
+
+/* Start request, returning a negative value if it couldn't be started. */
+typedef int (*di_queue_start_t)(di_request_t *request);
+
+struct di_request_t {
+    /* the ioctl input block, which IOS needs to stay put while in flight. */
+    uint32_t command[8] __attribute__((aligned(32)));
+    di_queue_t *queue;
+    void *buffer;
+    uint32_t length;
+    uint32_t offset;
+    volatile int result;
+    volatile bool done;
+    bool in_use;
+    /* order of submission, so a full queue waits for the oldest read. */
+    unsigned sequence;
+};
+
+struct di_queue_t {
+    di_request_t requests[DI_QUEUE_DEPTH];
+    di_queue_start_t start;
+    unsigned sequence;
+#ifdef GEKKO
+    lwpq_t wait;
+#else
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+};
+
+bool DIQueue_Init(di_queue_t *queue, di_queue_start_t start);
+void DIQueue_Destroy(di_queue_t *queue);
+
+/* Start reading length bytes from offset into buffer. Waits for the oldest
+ * read if DI_QUEUE_DEPTH are already in flight. */
+di_request_t *DIQueue_Read(
+    di_queue_t *queue, void *buffer, uint32_t length, uint32_t offset);
+/* Wait for request to succeed and release it, returning its result. */
+int DIQueue_Wait(di_queue_t *queue, di_request_t *request);
+void DIQueue_WaitAll(di_queue_t *queue);
+
+/* Called by the backend when request finishes. */
+void DIQueue_Complete(di_request_t *request, int result);
+
+#endif /* DI_QUEUE_H_ */
@@ -1,4 +1,5 @@
 WD    := $(dir $(lastword $(MAKEFILE_LIST)))
 WD_DI := $(WD)
 
-SRC += $(WD)di.c
\ No newline at end of file
+SRC += $(WD)di.c
+SRC += $(WD)di_queue.c
@@ -27,6 +27,7 @@
  * triggered.
  * An event can be triggered by any thread, causing all waiting threads to be
  * released.
+ * Waits that block and triggers are recorded in the boot trace by name.
  */
  
 #ifndef EVENT_H_
@@ -36,20 +37,24 @@
 #include <ogc/semaphore.h>
 #include <stdbool.h>
 
+#include "library/trace.h"
+
 typedef struct {
     bool triggered; /* fast lockless variable for already triggered events */
     sem_t sem;
+    const char *name;
 } event_t;
 
-static bool Event_Init(event_t *event);
+static bool Event_Init(event_t *event, const char *name);
 static bool Event_Destroy(event_t *event);
 static bool Event_Wait(event_t *event);
 static bool Event_Trigger(event_t *event);
 static bool Event_Reset(event_t *event);
 
-static inline bool Event_Init(event_t *event) {
+static inline bool Event_Init(event_t *event, const char *name) {
     assert(event);
     event->triggered = false;
+    event->name = name;
     return LWP_SemInit(&event->sem, 0, 1) == 0;
 }
 
@@ -73,7 +78,9 @@ static inline bool Event_Wait(event_t *event) {
     if (event->triggered) {
         return true;
     } else {
+        Trace_Begin("wait", event->name);
         ret = LWP_SemWait(event->sem);
+        Trace_End("wait", event->name);
         if (ret)
             return false;
         return LWP_SemPost(event->sem) == 0;
@@ -84,6 +91,7 @@ static inline bool Event_Trigger(event_t *event) {
     assert(event);
     assert(event->sem != LWP_SEM_NULL);
     event->triggered = true;
+    Trace_Instant("trigger", event->name);
     return LWP_SemPost(event->sem) == 0;
 }
 
@@ -0,0 +1,5 @@
+WD         := $(dir $(lastword $(MAKEFILE_LIST)))
+WD_LIBRARY := $(WD)
+
+SRC += $(WD)trace.c
+SRC += $(WD)sched.c
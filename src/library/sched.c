@@ -0,0 +1,402 @@
+/* sched.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sched.h"
+
+#include <stdlib.h>
+
+#ifdef GEKKO
+
+#include <ogc/cond.h>
+#include <ogc/lwp.h>
+#include <ogc/mutex.h>
+
+#include "threads.h"
+
+#define SCHED_STACK_SIZE (32 * 1024)
+
+typedef mutex_t sched_mutex_t;
+typedef cond_t sched_cond_t;
+typedef lwp_t sched_thread_t;
+
+static bool Sched_MutexInit(sched_mutex_t *mutex) {
+    return LWP_MutexInit(mutex, false) == 0;
+}
+static void Sched_MutexDestroy(sched_mutex_t *mutex) {
+    LWP_MutexDestroy(*mutex);
+}
+static void Sched_MutexLock(sched_mutex_t *mutex) {
+    LWP_MutexLock(*mutex);
+}
+static void Sched_MutexUnlock(sched_mutex_t *mutex) {
+    LWP_MutexUnlock(*mutex);
+}
+static bool Sched_CondInit(sched_cond_t *cond) {
+    return LWP_CondInit(cond) == 0;
+}
+static void Sched_CondDestroy(sched_cond_t *cond) {
+    LWP_CondDestroy(*cond);
+}
+static void Sched_CondWait(sched_cond_t *cond, sched_mutex_t *mutex) {
+    LWP_CondWait(*cond, *mutex);
+}
+static void Sched_CondSignal(sched_cond_t *cond) {
+    LWP_CondSignal(*cond);
+}
+static void Sched_CondBroadcast(sched_cond_t *cond) {
+    LWP_CondBroadcast(*cond);
+}
+static bool Sched_ThreadCreate(
+        sched_thread_t *thread, void *(*fn)(void *), void *arg) {
+    return LWP_CreateThread(
+        thread, fn, arg, NULL, SCHED_STACK_SIZE, THREAD_PRIO_IO) == 0;
+}
+static void Sched_ThreadJoin(sched_thread_t thread) {
+    LWP_JoinThread(thread, NULL);
+}
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_mutex_t sched_mutex_t;
+typedef pthread_cond_t sched_cond_t;
+typedef pthread_t sched_thread_t;
+
+static bool Sched_MutexInit(sched_mutex_t *mutex) {
+    return pthread_mutex_init(mutex, NULL) == 0;
+}
+static void Sched_MutexDestroy(sched_mutex_t *mutex) {
+    pthread_mutex_destroy(mutex);
+}
+static void Sched_MutexLock(sched_mutex_t *mutex) {
+    pthread_mutex_lock(mutex);
+}
+static void Sched_MutexUnlock(sched_mutex_t *mutex) {
+    pthread_mutex_unlock(mutex);
+}
+static bool Sched_CondInit(sched_cond_t *cond) {
+    return pthread_cond_init(cond, NULL) == 0;
+}
+static void Sched_CondDestroy(sched_cond_t *cond) {
+    pthread_cond_destroy(cond);
+}
+static void Sched_CondWait(sched_cond_t *cond, sched_mutex_t *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+static void Sched_CondSignal(sched_cond_t *cond) {
+    pthread_cond_signal(cond);
+}
+static void Sched_CondBroadcast(sched_cond_t *cond) {
+    pthread_cond_broadcast(cond);
+}
+static bool Sched_ThreadCreate(
+        sched_thread_t *thread, void *(*fn)(void *), void *arg) {
+    return pthread_create(thread, NULL, fn, arg) == 0;
+}
+static void Sched_ThreadJoin(sched_thread_t thread) {
+    pthread_join(thread, NULL);
+}
+
+#endif
+
+typedef struct sched_edge_t {
+    sched_task_t *task;
+    struct sched_edge_t *next;
+} sched_edge_t;
+
+struct sched_task_t {
+    sched_fn_t fn;
+    void *arg;
+    /* unfinished inputs, plus one until the task is submitted. */
+    size_t waiting;
+    bool done;
+    bool failed;
+    /* tasks waiting for this one. */
+    sched_edge_t *dependents;
+    sched_task_t *ready_next;
+    sched_task_t *all_next;
+};
+
+struct sched_t {
+    sched_mutex_t mutex;
+    /* signalled once for each task that becomes ready while a thread is
+     * idle, and broadcast when pending reaches 0 and when the threads should
+     * stop. */
+    sched_cond_t cond;
+    /* threads (and Sched_Wait) blocked on cond. */
+    size_t idle;
+    sched_task_t *ready_head;
+    sched_task_t *ready_tail;
+    /* every task since the last Sched_Wait, so they can be freed. */
+    sched_task_t *tasks;
+    size_t pending;
+    bool failed;
+    bool stop;
+    size_t thread_count;
+    sched_thread_t threads[];
+};
+
+static bool Sched_Nothing(void *arg);
+static void *Sched_Main(void *arg);
+static void Sched_IdleLocked(sched_t *sched);
+static void Sched_RunLocked(sched_t *sched);
+static bool Sched_ReleaseLocked(sched_t *sched, sched_task_t *task);
+static void Sched_WakeLocked(sched_t *sched, size_t count);
+static void Sched_FreeTasks(sched_t *sched);
+
+sched_t *Sched_Create(size_t thread_count) {
+    sched_t *sched;
+    size_t i;
+    
+    sched = malloc(sizeof(sched_t) + thread_count * sizeof(sched_thread_t));
+    if (sched == NULL)
+        return NULL;
+    
+    if (!Sched_MutexInit(&sched->mutex)) {
+        free(sched);
+        return NULL;
+    }
+    if (!Sched_CondInit(&sched->cond)) {
+        Sched_MutexDestroy(&sched->mutex);
+        free(sched);
+        return NULL;
+    }
+    
+    sched->ready_head = NULL;
+    sched->ready_tail = NULL;
+    sched->tasks = NULL;
+    sched->pending = 0;
+    sched->idle = 0;
+    sched->failed = false;
+    sched->stop = false;
+    sched->thread_count = 0;
+    
+    for (i = 0; i < thread_count; i++) {
+        if (!Sched_ThreadCreate(sched->threads + i, &Sched_Main, sched)) {
+            Sched_Destroy(sched);
+            return NULL;
+        }
+        sched->thread_count++;
+    }
+    
+    return sched;
+}
+
+void Sched_Destroy(sched_t *sched) {
+    size_t i;
+    
+    if (sched == NULL)
+        return;
+    
+    Sched_MutexLock(&sched->mutex);
+    sched->stop = true;
+    Sched_CondBroadcast(&sched->cond);
+    Sched_MutexUnlock(&sched->mutex);
+    
+    for (i = 0; i < sched->thread_count; i++)
+        Sched_ThreadJoin(sched->threads[i]);
+    
+    Sched_FreeTasks(sched);
+    Sched_CondDestroy(&sched->cond);
+    Sched_MutexDestroy(&sched->mutex);
+    free(sched);
+}
+
+sched_task_t *Sched_Task(sched_t *sched, sched_fn_t fn, void *arg) {
+    sched_task_t *task;
+    
+    task = malloc(sizeof(sched_task_t));
+    if (task == NULL)
+        return NULL;
+    
+    task->fn = fn;
+    task->arg = arg;
+    task->waiting = 1;
+    task->done = false;
+    task->failed = false;
+    task->dependents = NULL;
+    task->ready_next = NULL;
+    
+    Sched_MutexLock(&sched->mutex);
+    task->all_next = sched->tasks;
+    sched->tasks = task;
+    sched->pending++;
+    Sched_MutexUnlock(&sched->mutex);
+    
+    return task;
+}
+
+sched_task_t *Sched_Join(sched_t *sched) {
+    return Sched_Task(sched, &Sched_Nothing, NULL);
+}
+
+static bool Sched_Nothing(void *arg) {
+    return true;
+}
+
+bool Sched_Depend(sched_t *sched, sched_task_t *task, sched_task_t *input) {
+    sched_edge_t *edge;
+    
+    edge = malloc(sizeof(sched_edge_t));
+    if (edge == NULL)
+        return false;
+    
+    Sched_MutexLock(&sched->mutex);
+    if (input->done) {
+        if (input->failed)
+            task->failed = true;
+        free(edge);
+    } else {
+        edge->task = task;
+        edge->next = input->dependents;
+        input->dependents = edge;
+        task->waiting++;
+    }
+    Sched_MutexUnlock(&sched->mutex);
+    
+    return true;
+}
+
+void Sched_Submit(sched_t *sched, sched_task_t *task) {
+    Sched_MutexLock(&sched->mutex);
+    if (Sched_ReleaseLocked(sched, task))
+        Sched_WakeLocked(sched, 1);
+    Sched_MutexUnlock(&sched->mutex);
+}
+
+bool Sched_Wait(sched_t *sched) {
+    bool result;
+    
+    Sched_MutexLock(&sched->mutex);
+    while (sched->pending > 0) {
+        if (sched->ready_head != NULL)
+            Sched_RunLocked(sched);
+        else
+            Sched_IdleLocked(sched);
+    }
+    result = !sched->failed;
+    sched->failed = false;
+    Sched_FreeTasks(sched);
+    Sched_MutexUnlock(&sched->mutex);
+    
+    return result;
+}
+
+static void *Sched_Main(void *arg) {
+    sched_t *sched = arg;
+    
+    Sched_MutexLock(&sched->mutex);
+    while (!sched->stop) {
+        if (sched->ready_head != NULL)
+            Sched_RunLocked(sched);
+        else
+            Sched_IdleLocked(sched);
+    }
+    Sched_MutexUnlock(&sched->mutex);
+    
+    return NULL;
+}
+
+static void Sched_IdleLocked(sched_t *sched) {
+    sched->idle++;
+    Sched_CondWait(&sched->cond, &sched->mutex);
+    sched->idle--;
+}
+
+/* Take the first ready task and run it without the lock held. */
+static void Sched_RunLocked(sched_t *sched) {
+    sched_task_t *task;
+    sched_edge_t *edge;
+    size_t released;
+    bool ok;
+    
+    task = sched->ready_head;
+    sched->ready_head = task->ready_next;
+    if (sched->ready_head == NULL)
+        sched->ready_tail = NULL;
+    
+    Sched_MutexUnlock(&sched->mutex);
+    ok = !task->failed && task->fn(task->arg);
+    Sched_MutexLock(&sched->mutex);
+    
+    task->done = true;
+    task->failed = !ok;
+    if (!ok)
+        sched->failed = true;
+    
+    released = 0;
+    for (edge = task->dependents; edge != NULL; edge = edge->next) {
+        if (!ok)
+            edge->task->failed = true;
+        if (Sched_ReleaseLocked(sched, edge->task))
+            released++;
+    }
+    
+    sched->pending--;
+    if (sched->pending == 0)
+        Sched_CondBroadcast(&sched->cond);
+    else if (released > 1)
+        /* this thread takes the first of them itself. */
+        Sched_WakeLocked(sched, released - 1);
+}
+
+/* Returns whether task became ready. */
+static bool Sched_ReleaseLocked(sched_t *sched, sched_task_t *task) {
+    task->waiting--;
+    if (task->waiting > 0)
+        return false;
+    
+    if (sched->ready_tail == NULL)
+        sched->ready_head = task;
+    else
+        sched->ready_tail->ready_next = task;
+    sched->ready_tail = task;
+    return true;
+}
+
+/* Wake one idle thread for each of count newly ready tasks. */
+static void Sched_WakeLocked(sched_t *sched, size_t count) {
+    if (count > sched->idle)
+        count = sched->idle;
+    while (count-- > 0)
+        Sched_CondSignal(&sched->cond);
+}
+
+static void Sched_FreeTasks(sched_t *sched) {
+    while (sched->tasks != NULL) {
+        sched_task_t *task;
+        
+        task = sched->tasks;
+        sched->tasks = task->all_next;
+        while (task->dependents != NULL) {
+            sched_edge_t *edge;
+            
+            edge = task->dependents;
+            task->dependents = edge->next;
+            free(edge);
+        }
+        free(task);
+    }
+}
@@ -0,0 +1,71 @@
+/* sched.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* This file should ideally avoid Wii specific methods so unit testing can be
+ * conducted elsewhere. */
+
+/* A small scheduler for a graph of tasks. Each task names the tasks whose
+ * results it needs, and runs on a fixed pool of threads as soon as they have
+ * all finished, rather than when a hand picked event says so.
+ *
+ * Build the graph with Sched_Task and Sched_Depend, release each task with
+ * Sched_Submit once its inputs are declared, then Sched_Wait, which helps run
+ * tasks until all are done. A task that fails (returns false) fails every
+ * task that depends on it, without running them.
+ *
+ * A running task may create and submit more tasks, and may give inputs to any
+ * task not yet submitted. So work whose shape is only known once earlier
+ * tasks have run, such as one task per file found by a scan, is waited on
+ * through a Sched_Join made up front and submitted once it has its inputs.
+ *
+ * On the Wii the pool uses LWP threads; elsewhere it uses pthreads.
+ */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct sched_t sched_t;
+typedef struct sched_task_t sched_task_t;
+
+typedef bool (*sched_fn_t)(void *arg);
+
+/* A scheduler with thread_count threads of its own; with none, all tasks run
+ * in Sched_Wait. */
+sched_t *Sched_Create(size_t thread_count);
+void Sched_Destroy(sched_t *sched);
+
+sched_task_t *Sched_Task(sched_t *sched, sched_fn_t fn, void *arg);
+/* A task that does nothing, finishing once its inputs have. */
+sched_task_t *Sched_Join(sched_t *sched);
+/* task must not start until input has finished. */
+bool Sched_Depend(sched_t *sched, sched_task_t *task, sched_task_t *input);
+void Sched_Submit(sched_t *sched, sched_task_t *task);
+/* Run tasks until every task created has finished, then free them. Returns
+ * whether they all succeeded. */
+bool Sched_Wait(sched_t *sched);
+
+#endif /* SCHED_H_ */
@@ -0,0 +1,286 @@
+/* trace.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The most threads and nesting depth Trace_Summary follows; deeper phases
+ * are left out of the totals. */
+#define TRACE_THREADS_MAX 16
+#define TRACE_DEPTH_MAX 32
+
+typedef struct {
+    const char *category;
+    const char *name;
+    uint64_t ticks;
+    size_t count;
+} trace_total_t;
+
+typedef struct {
+    uint32_t thread;
+    size_t depth;
+    size_t open[TRACE_DEPTH_MAX];
+} trace_stack_t;
+
+static trace_event_t *trace_events = NULL;
+static size_t trace_capacity = 0;
+/* slots handed out, which may run past trace_capacity. */
+static volatile size_t trace_claimed = 0;
+static trace_clock_t trace_clock;
+static trace_thread_t trace_thread;
+static uint32_t trace_ticks_per_ms;
+static uint64_t trace_start;
+static volatile uint64_t trace_offset;
+
+static void Trace_Record(char phase, const char *category, const char *name);
+static uint64_t Trace_Microseconds(uint64_t time);
+static void Trace_WriteString(FILE *file, const char *string);
+static int Trace_TotalCompare(const void *left, const void *right);
+
+bool Trace_Init(
+        size_t capacity, trace_clock_t clock, trace_thread_t thread,
+        uint32_t ticks_per_ms) {
+    
+    if (capacity == 0 || clock == NULL || thread == NULL || ticks_per_ms == 0)
+        return false;
+    
+    Trace_Free();
+    
+    trace_events = malloc(sizeof(trace_event_t) * capacity);
+    if (trace_events == NULL)
+        return false;
+    
+    trace_capacity = capacity;
+    trace_claimed = 0;
+    trace_clock = clock;
+    trace_thread = thread;
+    trace_ticks_per_ms = ticks_per_ms;
+    trace_offset = 0;
+    trace_start = clock();
+    return true;
+}
+
+void Trace_Free(void) {
+    free(trace_events);
+    trace_events = NULL;
+    trace_capacity = 0;
+    trace_claimed = 0;
+}
+
+void Trace_Begin(const char *category, const char *name) {
+    Trace_Record('B', category, name);
+}
+
+void Trace_End(const char *category, const char *name) {
+    Trace_Record('E', category, name);
+}
+
+void Trace_Instant(const char *category, const char *name) {
+    Trace_Record('i', category, name);
+}
+
+void Trace_ThreadName(const char *name) {
+    Trace_Record('M', "thread", name);
+}
+
+void Trace_ClockChanged(uint64_t before, uint64_t after) {
+    trace_offset += before - after;
+}
+
+size_t Trace_Count(void) {
+    return trace_claimed < trace_capacity ? trace_claimed : trace_capacity;
+}
+
+size_t Trace_Dropped(void) {
+    return trace_claimed - Trace_Count();
+}
+
+const trace_event_t *Trace_Events(void) {
+    return trace_events;
+}
+
+static void Trace_Record(char phase, const char *category, const char *name) {
+    trace_event_t *event;
+    size_t index;
+    
+    if (trace_events == NULL)
+        return;
+    
+    /* threads may preempt each other here, so each claims its own slot. */
+    index = __sync_fetch_and_add(&trace_claimed, 1);
+    if (index >= trace_capacity)
+        return;
+    
+    event = trace_events + index;
+    event->category = category;
+    event->name = name;
+    event->thread = trace_thread();
+    event->phase = phase;
+    event->time = trace_clock() + trace_offset;
+}
+
+static uint64_t Trace_Microseconds(uint64_t time) {
+    if (time < trace_start)
+        return 0;
+    return (time - trace_start) * 1000 / trace_ticks_per_ms;
+}
+
+static void Trace_WriteString(FILE *file, const char *string) {
+    fputc('"', file);
+    for (; *string != '\0'; string++) {
+        if (*string == '"' || *string == '\\')
+            fprintf(file, "\\%c", *string);
+        else if ((unsigned char)*string < 0x20)
+            fprintf(file, "\\u%04x", (unsigned char)*string);
+        else
+            fputc(*string, file);
+    }
+    fputc('"', file);
+}
+
+bool Trace_WriteJson(FILE *file) {
+    size_t i, count;
+    
+    count = Trace_Count();
+    
+    fputs("{\"traceEvents\":[\n", file);
+    for (i = 0; i < count; i++) {
+        const trace_event_t *event;
+        
+        event = trace_events + i;
+        fputs("{\"name\":", file);
+        if (event->phase == 'M') {
+            fputs("\"thread_name\",\"ph\":\"M\"", file);
+        } else {
+            Trace_WriteString(file, event->name);
+            fputs(",\"cat\":", file);
+            Trace_WriteString(file, event->category);
+            fprintf(
+                file, ",\"ph\":\"%c\",\"ts\":%llu", event->phase,
+                (unsigned long long)Trace_Microseconds(event->time));
+            if (event->phase == 'i')
+                fputs(",\"s\":\"t\"", file);
+        }
+        fprintf(file, ",\"pid\":1,\"tid\":%lu", (unsigned long)event->thread);
+        if (event->phase == 'M') {
+            fputs(",\"args\":{\"name\":", file);
+            Trace_WriteString(file, event->name);
+            fputc('}', file);
+        }
+        fputs(i + 1 < count ? "},\n" : "}\n", file);
+    }
+    fputs("],\"displayTimeUnit\":\"ms\"}\n", file);
+    
+    return !ferror(file);
+}
+
+void Trace_Summary(FILE *file) {
+    trace_stack_t stacks[TRACE_THREADS_MAX];
+    trace_total_t *totals;
+    size_t i, j, count, stack_count = 0, total_count = 0;
+    
+    count = Trace_Count();
+    totals = malloc(sizeof(trace_total_t) * (count + 1));
+    if (totals == NULL)
+        return;
+    
+    for (i = 0; i < count; i++) {
+        const trace_event_t *event, *begin;
+        trace_stack_t *stack;
+        
+        event = trace_events + i;
+        if (event->phase != 'B' && event->phase != 'E')
+            continue;
+        
+        for (j = 0; j < stack_count; j++)
+            if (stacks[j].thread == event->thread)
+                break;
+        if (j == stack_count) {
+            if (stack_count == TRACE_THREADS_MAX)
+                continue;
+            stacks[stack_count].thread = event->thread;
+            stacks[stack_count].depth = 0;
+            stack_count++;
+        }
+        stack = stacks + j;
+        
+        if (event->phase == 'B') {
+            if (stack->depth < TRACE_DEPTH_MAX)
+                stack->open[stack->depth] = i;
+            stack->depth++;
+            continue;
+        }
+        
+        if (stack->depth == 0)
+            continue;
+        stack->depth--;
+        if (stack->depth >= TRACE_DEPTH_MAX)
+            continue;
+        
+        begin = trace_events + stack->open[stack->depth];
+        if (strcmp(begin->name, event->name) != 0 ||
+            strcmp(begin->category, event->category) != 0)
+            continue;
+        
+        for (j = 0; j < total_count; j++)
+            if (strcmp(totals[j].name, event->name) == 0 &&
+                strcmp(totals[j].category, event->category) == 0)
+                break;
+        if (j == total_count) {
+            totals[j].category = event->category;
+            totals[j].name = event->name;
+            totals[j].ticks = 0;
+            totals[j].count = 0;
+            total_count++;
+        }
+        if (event->time > begin->time)
+            totals[j].ticks += event->time - begin->time;
+        totals[j].count++;
+    }
+    
+    qsort(totals, total_count, sizeof(trace_total_t), &Trace_TotalCompare);
+    
+    for (i = 0; i < total_count; i++)
+        fprintf(
+            file, "%7lu ms %4lux %s %s\n",
+            (unsigned long)(totals[i].ticks / trace_ticks_per_ms),
+            (unsigned long)totals[i].count, totals[i].category,
+            totals[i].name);
+    if (Trace_Dropped() > 0)
+        fprintf(
+            file, "(%lu trace events dropped)\n",
+            (unsigned long)Trace_Dropped());
+    
+    free(totals);
+}
+
+static int Trace_TotalCompare(const void *left, const void *right) {
+    const trace_total_t *left_total = left, *right_total = right;
+    
+    if (left_total->ticks != right_total->ticks)
+        return left_total->ticks > right_total->ticks ? -1 : 1;
+    return strcmp(left_total->name, right_total->name);
+}
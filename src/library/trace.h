@@ -0,0 +1,82 @@
+/* trace.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* This file should ideally avoid Wii specific methods so unit testing can be
+ * conducted elsewhere. */
+
+/* A timeline of the boot, for finding where the time goes. Threads record the
+ * start and end of each phase into a fixed size buffer without locking, and
+ * the result can be written out in the Chrome trace format (load it in
+ * chrome://tracing or Perfetto) or summarised as totals per phase.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef uint64_t (*trace_clock_t)(void);
+typedef uint32_t (*trace_thread_t)(void);
+
+typedef struct {
+    const char *category;
+    const char *name;
+    uint64_t time;
+    uint32_t thread;
+    /* 'B', 'E', 'i' or 'M' (thread name) as in the Chrome trace format. */
+    char phase;
+} trace_event_t;
+
+#define TRACE_CAPACITY_DEFAULT 4096
+
+/* Start recording, reading time from clock, which counts ticks_per_ms ticks
+ * per millisecond. Names and categories must outlive the trace. Until this
+ * is called nothing is recorded. */
+bool Trace_Init(
+    size_t capacity, trace_clock_t clock, trace_thread_t thread,
+    uint32_t ticks_per_ms);
+void Trace_Free(void);
+
+void Trace_Begin(const char *category, const char *name);
+void Trace_End(const char *category, const char *name);
+void Trace_Instant(const char *category, const char *name);
+/* Name the calling thread in the output. */
+void Trace_ThreadName(const char *name);
+/* The clock was set from before to after, so shift later times to keep the
+ * timeline continuous. */
+void Trace_ClockChanged(uint64_t before, uint64_t after);
+
+/* Events recorded, and those dropped because the buffer was full. */
+size_t Trace_Count(void);
+size_t Trace_Dropped(void);
+const trace_event_t *Trace_Events(void);
+
+bool Trace_WriteJson(FILE *file);
+/* Total time and count for each phase, longest first. */
+void Trace_Summary(FILE *file);
+
+#endif /* TRACE_H_ */
@@ -32,6 +32,7 @@
 #include <malloc.h>
 #include <ogc/consol.h>
 #include <ogc/lwp.h>
+#include <ogc/lwp_watchdog.h>
 #include <ogc/system.h>
 #include <ogc/video.h>
 #include <sdcard/wiisd_io.h>
@@ -42,41 +43,62 @@
 #include "apploader/apploader.h"
 #include "library/dolphin_os.h"
 #include "library/event.h"
+#include "library/sched.h"
+#include "library/trace.h"
 #include "modules/module.h"
 #include "network.h"
 #include "search/search.h"
 #include "settings/settings.h"
 #include "threads.h"
 
-event_t main_event_fat_loaded;
+/* Threads loading runs on. The Wii has one core, so they are there to keep
+ * the disc, the SD card and the CPU busy at once: the game's reads hold one
+ * for most of the boot, the module and symbol file reads another, leaving
+ * parsing, the FSM build and linking the rest. */
+#define MAIN_SCHED_THREADS 4
+
+sched_task_t *main_task_fat_loaded;
 
 static void Main_PrintSize(size_t size);
+static void Main_TraceWrite(void);
 static void ConnectHOST(void);
 static void ConnectGUEST(void);
 
 int host_ip = 0xc0a80121;
 int port = 10000;
+int main_trace = 1;
 
 int main(void) {
     int ret;
+    bool booted;
+    sched_t *sched;
     void *frame_buffer = NULL;
     GXRModeObj *rmode = NULL;   
 	
     /* The game's boot loader is statically loaded at 0x81200000, so we'd better
      * not start mallocing there! */
     SYS_SetArena1Hi((void *)0x81200000);
+    
+    /* record the boot timeline; if this fails, nothing is recorded. */
+    Trace_Init(TRACE_CAPACITY_DEFAULT, &gettime, &LWP_GetSelf, TB_TIMER_CLOCK);
+    Trace_ThreadName("main");
+    
 	/* initialise Wii Remotes?! */
 	WPAD_Init();
 	settings_init();
 	
-    /* initialise all subsystems */
-    if (!Event_Init(&main_event_fat_loaded))
+    /* initialise all subsystems, each making the tasks the others depend on */
+    sched = Sched_Create(MAIN_SCHED_THREADS);
+    if (sched == NULL)
+        goto exit_error;
+    main_task_fat_loaded = Sched_Join(sched);
+    if (main_task_fat_loaded == NULL)
         goto exit_error;
-    if (!Apploader_Init())
+    if (!Apploader_Init(sched))
         goto exit_error;
-    if (!Module_Init())
+    if (!Module_Init(sched))
         goto exit_error;
-    if (!Search_Init())
+    if (!Search_Init(sched))
         goto exit_error;
     
     /* main thread is UI, so set thread prior to UI */
@@ -94,12 +116,12 @@ int main(void) {
         frame_buffer, 20, 20, rmode->fbWidth, rmode->xfbHeight,
         rmode->fbWidth * VI_DISPLAY_PIX_SZ);
 
-    /* spawn lots of worker threads to do stuff */
-    if (!Apploader_RunBackground())
+    /* let the scheduler's threads get on with loading */
+    if (!Apploader_Schedule())
         goto exit_error;
-    if (!Module_RunBackground())
+    if (!Module_Schedule())
         goto exit_error;
-    if (!Search_RunBackground())
+    if (!Search_Schedule())
         goto exit_error;
         
     VIDEO_Configure(rmode);
@@ -145,10 +167,12 @@ int main(void) {
         goto exit_error;
     }
     
-    Event_Trigger(&main_event_fat_loaded);
-	
+	/* settings are loaded before the module thread is let at the SD card, as
+	 * it reads some of them. */
 	settings_load();
     
+    Sched_Submit(sched, main_task_fat_loaded);
+    
     printf("Waiting for game disk...\n");
     Event_Wait(&apploader_event_disk_id);
 	printf("Game ID: %.4s Version %d\nMake sure all players use the same version!\n", os0->disc.gamename, (int)os0->disc.gamever + 1);
@@ -176,16 +200,29 @@ int main(void) {
         
         Main_PrintSize(module_list_size);
         puts(" total.");
+        
+        if (module_list_padding_size > 0) {
+            Main_PrintSize(module_list_padding_size);
+            puts(" lost to alignment padding.");
+        }
     }
     
 	printf("\nPlease wait while the game is patched.\nIf nothing happens after about 2 minutes, reset the machine!\n");
 
-    Event_Wait(&apploader_event_complete);
-    Event_Wait(&module_event_complete);
+    /* help run the tasks until they are all done. */
+    booted = Sched_Wait(sched);
+    Sched_Destroy(sched);
+    
+    printf("\nBoot timeline:\n");
+    Trace_Summary(stdout);
+    if (main_trace)
+        Main_TraceWrite();
+    Trace_Free();
+    
     fatUnmount("sd");
     __io_wiisd.shutdown();
     
-    if (module_has_error) {
+    if (!booted || module_has_error) {
         printf("\nPress RESET to exit.\n");
         goto exit_error;
     }
@@ -271,6 +308,23 @@ static void Main_PrintSize(size_t size) {
     printf("%.*f %s", precision, sizef, suffix[magnitude]);
 }
 
+static void Main_TraceWrite(void) {
+    static const char path[] = APP_PATH "/trace.json";
+    FILE *file;
+    
+    file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Could not write %s.\n", path);
+        return;
+    }
+    if (!Trace_WriteJson(file))
+        printf("Could not write %s.\n", path);
+    fclose(file);
+}
+
+// Round trips the host times before starting, to choose the input delay.
+#define RTT_PINGS 8
+
 static void ConnectHOST(void)
 {
 	if(Mynet_init())
@@ -312,8 +366,28 @@ static void ConnectHOST(void)
 		goto error;
 	}
 	
-	int on = 0;
-	Mynet_setsockopt(communicationSock, 0, TCP_NODELAY, (char *) &on, sizeof(on));
+	int on = 1;
+	Mynet_setsockopt(communicationSock, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
+
+	// Frames go over UDP on the same port; TCP is only used to set up.
+	int datagramSock = Mynet_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+	if (datagramSock < 0)
+	{
+		goto error;
+	}
+
+	if(Mynet_bind(datagramSock, (struct sockaddr*)&myAddress, myAddress.sin_len))
+	{
+		goto error;
+	}
+
+	// Only a guess at the guest's UDP port; NetPlay replies to wherever its
+	// datagrams actually come from once the first arrives.
+	struct sockaddr_in peerAddress = theirAddress;
+	peerAddress.sin_family = AF_INET;
+	peerAddress.sin_len = 8;
+	peerAddress.sin_port = port;
 
 	printf("Connected! Sending start request!");
 
@@ -337,13 +411,40 @@ static void ConnectHOST(void)
 
 	if (whatigot == 1)
 	{
-		printf("That was good.\n");
+		printf("That was good.\nTiming the connection...");
+		int rtt = 0;
+		for (int i = 0; i < RTT_PINGS; i++)
+		{
+			u64 start = gettime();
+			int ping = i;
+			if(Mynet_send(communicationSock, &ping, sizeof(ping), 0) != sizeof(ping))
+			{
+				goto error;
+			}
+			if(Mynet_recv(communicationSock, &ping, sizeof(ping), 0) != sizeof(ping) || ping != i)
+			{
+				goto error;
+			}
+			rtt += diff_usec(start, gettime());
+		}
+		rtt /= RTT_PINGS;
+		if(Mynet_send(communicationSock, &rtt, sizeof(rtt), 0) != sizeof(rtt))
+		{
+			goto error;
+		}
+		printf(" %dms.\n", rtt / 1000);
 		int* sockPointer = (int*)Search_SymbolLookup("communicationSock");
 		*sockPointer = communicationSock;
+		int* datagramSockPointer = (int*)Search_SymbolLookup("datagramSock");
+		*datagramSockPointer = datagramSock;
+		struct sockaddr_in* peerAddressPointer = (struct sockaddr_in*)Search_SymbolLookup("peerAddress");
+		*peerAddressPointer = peerAddress;
 		int* net_ip_top_fd_pointer = (int*)Search_SymbolLookup("net_ip_top_fd");
 		*net_ip_top_fd_pointer = net_ip_top_fd;
 		int* host_pointer = (int*)Search_SymbolLookup("host");
 		*host_pointer = 1;
+		int* sessionRttPointer = (int*)Search_SymbolLookup("sessionRtt");
+		*sessionRttPointer = rtt;
 		return;
 	}
 	else
@@ -388,8 +489,27 @@ if(Mynet_init())
 		goto error;
 	}
 	
-	int on = 0;
-	Mynet_setsockopt(sock, 0, TCP_NODELAY, (char *) &on, sizeof(on));
+	int on = 1;
+	Mynet_setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
+
+	// Frames go over UDP on the same port; TCP is only used to set up.
+	int datagramSock = Mynet_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+	if (datagramSock < 0)
+	{
+		goto error;
+	}
+
+	struct sockaddr_in myAddress = {};
+	myAddress.sin_family = AF_INET;
+	myAddress.sin_len = 8;
+	myAddress.sin_port = port;
+	myAddress.sin_addr.s_addr = Mynet_gethostip();
+
+	if(Mynet_bind(datagramSock, (struct sockaddr*)&myAddress, myAddress.sin_len))
+	{
+		goto error;
+	}
 
 
 
@@ -417,13 +537,37 @@ if(Mynet_init())
 
 	if (whatigot == 1)
 	{
-		printf("That was good.\n");
+		printf("That was good.\nTiming the connection...");
+		for (int i = 0; i < RTT_PINGS; i++)
+		{
+			int ping;
+			if(Mynet_recv(sock, &ping, sizeof(ping), 0) != sizeof(ping))
+			{
+				goto error;
+			}
+			if(Mynet_send(sock, &ping, sizeof(ping), 0) != sizeof(ping))
+			{
+				goto error;
+			}
+		}
+		int rtt = 0;
+		if(Mynet_recv(sock, &rtt, sizeof(rtt), 0) != sizeof(rtt))
+		{
+			goto error;
+		}
+		printf(" %dms.\n", rtt / 1000);
 		int* sockPointer = (int*)Search_SymbolLookup("communicationSock");
 		*sockPointer = sock;
+		int* datagramSockPointer = (int*)Search_SymbolLookup("datagramSock");
+		*datagramSockPointer = datagramSock;
+		struct sockaddr_in* peerAddressPointer = (struct sockaddr_in*)Search_SymbolLookup("peerAddress");
+		*peerAddressPointer = hostAddress;
 		int* net_ip_top_fd_pointer = (int*)Search_SymbolLookup("net_ip_top_fd");
 		*net_ip_top_fd_pointer = net_ip_top_fd;
 		int* host_pointer = (int*)Search_SymbolLookup("host");
 		*host_pointer = 0;
+		int* sessionRttPointer = (int*)Search_SymbolLookup("sessionRtt");
+		*sessionRttPointer = rtt;
 		return;
 	}
 	else
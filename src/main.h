@@ -27,14 +27,17 @@
 
 #include <bslug_include/version.h>
 
-#include "library/event.h"
+#include "library/sched.h"
 
 #define BSLUG_LOADER_VERSION BSLUG_VERSION(0, 1, 2)
 
 #define APP_PATH "sd:/apps/netslug"
 
-extern event_t main_event_fat_loaded;
+/* the SD card is mounted and the settings loaded. */
+extern sched_task_t *main_task_fat_loaded;
 extern int host_ip;
 extern int port;
+/* whether to write the boot timeline to APP_PATH "/trace.json". */
+extern int main_trace;
 
 #endif /* MAIN_H_ */
\ No newline at end of file
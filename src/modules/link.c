@@ -0,0 +1,994 @@
+/* link.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* This file should ideally avoid Wii specific methods so unit testing can be
+ * conducted elsewhere. */
+ 
+#include "link.h"
+
+#include <assert.h>
+#include <elfdefinitions.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* how many instructions to decode from each function when looking for the
+ * small data bases. */
+#define LINK_SDA_SCAN_LENGTH 64
+/* how many calls from the entry point to follow. */
+#define LINK_SDA_SCAN_CALLS 8
+
+typedef struct {
+    size_t shndx;
+    bool hot;
+    bool code;
+    size_t align;
+    size_t size;
+} link_layout_section_t;
+
+static uint16_t Link_Read16(const uint8_t *address);
+static bool Link_ElfRelocation(
+    const link_elf_t *elf, const Elf32_Shdr *shdr, size_t index,
+    Elf32_Rela *rela);
+static size_t Link_ElfRelocationCount(const Elf32_Shdr *shdr);
+static int Link_ElfLayoutCompare(const void *left, const void *right);
+static bool Link_FitsSigned16(int value);
+static bool Link_FitsSigned26(int value);
+static size_t Link_RelocateSize(unsigned char type);
+static bool Link_Lz4Length(
+    const uint8_t **source, const uint8_t *source_end, size_t *length);
+static void Link_FindSdaBasesScan(
+    const uint8_t *code, uint32_t code_addr, size_t code_size,
+    uint32_t start, link_sda_t *sda, uint32_t *calls, size_t *call_count);
+
+static uint16_t Link_Read16(const uint8_t *address) {
+    return ((uint16_t)address[0] << 8) | (uint16_t)address[1];
+}
+
+link_elf_error_t Link_ElfOpen(
+        link_elf_t *elf, const uint8_t *data, size_t size) {
+    size_t shoff, shentsize, i;
+    Elf32_Shdr shdr;
+    
+    assert(elf != NULL);
+    assert(data != NULL);
+    
+    elf->data = data;
+    elf->size = size;
+    elf->section_count = 0;
+    elf->shstrndx = 0;
+    
+    if (size >= 8 && memcmp(data, "!<arch>\n", 8) == 0)
+        return LINK_ELF_ARCHIVE;
+    if (size < sizeof(Elf32_Ehdr) ||
+        data[EI_MAG0] != ELFMAG0 || data[EI_MAG1] != ELFMAG1 ||
+        data[EI_MAG2] != ELFMAG2 || data[EI_MAG3] != ELFMAG3)
+        return LINK_ELF_INVALID_HEADER;
+    if (data[EI_CLASS] != ELFCLASS32)
+        return LINK_ELF_NOT_32BIT;
+    if (data[EI_DATA] != ELFDATA2MSB)
+        return LINK_ELF_NOT_BIG_ENDIAN;
+    if (data[EI_VERSION] != EV_CURRENT ||
+        Link_Read32(data + offsetof(Elf32_Ehdr, e_version)) != EV_CURRENT)
+        return LINK_ELF_UNKNOWN_VERSION;
+    if (Link_Read16(data + offsetof(Elf32_Ehdr, e_type)) != ET_REL)
+        return LINK_ELF_NOT_RELOCATABLE;
+    if (Link_Read16(data + offsetof(Elf32_Ehdr, e_machine)) != EM_PPC)
+        return LINK_ELF_NOT_PPC;
+    
+    shoff = Link_Read32(data + offsetof(Elf32_Ehdr, e_shoff));
+    shentsize = Link_Read16(data + offsetof(Elf32_Ehdr, e_shentsize));
+    elf->section_count = Link_Read16(data + offsetof(Elf32_Ehdr, e_shnum));
+    elf->shstrndx = Link_Read16(data + offsetof(Elf32_Ehdr, e_shstrndx));
+    
+    if (shentsize != sizeof(Elf32_Shdr) || shoff > size ||
+        elf->section_count > (size - shoff) / sizeof(Elf32_Shdr) ||
+        elf->shstrndx >= elf->section_count)
+        return LINK_ELF_INVALID_SECTIONS;
+    
+    for (i = 0; i < elf->section_count; i++) {
+        if (!Link_ElfSection(elf, i, &shdr))
+            return LINK_ELF_INVALID_SECTIONS;
+    }
+    
+    return LINK_ELF_OK;
+}
+
+bool Link_ElfSection(const link_elf_t *elf, size_t shndx, Elf32_Shdr *shdr) {
+    const uint8_t *raw;
+    
+    if (shndx >= elf->section_count)
+        return false;
+    
+    raw = elf->data +
+        Link_Read32(elf->data + offsetof(Elf32_Ehdr, e_shoff)) +
+        shndx * sizeof(Elf32_Shdr);
+    
+    shdr->sh_name = Link_Read32(raw + offsetof(Elf32_Shdr, sh_name));
+    shdr->sh_type = Link_Read32(raw + offsetof(Elf32_Shdr, sh_type));
+    shdr->sh_flags = Link_Read32(raw + offsetof(Elf32_Shdr, sh_flags));
+    shdr->sh_addr = Link_Read32(raw + offsetof(Elf32_Shdr, sh_addr));
+    shdr->sh_offset = Link_Read32(raw + offsetof(Elf32_Shdr, sh_offset));
+    shdr->sh_size = Link_Read32(raw + offsetof(Elf32_Shdr, sh_size));
+    shdr->sh_link = Link_Read32(raw + offsetof(Elf32_Shdr, sh_link));
+    shdr->sh_info = Link_Read32(raw + offsetof(Elf32_Shdr, sh_info));
+    shdr->sh_addralign =
+        Link_Read32(raw + offsetof(Elf32_Shdr, sh_addralign));
+    shdr->sh_entsize = Link_Read32(raw + offsetof(Elf32_Shdr, sh_entsize));
+    
+    if (shdr->sh_type != SHT_NOBITS && shdr->sh_type != SHT_NULL &&
+        (shdr->sh_offset > elf->size ||
+         shdr->sh_size > elf->size - shdr->sh_offset))
+        return false;
+    
+    /* from here on, describe what the section holds once decompressed;
+     * sh_offset is left pointing at the compression header. */
+    if (shdr->sh_flags & SHF_COMPRESSED) {
+        const uint8_t *chdr;
+        
+        if (shdr->sh_type != SHT_PROGBITS ||
+            shdr->sh_size < LINK_ELF_CHDR_SIZE)
+            return false;
+        
+        chdr = elf->data + shdr->sh_offset;
+        if (Link_Read32(chdr) != LINK_ELFCOMPRESS_LZ4)
+            return false;
+        shdr->sh_size = Link_Read32(chdr + 4);
+        shdr->sh_addralign = Link_Read32(chdr + 8);
+    }
+    /* alignments must be powers of two */
+    if (shdr->sh_addralign & (shdr->sh_addralign - 1))
+        return false;
+    
+    return true;
+}
+
+size_t Link_ElfSectionFileSize(const link_elf_t *elf, size_t shndx) {
+    Elf32_Shdr shdr;
+    
+    if (!Link_ElfSection(elf, shndx, &shdr) || shdr.sh_type == SHT_NOBITS)
+        return 0;
+    
+    /* the header's own sh_size, which Link_ElfSection replaces for
+     * compressed sections. */
+    return Link_Read32(
+        elf->data + Link_Read32(elf->data + offsetof(Elf32_Ehdr, e_shoff)) +
+        shndx * sizeof(Elf32_Shdr) + offsetof(Elf32_Shdr, sh_size));
+}
+
+const char *Link_ElfString(
+        const link_elf_t *elf, size_t strndx, size_t offset) {
+    Elf32_Shdr shdr;
+    const char *string;
+    
+    if (!Link_ElfSection(elf, strndx, &shdr) || shdr.sh_type != SHT_STRTAB)
+        return NULL;
+    if (offset >= shdr.sh_size)
+        return NULL;
+    
+    string = (const char *)elf->data + shdr.sh_offset + offset;
+    /* the string must be terminated inside the section */
+    if (memchr(string, '\0', shdr.sh_size - offset) == NULL)
+        return NULL;
+    
+    return string;
+}
+
+const char *Link_ElfSectionName(
+        const link_elf_t *elf, const Elf32_Shdr *shdr) {
+    return Link_ElfString(elf, elf->shstrndx, shdr->sh_name);
+}
+
+size_t Link_ElfFindSection(const link_elf_t *elf, const char *name) {
+    size_t shndx;
+    
+    for (shndx = 1; shndx < elf->section_count; shndx++) {
+        Elf32_Shdr shdr;
+        const char *section_name;
+        
+        if (!Link_ElfSection(elf, shndx, &shdr))
+            continue;
+        section_name = Link_ElfSectionName(elf, &shdr);
+        if (section_name != NULL && strcmp(section_name, name) == 0)
+            return shndx;
+    }
+    
+    return 0;
+}
+
+bool Link_ElfLoadSection(
+        const link_elf_t *elf, size_t shndx, const Elf32_Shdr *shdr,
+        void *destination) {
+        
+    assert(destination != NULL);
+    
+    switch (shdr->sh_type) {
+        case SHT_SYMTAB:
+        case SHT_PROGBITS: {
+            /* the block ends with the section, not the file. */
+            if (shdr->sh_flags & SHF_COMPRESSED)
+                return Link_Lz4Decompress(
+                    elf->data + shdr->sh_offset + LINK_ELF_CHDR_SIZE,
+                    Link_ElfSectionFileSize(elf, shndx) - LINK_ELF_CHDR_SIZE,
+                    destination, shdr->sh_size);
+            memcpy(destination, elf->data + shdr->sh_offset, shdr->sh_size);
+            return true;
+        } case SHT_NOBITS: {
+            memset(destination, 0, shdr->sh_size);
+            return true;
+        } default:
+            return false;
+    }
+}
+
+Elf32_Sym *Link_ElfLoadSymtab(
+        const link_elf_t *elf, size_t *symtab_count, size_t *symtab_strndx) {
+    size_t shndx, i;
+    
+    for (shndx = 1; shndx < elf->section_count; shndx++) {
+        Elf32_Shdr shdr;
+        Elf32_Sym *symtab;
+        
+        if (!Link_ElfSection(elf, shndx, &shdr) || shdr.sh_type != SHT_SYMTAB)
+            continue;
+        
+        *symtab_count = shdr.sh_size / sizeof(Elf32_Sym);
+        *symtab_strndx = shdr.sh_link;
+        
+        symtab = malloc(sizeof(Elf32_Sym) * *symtab_count + 1);
+        if (symtab == NULL)
+            return NULL;
+        
+        for (i = 0; i < *symtab_count; i++) {
+            const uint8_t *raw;
+            
+            raw = elf->data + shdr.sh_offset + i * sizeof(Elf32_Sym);
+            symtab[i].st_name = Link_Read32(raw + offsetof(Elf32_Sym, st_name));
+            symtab[i].st_value =
+                Link_Read32(raw + offsetof(Elf32_Sym, st_value));
+            symtab[i].st_size = Link_Read32(raw + offsetof(Elf32_Sym, st_size));
+            symtab[i].st_info = raw[offsetof(Elf32_Sym, st_info)];
+            symtab[i].st_other = 0;
+            symtab[i].st_shndx =
+                Link_Read16(raw + offsetof(Elf32_Sym, st_shndx));
+        }
+        
+        return symtab;
+    }
+    
+    return NULL;
+}
+
+void Link_ElfLoadSymbols(
+        size_t shndx, uint32_t address,
+        Elf32_Sym *symtab, size_t symtab_count) {
+    
+    size_t i;
+    
+    /* use the st_other field (no defined meaning) to indicate whether or not a
+     * symbol address has been calculated. */
+    for (i = 0; i < symtab_count; i++) {
+        if (symtab[i].st_shndx == shndx &&
+            symtab[i].st_other == 0) {
+            
+            symtab[i].st_value += address;
+            symtab[i].st_other = 1;
+        }
+    }
+}
+
+static size_t Link_ElfRelocationCount(const Elf32_Shdr *shdr) {
+    switch (shdr->sh_type) {
+        case SHT_REL:
+            return shdr->sh_size / sizeof(Elf32_Rel);
+        case SHT_RELA:
+            return shdr->sh_size / sizeof(Elf32_Rela);
+        default:
+            return 0;
+    }
+}
+
+/* Read a REL or RELA entry; REL entries get an addend of 0, and it is up to
+ * the caller to read the addend in place. */
+static bool Link_ElfRelocation(
+        const link_elf_t *elf, const Elf32_Shdr *shdr, size_t index,
+        Elf32_Rela *rela) {
+    const uint8_t *raw;
+    
+    if (index >= Link_ElfRelocationCount(shdr))
+        return false;
+    
+    if (shdr->sh_type == SHT_REL) {
+        raw = elf->data + shdr->sh_offset + index * sizeof(Elf32_Rel);
+        rela->r_addend = 0;
+    } else {
+        raw = elf->data + shdr->sh_offset + index * sizeof(Elf32_Rela);
+        rela->r_addend = (int32_t)Link_Read32(
+            raw + offsetof(Elf32_Rela, r_addend));
+    }
+    rela->r_offset = Link_Read32(raw + offsetof(Elf32_Rela, r_offset));
+    rela->r_info = Link_Read32(raw + offsetof(Elf32_Rela, r_info));
+    
+    return true;
+}
+
+bool Link_ElfLoadReferences(
+        const link_elf_t *elf, size_t shndx,
+        const Elf32_Sym *symtab, size_t symtab_count) {
+    size_t load, rel_shndx;
+    
+    load = Link_ElfFindSection(elf, ".bslug.load");
+    if (load == 0)
+        return false;
+    
+    for (rel_shndx = 1; rel_shndx < elf->section_count; rel_shndx++) {
+        Elf32_Shdr shdr;
+        Elf32_Rela rela;
+        size_t j, symbol;
+        
+        if (!Link_ElfSection(elf, rel_shndx, &shdr))
+            continue;
+        if (shdr.sh_type != SHT_REL && shdr.sh_type != SHT_RELA)
+            continue;
+        if (shdr.sh_info != load)
+            continue;
+        
+        for (j = 0; Link_ElfRelocation(elf, &shdr, j, &rela); j++) {
+            symbol = ELF32_R_SYM(rela.r_info);
+            
+            if (symbol < symtab_count && symtab[symbol].st_shndx == shndx)
+                return true;
+        }
+    }
+    
+    return false;
+}
+
+/* Plan where each of the placed sections goes. Sections are not simply laid
+ * out in file order: hot code (.text.hot*, and the functions .bslug.load
+ * points at, which are called in place of game functions) comes first so it
+ * shares cache lines, then the rest of the code, then data. Within each
+ * group the most strictly aligned sections come first, largest first, so
+ * that little is lost to padding. */
+bool Link_ElfLayout(
+        const link_elf_t *elf, const bool *placed,
+        const Elf32_Sym *symtab, size_t symtab_count, link_layout_t *layout) {
+    link_layout_section_t *sections = NULL;
+    size_t count, i;
+    bool result = false;
+    
+    layout->offsets = malloc(sizeof(size_t) * (elf->section_count + 1));
+    sections = malloc(
+        sizeof(link_layout_section_t) * (elf->section_count + 1));
+    if (layout->offsets == NULL || sections == NULL)
+        goto exit_error;
+    
+    layout->size = 0;
+    layout->align = 4;
+    layout->padding = 0;
+    
+    count = 0;
+    for (i = 0; i < elf->section_count; i++) {
+        Elf32_Shdr shdr;
+        const char *name;
+        link_layout_section_t *section;
+        
+        layout->offsets[i] = SIZE_MAX;
+        
+        if (!placed[i])
+            continue;
+        
+        if (!Link_ElfSection(elf, i, &shdr))
+            goto exit_error;
+        name = Link_ElfSectionName(elf, &shdr);
+        
+        section = sections + count++;
+        section->shndx = i;
+        section->size = shdr.sh_size;
+        section->align = shdr.sh_addralign > 3 ? shdr.sh_addralign : 4;
+        section->code = (shdr.sh_flags & SHF_EXECINSTR) != 0;
+        section->hot = section->code &&
+            ((name != NULL && strncmp(name, ".text.hot", 9) == 0) ||
+             Link_ElfLoadReferences(elf, i, symtab, symtab_count));
+    }
+    
+    qsort(
+        sections, count, sizeof(link_layout_section_t),
+        &Link_ElfLayoutCompare);
+    
+    for (i = 0; i < count; i++) {
+        size_t padding;
+        
+        padding = -layout->size & (sections[i].align - 1);
+        layout->padding += padding;
+        layout->offsets[sections[i].shndx] = layout->size + padding;
+        layout->size += padding + sections[i].size;
+        
+        if (sections[i].align > layout->align)
+            layout->align = sections[i].align;
+    }
+    
+    result = true;
+exit_error:
+    if (sections != NULL)
+        free(sections);
+    return result;
+}
+
+static int Link_ElfLayoutCompare(const void *left, const void *right) {
+    const link_layout_section_t *a = left, *b = right;
+    
+    if (a->hot != b->hot)
+        return a->hot ? -1 : 1;
+    if (a->code != b->code)
+        return a->code ? -1 : 1;
+    if (a->align != b->align)
+        return a->align > b->align ? -1 : 1;
+    if (a->size != b->size)
+        return a->size > b->size ? -1 : 1;
+    if (a->shndx != b->shndx)
+        return a->shndx < b->shndx ? -1 : 1;
+    return 0;
+}
+
+/* Each module's region is rounded to 32 bytes, so stricter alignments need
+ * extra room to round the start down. */
+size_t Link_LayoutRegionSize(const link_layout_t *layout) {
+    size_t size;
+    
+    size = layout->size + (-layout->size & 0x1f);
+    if (layout->align > 0x20)
+        size += layout->align - 0x20;
+    
+    return size;
+}
+
+int Link_ElfLinkSection(
+        const link_elf_t *elf, size_t shndx, uint8_t *destination,
+        uint32_t address, const Elf32_Sym *symtab, size_t symtab_count,
+        size_t symtab_strndx, const link_sda_t *sda,
+        link_defer_t defer, void *defer_arg) {
+    Elf32_Shdr target_shdr;
+    size_t rel_shndx;
+    int count = 0;
+    
+    if (!Link_ElfSection(elf, shndx, &target_shdr))
+        return -1;
+    
+    for (rel_shndx = 1; rel_shndx < elf->section_count; rel_shndx++) {
+        Elf32_Shdr shdr;
+        Elf32_Rela rela;
+        size_t i;
+        
+        if (!Link_ElfSection(elf, rel_shndx, &shdr))
+            continue;
+        if (shdr.sh_type != SHT_REL && shdr.sh_type != SHT_RELA)
+            continue;
+        if (shdr.sh_info != shndx)
+            continue;
+        
+        for (i = 0; Link_ElfRelocation(elf, &shdr, i, &rela); i++) {
+            uint32_t symbol_addr;
+            size_t symbol;
+            unsigned char type;
+            
+            symbol = ELF32_R_SYM(rela.r_info);
+            type = ELF32_R_TYPE(rela.r_info);
+            
+            if (symbol >= symtab_count)
+                return -1;
+            if (rela.r_offset > target_shdr.sh_size ||
+                target_shdr.sh_size - rela.r_offset < Link_RelocateSize(type))
+                return -1;
+            
+            if (shdr.sh_type == SHT_REL) {
+                if (target_shdr.sh_size - rela.r_offset < 4)
+                    return -1;
+                rela.r_addend = (int32_t)Link_Read32(
+                    destination + rela.r_offset);
+            }
+            
+            switch (symtab[symbol].st_shndx) {
+                case SHN_ABS: {
+                    symbol_addr = symtab[symbol].st_value;
+                    break;
+                } case SHN_COMMON: {
+                    return -1;
+                } case SHN_UNDEF: {
+                    const char *name;
+                    
+                    if (defer == NULL)
+                        return -1;
+                    
+                    name = Link_ElfString(
+                        elf, symtab_strndx, symtab[symbol].st_name);
+                    if (name == NULL)
+                        return -1;
+                    
+                    if (!defer(
+                            defer_arg, shndx, name, rela.r_offset, type,
+                            rela.r_addend, 0))
+                        return -1;
+                    continue;
+                } default: {
+                    if (symtab[symbol].st_other != 1)
+                        return -1;
+                    
+                    symbol_addr = symtab[symbol].st_value;
+                    break;
+                }
+            }
+            
+            if (sda == NULL && Link_RelocateNeedsSda(type)) {
+                if (defer == NULL ||
+                    !defer(
+                        defer_arg, shndx, NULL, rela.r_offset, type,
+                        rela.r_addend, symbol_addr))
+                    return -1;
+                continue;
+            }
+            
+            if (!Link_Relocate(
+                    type, destination + rela.r_offset,
+                    address + rela.r_offset, rela.r_offset, rela.r_addend,
+                    symbol_addr, sda))
+                return -1;
+            count++;
+        }
+    }
+    
+    return count;
+}
+
+bool Link_ElfLoadModule(
+        const link_elf_t *elf, uint8_t *const *destinations,
+        const uint32_t *addresses, Elf32_Sym *symtab, size_t symtab_count,
+        link_load_t load, void *load_arg) {
+    size_t shndx;
+    
+    for (shndx = 1; shndx < elf->section_count; shndx++) {
+        Elf32_Shdr shdr;
+        
+        if (destinations[shndx] == NULL)
+            continue;
+        
+        if (!Link_ElfSection(elf, shndx, &shdr))
+            return false;
+        if (load != NULL) {
+            if (!load(load_arg, elf, shndx, &shdr, destinations[shndx]))
+                return false;
+        } else if (!Link_ElfLoadSection(
+                elf, shndx, &shdr, destinations[shndx]))
+            return false;
+        
+        Link_ElfLoadSymbols(shndx, addresses[shndx], symtab, symtab_count);
+    }
+    
+    return true;
+}
+
+bool Link_ElfLinkModule(
+        const link_elf_t *elf, uint8_t *const *destinations,
+        const uint32_t *addresses, const Elf32_Sym *symtab,
+        size_t symtab_count, size_t symtab_strndx, const link_sda_t *sda,
+        link_defer_t defer, void *defer_arg) {
+    size_t shndx;
+    
+    for (shndx = 1; shndx < elf->section_count; shndx++) {
+        if (destinations[shndx] == NULL)
+            continue;
+        
+        if (Link_ElfLinkSection(
+                elf, shndx, destinations[shndx], addresses[shndx],
+                symtab, symtab_count, symtab_strndx, sda,
+                defer, defer_arg) < 0)
+            return false;
+    }
+    
+    return true;
+}
+
+/* Reads the 255 terminated extension of an LZ4 length. */
+static bool Link_Lz4Length(
+        const uint8_t **source, const uint8_t *source_end, size_t *length) {
+    uint8_t byte;
+    
+    do {
+        if (*source >= source_end)
+            return false;
+        byte = *(*source)++;
+        *length += byte;
+    } while (byte == 255);
+    
+    return true;
+}
+
+bool Link_Lz4Decompress(
+        const uint8_t *source, size_t source_size,
+        uint8_t *destination, size_t destination_size) {
+    const uint8_t *source_end;
+    uint8_t *output, *output_end;
+    
+    source_end = source + source_size;
+    output = destination;
+    output_end = destination + destination_size;
+    
+    /* each sequence is a token, literals, then a match; the last sequence
+     * stops after its literals. */
+    while (source < source_end) {
+        uint8_t token;
+        size_t length, offset;
+        
+        token = *source++;
+        
+        length = token >> 4;
+        if (length == 15 && !Link_Lz4Length(&source, source_end, &length))
+            return false;
+        if (length > (size_t)(source_end - source) ||
+            length > (size_t)(output_end - output))
+            return false;
+        memcpy(output, source, length);
+        output += length;
+        source += length;
+        
+        if (output == output_end)
+            return true;
+        
+        if (source_end - source < 2)
+            return false;
+        offset = source[0] | (source[1] << 8);
+        source += 2;
+        if (offset == 0 || offset > (size_t)(output - destination))
+            return false;
+        
+        length = token & 0xf;
+        if (length == 15 && !Link_Lz4Length(&source, source_end, &length))
+            return false;
+        length += 4;
+        if (length > (size_t)(output_end - output))
+            return false;
+        
+        /* matches may overlap their own output, so copy forwards. */
+        for (; length > 0; length--, output++)
+            *output = *(output - offset);
+        
+        if (output == output_end)
+            return true;
+    }
+    
+    return output == output_end;
+}
+
+bool Link_Relocate(
+        unsigned char type, uint8_t *target, uint32_t target_addr,
+        size_t offset, int addend, uint32_t symbol_addr,
+        const link_sda_t *sda) {
+    int value;
+    uint32_t insn;
+    
+    assert(target != NULL);
+
+    switch (type) {
+        case R_PPC_ADDR32:
+        case R_PPC_ADDR24:
+        case R_PPC_ADDR16:
+        case R_PPC_ADDR16_HI:
+        case R_PPC_ADDR16_HA:
+        case R_PPC_ADDR16_LO:
+        case R_PPC_ADDR14:
+        case R_PPC_ADDR14_BRTAKEN:
+        case R_PPC_ADDR14_BRNTAKEN:
+        case R_PPC_UADDR32:
+        case R_PPC_UADDR16:
+        case R_PPC_EMB_SDA21: {
+            value = (int)symbol_addr + addend;
+            break;
+        } case R_PPC_REL24:
+        case R_PPC_REL14:
+        case R_PPC_REL14_BRTAKEN:
+        case R_PPC_REL14_BRNTAKEN:
+        case R_PPC_REL32:
+        case R_PPC_ADDR30: {
+            value = (int)symbol_addr + addend - (int)target_addr;
+            break;
+        } case R_PPC_SECTOFF:
+        case R_PPC_SECTOFF_LO:
+        case R_PPC_SECTOFF_HI:
+        case R_PPC_SECTOFF_HA: {
+            value = offset + addend;
+            break;
+        } case R_PPC_EMB_NADDR32:
+        case R_PPC_EMB_NADDR16:
+        case R_PPC_EMB_NADDR16_LO:
+        case R_PPC_EMB_NADDR16_HI:
+        case R_PPC_EMB_NADDR16_HA: {
+            value = addend - (int)symbol_addr;
+            break;
+        } case R_PPC_SDAREL16: {
+            if (sda == NULL || sda->sda_base == 0)
+                return false;
+            value = (int)symbol_addr + addend - (int)sda->sda_base;
+            break;
+        } case R_PPC_EMB_SDA2REL: {
+            if (sda == NULL || sda->sda2_base == 0)
+                return false;
+            value = (int)symbol_addr + addend - (int)sda->sda2_base;
+            break;
+        } default:
+            return false;
+    }
+    
+    switch (type) {
+        case R_PPC_ADDR32:
+        case R_PPC_UADDR32:
+        case R_PPC_REL32:
+        case R_PPC_SECTOFF:
+        case R_PPC_EMB_NADDR32: {
+            Link_Write32(target, value);
+            break;
+        } case R_PPC_ADDR24:
+        case R_PPC_REL24: {
+            /* a branch between MEM1 and MEM2 cannot reach; refuse to wrap it. */
+            if (type == R_PPC_REL24 && !Link_FitsSigned26(value))
+                return false;
+            insn = Link_Read32(target);
+            Link_Write32(target, (insn & 0xfc000003) | (value & 0x03fffffc));
+            break;
+        } case R_PPC_ADDR16:
+        case R_PPC_UADDR16:
+        case R_PPC_EMB_NADDR16: {
+            Link_Write16(target, value);
+            break;
+        } case R_PPC_ADDR16_HI:
+        case R_PPC_SECTOFF_HI:
+        case R_PPC_EMB_NADDR16_HI: {
+            Link_Write16(target, value >> 16);
+            break;
+        } case R_PPC_ADDR16_HA:
+        case R_PPC_SECTOFF_HA:
+        case R_PPC_EMB_NADDR16_HA: {
+            Link_Write16(target, (value >> 16) + ((value >> 15) & 1));
+            break;
+        } case R_PPC_ADDR16_LO:
+        case R_PPC_SECTOFF_LO:
+        case R_PPC_EMB_NADDR16_LO: {
+            Link_Write16(target, value & 0xffff);
+            break;
+        } case R_PPC_ADDR14:
+        case R_PPC_REL14: {
+            if (type == R_PPC_REL14 && !Link_FitsSigned16(value))
+                return false;
+            insn = Link_Read32(target);
+            Link_Write32(target, (insn & 0xffff0003) | (value & 0x0000fffc));
+            break;
+        } case R_PPC_ADDR14_BRTAKEN:
+        case R_PPC_REL14_BRTAKEN: {
+            if (type == R_PPC_REL14_BRTAKEN && !Link_FitsSigned16(value))
+                return false;
+            insn = Link_Read32(target);
+            Link_Write32(
+                target,
+                (insn & 0xffdf0003) | (value & 0x0000fffc) | 0x00200000);
+            break;
+        } case R_PPC_ADDR14_BRNTAKEN:
+        case R_PPC_REL14_BRNTAKEN: {
+            if (type == R_PPC_REL14_BRNTAKEN && !Link_FitsSigned16(value))
+                return false;
+            insn = Link_Read32(target);
+            Link_Write32(target, (insn & 0xffdf0003) | (value & 0x0000fffc));
+            break;
+        } case R_PPC_ADDR30: {
+            insn = Link_Read32(target);
+            Link_Write32(target, (insn & 0x00000003) | (value & 0xfffffffc));
+            break;
+        } case R_PPC_SDAREL16:
+        case R_PPC_EMB_SDA2REL: {
+            if (!Link_FitsSigned16(value))
+                return false;
+            Link_Write16(target, value & 0xffff);
+            break;
+        } case R_PPC_EMB_SDA21: {
+            unsigned int base_register;
+            
+            /* The instruction's rA field is rewritten to whichever of r13, r2
+             * or r0 (meaning an absolute address) the symbol is in range of,
+             * as the EABI allows the linker to pick. */
+            if (sda != NULL && sda->sda_base != 0 &&
+                Link_FitsSigned16(value - (int)sda->sda_base)) {
+                base_register = 13;
+                value -= (int)sda->sda_base;
+            } else if (sda != NULL && sda->sda2_base != 0 &&
+                Link_FitsSigned16(value - (int)sda->sda2_base)) {
+                base_register = 2;
+                value -= (int)sda->sda2_base;
+            } else if (Link_FitsSigned16(value)) {
+                base_register = 0;
+            } else
+                return false;
+            
+            /* the relocation covers the low 21 bits of the instruction */
+            insn = Link_Read32(target);
+            Link_Write32(
+                target,
+                (insn & 0xffe00000) | (base_register << 16) |
+                (value & 0xffff));
+            break;
+        } default:
+            return false;
+    }
+    
+    return true;
+}
+
+bool Link_RelocateIsBranch(unsigned char type) {
+    switch (type) {
+        case R_PPC_REL24:
+        case R_PPC_REL14:
+        case R_PPC_REL14_BRTAKEN:
+        case R_PPC_REL14_BRNTAKEN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Link_RelocateNeedsSda(unsigned char type) {
+    switch (type) {
+        case R_PPC_SDAREL16:
+        case R_PPC_EMB_SDA2REL:
+        case R_PPC_EMB_SDA21:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* The bytes a relocation writes at its offset. Types Link_Relocate doesn't
+ * know are given the larger size; it refuses them anyway. */
+static size_t Link_RelocateSize(unsigned char type) {
+    switch (type) {
+        case R_PPC_ADDR16:
+        case R_PPC_ADDR16_HI:
+        case R_PPC_ADDR16_HA:
+        case R_PPC_ADDR16_LO:
+        case R_PPC_UADDR16:
+        case R_PPC_SECTOFF_LO:
+        case R_PPC_SECTOFF_HI:
+        case R_PPC_SECTOFF_HA:
+        case R_PPC_EMB_NADDR16:
+        case R_PPC_EMB_NADDR16_LO:
+        case R_PPC_EMB_NADDR16_HI:
+        case R_PPC_EMB_NADDR16_HA:
+        case R_PPC_SDAREL16:
+        case R_PPC_EMB_SDA2REL:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+static bool Link_FitsSigned16(int value) {
+    return value >= -0x8000 && value < 0x8000;
+}
+
+static bool Link_FitsSigned26(int value) {
+    return value >= -0x2000000 && value < 0x2000000;
+}
+
+void Link_FindSdaBases(
+        const uint8_t *code, uint32_t code_addr, size_t code_size,
+        uint32_t entry, link_sda_t *sda) {
+    uint32_t calls[LINK_SDA_SCAN_CALLS];
+    size_t call_count, i;
+    link_sda_t found = { 0, 0 };
+    
+    assert(code != NULL);
+    assert(sda != NULL);
+    
+    call_count = 0;
+    Link_FindSdaBasesScan(
+        code, code_addr, code_size, entry, &found, calls, &call_count);
+    
+    /* __init_registers is normally among the first few calls made. */
+    for (i = 0; i < call_count; i++) {
+        if (found.sda_base != 0 && found.sda2_base != 0)
+            break;
+        Link_FindSdaBasesScan(
+            code, code_addr, code_size, calls[i], &found, NULL, NULL);
+    }
+    
+    if (found.sda_base != 0)
+        sda->sda_base = found.sda_base;
+    if (found.sda2_base != 0)
+        sda->sda2_base = found.sda2_base;
+}
+
+static void Link_FindSdaBasesScan(
+        const uint8_t *code, uint32_t code_addr, size_t code_size,
+        uint32_t start, link_sda_t *sda, uint32_t *calls, size_t *call_count) {
+    /* value loaded into r2 and r13 by a preceding lis, or 0 */
+    uint32_t high[32] = { 0 };
+    size_t i;
+    
+    for (i = 0; i < LINK_SDA_SCAN_LENGTH; i++) {
+        uint32_t address, insn;
+        unsigned int opcode, rd, ra;
+        
+        address = start + i * 4;
+        if (address < code_addr || address - code_addr + 4 > code_size)
+            return;
+        
+        insn = Link_Read32(code + (address - code_addr));
+        opcode = insn >> 26;
+        rd = (insn >> 21) & 0x1f;
+        ra = (insn >> 16) & 0x1f;
+        
+        if (insn == 0x4e800020) /* blr */
+            return;
+        
+        switch (opcode) {
+            case 15: { /* addis rD, rA, SIMM; lis when rA is 0 */
+                if (ra == 0)
+                    high[rd] = insn << 16;
+                break;
+            } case 14: /* addi rD, rA, SIMM */
+            case 24: { /* ori rA, rS, UIMM */
+                uint32_t value;
+                unsigned int reg;
+                
+                /* ori has its source and destination the other way round */
+                reg = opcode == 24 ? ra : rd;
+                if ((opcode == 24 ? rd : ra) != reg || high[reg] == 0)
+                    break;
+                
+                if (opcode == 14)
+                    value = high[reg] + (uint32_t)(int16_t)(insn & 0xffff);
+                else
+                    value = high[reg] | (insn & 0xffff);
+                
+                if (reg == 13 && sda->sda_base == 0)
+                    sda->sda_base = value;
+                else if (reg == 2 && sda->sda2_base == 0)
+                    sda->sda2_base = value;
+                break;
+            } case 18: { /* b, bl */
+                if ((insn & 3) == 1 && calls != NULL &&
+                    *call_count < LINK_SDA_SCAN_CALLS) {
+                    
+                    int32_t displacement;
+                    
+                    displacement = insn & 0x03fffffc;
+                    if (displacement & 0x02000000)
+                        displacement -= 0x04000000;
+                    calls[(*call_count)++] = address + displacement;
+                } else if ((insn & 3) == 0)
+                    /* unconditional branch; stop following this path */
+                    return;
+                break;
+            }
+        }
+    }
+}
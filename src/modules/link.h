@@ -0,0 +1,206 @@
+/* link.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* This file should ideally avoid Wii specific methods so unit testing can be
+ * conducted elsewhere. */
+ 
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <elfdefinitions.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef SHF_COMPRESSED
+#define SHF_COMPRESSED 0x800
+#endif
+
+/* A section compressed by bslug_pack has SHF_COMPRESSED set and starts with
+ * an Elf32_Chdr (ch_type, ch_size, ch_addralign) followed by the contents as
+ * a raw LZ4 block. The type is the first of the OS specific ch_types. */
+#define LINK_ELFCOMPRESS_LZ4 0x60000000
+#define LINK_ELF_CHDR_SIZE 12
+
+/* Base registers of the small data areas, as set up by the game. A base of 0
+ * means the area is not known, and nothing will be linked against it. */
+typedef struct {
+    /* r13, _SDA_BASE_, addresses .sdata and .sbss. */
+    uint32_t sda_base;
+    /* r2, _SDA2_BASE_, addresses .sdata2 and .sbss2. */
+    uint32_t sda2_base;
+} link_sda_t;
+
+/* A relocatable ELF file held in memory. Everything is read through the
+ * functions below, which check bounds and convert from big endian. */
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t section_count;
+    size_t shstrndx;
+} link_elf_t;
+
+typedef enum {
+    LINK_ELF_OK,
+    LINK_ELF_ARCHIVE,
+    LINK_ELF_INVALID_HEADER,
+    LINK_ELF_NOT_32BIT,
+    LINK_ELF_NOT_BIG_ENDIAN,
+    LINK_ELF_UNKNOWN_VERSION,
+    LINK_ELF_NOT_RELOCATABLE,
+    LINK_ELF_NOT_PPC,
+    LINK_ELF_INVALID_SECTIONS,
+} link_elf_error_t;
+
+/* Where a module's sections go, relative to the start of its region. */
+typedef struct {
+    /* offset of each section, or SIZE_MAX if it isn't placed. */
+    size_t *offsets;
+    /* bytes from the start of the first section to the end of the last. */
+    size_t size;
+    /* strictest alignment of any placed section (at least 4). */
+    size_t align;
+    /* bytes of padding between sections. */
+    size_t padding;
+} link_layout_t;
+
+/* Called for relocations Link_ElfLinkSection can't apply yet: those against
+ * undefined symbols (name is the symbol), and small data relocations when no
+ * bases were given (name is NULL and symbol_addr the resolved address).
+ * offset is from the start of section shndx. */
+typedef bool (*link_defer_t)(
+    void *arg, size_t shndx, const char *name, size_t offset,
+    unsigned char type, int addend, uint32_t symbol_addr);
+
+/* Copies a section to destination for Link_ElfLoadModule, as
+ * Link_ElfLoadSection does. */
+typedef bool (*link_load_t)(
+    void *arg, const link_elf_t *elf, size_t shndx, const Elf32_Shdr *shdr,
+    void *destination);
+
+link_elf_error_t Link_ElfOpen(
+    link_elf_t *elf, const uint8_t *data, size_t size);
+/* Read a section header. Fails if it, or its contents, lie outside the file.
+ * Compressed sections report their decompressed size and alignment. */
+bool Link_ElfSection(const link_elf_t *elf, size_t shndx, Elf32_Shdr *shdr);
+/* The bytes a section occupies in the file, compressed or not. */
+size_t Link_ElfSectionFileSize(const link_elf_t *elf, size_t shndx);
+const char *Link_ElfString(
+    const link_elf_t *elf, size_t strndx, size_t offset);
+const char *Link_ElfSectionName(const link_elf_t *elf, const Elf32_Shdr *shdr);
+/* Find a section by name, returning its index or 0. */
+size_t Link_ElfFindSection(const link_elf_t *elf, const char *name);
+/* Copy (or decompress) a PROGBITS section, or clear a NOBITS one. shdr is
+ * section shndx, as Link_ElfSection read it. */
+bool Link_ElfLoadSection(
+    const link_elf_t *elf, size_t shndx, const Elf32_Shdr *shdr,
+    void *destination);
+/* Read the symbol table into a newly allocated array. st_other is reused to
+ * mark symbols whose st_value has been made absolute. */
+Elf32_Sym *Link_ElfLoadSymtab(
+    const link_elf_t *elf, size_t *symtab_count, size_t *symtab_strndx);
+/* Make the symbols of a section absolute, now it is at address. */
+void Link_ElfLoadSymbols(
+    size_t shndx, uint32_t address, Elf32_Sym *symtab, size_t symtab_count);
+/* Whether .bslug.load refers directly to a symbol in the given section. */
+bool Link_ElfLoadReferences(
+    const link_elf_t *elf, size_t shndx,
+    const Elf32_Sym *symtab, size_t symtab_count);
+/* Plan where each placed section goes; layout->offsets is allocated. */
+bool Link_ElfLayout(
+    const link_elf_t *elf, const bool *placed,
+    const Elf32_Sym *symtab, size_t symtab_count, link_layout_t *layout);
+/* The space a layout needs in the module region. */
+size_t Link_LayoutRegionSize(const link_layout_t *layout);
+/* Apply the relocations of section shndx, loaded at destination, which will
+ * run at address. Returns the number applied, or -1 on error. */
+int Link_ElfLinkSection(
+    const link_elf_t *elf, size_t shndx, uint8_t *destination,
+    uint32_t address, const Elf32_Sym *symtab, size_t symtab_count,
+    size_t symtab_strndx, const link_sda_t *sda,
+    link_defer_t defer, void *defer_arg);
+/* A module is loaded and linked in two passes, since a section's relocations
+ * can refer to any other section. destinations[shndx] is where each section
+ * is loaded (NULL for those that aren't), and addresses[shndx] the address it
+ * runs at there, which is the same thing on the Wii itself.
+ *
+ * Link_ElfLoadModule loads each section, through load if given, and makes its
+ * symbols absolute. */
+bool Link_ElfLoadModule(
+    const link_elf_t *elf, uint8_t *const *destinations,
+    const uint32_t *addresses, Elf32_Sym *symtab, size_t symtab_count,
+    link_load_t load, void *load_arg);
+/* Apply the relocations of each loaded section, passing the ones that can't
+ * be applied yet to defer. */
+bool Link_ElfLinkModule(
+    const link_elf_t *elf, uint8_t *const *destinations,
+    const uint32_t *addresses, const Elf32_Sym *symtab,
+    size_t symtab_count, size_t symtab_strndx, const link_sda_t *sda,
+    link_defer_t defer, void *defer_arg);
+
+/* Decompress an LZ4 block, which must fill destination exactly. Input past
+ * the end of the block is ignored, so source_size may be an upper bound. */
+bool Link_Lz4Decompress(
+    const uint8_t *source, size_t source_size,
+    uint8_t *destination, size_t destination_size);
+
+/* Apply one PowerPC relocation.
+ *  target is where the relocation is written, and target_addr the address
+ *  that will have once loaded (the same thing on the Wii itself). offset is
+ *  the relocation's offset in its section. Returns false for unsupported
+ *  types or values that don't fit. */
+bool Link_Relocate(
+    unsigned char type, uint8_t *target, uint32_t target_addr, size_t offset,
+    int addend, uint32_t symbol_addr, const link_sda_t *sda);
+/* Whether a relocation type is a relative branch, which only reaches 32MiB
+ * (or 32KiB for conditional branches) either way. */
+bool Link_RelocateIsBranch(unsigned char type);
+/* Whether a relocation type needs the small data bases. */
+bool Link_RelocateNeedsSda(unsigned char type);
+/* Find the small data bases by decoding the code the game runs on entry,
+ * which loads r2 and r13 with lis/ori or lis/addi pairs, usually in
+ * __init_registers which is called from __start. code is a copy of memory
+ * starting at code_addr. Bases not found are left as they were. */
+void Link_FindSdaBases(
+    const uint8_t *code, uint32_t code_addr, size_t code_size,
+    uint32_t entry, link_sda_t *sda);
+
+/* Big endian memory accessors, so that this can run on little endian hosts. */
+static inline uint32_t Link_Read32(const uint8_t *address) {
+    return
+        ((uint32_t)address[0] << 24) | ((uint32_t)address[1] << 16) |
+        ((uint32_t)address[2] << 8) | (uint32_t)address[3];
+}
+static inline void Link_Write32(uint8_t *address, uint32_t value) {
+    address[0] = value >> 24;
+    address[1] = value >> 16;
+    address[2] = value >> 8;
+    address[3] = value;
+}
+static inline void Link_Write16(uint8_t *address, uint16_t value) {
+    address[0] = value >> 8;
+    address[1] = value;
+}
+
+#endif /* LINK_H_ */
@@ -1,4 +1,5 @@
 WD        := $(dir $(lastword $(MAKEFILE_LIST)))
 WD_MODULE := $(WD)
 
+SRC += $(WD)link.c
 SRC += $(WD)module.c
@@ -27,11 +27,10 @@
 #include <assert.h>
 #include <bslug_include/bslug.h>
 #include <dirent.h>
-#include <errno.h>
 #include <fcntl.h>
-#include <libelf.h>
 #include <ogc/cache.h>
-#include <ogc/lwp.h>
+#include <ogc/lwp_watchdog.h>
+#include <ogc/system.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -42,21 +41,52 @@
 #include "apploader/apploader.h"
 #include "library/dolphin_os.h"
 #include "library/event.h"
+#include "library/sched.h"
+#include "library/trace.h"
 #include "main.h"
+#include "modules/link.h"
 #include "search/search.h"
-#include "threads.h"
+#include "search/symbol.h"
 
 typedef struct {
     size_t module;
+    /* symbol to look up, or NULL if symbol_addr is already known and the
+     * relocation was only waiting for the small data bases. */
     const char *name;
+    uint32_t symbol_addr;
     void *address;
     size_t offset;
     char type;
     int addend;
 } module_unresolved_relocation_t;
 
+/* Passed through Link_ElfLinkModule to Module_ElfLinkDefer. */
+typedef struct {
+    size_t index;
+    uint8_t *const *destinations;
+} module_link_context_t;
+
+/* A module file, read by Module_FileRead while the ones before it are parsed
+ * (Module_FileLoad) or linked (Module_FileLink). */
+typedef struct {
+    const char *path;
+    /* the module's place in module_list, when linking. */
+    size_t index;
+    uint8_t *data;
+    size_t size;
+    bool ok;
+} module_file_t;
+
+/* Totals for the compressed sections of one module, for the boot log. */
+typedef struct {
+    size_t compressed_size;
+    size_t size;
+    uint64_t ticks;
+} module_decompress_t;
+
 event_t module_event_list_loaded;
-event_t module_event_complete;
+sched_task_t *module_task_list_loaded;
+sched_task_t *module_task_complete;
 
 bool module_has_error;
 bool module_has_info;
@@ -64,6 +94,9 @@ bool module_has_info;
 #define MODULE_LIST_CAPACITY_DEFAULT 16
 
 size_t module_list_size = 0;
+size_t module_list_padding_size = 0;
+size_t module_list_mem2_size = 0;
+void *module_mem2_start = NULL;
 module_metadata_t **module_list = NULL;
 size_t module_list_count = 0;
 static size_t module_list_capacity = 0;
@@ -80,105 +113,291 @@ static bslug_loader_entry_t *module_entries = NULL;
 static size_t module_entries_count = 0;
 static size_t module_entries_capacity = 0;
 
+/* Module files are read on one task while the ones before them are parsed
+ * on another, and again while they are linked, at most
+ * module_read_queue_depth files ahead. Both go through the files in order, so
+ * module_list and the layout are the same as doing it serially. */
+#ifndef MODULE_READ_QUEUE_DEPTH
+#define MODULE_READ_QUEUE_DEPTH 2
+#endif
+
+int module_read_queue_depth = MODULE_READ_QUEUE_DEPTH;
+
+#define MODULE_FILES_CAPACITY_DEFAULT 16
+
+/* The scan only lists the files; Module_FilesSchedule then reads and parses
+ * them in directory order. */
+static module_file_t *module_files = NULL;
+static size_t module_files_count = 0;
+static size_t module_files_capacity = 0;
+
+/* Loading is a chain of tasks: the scan, which makes a read and a parse
+ * task for each file, then sizing the list once they're done, which makes a
+ * read and a link task for each module, then the final link. */
+static sched_t *module_sched = NULL;
+static sched_task_t *module_task_scan;
+static sched_task_t *module_task_loaded;
+static sched_task_t *module_task_linked;
+
+/* Where Module_FileLink places modules, and the time it spends doing so. */
+static uint8_t *module_space;
+static uint8_t *module_space_mem2;
+static module_file_t *module_link_files = NULL;
+static uint64_t module_link_start;
+static uint64_t module_link_ticks;
+
+/* Replacement stubs and long branch veneers, packed into one cache line
+ * aligned block below the modules, sized before any are written. */
+static uint32_t *module_trampolines = NULL;
+static size_t module_trampolines_count = 0;
+static size_t module_trampolines_capacity = 0;
+
+/* Words of a BSLUG_HOOK_AT stub before the displaced instruction: saving the
+ * volatile registers to a bslug_hook_context_t, calling the handler and
+ * restoring them. */
+#define MODULE_HOOK_SIZE 75
+/* the stack frame: back chain, lr save word, then the context at 8. */
+#define MODULE_HOOK_FRAME 192
+
+/* The table behind bslug_sym_lookup, at the bottom of the MEM2 region. It is
+ * only built if a module refers to it. */
+static bool module_sym_table_needed = false;
+static size_t module_sym_table_size = 0;
+static bslug_sym_table_t *module_sym_table = NULL;
+
 static const char module_path[] = APP_PATH "/modules";
 
-static void *Module_Main(void *arg);
+/* the game's small data bases, found once the game is loaded. */
+static link_sda_t module_sda = { 0, 0 };
+
+static bool Module_Scan(void *arg);
+static bool Module_ListLoaded(void *arg);
+static bool Module_ListSize(void *arg);
+static bool Module_ListFinal(void *arg);
 static void *Module_ListAllocate(
     void *list, size_t entry_size, size_t num,
     size_t *capacity, size_t *count, size_t default_capacity);
     
-static void Module_ListLoad(void);
 static void Module_CheckDirectory(char *path);
 static void Module_CheckFile(const char *path);
-static void Module_Load(const char *path);
-static void Module_LoadElf(const char *path, Elf *elf);
-static bool Module_LoadElfSymtab(
-    Elf *elf, Elf32_Sym **symtab, size_t *symtab_count, size_t *symtab_strndx);
+static bool Module_ReadFile(const char *path, uint8_t **data, size_t *size);
+static bool Module_FilesSchedule(
+    module_file_t *files, size_t count, sched_fn_t process,
+    sched_task_t *join);
+static bool Module_FileRead(void *arg);
+static bool Module_FileLoad(void *arg);
+static bool Module_FileLink(void *arg);
+static void Module_Load(const char *path, uint8_t *data, size_t size);
+static void Module_LoadElf(const char *path, const link_elf_t *elf);
 static module_metadata_t *Module_MetadataRead(
-    const char *path, size_t index, Elf *elf, 
+    const char *path, size_t index, const link_elf_t *elf, 
     Elf32_Sym *symtab, size_t symtab_count, size_t symtab_strndx);
+static bool Module_ElfSectionMem2(
+    const module_metadata_t *metadata, const Elf32_Shdr *shdr,
+    const char *name);
+static bool Module_ElfLayout(
+    const link_elf_t *elf, const bool *placed, const bool *mem2,
+    const Elf32_Sym *symtab, size_t symtab_count,
+    link_layout_t *layout, link_layout_t *layout_mem2);
+static bool Module_ElfLinkDefer(
+    void *arg, size_t shndx, const char *name, size_t offset,
+    unsigned char type, int addend, uint32_t symbol_addr);
+static void Module_FindSdaBases(void);
+    
+static bool Module_ListLink(void);
+static bool Module_ListLinked(void *arg);
+static bool Module_LinkModule(
+    size_t index, const uint8_t *data, size_t size,
+    uint8_t **space, uint8_t **space_mem2);
+static bool Module_LinkModuleElf(
+    size_t index, const link_elf_t *elf,
+    uint8_t **space, uint8_t **space_mem2);
 static bool Module_ElfLoadSection(
-    const Elf *elf, Elf_Scn *scn, const Elf32_Shdr *shdr, void *destination);
-static void Module_ElfLoadSymbols(
-    size_t shndx, const const void *destination, 
-    Elf32_Sym *symtab, size_t symtab_count);
-static bool Module_ElfLink(
-    size_t index, Elf *elf, size_t shndx, void *destination,
-    Elf32_Sym *symtab, size_t symtab_count, size_t symtab_strndx,
-    bool allow_globals);
-static bool Module_ElfLinkOne(
-    char type, size_t offset, int addend, void *destination,
-    uint32_t symbol_addr);
-    
-static bool Module_ListLink(uint8_t **space);
-static bool Module_LinkModule(size_t index, const char *path, uint8_t **space);
-static bool Module_LinkModuleElf(size_t index, Elf *elf, uint8_t **space);
+    void *arg, const link_elf_t *elf, size_t shndx, const Elf32_Shdr *shdr,
+    void *destination);
 
 static bool Module_ListLoadSymbols(uint8_t **space);
+static size_t Module_SymTableBuckets(size_t count);
+static size_t Module_SymTableSize(void);
+static bool Module_SymTableBuild(void);
 
 static bool Module_ListLinkFinal(uint8_t **space);
-static bool Module_ListLinkFinalReplaceFunction(
-        uint8_t **space, bslug_loader_entry_t *entry);
+static bool Module_ListLinkFinalReplaceFunction(bslug_loader_entry_t *entry);
+static size_t Module_TrampolineSize(
+    const bslug_loader_entry_t *entry, uint32_t pool);
+static uint32_t *Module_TrampolineAllocate(size_t size);
+static bool Module_BranchInRange(uint32_t from, uint32_t to);
+static bool Module_Branch(uint32_t from, uint32_t to, uint32_t *instruction);
+static size_t Module_DisplaceSize(uint32_t instruction);
+static void Module_Displace(const uint32_t *data, uint32_t *stub);
+static bool Module_ListLinkFinalHook(bslug_loader_entry_t *entry);
+static uint32_t *Module_HookAddress(const bslug_loader_entry_t *entry);
+static size_t Module_ElfHooksSize(
+    const link_elf_t *elf, size_t shndx, const Elf32_Shdr *shdr);
         
-bool Module_Init(void) {
+bool Module_Init(sched_t *sched) {
+    module_sched = sched;
+    module_task_scan = Sched_Task(sched, &Module_Scan, NULL);
+    module_task_loaded = Sched_Task(sched, &Module_ListLoaded, NULL);
+    module_task_list_loaded = Sched_Task(sched, &Module_ListSize, NULL);
+    module_task_linked = Sched_Task(sched, &Module_ListLinked, NULL);
+    module_task_complete = Sched_Task(sched, &Module_ListFinal, NULL);
+    
     return
-        Event_Init(&module_event_list_loaded) &&
-        Event_Init(&module_event_complete);
+        Event_Init(&module_event_list_loaded, "module_list_loaded") &&
+        module_task_scan != NULL &&
+        module_task_loaded != NULL &&
+        module_task_list_loaded != NULL &&
+        module_task_linked != NULL &&
+        module_task_complete != NULL;
 }
 
-bool Module_RunBackground(void) {
-    int ret;
-    lwp_t thread;
-    
-    ret = LWP_CreateThread(
-        &thread, &Module_Main,
-        NULL, NULL, 32 * 1024, THREAD_PRIO_IO);
-        
-    if (ret) {
-        errno = ENOMEM;
+bool Module_Schedule(void) {
+    /* modules for other games are skipped as they're loaded, so the scan
+     * also needs the disc. */
+    if (!Sched_Depend(module_sched, module_task_scan, main_task_fat_loaded) ||
+        !Sched_Depend(
+            module_sched, module_task_scan, apploader_task_disk_id) ||
+        !Sched_Depend(
+            module_sched, module_task_list_loaded, module_task_loaded) ||
+        !Sched_Depend(
+            module_sched, module_task_linked, module_task_list_loaded) ||
+        !Sched_Depend(
+            module_sched, module_task_complete, module_task_linked) ||
+        !Sched_Depend(
+            module_sched, module_task_complete, apploader_task_complete) ||
+        !Sched_Depend(
+            module_sched, module_task_complete, search_task_complete))
         return false;
+    
+    /* the scan submits module_task_loaded, that module_task_list_loaded and
+     * that module_task_linked, once they know all their inputs. */
+    Sched_Submit(module_sched, module_task_scan);
+    Sched_Submit(module_sched, module_task_complete);
+    return true;
+}
+
+/* Like Module_ListLoaded, never fails, as the tasks it submits would never
+ * be. Errors are left in module_has_error. */
+static bool Module_Scan(void *arg) {
+    char path[FILENAME_MAX];
+    
+    assert(sizeof(path) > sizeof(module_path));
+    
+    Trace_Begin("phase", "scan modules");
+    strcpy(path, module_path);
+    Module_CheckDirectory(path);
+    Trace_End("phase", "scan modules");
+    
+    if (!Module_FilesSchedule(
+            module_files, module_files_count, &Module_FileLoad,
+            module_task_loaded)) {
+        printf("Module_Scan: Couldn't schedule module loading.\n");
+        module_has_error = true;
     }
     
+    Sched_Submit(module_sched, module_task_loaded);
     return true;
 }
 
-static void *Module_Main(void *arg) {
-    uint8_t *space;
+static bool Module_ListLoaded(void *arg) {
+    size_t i;
     
-    Module_ListLoad();
+    /* if the scan couldn't give this task all the file tasks as inputs, some
+     * may still be running, so the list is left alone. */
+    if (!module_has_error) {
+        for (i = 0; i < module_files_count; i++)
+            free((char *)module_files[i].path);
+        free(module_files);
+        module_files = NULL;
+        module_files_count = 0;
+        module_files_capacity = 0;
+    }
     
+    /* the trampoline pool is rounded up to a cache line. */
+    module_list_size += 0x20;
     module_list_size += ((-module_list_size) & 0x1f);
     
-    Event_Trigger(&module_event_list_loaded);
+    /* the table needs room for any symbol the search might find, so the
+     * symbol files must have been read. */
+    if (module_sym_table_needed &&
+        !Sched_Depend(
+            module_sched, module_task_list_loaded,
+            search_task_symbols_loaded))
+        module_has_error = true;
     
-    space = (uint8_t *)0x81800000;
+    Sched_Submit(module_sched, module_task_list_loaded);
+    return true;
+}
+
+static bool Module_ListSize(void *arg) {
+    bool result = false;
     
-    if (!Module_ListLink(&space))
+    if (module_has_error)
         goto exit_error;
     
-    Event_Wait(&apploader_event_complete);
-    Event_Wait(&search_event_complete);
-    if (search_has_error)
-        goto exit_error;
+    if (module_sym_table_needed) {
+        module_sym_table_size = Module_SymTableSize();
+        module_sym_table_size += (-module_sym_table_size) & 0x1f;
+        module_list_mem2_size += module_sym_table_size;
+    }
     
-    if (!Module_ListLoadSymbols(&space))
-        goto exit_error;
+    /* MEM2 sections go at the top of the MEM2 arena, which is lowered past
+     * them so the game's allocator never hands them out. */
+    module_list_mem2_size += ((-module_list_mem2_size) & 0x1f);
+    if (module_list_mem2_size > 0) {
+        module_mem2_start = (void *)(
+            ((uint32_t)SYS_GetArena2Hi() - module_list_mem2_size) & ~0x1f);
+        if (module_mem2_start < SYS_GetArena2Lo()) {
+            printf(
+                "Module_ListSize: %u bytes of MEM2 requested, not available.\n",
+                (unsigned)module_list_mem2_size);
+            goto exit_error;
+        }
+        SYS_SetArena2Hi(module_mem2_start);
+        if (module_sym_table_needed)
+            module_sym_table = module_mem2_start;
+    }
     
-    if (!Module_ListLinkFinal(&space))
-        goto exit_error;
+    module_space = (uint8_t *)0x81800000;
+    module_space_mem2 = (uint8_t *)module_mem2_start + module_list_mem2_size;
     
-    assert(space > (uint8_t *)0x81800000 - module_list_size);
+    if (!Module_ListLink()) {
+        printf("Module_ListSize: Couldn't schedule module linking.\n");
+        goto exit_error;
+    }
     
-    DCFlushRange(space, 0x81800000 - (uint32_t)space);
+    result = true;
+exit_error:
+    if (!result)
+        module_has_error = true;
+    Event_Trigger(&module_event_list_loaded);
+    Sched_Submit(module_sched, module_task_linked);
+    return result;
+}
 
-    Event_Trigger(&module_event_complete);
+static bool Module_ListFinal(void *arg) {
+    bool ok;
+    
+    Trace_Begin("phase", "final link");
+    ok = Module_ListLoadSymbols(&module_space) &&
+        Module_ListLinkFinal(&module_space);
+    Trace_End("phase", "final link");
+    if (!ok) {
+        printf("Module_ListFinal: exit_error\n");
+        module_has_error = true;
+        return false;
+    }
     
-    return NULL;
-exit_error:
-    printf("Module_Main: exit_error\n");
-    module_has_error = true;
-    Event_Trigger(&module_event_complete);
-    return NULL;
+    assert(module_space > (uint8_t *)0x81800000 - module_list_size);
+    assert(module_space_mem2 >=
+        (uint8_t *)module_mem2_start + module_sym_table_size);
+    
+    DCFlushRange(module_space, 0x81800000 - (uint32_t)module_space);
+    if (module_list_mem2_size > 0)
+        DCFlushRange(module_mem2_start, module_list_mem2_size);
+    
+    return true;
 }
 
 static void *Module_ListAllocate(
@@ -212,16 +431,92 @@ static void *Module_ListAllocate(
     return result;
 }
 
-static void Module_ListLoad(void) {
-    char path[FILENAME_MAX];
-
-    Event_Wait(&main_event_fat_loaded);
+/* Make the tasks to read each file and pass it to process, in order, and
+ * give them to join. Reads run at most module_read_queue_depth files ahead,
+ * bounding the files held in memory. */
+static bool Module_FilesSchedule(
+        module_file_t *files, size_t count, sched_fn_t process,
+        sched_task_t *join) {
+    sched_task_t *run = NULL;
+    sched_task_t *runs[MODULE_READ_QUEUE_MAX];
+    size_t i, depth;
+    bool result = true;
+    
+    depth = module_read_queue_depth;
+    if (depth < 1)
+        depth = 1;
+    if (depth > MODULE_READ_QUEUE_MAX)
+        depth = MODULE_READ_QUEUE_MAX;
+    
+    /* every task made has to be submitted, so a failure part way just stops
+     * adding files. */
+    for (i = 0; i < count && result; i++) {
+        sched_task_t *read, *next;
+        
+        read = Sched_Task(module_sched, &Module_FileRead, files + i);
+        next = read == NULL ?
+            NULL : Sched_Task(module_sched, process, files + i);
+        if (next == NULL ||
+            (i >= depth &&
+             !Sched_Depend(module_sched, read, runs[i % depth])) ||
+            !Sched_Depend(module_sched, next, read) ||
+            (run != NULL && !Sched_Depend(module_sched, next, run)))
+            result = false;
+        
+        if (read != NULL)
+            Sched_Submit(module_sched, read);
+        if (next != NULL) {
+            Sched_Submit(module_sched, next);
+            runs[i % depth] = next;
+            run = next;
+        }
+    }
     
-    assert(sizeof(path) > sizeof(module_path));
+    if (run != NULL && !Sched_Depend(module_sched, join, run))
+        result = false;
+    return result;
+}
+
+/* Runs on a thread of its own, overlapping the SD card with parsing and
+ * linking. Once a module fails to link, the rest are neither read nor
+ * linked. */
+static bool Module_FileRead(void *arg) {
+    module_file_t *file = arg;
+    
+    if (!module_has_error)
+        file->ok = Module_ReadFile(file->path, &file->data, &file->size);
+    return true;
+}
+
+static bool Module_FileLoad(void *arg) {
+    module_file_t *file = arg;
     
-    strcpy(path, module_path);
+    if (file->ok)
+        Module_Load(file->path, file->data, file->size);
+    free(file->data);
+    file->data = NULL;
+    return true;
+}
+
+/* Failures are left in module_has_error for Module_ListLinked, so every
+ * file's data is freed. */
+static bool Module_FileLink(void *arg) {
+    module_file_t *file = arg;
+    uint64_t start;
+    
+    if (!module_has_error) {
+        start = gettime();
+        if (!file->ok ||
+            !Module_LinkModule(
+                file->index, file->data, file->size,
+                &module_space, &module_space_mem2))
+            module_has_error = true;
+        module_link_ticks += gettime() - start;
+    }
     
-    Module_CheckDirectory(path);
+    free(file->data);
+    file->data = NULL;
+    return true;
 }
 
 static void Module_CheckDirectory(char *path) {
@@ -260,8 +555,6 @@ static void Module_CheckDirectory(char *path) {
                         strcmp(entry->d_name, "..") == 0)
                         break;
                     
-                    Event_Wait(&apploader_event_disk_id);
-                    
                     /* load directories with a prefix match on the game name:
                      * e.g. load directory RMC for game RMCP. */
                     if (strncmp(os0->disc.gamename, entry->d_name,
@@ -312,137 +605,147 @@ static void Module_CheckFile(const char *path) {
         strcmp(extension, "a") == 0 ||
         strcmp(extension, "elf") == 0) {
         
-        Module_Load(path);
+        module_file_t *file;
+        
+        file = Module_ListAllocate(
+            &module_files, sizeof(module_file_t), 1, &module_files_capacity,
+            &module_files_count, MODULE_FILES_CAPACITY_DEFAULT);
+        if (file == NULL)
+            goto exit_error;
+        
+        file->path = strdup(path);
+        file->data = NULL;
+        file->size = 0;
+        file->ok = false;
+        if (file->path == NULL) {
+            module_files_count--;
+            goto exit_error;
+        }
     }
+    return;
+exit_error:
+    printf("Warning: Ignoring '%s' - Out of memory.\n", path);
+    module_has_info = true;
 }
 
-static void Module_Load(const char *path) {
+static bool Module_ReadFile(const char *path, uint8_t **data, size_t *size) {
     int fd = -1;
-    Elf *elf = NULL;
+    off_t length;
+    size_t n;
+    bool result = false;
     
-    /* check for compile errors */
-    if (elf_version(EV_CURRENT) == EV_NONE)
-        goto exit_error;
+    *data = NULL;
+    Trace_Begin("phase", "read module");
     
     fd = open(path, O_RDONLY, 0);
-    
     if (fd == -1)
         goto exit_error;
-        
-    elf = elf_begin(fd, ELF_C_READ, NULL);
     
-    if (elf == NULL)
+    length = lseek(fd, 0, SEEK_END);
+    if (length <= 0 || lseek(fd, 0, SEEK_SET) != 0)
+        goto exit_error;
+    
+    *data = malloc(length);
+    if (*data == NULL)
         goto exit_error;
+    
+    for (n = 0; n < (size_t)length; ) {
+        ssize_t ret;
         
-    switch (elf_kind(elf)) {
-        case ELF_K_AR:
+        ret = read(fd, *data + n, length - n);
+        if (ret <= 0)
+            goto exit_error;
+        n += ret;
+    }
+    
+    *size = length;
+    result = true;
+exit_error:
+    if (!result && *data != NULL) {
+        free(*data);
+        *data = NULL;
+    }
+    if (fd != -1)
+        close(fd);
+    Trace_End("phase", "read module");
+    return result;
+}
+
+static void Module_Load(const char *path, uint8_t *data, size_t size) {
+    link_elf_t elf;
+    
+    switch (Link_ElfOpen(&elf, data, size)) {
+        case LINK_ELF_OK:
+            Trace_Begin("phase", "parse module");
+            Module_LoadElf(path, &elf);
+            Trace_End("phase", "parse module");
+            break;
+        case LINK_ELF_ARCHIVE:
             /* TODO */
             printf(
                 "Warning: Ignoring '%s' - Archives not yet supported.\n", path);
             module_has_info = true;
-            goto exit_error;
-        case ELF_K_ELF:
-            Module_LoadElf(path, elf);
             break;
-        default:
+        case LINK_ELF_INVALID_HEADER:
             printf(
                 "Warning: Ignoring '%s' - Invalid ELF file.\n", path);
-            goto exit_error;
+            break;
+        case LINK_ELF_NOT_32BIT:
+            printf("Warning: Ignoring '%s' - Not 32 bit ELF.\n", path);
+            module_has_info = true;
+            break;
+        case LINK_ELF_NOT_BIG_ENDIAN:
+            printf("Warning: Ignoring '%s' - Not Big Endian.\n", path);
+            module_has_info = true;
+            break;
+        case LINK_ELF_UNKNOWN_VERSION:
+            printf("Warning: Ignoring '%s' - Unknown ELF version.\n", path);
+            module_has_info = true;
+            break;
+        case LINK_ELF_NOT_RELOCATABLE:
+            printf("Warning: Ignoring '%s' - Not relocatable ELF.\n", path);
+            module_has_info = true;
+            break;
+        case LINK_ELF_NOT_PPC:
+            printf(
+                "Warning: Ignoring '%s' - Architecture not EM_PPC.\n", path);
+            module_has_info = true;
+            break;
+        case LINK_ELF_INVALID_SECTIONS:
+            printf(
+                "Warning: Ignoring '%s' - Invalid section headers.\n", path);
+            module_has_info = true;
+            break;
     }
-
-exit_error:
-    if (elf != NULL)
-        elf_end(elf);
-    if (fd != -1)
-        close(fd);
 }
 
-static void Module_LoadElf(const char *path, Elf *elf) {
-    Elf_Scn *scn;
-    Elf32_Ehdr *ehdr;
-    char *ident;
-    size_t shstrndx, sz, symtab_count, i, symtab_strndx;
+static void Module_LoadElf(const char *path, const link_elf_t *elf) {
+    size_t symtab_count, i, symtab_strndx, shndx;
     Elf32_Sym *symtab = NULL;
+    bool *placed = NULL, *mem2 = NULL, mem2_code = false;
+    bool sym_table = false;
+    link_layout_t layout = { NULL, 0, 0, 0 };
+    link_layout_t layout_mem2 = { NULL, 0, 0, 0 };
     module_metadata_t *metadata = NULL;
     module_metadata_t **list_ptr;
     
     assert(elf != NULL);
-    assert(elf_kind(elf) == ELF_K_ELF);
-    
-    ident = elf_getident(elf, &sz);
-    
-    if (ident == NULL) {
-        printf("Warning: Ignoring '%s' - Invalid ELF header.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    if (sz < 7) {
-        printf("Warning: Ignoring '%s' - Invalid ELF header.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    if (ident[4] != ELFCLASS32) {
-        printf("Warning: Ignoring '%s' - Not 32 bit ELF.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    if (ident[5] != ELFDATA2MSB) {
-        printf("Warning: Ignoring '%s' - Not Big Endian.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    if (ident[6] != EV_CURRENT) {
-        printf("Warning: Ignoring '%s' - Unknown ELF version.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-        
-    ehdr = elf32_getehdr(elf);
     
-    if (ehdr == NULL) {
-        printf("Warning: Ignoring '%s' - Invalid ELF header\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    if (ehdr->e_type != ET_REL) {
-        printf("Warning: Ignoring '%s' - Not relocatable ELF.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    if (ehdr->e_machine != EM_PPC) {
-        printf("Warning: Ignoring '%s' - Architecture not EM_PPC.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    if (ehdr->e_version != EV_CURRENT) {
-        printf("Warning: Ignoring '%s' - Unknown ELF version.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-        
-    if (!Module_LoadElfSymtab(elf, &symtab, &symtab_count, &symtab_strndx)) {
+    symtab = Link_ElfLoadSymtab(elf, &symtab_count, &symtab_strndx);
+    if (symtab == NULL) {
         printf("Warning: Ignoring '%s' - Couldn't parse symtab.\n", path);
         module_has_info = true;
         goto exit_error;
     }
         
-    assert(symtab != NULL);
-        
     metadata = Module_MetadataRead(
         path, module_list_count, elf, symtab, symtab_count, symtab_strndx);
     
     if (metadata == NULL) /* error reporting done inside method */
         goto exit_error;
     
-    if (elf_getshdrstrndx(elf, &shstrndx) != 0) {
-        printf("Warning: Ignoring '%s' - Couldn't find shdrstndx.\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
-    
     for (i = 0; metadata->game[i] != '\0'; i++) {
         if (metadata->game[i] != '?') {
-            Event_Wait(&apploader_event_disk_id);
             if ((i < 4 && metadata->game[i] != os0->disc.gamename[i]) ||
                 (i >= 4 && i < 6 &&
                  metadata->game[i] != os0->disc.company[i - 4]) ||
@@ -451,22 +754,41 @@ static void Module_LoadElf(const char *path, Elf *elf) {
         }
     }
     
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
+    for (i = 1; i < symtab_count; i++) {
+        const char *name;
         
-        Elf32_Shdr *shdr;
+        if (symtab[i].st_shndx != SHN_UNDEF)
+            continue;
+        name = Link_ElfString(elf, symtab_strndx, symtab[i].st_name);
+        if (name != NULL && strcmp(name, "bslug_sym_table") == 0)
+            sym_table = true;
+    }
+    
+    placed = malloc(sizeof(bool) * elf->section_count);
+    mem2 = malloc(sizeof(bool) * elf->section_count);
+    if (placed == NULL || mem2 == NULL) {
+        printf("Warning: Ignoring '%s' - ENOMEM.\n", path);
+        module_has_info = true;
+        goto exit_error;
+    }
+    
+    for (i = 0; i < elf->section_count; i++) {
+        placed[i] = false;
+        mem2[i] = false;
+    }
+    
+    for (shndx = 1; shndx < elf->section_count; shndx++) {
+        Elf32_Shdr shdr;
         
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
+        if (!Link_ElfSection(elf, shndx, &shdr))
             continue;
             
-        if ((shdr->sh_type == SHT_PROGBITS || shdr->sh_type == SHT_NOBITS) && 
-            (shdr->sh_flags & SHF_ALLOC)) {
+        if ((shdr.sh_type == SHT_PROGBITS || shdr.sh_type == SHT_NOBITS) && 
+            (shdr.sh_flags & SHF_ALLOC)) {
             
             const char *name;
                 
-            name = elf_strptr(elf, shstrndx, shdr->sh_name);
+            name = Link_ElfSectionName(elf, &shdr);
             if (name == NULL)
                 continue;
             
@@ -474,21 +796,38 @@ static void Module_LoadElf(const char *path, Elf *elf) {
                 continue;
             } else if (strcmp(name, ".bslug.load") == 0) {
                 metadata->size +=
-                    shdr->sh_size / sizeof(bslug_loader_entry_t) * 12;
+                    shdr.sh_size / sizeof(bslug_loader_entry_t) * 12;
+                metadata->size += Module_ElfHooksSize(elf, shndx, &shdr);
             } else {
-                metadata->size += shdr->sh_size;
-                /* add alignment padding to size */
-                if (shdr->sh_addralign > 3)
-                    /* roundup to multiple of sh_addralign  */
-                    metadata->size +=
-                        (-metadata->size & (shdr->sh_addralign - 1));
-                else
-                    /* roundup to multiple of 4 */
-                    metadata->size += (-metadata->size & 3);
+                placed[shndx] = true;
+                mem2[shndx] = Module_ElfSectionMem2(
+                    metadata, &shdr, name);
+                if (mem2[shndx] && (shdr.sh_flags & SHF_EXECINSTR))
+                    mem2_code = true;
             }
         }
     }
     
+    if (!Module_ElfLayout(
+            elf, placed, mem2, symtab, symtab_count, &layout, &layout_mem2)) {
+        printf("Warning: Ignoring '%s' - ENOMEM.\n", path);
+        module_has_info = true;
+        goto exit_error;
+    }
+    
+    metadata->size += Link_LayoutRegionSize(&layout);
+    metadata->padding_size =
+        Link_LayoutRegionSize(&layout) - layout.size + layout.padding;
+    if (layout_mem2.size > 0) {
+        metadata->mem2_size = Link_LayoutRegionSize(&layout_mem2);
+        metadata->mem2_size += -metadata->mem2_size & 0x1f;
+        metadata->padding_size += layout_mem2.padding;
+    }
+    /* replacements in MEM2 are too far for a b from the game, so they need
+     * a long branch veneer in the trampoline pool. */
+    if (mem2_code)
+        metadata->size += metadata->entries_count * 16;
+    
     /* roundup to multiple of 4 */
     metadata->size += (-metadata->size & 3);
     
@@ -506,106 +845,137 @@ static void Module_LoadElf(const char *path, Elf *elf) {
     
     *list_ptr = metadata;
     module_list_size += metadata->size;
+    module_list_padding_size += metadata->padding_size;
+    module_list_mem2_size += metadata->mem2_size;
+    if (sym_table)
+        module_sym_table_needed = true;
     /* prevent the data being freed */
     metadata = NULL;
     
 exit_error:
     if (metadata != NULL)
         free(metadata);
+    if (layout.offsets != NULL)
+        free(layout.offsets);
+    if (layout_mem2.offsets != NULL)
+        free(layout_mem2.offsets);
+    if (mem2 != NULL)
+        free(mem2);
+    if (placed != NULL)
+        free(placed);
     if (symtab != NULL)
         free(symtab);
 }
 
-static bool Module_LoadElfSymtab(
-        Elf *elf, Elf32_Sym **symtab, size_t *symtab_count,
-        size_t *symtab_strndx) {
-    Elf_Scn *scn;
-    bool result = false;
-
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-         
-        Elf32_Shdr *shdr;
-        
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
-            continue;
-            
-        if (shdr->sh_type == SHT_SYMTAB) {
-            size_t sym;
-            
-            assert (*symtab == NULL);
-            *symtab = malloc(shdr->sh_size);
-            if (*symtab == NULL)
-                continue;
-            
-            *symtab_count = shdr->sh_size / sizeof(Elf32_Sym);
-            *symtab_strndx = shdr->sh_link;
-
-            if (!Module_ElfLoadSection(elf, scn, shdr, *symtab))
-                goto exit_error;
-            
-            for (sym = 0; sym < *symtab_count; sym++)
-                (*symtab)[sym].st_other = 0;
-            
-            
-            
-            break;
-        }
+/* Whether a section belongs in MEM2, by its name or the module's
+ * preference. bslug.ld links each module's code into .text.hot and .text, so
+ * "all" keeps .text.hot in MEM1 and moves the rest; replacements in .text are
+ * then reached through a veneer. */
+static bool Module_ElfSectionMem2(
+        const module_metadata_t *metadata, const Elf32_Shdr *shdr,
+        const char *name) {
+    
+    if (strncmp(name, ".mem2.", 6) == 0 ||
+        strcmp(name, ".bss.mem2") == 0 ||
+        strncmp(name, ".bss.mem2.", 10) == 0)
+        return true;
+    
+    switch (metadata->mem2) {
+        case MODULE_MEM2_DATA:
+            return !(shdr->sh_flags & SHF_EXECINSTR);
+        case MODULE_MEM2_ALL:
+            return
+                !(shdr->sh_flags & SHF_EXECINSTR) ||
+                strncmp(name, ".text.hot", 9) != 0;
+        default:
+            return false;
     }
+}
+
+/* Plan the MEM1 and MEM2 parts of a module separately. */
+static bool Module_ElfLayout(
+        const link_elf_t *elf, const bool *placed, const bool *mem2,
+        const Elf32_Sym *symtab, size_t symtab_count,
+        link_layout_t *layout, link_layout_t *layout_mem2) {
+    bool *region;
+    size_t i;
+    bool result = false;
+    
+    region = malloc(sizeof(bool) * elf->section_count);
+    if (region == NULL)
+        goto exit_error;
+    
+    for (i = 0; i < elf->section_count; i++)
+        region[i] = placed[i] && !mem2[i];
+    if (!Link_ElfLayout(elf, region, symtab, symtab_count, layout))
+        goto exit_error;
     
-    if (*symtab == NULL)
+    for (i = 0; i < elf->section_count; i++)
+        region[i] = placed[i] && mem2[i];
+    if (!Link_ElfLayout(elf, region, symtab, symtab_count, layout_mem2))
         goto exit_error;
     
     result = true;
 exit_error:
+    if (region != NULL)
+        free(region);
     return result;
 }
 
+/* Pool space for the module's BSLUG_HOOK_AT stubs, which are much bigger
+ * than the stubs for replacements. */
+static size_t Module_ElfHooksSize(
+        const link_elf_t *elf, size_t shndx, const Elf32_Shdr *shdr) {
+    bslug_loader_entry_t *entries;
+    size_t i, size = 0;
+    
+    entries = malloc(shdr->sh_size);
+    if (entries == NULL)
+        return 0;
+    
+    /* the type is the one field that isn't relocated. */
+    if (Link_ElfLoadSection(elf, shndx, shdr, entries)) {
+        for (i = 0; i < shdr->sh_size / sizeof(bslug_loader_entry_t); i++)
+            if (entries[i].type == BSLUG_LOADER_ENTRY_HOOK)
+                size += (MODULE_HOOK_SIZE + 3) * 4;
+    }
+    
+    free(entries);
+    return size;
+}
+
 static module_metadata_t *Module_MetadataRead(
-        const char *path, size_t index, Elf *elf,
+        const char *path, size_t index, const link_elf_t *elf,
         Elf32_Sym *symtab, size_t symtab_count, size_t symtab_strndx) {
     char *metadata = NULL, *metadata_cur, *metadata_end, *tmp;
-    const char *game, *name, *author, *version, *license, *bslug;
+    const char *game, *name, *author, *version, *license, *bslug, *mem2;
     module_metadata_t *ret = NULL;
-    Elf_Scn *scn;
-    size_t shstrndx, entries_count;
-    
-    if (elf_getshdrstrndx(elf, &shstrndx) != 0) {
-        printf("Warning: Ignoring '%s' - Couldn't find shstrndx\n", path);
-        module_has_info = true;
-        goto exit_error;
-    }
+    size_t shndx, entries_count;
     
     entries_count = 0;
     
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-         
-        Elf32_Shdr *shdr;
+    for (shndx = 1; shndx < elf->section_count; shndx++) {
+        Elf32_Shdr shdr;
         const char *name;
         
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
+        if (!Link_ElfSection(elf, shndx, &shdr))
             continue;
             
-        name = elf_strptr(elf, shstrndx, shdr->sh_name);
+        name = Link_ElfSectionName(elf, &shdr);
         if (name == NULL)
             continue;
         
         if (strcmp(name, ".bslug.meta") == 0) {
-            if (shdr->sh_size == 0)
+            if (shdr.sh_size == 0)
                 continue;
             
             if (metadata != NULL)
                 continue;
-            metadata = malloc(shdr->sh_size);
+            metadata = malloc(shdr.sh_size);
             if (metadata == NULL)
                 continue;
                 
-            if (!Module_ElfLoadSection(elf, scn, shdr, metadata)) {
+            if (!Link_ElfLoadSection(elf, shndx, &shdr, metadata)) {
                 printf(
                     "Warning: Ignoring '%s' - Couldn't load .bslug.meta.\n",
                     path);
@@ -613,12 +983,13 @@ static module_metadata_t *Module_MetadataRead(
                 goto exit_error;
             }
             
-            Module_ElfLoadSymbols(
-                elf_ndxscn(scn), metadata, symtab, symtab_count);
+            Link_ElfLoadSymbols(
+                shndx, (uint32_t)metadata, symtab, symtab_count);
             
-            if (!Module_ElfLink(
-                    index, elf, elf_ndxscn(scn), metadata,
-                    symtab, symtab_count, symtab_strndx, false)) {
+            if (Link_ElfLinkSection(
+                    elf, shndx, (uint8_t *)metadata, (uint32_t)metadata,
+                    symtab, symtab_count, symtab_strndx, &module_sda,
+                    NULL, NULL) < 0) {
                 printf(
                     "Warning: Ignoring '%s' - .bslug.meta contains invalid "
                     "relocations.\n", path);
@@ -626,10 +997,10 @@ static module_metadata_t *Module_MetadataRead(
                 goto exit_error;
             }
             
-            metadata_end = metadata + shdr->sh_size;
+            metadata_end = metadata + shdr.sh_size;
             metadata_end[-1] = '\0';
         } else if (strcmp(name, ".bslug.load") == 0) {
-            entries_count = shdr->sh_size / sizeof(bslug_loader_entry_t);
+            entries_count = shdr.sh_size / sizeof(bslug_loader_entry_t);
         }
     }
 
@@ -645,6 +1016,7 @@ static module_metadata_t *Module_MetadataRead(
     version = NULL;
     license = NULL;
     bslug = NULL;
+    mem2 = NULL;
     
     for (metadata_cur = metadata;
          metadata_cur < metadata_end;
@@ -715,6 +1087,15 @@ static module_metadata_t *Module_MetadataRead(
                 goto exit_error;
             }
             bslug = eq + 1;
+        } else if (strncmp(metadata_cur, "mem2", eq - metadata_cur) == 0) {
+            if (mem2 != NULL) {
+                printf(
+                    "Warning: Ignoring '%s' - Multiple BSLUG_MODULE_MEM2 "
+                    "declarations.\n", path);
+                module_has_info = true;
+                goto exit_error;
+            }
+            mem2 = eq + 1;
         }
     }
     
@@ -753,6 +1134,14 @@ static module_metadata_t *Module_MetadataRead(
         module_has_info = true;
         goto exit_error;
     }
+    if (mem2 != NULL && strcmp(mem2, "data") != 0 &&
+        strcmp(mem2, "all") != 0) {
+        printf(
+            "Warning: Ignoring '%s' - Unrecognised BSLUG_MODULE_MEM2 "
+            "'%s'.\n", path, mem2);
+        module_has_info = true;
+        goto exit_error;
+    }
     
     ret = malloc(
         sizeof(module_metadata_t) + strlen(path) +
@@ -783,6 +1172,13 @@ static module_metadata_t *Module_MetadataRead(
     strcpy(tmp, license);
     ret->license = tmp;
     ret->size = 0;
+    ret->padding_size = 0;
+    ret->mem2 =
+        mem2 == NULL ? MODULE_MEM2_NONE :
+        strcmp(mem2, "data") == 0 ? MODULE_MEM2_DATA : MODULE_MEM2_ALL;
+    ret->mem2_size = 0;
+    ret->mem1_address = NULL;
+    ret->mem2_address = NULL;
     ret->entries_count = entries_count;
     
 exit_error:
@@ -792,453 +1188,189 @@ exit_error:
     return ret;
 }
 
-static bool Module_ElfLoadSection(
-        const Elf *elf, Elf_Scn *scn, const Elf32_Shdr *shdr,
-        void *destination) {
-        
-    assert(destination != NULL);
+/* Relocations against symbols from the game or other modules wait until the
+ * game has been searched. Small data relocations need the game's r2 and r13,
+ * which aren't known until the game has been loaded, so they wait too. */
+static bool Module_ElfLinkDefer(
+        void *arg, size_t shndx, const char *name, size_t offset,
+        unsigned char type, int addend, uint32_t symbol_addr) {
+    const module_link_context_t *context = arg;
+    module_unresolved_relocation_t *reloc;
+    
+    reloc = Module_ListAllocate(
+        &module_relocations,
+        sizeof(module_unresolved_relocation_t), 1,
+        &module_relocations_capacity,
+        &module_relocations_count,
+        MODULE_RELOCATIONS_CAPCITY_DEFAULT);
+    if (reloc == NULL)
+        return false;
     
-    switch (shdr->sh_type) {
-        case SHT_SYMTAB:
-        case SHT_PROGBITS: {
-            Elf_Data *data;
-            size_t n;
-        
-            n = 0;
-            for (data = elf_getdata(scn, NULL);
-                 data != NULL;
-                 data = elf_getdata(scn, data)) {
-                memcpy((char *)destination + n, data->d_buf, data->d_size);
-                n += data->d_size;
-            }
-            return true;
-        } case SHT_NOBITS: {
-            memset(destination, 0, shdr->sh_size);
-            return true;
-        } default:
+    if (name != NULL) {
+        reloc->name = strdup(name);
+        if (reloc->name == NULL) {
+            module_relocations_count--;
             return false;
-    }
+        }
+    } else
+        reloc->name = NULL;
+    
+    reloc->module = context->index;
+    reloc->symbol_addr = symbol_addr;
+    reloc->address = context->destinations[shndx];
+    reloc->offset = offset;
+    reloc->type = type;
+    reloc->addend = addend;
+    
+    return true;
 }
 
-static void Module_ElfLoadSymbols(
-        size_t shndx, const const void *destination,
-        Elf32_Sym *symtab, size_t symtab_count) {
-    
+/* Games built with CodeWarrior define _SDA_BASE_ and _SDA2_BASE_, so a symbol
+ * file may name them; failing that, read them out of the game's start up
+ * code. */
+static void Module_FindSdaBases(void) {
+    void *start;
+    
+    module_sda.sda_base = (uint32_t)Search_SymbolLookup("_SDA_BASE_");
+    module_sda.sda2_base = (uint32_t)Search_SymbolLookup("_SDA2_BASE_");
+    
+    if (module_sda.sda_base != 0 && module_sda.sda2_base != 0)
+        return;
+    
+    start = Search_SymbolLookup("_start");
+    if (start == NULL || apploader_app0_start == NULL)
+        return;
+    
+    Link_FindSdaBases(
+        apploader_app0_start, (uint32_t)apploader_app0_start,
+        apploader_app0_end - apploader_app0_start, (uint32_t)start,
+        &module_sda);
+}
+
+/* Schedule reading each module again and linking it, for
+ * module_task_linked. */
+static bool Module_ListLink(void) {
     size_t i;
     
-    /* use the st_other field (no defined meaning) to indicate whether or not a
-     * symbol address has been calculated. */
-    for (i = 0; i < symtab_count; i++) {
-        if (symtab[i].st_shndx == shndx &&
-            symtab[i].st_other == 0) {
-            
-            symtab[i].st_value += (Elf32_Addr)destination;
-            symtab[i].st_other = 1;
-        }
+    module_link_files = malloc(sizeof(module_file_t) * module_list_count);
+    if (module_link_files == NULL && module_list_count > 0)
+        return false;
+    
+    for (i = 0; i < module_list_count; i++) {
+        module_link_files[i].path = module_list[i]->path;
+        module_link_files[i].index = i;
+        module_link_files[i].data = NULL;
+        module_link_files[i].size = 0;
+        module_link_files[i].ok = false;
     }
+    
+    module_link_ticks = 0;
+    module_link_start = gettime();
+    
+    return Module_FilesSchedule(
+        module_link_files, module_list_count, &Module_FileLink,
+        module_task_linked);
 }
 
-static bool Module_ElfLink(
-        size_t index, Elf *elf, size_t shndx, void *destination,
-        Elf32_Sym *symtab, size_t symtab_count, size_t symtab_strndx,
-        bool allow_globals) {
-    Elf_Scn *scn;
+static bool Module_ListLinked(void *arg) {
+    size_t i;
+    uint64_t total_ticks;
+    bool result = false;
     
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-         
-        Elf32_Shdr *shdr;
-        
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
-            continue;
-        
-        switch (shdr->sh_type) {
-            case SHT_REL: {
-                const Elf32_Rel *rel;
-                Elf_Data *data;
-                size_t i;
-                
-                if (shdr->sh_info != shndx)
-                    continue;
-                
-                data = elf_getdata(scn, NULL);
-                if (data == NULL)
-                    continue;
-                    
-                rel = data->d_buf;
-                
-                for (i = 0; i < shdr->sh_size / sizeof(Elf32_Rel); i++) {
-                    uint32_t symbol_addr;
-                    size_t symbol;
-                    
-                    symbol = ELF32_R_SYM(rel[i].r_info);
-                    
-                    if (symbol > symtab_count)
-                        return false;
-                    
-                    switch (symtab[symbol].st_shndx) {
-                        case SHN_ABS: {
-                            symbol_addr = symtab[symbol].st_value;
-                            break;
-                        } case SHN_COMMON: {
-                            return false;
-                        } case SHN_UNDEF: {
-                            if (allow_globals) {
-                                module_unresolved_relocation_t *reloc;
-                                char *name;
-                                
-                                reloc = Module_ListAllocate(
-                                    &module_relocations,
-                                    sizeof(module_unresolved_relocation_t), 1,
-                                    &module_relocations_capacity,
-                                    &module_relocations_count,
-                                    MODULE_RELOCATIONS_CAPCITY_DEFAULT);
-                                if (reloc == NULL)
-                                    return false;
-                                
-                                name = elf_strptr(
-                                    elf, symtab_strndx, symtab[symbol].st_name);
-                                
-                                if (name == NULL) {
-                                    module_relocations_count--;
-                                    return false;
-                                }
-                                
-                                reloc->name = strdup(name);
-                                if (reloc->name == NULL) {
-                                    module_relocations_count--;
-                                    return false;
-                                }
-                                
-                                reloc->module = index;
-                                reloc->address = destination;
-                                reloc->offset = rel[i].r_offset;
-                                reloc->type = ELF32_R_TYPE(rel[i].r_info);
-                                reloc->addend = 
-                                    *(int *)((char *)destination +
-                                        rel[i].r_offset);
-                                
-                                continue;
-                            } else
-                                return false;
-                        } default: {
-                            if (symtab[symbol].st_other != 1)
-                                return false;
-                            
-                            symbol_addr = symtab[symbol].st_value;
-                            break;
-                        }
-                    }
-                    
-                    if (!Module_ElfLinkOne(
-                            ELF32_R_TYPE(rel[i].r_info), rel[i].r_offset,
-                            *(int *)((char *)destination + rel[i].r_offset),
-                            destination, symbol_addr))
-                        return false;
-                }
-                break;
-            } case SHT_RELA: {
-                const Elf32_Rela *rela;
-                Elf_Data *data;
-                size_t i;
-                
-                if (shdr->sh_info != shndx)
-                    continue;
-                
-                data = elf_getdata(scn, NULL);
-                if (data == NULL)
-                    continue;
-                    
-                rela = data->d_buf;
-                
-                for (i = 0; i < shdr->sh_size / sizeof(Elf32_Rela); i++) {
-                    uint32_t symbol_addr;
-                    size_t symbol;
-                    
-                    symbol = ELF32_R_SYM(rela[i].r_info);
-                    
-                    if (symbol > symtab_count)
-                        return false;
-                    
-                    switch (symtab[symbol].st_shndx) {
-                        case SHN_ABS: {
-                            symbol_addr = symtab[symbol].st_value;
-                            break;
-                        } case SHN_COMMON: {
-                            return false;
-                        } case SHN_UNDEF: {
-                            if (allow_globals) {
-                                module_unresolved_relocation_t *reloc;
-                                char *name;
-                                
-                                reloc = Module_ListAllocate(
-                                    &module_relocations,
-                                    sizeof(module_unresolved_relocation_t), 1,
-                                    &module_relocations_capacity,
-                                    &module_relocations_count,
-                                    MODULE_RELOCATIONS_CAPCITY_DEFAULT);
-                                if (reloc == NULL)
-                                    return false;
-                                
-                                name = elf_strptr(
-                                    elf, symtab_strndx, symtab[symbol].st_name);
-                                
-                                if (name == NULL) {
-                                    module_relocations_count--;
-                                    return false;
-                                }
-                                
-                                reloc->name = strdup(name);
-                                if (reloc->name == NULL) {
-                                    module_relocations_count--;
-                                    return false;
-                                }
-                                
-                                reloc->module = index;
-                                reloc->address = destination;
-                                reloc->offset = rela[i].r_offset;
-                                reloc->type = ELF32_R_TYPE(rela[i].r_info);
-                                reloc->addend = rela[i].r_addend;
-                                
-                                continue;
-                            } else
-                                return false;
-                        } default: {
-                            if (symtab[symbol].st_other != 1)
-                                return false;
-                            
-                            symbol_addr = symtab[symbol].st_value;
-                            break;
-                        }
-                    }
-                                
-                    if (!Module_ElfLinkOne(
-                            ELF32_R_TYPE(rela[i].r_info), rela[i].r_offset,
-                            rela[i].r_addend, destination, symbol_addr))
-                        return false;
-                }
-                break;
-            }
-        }
-    }
-    
-    return true;
-}
-
-static bool Module_ElfLinkOne(
-        char type, size_t offset, int addend,
-        void *destination, uint32_t symbol_addr) {
-    int value;
-    char *target = (char *)destination + offset;
-    bool result = false;
-
-    switch (type) {
-        case R_PPC_ADDR32:
-        case R_PPC_ADDR24:
-        case R_PPC_ADDR16:
-        case R_PPC_ADDR16_HI:
-        case R_PPC_ADDR16_HA:
-        case R_PPC_ADDR16_LO:
-        case R_PPC_ADDR14:
-        case R_PPC_ADDR14_BRTAKEN:
-        case R_PPC_ADDR14_BRNTAKEN:
-        case R_PPC_UADDR32:
-        case R_PPC_UADDR16: {
-            value = (int)symbol_addr + addend;
-            break;
-        } case R_PPC_REL24:
-        case R_PPC_REL14:
-        case R_PPC_REL14_BRTAKEN:
-        case R_PPC_REL14_BRNTAKEN:
-        case R_PPC_REL32:
-        case R_PPC_ADDR30: {
-            value = (int)symbol_addr + addend - (int)target;
-            break;
-        } case R_PPC_SECTOFF:
-        case R_PPC_SECTOFF_LO:
-        case R_PPC_SECTOFF_HI:
-        case R_PPC_SECTOFF_HA: {
-            value = offset + addend;
-            break;
-        } case R_PPC_EMB_NADDR32:
-        case R_PPC_EMB_NADDR16:
-        case R_PPC_EMB_NADDR16_LO:
-        case R_PPC_EMB_NADDR16_HI:
-        case R_PPC_EMB_NADDR16_HA: {
-            value = addend - (int)symbol_addr;
-            break;
-        } default:
-            goto exit_error;
-    }
-    
-    
-    switch (type) {
-        case R_PPC_ADDR32:
-        case R_PPC_UADDR32:
-        case R_PPC_REL32:
-        case R_PPC_SECTOFF:
-        case R_PPC_EMB_NADDR32: {
-            *(int *)target = value;
-            break;
-        } case R_PPC_ADDR24:
-        case R_PPC_REL24: {
-            *(int *)target =
-                (*(int *)target & 0xfc000003) | (value & 0x03fffffc);
-            break;
-        } case R_PPC_ADDR16:
-        case R_PPC_UADDR16:
-        case R_PPC_EMB_NADDR16: {
-            *(short *)target = value;
-            break;
-        } case R_PPC_ADDR16_HI:
-        case R_PPC_SECTOFF_HI:
-        case R_PPC_EMB_NADDR16_HI: {
-            *(short *)target = value >> 16;
-            break;
-        } case R_PPC_ADDR16_HA:
-        case R_PPC_SECTOFF_HA:
-        case R_PPC_EMB_NADDR16_HA: {
-            *(short *)target = (value >> 16) + ((value >> 15) & 1);
-            break;
-        } case R_PPC_ADDR16_LO:
-        case R_PPC_SECTOFF_LO:
-        case R_PPC_EMB_NADDR16_LO: {
-            *(short *)target = value & 0xffff;
-            break;
-        } case R_PPC_ADDR14:
-        case R_PPC_REL14: {
-            *(int *)target =
-                (*(int *)target & 0xffff0003) | (value & 0x0000fffc);
-            break;
-        } case R_PPC_ADDR14_BRTAKEN:
-        case R_PPC_REL14_BRTAKEN: {
-            *(int *)target =
-                (*(int *)target & 0xffdf0003) | (value & 0x0000fffc) |
-                0x00200000;
-            break;
-        } case R_PPC_ADDR14_BRNTAKEN:
-        case R_PPC_REL14_BRNTAKEN: {
-            *(int *)target =
-                (*(int *)target & 0xffdf0003) | (value & 0x0000fffc);
-            break;
-        } case R_PPC_ADDR30: {
-            *(int *)target =
-                (*(int *)target & 0x00000003) | (value & 0xfffffffc);
-            break;
-        } default:
-            goto exit_error;
-    }
-    
-    result = true;
-exit_error:
-    if (!result) printf("Module_ElfLinkOne: exit_error\n");
-    return result;
-}
-
-static bool Module_ListLink(uint8_t **space) {
-    size_t i;
-    bool result = false;
+    if (module_has_error)
+        goto exit_error;
     
+    total_ticks = gettime() - module_link_start;
+    printf(
+        "Modules linked in %u ms, %u ms of it waiting for the SD card.\n",
+        (unsigned)ticks_to_millisecs(total_ticks),
+        (unsigned)ticks_to_millisecs(total_ticks - module_link_ticks));
     for (i = 0; i < module_list_count; i++) {
-        if (!Module_LinkModule(i, module_list[i]->path, space))
-            goto exit_error;
+        if (module_list[i]->mem2_size > 0)
+            printf(
+                "\t%s: MEM1 %p, MEM2 %p\n", module_list[i]->name,
+                module_list[i]->mem1_address, module_list[i]->mem2_address);
+        else
+            printf(
+                "\t%s: MEM1 %p\n", module_list[i]->name,
+                module_list[i]->mem1_address);
     }
     
     result = true;
 exit_error:
-    if (!result) printf("Module_ListLink: exit_error\n");
+    if (!result) printf("Module_ListLinked: exit_error\n");
+    free(module_link_files);
+    module_link_files = NULL;
     return result;
 }
 
-static bool Module_LinkModule(size_t index, const char *path, uint8_t **space) {
-    int fd = -1;
-    Elf *elf = NULL;
+static bool Module_LinkModule(
+        size_t index, const uint8_t *data, size_t size,
+        uint8_t **space, uint8_t **space_mem2) {
+    link_elf_t elf;
     bool result = false;
     
-    /* check for compile errors */
-    assert(elf_version(EV_CURRENT) != EV_NONE);
-    
-    fd = open(path, O_RDONLY, 0);
-    
-    if (fd == -1)
+    if (Link_ElfOpen(&elf, data, size) != LINK_ELF_OK)
         goto exit_error;
-        
-    elf = elf_begin(fd, ELF_C_READ, NULL);
     
-    if (elf == NULL)
+    if (!Module_LinkModuleElf(index, &elf, space, space_mem2))
         goto exit_error;
-        
-    switch (elf_kind(elf)) {
-        case ELF_K_AR:
-            /* TODO */
-            goto exit_error;
-        case ELF_K_ELF:
-            if (!Module_LinkModuleElf(index, elf, space))
-                goto exit_error;
-            break;
-        default:
-            goto exit_error;
-    }
 
     result = true;
 exit_error:
     if (!result) printf("Module_LinkModule: exit_error\n");
-    if (elf != NULL)
-        elf_end(elf);
-    if (fd != -1)
-        close(fd);
     return result;
 }
 
-static bool Module_LinkModuleElf(size_t index, Elf *elf, uint8_t **space) {
-    Elf_Scn *scn;
-    size_t symtab_count, section_count, shstrndx, symtab_strndx, entries_count;
+static bool Module_LinkModuleElf(
+        size_t index, const link_elf_t *elf,
+        uint8_t **space, uint8_t **space_mem2) {
+    size_t symtab_count, symtab_strndx, entries_count, i, shndx;
     Elf32_Sym *symtab = NULL;
     uint8_t **destinations = NULL;
+    uint32_t *addresses = NULL;
+    uint8_t *base, *base_mem2 = NULL;
+    module_link_context_t context;
+    bool *placed = NULL, *mem2 = NULL;
+    link_layout_t layout = { NULL, 0, 0, 0 };
+    link_layout_t layout_mem2 = { NULL, 0, 0, 0 };
     bslug_loader_entry_t *entries = NULL;
+    module_decompress_t decompress = { 0, 0, 0 };
     bool result = false;
     
-    if (!Module_LoadElfSymtab(elf, &symtab, &symtab_count, &symtab_strndx))
+    symtab = Link_ElfLoadSymtab(elf, &symtab_count, &symtab_strndx);
+    if (symtab == NULL)
 	{
 		printf("\n1");
         goto exit_error;
 	}
     
-    assert(symtab != NULL);
-    
-    if (elf_getshdrnum(elf, &section_count) != 0)
-	{
-		printf("\n2");
-        goto exit_error;
-	}
-    if (elf_getshdrstrndx(elf, &shstrndx) != 0)
-	{
-		printf("\n3");
+    destinations = malloc(sizeof(uint8_t *) * elf->section_count);
+    addresses = malloc(sizeof(uint32_t) * elf->section_count);
+    placed = malloc(sizeof(bool) * elf->section_count);
+    mem2 = malloc(sizeof(bool) * elf->section_count);
+    if (destinations == NULL || addresses == NULL ||
+        placed == NULL || mem2 == NULL)
         goto exit_error;
-	}
     
-    destinations = malloc(sizeof(uint8_t *) * section_count);
+    for (i = 0; i < elf->section_count; i++) {
+        destinations[i] = NULL;
+        placed[i] = false;
+        mem2[i] = false;
+    }
     
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-        
-        Elf32_Shdr *shdr;
+    for (shndx = 1; shndx < elf->section_count; shndx++) {
+        Elf32_Shdr shdr;
         
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
+        if (!Link_ElfSection(elf, shndx, &shdr))
             continue;
         
-        if ((shdr->sh_type == SHT_PROGBITS || shdr->sh_type == SHT_NOBITS) && 
-            (shdr->sh_flags & SHF_ALLOC)) {
+        if ((shdr.sh_type == SHT_PROGBITS || shdr.sh_type == SHT_NOBITS) && 
+            (shdr.sh_flags & SHF_ALLOC)) {
             
             const char *name;
             
-            destinations[elf_ndxscn(scn)] = NULL;
-            
-            name = elf_strptr(elf, shstrndx, shdr->sh_name);
+            name = Link_ElfSectionName(elf, &shdr);
             if (name == NULL)
                 continue;
             
@@ -1250,7 +1382,7 @@ static bool Module_LinkModuleElf(size_t index, Elf *elf, uint8_t **space) {
 					printf("\n4");
                     goto exit_error;
 				}   
-                entries_count = shdr->sh_size / sizeof(bslug_loader_entry_t);
+                entries_count = shdr.sh_size / sizeof(bslug_loader_entry_t);
                 entries = Module_ListAllocate(
                     &module_entries, sizeof(bslug_loader_entry_t),
                     entries_count, &module_entries_capacity,
@@ -1261,64 +1393,81 @@ static bool Module_LinkModuleElf(size_t index, Elf *elf, uint8_t **space) {
 					printf("\n5");
                     goto exit_error;
 				}
-                destinations[elf_ndxscn(scn)] = (uint8_t *)entries;
-                if (!Module_ElfLoadSection(elf, scn, shdr, entries))
-				{
-					printf("\n6");
-                    goto exit_error;
-				}
-                Module_ElfLoadSymbols(
-                    elf_ndxscn(scn), entries, symtab, symtab_count);
+                destinations[shndx] = (uint8_t *)entries;
             } else {
-                *space -= shdr->sh_size;
-                if (shdr->sh_addralign > 3)
-                    *space = (uint8_t *)((int)*space &
-                        ~(shdr->sh_addralign - 1));
-                else 
-                    *space = (uint8_t *)((int)*space & ~3);
-                
-                destinations[elf_ndxscn(scn)] = *space;
-                
-                assert(*space != NULL);
-                if (!Module_ElfLoadSection(elf, scn, shdr, *space))
-				{
-					printf("\n7");
-                    goto exit_error;
-				}
-                Module_ElfLoadSymbols(
-                    elf_ndxscn(scn), *space, symtab, symtab_count);
+                placed[shndx] = true;
+                mem2[shndx] = Module_ElfSectionMem2(
+                    module_list[index], &shdr, name);
             }
         }
     }
     
+    if (!Module_ElfLayout(
+            elf, placed, mem2, symtab, symtab_count, &layout, &layout_mem2))
+        goto exit_error;
+    
+    /* must match the space Module_LoadElf reserved for this module. */
+    *space -= layout.size + (-layout.size & 0x1f);
+    *space = (uint8_t *)((int)*space & ~(layout.align - 1));
+    base = *space;
+    if (layout_mem2.size > 0) {
+        *space_mem2 -= layout_mem2.size + (-layout_mem2.size & 0x1f);
+        *space_mem2 =
+            (uint8_t *)((int)*space_mem2 & ~(layout_mem2.align - 1));
+        base_mem2 = *space_mem2;
+    }
+    module_list[index]->mem1_address = base;
+    module_list[index]->mem2_address = base_mem2;
+    
+    for (shndx = 1; shndx < elf->section_count; shndx++) {
+        if (!placed[shndx])
+            continue;
+        
+        if (mem2[shndx]) {
+            assert(layout_mem2.offsets[shndx] != SIZE_MAX);
+            destinations[shndx] = base_mem2 + layout_mem2.offsets[shndx];
+        } else {
+            assert(layout.offsets[shndx] != SIZE_MAX);
+            destinations[shndx] = base + layout.offsets[shndx];
+        }
+    }
+    
+    for (i = 0; i < elf->section_count; i++)
+        addresses[i] = (uint32_t)destinations[i];
+    if (!Link_ElfLoadModule(
+            elf, destinations, addresses, symtab, symtab_count,
+            &Module_ElfLoadSection, &decompress))
+	{
+		printf("\n7");
+        goto exit_error;
+	}
+    
     if (entries == NULL)
 	{
 		printf("\n8");
         goto exit_error;
 	}
     
-    for (scn = elf_nextscn(elf, NULL);
-         scn != NULL;
-         scn = elf_nextscn(elf, scn)) {
-        
-        Elf32_Shdr *shdr;
-        
-        shdr = elf32_getshdr(scn);
-        if (shdr == NULL)
-            continue;
-        
-        if ((shdr->sh_type == SHT_PROGBITS || shdr->sh_type == SHT_NOBITS) && 
-            (shdr->sh_flags & SHF_ALLOC) &&
-            destinations[elf_ndxscn(scn)] != NULL) {
-            
-            if (!Module_ElfLink(
-                    index, elf, elf_ndxscn(scn), destinations[elf_ndxscn(scn)],
-                    symtab, symtab_count, symtab_strndx, true))
-			{
-				printf("\n9");
-                goto exit_error;
-			}
-        }
+    context.index = index;
+    context.destinations = destinations;
+    
+    /* the small data bases aren't known yet, so those relocations are
+     * deferred along with the ones against other modules and the game. */
+    if (!Link_ElfLinkModule(
+            elf, destinations, addresses, symtab, symtab_count,
+            symtab_strndx, NULL, &Module_ElfLinkDefer, &context)) {
+        printf(
+            "Couldn't relocate '%s'; a branch may be out of range, build it "
+            "with -mlongcall\n", module_list[index]->name);
+        goto exit_error;
+    }
+    
+    if (decompress.compressed_size > 0) {
+        printf(
+            "%s: %u bytes decompressed from %u in %u us.\n",
+            module_list[index]->name, (unsigned)decompress.size,
+            (unsigned)decompress.compressed_size,
+            (unsigned)ticks_to_microsecs(decompress.ticks));
     }
         
     result = true;
@@ -1326,11 +1475,42 @@ exit_error:
     if (!result) printf("Module_LinkModuleElf: exit_error\n");
     if (destinations != NULL)
         free(destinations);
+    if (addresses != NULL)
+        free(addresses);
+    if (layout.offsets != NULL)
+        free(layout.offsets);
+    if (layout_mem2.offsets != NULL)
+        free(layout_mem2.offsets);
+    if (mem2 != NULL)
+        free(mem2);
+    if (placed != NULL)
+        free(placed);
     if (symtab != NULL)
         free(symtab);
     return result;
 }
 
+/* Load a section straight into its destination, timing any that have to be
+ * decompressed. */
+static bool Module_ElfLoadSection(
+        void *arg, const link_elf_t *elf, size_t shndx,
+        const Elf32_Shdr *shdr, void *destination) {
+    module_decompress_t *decompress = arg;
+    uint64_t start;
+    
+    if (!(shdr->sh_flags & SHF_COMPRESSED))
+        return Link_ElfLoadSection(elf, shndx, shdr, destination);
+    
+    start = gettime();
+    if (!Link_ElfLoadSection(elf, shndx, shdr, destination))
+        return false;
+    decompress->ticks += gettime() - start;
+    decompress->compressed_size += Link_ElfSectionFileSize(elf, shndx);
+    decompress->size += shdr->sh_size;
+    
+    return true;
+}
+
 static bool Module_ListLoadSymbols(uint8_t **space) {
     size_t i;
     bool result = false;
@@ -1352,19 +1532,145 @@ static bool Module_ListLoadSymbols(uint8_t **space) {
                 
             break;
         } case BSLUG_LOADER_ENTRY_FUNCTION:
-        case BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY: {
+        case BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY:
+        case BSLUG_LOADER_ENTRY_HOOK: {
             break;
         } default:
             goto exit_error;
         }
     }
     
+    if (module_sym_table_needed) {
+        if (!Search_SymbolAdd("bslug_sym_table", module_sym_table))
+            goto exit_error;
+        if (!Module_SymTableBuild())
+            goto exit_error;
+    }
+    
     result = true;
 exit_error:
     if (!result) printf("Module_ListLoadSymbols: exit_error\n");
     return result;
 }
 
+/* Enough buckets for about one symbol each. */
+static size_t Module_SymTableBuckets(size_t count) {
+    size_t bucket_count;
+    
+    for (bucket_count = 1; bucket_count < count; bucket_count *= 2)
+        ;
+    return bucket_count;
+}
+
+/* Upper bound on the table's size: every export, and every game symbol the
+ * search knows about, whether or not it is found. */
+static size_t Module_SymTableSize(void) {
+    size_t count, strings, i;
+    
+    count = symbol_count;
+    for (i = 0; i < module_list_count; i++)
+        count += module_list[i]->entries_count;
+    
+    /* export names are already in the module's memory, game ones aren't. */
+    strings = 0;
+    for (i = 0; i < symbol_count; i++)
+        strings += strlen(Symbol_GetSymbol(i)->name) + 1;
+    
+    return
+        sizeof(bslug_sym_table_t) +
+        (Module_SymTableBuckets(count) + 1) * sizeof(uint32_t) +
+        count * sizeof(bslug_sym_t) + strings;
+}
+
+static bool Module_SymTableBuild(void) {
+    size_t capacity, count, bucket_count, i;
+    bslug_sym_t *symbols = NULL, *table_symbols;
+    uint32_t *buckets, *cursors = NULL;
+    char *strings;
+    bool result = false;
+    
+    assert(module_sym_table != NULL);
+    
+    capacity = symbol_count + module_entries_count;
+    bucket_count = Module_SymTableBuckets(capacity);
+    buckets = (uint32_t *)(module_sym_table + 1);
+    table_symbols = (bslug_sym_t *)(buckets + bucket_count + 1);
+    strings = (char *)(table_symbols + capacity);
+    
+    symbols = malloc(sizeof(bslug_sym_t) * (capacity + 1));
+    cursors = malloc(sizeof(uint32_t) * bucket_count);
+    if (symbols == NULL || cursors == NULL)
+        goto exit_error;
+    
+    /* exports first, so they shadow game symbols of the same name. */
+    count = 0;
+    for (i = 0; i < module_entries_count; i++) {
+        bslug_loader_entry_t *entry;
+        
+        entry = module_entries + i;
+        if (entry->type != BSLUG_LOADER_ENTRY_EXPORT)
+            continue;
+        
+        symbols[count].hash = bslug_sym_hash(entry->data.export.name);
+        symbols[count].name = entry->data.export.name;
+        symbols[count].address = (void *)entry->data.export.target;
+        count++;
+    }
+    for (i = 0; i < symbol_count; i++) {
+        const char *name;
+        void *address;
+        
+        name = Symbol_GetSymbolAlphabetical(i)->name;
+        if (i > 0 &&
+            strcmp(name, Symbol_GetSymbolAlphabetical(i - 1)->name) == 0)
+            continue;
+        
+        address = Search_SymbolLookup(name);
+        if (address == NULL)
+            continue;
+        
+        symbols[count].hash = bslug_sym_hash(name);
+        symbols[count].name = strings;
+        symbols[count].address = address;
+        strcpy(strings, name);
+        strings += strlen(name) + 1;
+        count++;
+    }
+    assert(count <= capacity);
+    assert(strings <= (char *)module_sym_table + module_sym_table_size);
+    
+    /* a counting sort by bucket, which keeps the order within a bucket. */
+    for (i = 0; i <= bucket_count; i++)
+        buckets[i] = 0;
+    for (i = 0; i < count; i++)
+        buckets[(symbols[i].hash & (bucket_count - 1)) + 1]++;
+    for (i = 0; i < bucket_count; i++) {
+        buckets[i + 1] += buckets[i];
+        cursors[i] = buckets[i];
+    }
+    for (i = 0; i < count; i++)
+        table_symbols[cursors[symbols[i].hash & (bucket_count - 1)]++] =
+            symbols[i];
+    
+    module_sym_table->bucket_count = bucket_count;
+    module_sym_table->count = count;
+    module_sym_table->buckets = buckets;
+    module_sym_table->symbols = table_symbols;
+    
+    printf(
+        "Symbol table: %u symbols in %u buckets.\n",
+        (unsigned)count, (unsigned)bucket_count);
+    
+    result = true;
+exit_error:
+    if (!result) printf("Module_SymTableBuild: exit_error\n");
+    if (cursors != NULL)
+        free(cursors);
+    if (symbols != NULL)
+        free(symbols);
+    return result;
+}
+
 static bool Module_ListLinkFinal(uint8_t **space) {
     size_t relocation_index, entry_index, module_index;
     bool result = false, has_error = false;
@@ -1372,6 +1678,32 @@ static bool Module_ListLinkFinal(uint8_t **space) {
     relocation_index = 0;
     entry_index = 0;
     
+    Module_FindSdaBases();
+    
+    /* the game functions are known now, so it is known which stubs need a
+     * veneer to reach their replacement. */
+    module_trampolines_capacity = 0;
+    for (entry_index = 0; entry_index < module_entries_count; entry_index++) {
+        bslug_loader_entry_t *entry;
+        
+        entry = module_entries + entry_index;
+        if (entry->type == BSLUG_LOADER_ENTRY_FUNCTION ||
+            entry->type == BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY)
+            module_trampolines_capacity +=
+                Module_TrampolineSize(entry, (uint32_t)*space);
+        else if (entry->type == BSLUG_LOADER_ENTRY_HOOK &&
+                 Module_HookAddress(entry) != NULL)
+            module_trampolines_capacity +=
+                MODULE_HOOK_SIZE +
+                Module_DisplaceSize(*Module_HookAddress(entry));
+    }
+    entry_index = 0;
+    
+    assert(((uint32_t)*space & 31) == 0);
+    *space -= (module_trampolines_capacity * 4 + 31) & ~31;
+    module_trampolines = (uint32_t *)*space;
+    module_trampolines_count = 0;
+    
     /* Process the replacements the link each module in turn.
      * It must be done in this order, otherwise two replacements to the same
      * function will cause an infinite loop. */
@@ -1392,7 +1724,11 @@ static bool Module_ListLinkFinal(uint8_t **space) {
                 break;
             } case BSLUG_LOADER_ENTRY_FUNCTION:
             case BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY: {
-                if (!Module_ListLinkFinalReplaceFunction(space, entry))
+                if (!Module_ListLinkFinalReplaceFunction(entry))
+                    goto exit_error;
+                break;
+            } case BSLUG_LOADER_ENTRY_HOOK: {
+                if (!Module_ListLinkFinalHook(entry))
                     goto exit_error;
                 break;
             } default:
@@ -1405,27 +1741,49 @@ static bool Module_ListLinkFinal(uint8_t **space) {
              relocation_index++) {
             module_unresolved_relocation_t *reloc;
             void *symbol;
+            uint8_t *target;
             
             reloc = module_relocations + relocation_index;
             
             if (reloc->module != module_index)
                 break;
             
-            assert(reloc->name != NULL);
-            symbol = Search_SymbolLookup(reloc->name);
+            if (reloc->name != NULL) {
+                symbol = Search_SymbolLookup(reloc->name);
+                
+                if (symbol == NULL) {
+                    printf(
+                        "Missing symbol '%s' needed by '%s'\n", reloc->name,
+                        module_list[module_index]->name);
+                    has_error = true;
+                    continue;
+                }
+            } else
+                symbol = (void *)reloc->symbol_addr;
             
-            if (symbol == NULL) {
+            target = (uint8_t *)reloc->address + reloc->offset;
+            if (!Link_Relocate(
+                    reloc->type, target, (uint32_t)target, reloc->offset,
+                    reloc->addend, (uint32_t)symbol, &module_sda)) {
+                
+                if (Link_RelocateIsBranch(reloc->type)) {
+                    printf(
+                        "Branch to '%s' out of range in '%s'; "
+                        "build it with -mlongcall\n",
+                        reloc->name != NULL ? reloc->name : "(local)",
+                        module_list[module_index]->name);
+                    has_error = true;
+                    continue;
+                }
+                if (!Link_RelocateNeedsSda(reloc->type))
+                    goto exit_error;
+                
                 printf(
-                    "Missing symbol '%s' needed by '%s'\n", reloc->name,
+                    "Small data out of range of r2/r13 in '%s'; "
+                    "build it with -msdata=none\n",
                     module_list[module_index]->name);
                 has_error = true;
-                continue;
             }
-            
-            if (!Module_ElfLinkOne(
-                    reloc->type, reloc->offset, reloc->addend,
-                    reloc->address, (uint32_t)symbol))
-                goto exit_error;
         }
     }
     
@@ -1435,6 +1793,11 @@ static bool Module_ListLinkFinal(uint8_t **space) {
     if (has_error)
         goto exit_error;
     
+    if (module_trampolines_count > 0) {
+        DCFlushRange(module_trampolines, module_trampolines_count * 4);
+        ICInvalidateRange(module_trampolines, module_trampolines_count * 4);
+    }
+    
     result = true;
 exit_error:
     if (!result) printf("Module_ListLinkFinal: exit_error\n");
@@ -1444,36 +1807,83 @@ exit_error:
     return result;
 }
 
-static bool Module_ListLinkFinalReplaceFunction(
-        uint8_t **space, bslug_loader_entry_t *entry) {
-    bool result = false;
-    uint32_t *data;
+/* How many words of the trampoline pool a replacement may need. */
+static size_t Module_TrampolineSize(
+        const bslug_loader_entry_t *entry, uint32_t pool) {
+    const uint32_t *data;
+    size_t size;
     
-    assert(entry->type == BSLUG_LOADER_ENTRY_FUNCTION ||
-           entry->type == BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY);
-    assert(entry->data.function.name != NULL);
     data = Search_SymbolLookup(entry->data.function.name);
     
     if (data == NULL) {
-        if (entry->type == BSLUG_LOADER_ENTRY_FUNCTION) {
-            *space -= 4;
-            /* FIXME: this behaviour is bad; we should call abort or
-             * some such.
-             *
-             * The hack is, if we're replacing a function, we probably
-             * reference it. Since the symbol is missing, this won't
-             * work, so we make up a plausible symbol table entry for
-             * the purpose of relocation.
-             */
-            ((uint32_t *)*space)[0] = 0x48000000; /* spin loop */
-            Search_SymbolAdd(entry->data.function.name, *space);
-            goto exit_success;
-        } else {
-            printf("Missing symbol '%s'\n", entry->data.function.name);
-            goto exit_error;
-        }
+        /* a spin loop, and a stub for it if it's replaced again. */
+        size = 3;
+        if (!Module_BranchInRange(
+            pool, (uint32_t)entry->data.function.target))
+            size += 4;
+        return size;
     }
     
+    size = Module_DisplaceSize(*data);
+    if (!Module_BranchInRange(
+            (uint32_t)data, (uint32_t)entry->data.function.target) ||
+        !Module_BranchInRange(
+            pool, (uint32_t)entry->data.function.target))
+        size += 4;
+    
+    return size;
+}
+
+static uint32_t *Module_TrampolineAllocate(size_t size) {
+    uint32_t *result;
+    
+    if (module_trampolines_count + size > module_trampolines_capacity)
+        return NULL;
+    
+    result = module_trampolines + module_trampolines_count;
+    module_trampolines_count += size;
+    return result;
+}
+
+/* Whether a b at from can reach to. */
+static bool Module_BranchInRange(uint32_t from, uint32_t to) {
+    int offset;
+    
+    offset = (int)(to - from);
+    return offset >= -0x2000000 && offset < 0x2000000;
+}
+
+/* The instruction at from that branches to to, through a long branch veneer
+ * in the trampoline pool if it is too far for a b. The veneer uses r12 and
+ * ctr, which are volatile at the start of the function being replaced. */
+static bool Module_Branch(uint32_t from, uint32_t to, uint32_t *instruction) {
+    uint32_t *veneer;
+    
+    if (!Module_BranchInRange(from, to)) {
+        veneer = Module_TrampolineAllocate(4);
+        if (veneer == NULL || !Module_BranchInRange(from, (uint32_t)veneer))
+            return false;
+        
+        veneer[0] = 0x3d800000 | (to >> 16);       /* lis r12, to@h */
+        veneer[1] = 0x618c0000 | (to & 0xffff);    /* ori r12, r12, to@l */
+        veneer[2] = 0x7d8903a6;                    /* mtctr r12 */
+        veneer[3] = 0x4e800420;                    /* bctr */
+        to = (uint32_t)veneer;
+    }
+    
+    *instruction = 0x48000000 + ((to - from) & 0x3fffffc);
+    return true;
+}
+
+/* Words Module_Displace writes for instruction. */
+static size_t Module_DisplaceSize(uint32_t instruction) {
+    return (instruction & 0xfc000002) == 0x40000000 ? 3 : 2;
+}
+
+/* Write a copy of the instruction at data to stub which does the same thing
+ * there, then a branch back to the instruction after data. The pool is in
+ * MEM1 so it can always reach the game. */
+static void Module_Displace(const uint32_t *data, uint32_t *stub) {
     switch (*data & 0xfc000002) {
         case 0x40000000: { /* bc */
             void *target;
@@ -1483,22 +1893,21 @@ static bool Module_ListLinkFinalReplaceFunction(
             offset = (offset << 16) >> 16;
             target = (char *)data + offset;
         
-            *space -= 12;
             /* Conditional branch to either target or next instruction.
              * We can't just conditional branch to original target as
              * it is probably too far for a single branch. */
-            ((uint32_t *)*space)[0] = (*data & 0xffff0003) | 8;
+            stub[0] = (*data & 0xffff0003) | 8;
             /* branch to second instruction of function.
              * observe: we're branching from the second instruction of 
              *     the stub to the second instruction of the method, so
              *     no offset is needed. */
-            ((uint32_t *)*space)[1] =
+            stub[1] =
                 0x48000000 + 
-                (((uint32_t)data - (uint32_t)*space) & 0x3fffffc);
+                (((uint32_t)data - (uint32_t)stub) & 0x3fffffc);
             /* branch to the target of the original branch. */
-            ((uint32_t *)*space)[2] =
+            stub[2] =
                 0x48000000 + 
-                (((uint32_t)target - (uint32_t)(*space + 8))
+                (((uint32_t)target - (uint32_t)(stub + 2))
                     & 0x3fffffc);
             break;
         } case 0x48000000: { /* b */
@@ -1508,41 +1917,82 @@ static bool Module_ListLinkFinalReplaceFunction(
             offset = *data & 0x03fffffc;
             offset = (offset << 6) >> 6;
             target = (char *)data + offset;
-            *space -= 8;
             /* branch to the target of the original branch. */
-            ((uint32_t *)*space)[0] = 
+            stub[0] = 
                 (*data & 0xfc000003) + 
-                (((uint32_t)target - (uint32_t)*space) & 0x3fffffc);
+                (((uint32_t)target - (uint32_t)stub) & 0x3fffffc);
             /* branch to second instruction of function.
              * observe: we're branching from the second instruction of 
              *     the stub to the second instruction of the method, so
              *     no offset is needed. */
-            ((uint32_t *)*space)[1] =
+            stub[1] =
                 0x48000000 + 
-                (((uint32_t)data - (uint32_t)*space) & 0x3fffffc);
+                (((uint32_t)data - (uint32_t)stub) & 0x3fffffc);
             break;
         } default: { /* other (inc ba, and bca) */
-            *space -= 8;
             /* copy the original instruction. */
-            ((uint32_t *)*space)[0] = *data;
+            stub[0] = *data;
             /* branch to second instruction of function.
              * observe: we're branching from the second instruction of 
              *     the stub to the second instruction of the method, so
              *     no offset is needed. */
-            ((uint32_t *)*space)[1] =
+            stub[1] =
                 0x48000000 + 
-                (((uint32_t)data - (uint32_t)*space) & 0x3fffffc);
+                (((uint32_t)data - (uint32_t)stub) & 0x3fffffc);
             break;
         }
     }
+}
+
+static bool Module_ListLinkFinalReplaceFunction(bslug_loader_entry_t *entry) {
+    bool result = false;
+    uint32_t *data, *stub;
+    
+    assert(entry->type == BSLUG_LOADER_ENTRY_FUNCTION ||
+           entry->type == BSLUG_LOADER_ENTRY_FUNCTION_MANDATORY);
+    assert(entry->data.function.name != NULL);
+    data = Search_SymbolLookup(entry->data.function.name);
     
-    *data = 0x48000000 + 
-        (((uint32_t)entry->data.function.target
-            - (uint32_t)data) & 0x3fffffc);
+    if (data == NULL) {
+        if (entry->type == BSLUG_LOADER_ENTRY_FUNCTION) {
+            stub = Module_TrampolineAllocate(1);
+            if (stub == NULL)
+                goto exit_error;
+            /* FIXME: this behaviour is bad; we should call abort or
+             * some such.
+             *
+             * The hack is, if we're replacing a function, we probably
+             * reference it. Since the symbol is missing, this won't
+             * work, so we make up a plausible symbol table entry for
+             * the purpose of relocation.
+             */
+            stub[0] = 0x48000000; /* spin loop */
+            Search_SymbolAdd(entry->data.function.name, stub);
+            goto exit_success;
+        } else {
+            printf("Missing symbol '%s'\n", entry->data.function.name);
+            goto exit_error;
+        }
+    }
+    
+    /* the stub runs the function's first instruction then branches back to
+     * the second. */
+    stub = Module_TrampolineAllocate(Module_DisplaceSize(*data));
+    if (stub == NULL)
+        goto exit_error;
+    Module_Displace(data, stub);
+    
+    if (!Module_Branch(
+            (uint32_t)data, (uint32_t)entry->data.function.target, data)) {
+        printf(
+            "Could not reach the replacement for '%s'\n",
+            entry->data.function.name);
+        goto exit_error;
+    }
     DCFlushRange((void *)((uint32_t)data & ~31), 32);
     ICInvalidateRange((void *)((uint32_t)data & ~31), 32);
     
-    if (!Search_SymbolReplace(entry->data.function.name, *space))
+    if (!Search_SymbolReplace(entry->data.function.name, stub))
         goto exit_error;
 
 exit_success:
@@ -1551,3 +2001,112 @@ exit_error:
     if (!result) printf("Module_ListLinkFinalReplaceFunction: exit_error\n");
     return result;
 }
+
+static bool Module_ListLinkFinalHook(bslug_loader_entry_t *entry) {
+    bool result = false;
+    uint32_t *data, *stub, handler;
+    size_t i, n;
+    
+    assert(entry->type == BSLUG_LOADER_ENTRY_HOOK);
+    assert(entry->data.function.name != NULL);
+    data = Module_HookAddress(entry);
+    
+    if (data == NULL) {
+        printf("Warning: Skipping hook '%s'\n", entry->data.function.name);
+        module_has_info = true;
+        goto exit_success;
+    }
+    
+    stub = Module_TrampolineAllocate(
+        MODULE_HOOK_SIZE + Module_DisplaceSize(*data));
+    if (stub == NULL)
+        goto exit_error;
+    handler = (uint32_t)entry->data.function.target;
+    n = 0;
+    
+    /* stwu r1, -MODULE_HOOK_FRAME(r1) */
+    stub[n++] = 0x94210000 | (-MODULE_HOOK_FRAME & 0xffff);
+    stub[n++] = 0x90010008;                         /* stw r0, 8(r1) */
+    stub[n++] = 0x38010000 | MODULE_HOOK_FRAME;     /* addi r0, r1, FRAME */
+    stub[n++] = 0x9001000c;                         /* stw r0, 12(r1) */
+    for (i = 3; i <= 12; i++)                       /* stw ri, 8+4i(r1) */
+        stub[n++] = 0x90010000 | (i << 21) | (8 + 4 * i);
+    stub[n++] = 0x7c000026;                         /* mfcr r0 */
+    stub[n++] = 0x9001003c;                         /* stw r0, 60(r1) */
+    stub[n++] = 0x7c0102a6;                         /* mfxer r0 */
+    stub[n++] = 0x90010040;                         /* stw r0, 64(r1) */
+    stub[n++] = 0x7c0902a6;                         /* mfctr r0 */
+    stub[n++] = 0x90010044;                         /* stw r0, 68(r1) */
+    stub[n++] = 0x7c0802a6;                         /* mflr r0 */
+    stub[n++] = 0x90010048;                         /* stw r0, 72(r1) */
+    for (i = 0; i <= 13; i++)                       /* stfd fi, 80+8i(r1) */
+        stub[n++] = 0xd8010000 | (i << 21) | (80 + 8 * i);
+    
+    /* the handler may be anywhere, including MEM2. */
+    stub[n++] = 0x38610008;                         /* addi r3, r1, 8 */
+    stub[n++] = 0x3d800000 | (handler >> 16);       /* lis r12, handler@h */
+    stub[n++] = 0x618c0000 | (handler & 0xffff);    /* ori r12, handler@l */
+    stub[n++] = 0x7d8903a6;                         /* mtctr r12 */
+    stub[n++] = 0x4e800421;                         /* bctrl */
+    
+    for (i = 0; i <= 13; i++)                       /* lfd fi, 80+8i(r1) */
+        stub[n++] = 0xc8010000 | (i << 21) | (80 + 8 * i);
+    stub[n++] = 0x80010048;                         /* lwz r0, 72(r1) */
+    stub[n++] = 0x7c0803a6;                         /* mtlr r0 */
+    stub[n++] = 0x80010044;                         /* lwz r0, 68(r1) */
+    stub[n++] = 0x7c0903a6;                         /* mtctr r0 */
+    stub[n++] = 0x80010040;                         /* lwz r0, 64(r1) */
+    stub[n++] = 0x7c0103a6;                         /* mtxer r0 */
+    stub[n++] = 0x8001003c;                         /* lwz r0, 60(r1) */
+    stub[n++] = 0x7c0ff120;                         /* mtcrf 0xff, r0 */
+    for (i = 3; i <= 12; i++)                       /* lwz ri, 8+4i(r1) */
+        stub[n++] = 0x80010000 | (i << 21) | (8 + 4 * i);
+    stub[n++] = 0x80010008;                         /* lwz r0, 8(r1) */
+    stub[n++] = 0x38210000 | MODULE_HOOK_FRAME;     /* addi r1, r1, FRAME */
+    assert(n == MODULE_HOOK_SIZE);
+    
+    /* then the instruction the hook displaced, and back to the game. */
+    Module_Displace(data, stub + n);
+    
+    if (!Module_Branch((uint32_t)data, (uint32_t)stub, data)) {
+        printf(
+            "Could not reach the hook for '%s'\n", entry->data.function.name);
+        goto exit_error;
+    }
+    DCFlushRange((void *)((uint32_t)data & ~31), 32);
+    ICInvalidateRange((void *)((uint32_t)data & ~31), 32);
+    
+exit_success:
+    result = true;
+exit_error:
+    if (!result) printf("Module_ListLinkFinalHook: exit_error\n");
+    return result;
+}
+
+/* Where a hook goes, from its "symbol+offset" name, or NULL if the symbol is
+ * missing or the offset is malformed. */
+static uint32_t *Module_HookAddress(const bslug_loader_entry_t *entry) {
+    const char *plus;
+    char symbol[256], *end;
+    unsigned long offset;
+    uint8_t *data;
+    
+    plus = strrchr(entry->data.function.name, '+');
+    if (plus == NULL ||
+        (size_t)(plus - entry->data.function.name) >= sizeof(symbol))
+        return NULL;
+    
+    memcpy(symbol, entry->data.function.name,
+        plus - entry->data.function.name);
+    symbol[plus - entry->data.function.name] = '\0';
+    
+    offset = strtoul(plus + 1, &end, 0);
+    if (*end != '\0' || end == plus + 1 || (offset & 3) != 0)
+        return NULL;
+    
+    data = Search_SymbolLookup(symbol);
+    if (data == NULL)
+        return NULL;
+    
+    return (uint32_t *)(data + offset);
+}
@@ -29,6 +29,17 @@
 #include <stddef.h>
 
 #include "library/event.h"
+#include "library/sched.h"
+
+/* Which of a module's sections are placed in MEM2, from BSLUG_MODULE_MEM2.
+ * Sections declared with BSLUG_MEM2* always are. */
+typedef enum {
+    MODULE_MEM2_NONE,
+    /* everything but code. */
+    MODULE_MEM2_DATA,
+    /* everything but .bslug.load targets and .text.hot code. */
+    MODULE_MEM2_ALL
+} module_mem2_t;
 
 typedef struct {
     const char *path;
@@ -38,20 +49,47 @@ typedef struct {
     const char *version;
     const char *license;
     size_t size;
+    /* bytes of the module's space lost to alignment. */
+    size_t padding_size;
+    module_mem2_t mem2;
+    /* bytes of the module placed in MEM2 (not counted in size). */
+    size_t mem2_size;
+    /* where the module was placed, once linked. */
+    void *mem1_address;
+    void *mem2_address;
     size_t entries_count;
 } module_metadata_t;
 
+/* the modules have been loaded and sized, for the UI; module_list,
+ * module_list_size and the MEM2 region are final. */
 extern event_t module_event_list_loaded;
-extern event_t module_event_complete;
+/* as module_event_list_loaded, for other tasks. */
+extern sched_task_t *module_task_list_loaded;
+/* the modules are linked into the game; fails if they couldn't be. */
+extern sched_task_t *module_task_complete;
 extern bool module_has_error;
 /* whether or not to delay loading for debug messages. */
 extern bool module_has_info;
 
+/* The most module files that can be read ahead of linking. */
+#define MODULE_READ_QUEUE_MAX 8
+
+/* how many module files to read ahead of linking (1 reads then links each
+ * in turn). */
+extern int module_read_queue_depth;
+
 extern size_t module_list_size;
+extern size_t module_list_padding_size;
+/* the part of MEM2 reserved for modules, below the game's MEM2 arena. */
+extern size_t module_list_mem2_size;
+extern void *module_mem2_start;
 extern module_metadata_t **module_list;
 extern size_t module_list_count;
 
-bool Module_Init(void);
-bool Module_RunBackground(void);
+/* Make the modules' tasks on sched, for the other subsystems to depend
+ * on. */
+bool Module_Init(sched_t *sched);
+/* Give them their inputs and submit them, once every subsystem is Init. */
+bool Module_Schedule(void);
 
 #endif /* MODULE_H_ */
@@ -33,6 +33,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../library/trace.h"
+
 /* To be more efficient we construct a finite state machine (FSM) to do the
  * search. This is basically a flow chart that tells us what to do at each step.
  * The idea is constructing this is expensive and slow, but means we can search
@@ -61,12 +63,40 @@ struct fsm_t {
     unsigned int node_count;
 };
 
+/* FSM_Schedule's state. Each symbol's FSM is created up to FSM_BUILD_AHEAD
+ * symbols ahead of the merges, which have to go in order: merging is
+ * quadratic in the sizes of the two sides, so each merge takes one symbol into
+ * all those before it rather than pairing up halves. */
+#define FSM_BUILD_AHEAD 8
+
+struct fsm_build_t;
+
+typedef struct {
+    struct fsm_build_t *build;
+    symbol_index_t symbol;
+    fsm_t *fsm;
+} fsm_build_step_t;
+
+typedef struct fsm_build_t {
+    fsm_t **result;
+    /* the symbols merged so far. */
+    fsm_t *fsm;
+    bool failed;
+    /* whether every task was given its inputs. */
+    bool wired;
+    fsm_build_step_t steps[];
+} fsm_build_t;
+
 typedef struct {
     fsm_node_t *node;
     const fsm_node_t *left;
     const fsm_node_t *right;
     bool processed;
 } fsm_node_index_t;
+
+static bool FSM_BuildCreate(void *arg);
+static bool FSM_BuildMerge(void *arg);
+static bool FSM_BuildFinish(void *arg);
  
 static fsm_node_t *FSM_AllocNode(fsm_t *fsm) {
     fsm_node_t *node;
@@ -615,3 +645,115 @@ void FSM_Run(
     }
 }
 
+sched_task_t *FSM_Schedule(
+        sched_t *sched, symbol_index_t count, fsm_t **result) {
+    fsm_build_t *build;
+    sched_task_t *finish, *merge = NULL;
+    sched_task_t *merges[FSM_BUILD_AHEAD];
+    symbol_index_t i;
+    
+    build = malloc(sizeof(fsm_build_t) + count * sizeof(fsm_build_step_t));
+    if (build == NULL)
+        return NULL;
+    build->result = result;
+    build->fsm = NULL;
+    build->failed = false;
+    build->wired = true;
+    
+    finish = Sched_Task(sched, &FSM_BuildFinish, build);
+    if (finish == NULL) {
+        free(build);
+        return NULL;
+    }
+    
+    /* every task made has to be submitted, so a failure part way just stops
+     * adding symbols and lets finish report it. */
+    for (i = 0; i < count; i++) {
+        fsm_build_step_t *step = build->steps + i;
+        sched_task_t *create, *next;
+        
+        step->build = build;
+        step->symbol = i;
+        step->fsm = NULL;
+        
+        create = Sched_Task(sched, &FSM_BuildCreate, step);
+        next = create == NULL ? NULL : Sched_Task(sched, &FSM_BuildMerge, step);
+        if (next == NULL ||
+            (i >= FSM_BUILD_AHEAD && !Sched_Depend(
+                sched, create, merges[i % FSM_BUILD_AHEAD])) ||
+            !Sched_Depend(sched, next, create) ||
+            (merge != NULL && !Sched_Depend(sched, next, merge)))
+            build->wired = false;
+        if (create != NULL)
+            Sched_Submit(sched, create);
+        if (next != NULL) {
+            Sched_Submit(sched, next);
+            merges[i % FSM_BUILD_AHEAD] = next;
+            merge = next;
+        }
+        if (!build->wired)
+            break;
+    }
+    
+    if (merge != NULL && !Sched_Depend(sched, finish, merge))
+        build->wired = false;
+    Sched_Submit(sched, finish);
+    return finish;
+}
+
+static bool FSM_BuildCreate(void *arg) {
+    fsm_build_step_t *step = arg;
+    
+    Trace_Begin("fsm", "create");
+    step->fsm = FSM_Create(step->symbol);
+    Trace_End("fsm", "create");
+    return true;
+}
+
+/* Failures are left for FSM_BuildFinish, so every FSM made is freed. */
+static bool FSM_BuildMerge(void *arg) {
+    fsm_build_step_t *step = arg;
+    fsm_build_t *build = step->build;
+    fsm_t *merged;
+    
+    if (step->fsm == NULL || build->failed) {
+        build->failed = true;
+    } else if (build->fsm == NULL) {
+        build->fsm = step->fsm;
+        step->fsm = NULL;
+    } else {
+        Trace_Begin("fsm", "merge");
+        merged = FSM_Merge(build->fsm, step->fsm);
+        Trace_End("fsm", "merge");
+        FSM_Free(build->fsm);
+        build->fsm = merged;
+        if (merged == NULL)
+            build->failed = true;
+    }
+    
+    if (step->fsm != NULL)
+        FSM_Free(step->fsm);
+    step->fsm = NULL;
+    return true;
+}
+
+static bool FSM_BuildFinish(void *arg) {
+    fsm_build_t *build = arg;
+    bool result;
+    
+    /* tasks left without their inputs may still be running, so on that path
+     * (only reached when out of memory) nothing can be freed. */
+    if (!build->wired) {
+        *build->result = NULL;
+        return false;
+    }
+    
+    result = !build->failed;
+    if (!result && build->fsm != NULL) {
+        FSM_Free(build->fsm);
+        build->fsm = NULL;
+    }
+    *build->result = build->fsm;
+    free(build);
+    return result;
+}
@@ -32,6 +32,7 @@
 #include <stdint.h>
 
 #include "symbol.h"
+#include "../library/sched.h"
 
 typedef struct fsm_t fsm_t;
 
@@ -44,5 +45,12 @@ void FSM_Free(fsm_t *fsm);
 void FSM_Run(
     const fsm_t *fsm, uint8_t *data,
     size_t length, fsm_match_t match_fn);
+/* Build the FSM for symbols 0 to count - 1 on sched, a task creating each
+ * symbol's FSM and a chain of tasks merging them in order. Returns the last
+ * task, already submitted, which sets *result and fails if the FSM couldn't
+ * be built; NULL if nothing could be scheduled. The symbols must not change
+ * until it finishes. */
+sched_task_t *FSM_Schedule(
+    sched_t *sched, symbol_index_t count, fsm_t **result);
 
 #endif /* FSM_H_ */
@@ -27,9 +27,8 @@
  
 #include "search.h"
 
+#include <assert.h>
 #include <dirent.h>
-#include <errno.h>
-#include <ogc/lwp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,11 +36,11 @@
 
 #include "apploader/apploader.h"
 #include "library/dolphin_os.h"
-#include "library/event.h"
+#include "library/sched.h"
+#include "library/trace.h"
 #include "search/fsm.h"
 #include "search/symbol.h"
 #include "main.h"
-#include "threads.h"
 
 typedef struct {
     void *address;
@@ -52,6 +51,13 @@ typedef struct {
     const char *name;
 } search_module_symbol_t;
 
+/* A symbol file, read by Search_FileRead while the ones before it are parsed
+ * (Search_FileParse). */
+typedef struct {
+    const char *path;
+    char *data;
+} search_file_t;
+
 search_symbol_global_t *search_symbol_globals;
 
 #define SEARCH_MODULE_SYMBOLS_CAPACITY_DEFAULT 128
@@ -62,7 +68,8 @@ size_t search_module_symbols_count = 0;
 size_t search_module_symbols_capacity = 0;
 size_t search_module_symbols_sorted = 0;
 
-event_t search_event_complete;
+sched_task_t *search_task_symbols_loaded;
+sched_task_t *search_task_complete;
 
 bool search_has_error;
 bool search_has_info;
@@ -73,89 +80,80 @@ static const char search_path[] = APP_PATH  "/symbols";
 
 static void *search_symbol__start;
 
-static void *Search_Main(void *arg);
-static void Search_SymbolsLoad(void);
+/* Symbol files are read on one task while the ones before them are parsed
+ * on another, at most SEARCH_READ_QUEUE_DEPTH files ahead. Parsing adds to
+ * the symbol list, so goes through the files in order. */
+#define SEARCH_READ_QUEUE_DEPTH 2
+
+#define SEARCH_FILES_CAPACITY_DEFAULT 16
+
+static search_file_t *search_files = NULL;
+static size_t search_files_count = 0;
+static size_t search_files_capacity = 0;
+
+static sched_t *search_sched = NULL;
+static sched_task_t *search_task_scan;
+
+static bool Search_Scan(void *arg);
 static void Search_CheckDirectory(char *path);
 static void Search_CheckFile(const char *path);
-static void Search_Load(const char *path);
-static bool Search_BuildFSM(void);
+static bool Search_FilesSchedule(void);
+static bool Search_FileRead(void *arg);
+static bool Search_FileParse(void *arg);
+static bool Search_SymbolsLoaded(void *arg);
+static bool Search_Run(void *arg);
 static void Search_SymbolMatch(symbol_index_t symbol, uint8_t *addr);
 static int Search_ModuleSymbolCompare(const void *left, const void *right);
 
-bool Search_Init(void) {
-    return Event_Init(&search_event_complete);
+bool Search_Init(sched_t *sched) {
+    search_sched = sched;
+    search_task_scan = Sched_Task(sched, &Search_Scan, NULL);
+    search_task_symbols_loaded =
+        Sched_Task(sched, &Search_SymbolsLoaded, NULL);
+    search_task_complete = Sched_Task(sched, &Search_Run, NULL);
+    
+    return
+        search_task_scan != NULL &&
+        search_task_symbols_loaded != NULL &&
+        search_task_complete != NULL;
 }
 
-bool Search_RunBackground(void) {
-    int ret;
-    lwp_t thread;
-    
-    ret = LWP_CreateThread(
-        &thread, &Search_Main,
-        NULL, NULL, 32 * 1024, THREAD_PRIO_IO);
-        
-    if (ret) {
-        errno = ENOMEM;
+bool Search_Schedule(void) {
+    /* subdirectories are matched against the game's ID, so the scan also
+     * needs the disc. */
+    if (!Sched_Depend(search_sched, search_task_scan, main_task_fat_loaded) ||
+        !Sched_Depend(
+            search_sched, search_task_scan, apploader_task_disk_id) ||
+        !Sched_Depend(
+            search_sched, search_task_complete, search_task_symbols_loaded) ||
+        !Sched_Depend(search_sched, search_task_complete, apploader_task_game))
         return false;
-    }
     
+    /* the scan submits search_task_symbols_loaded, and that
+     * search_task_complete, once they know all their inputs. */
+    Sched_Submit(search_sched, search_task_scan);
     return true;
 }
 
-static void *Search_Main(void *arg) {
-    Search_SymbolsLoad();
-    
-    if (symbol_count > 0) {
-        symbol_index_t i;
-        
-        if (!Search_BuildFSM())
-           goto exit_error;
-        
-        assert(search_fsm != NULL);
-        
-        search_symbol_globals =
-            malloc(symbol_count * sizeof(*search_symbol_globals));
-        
-        for (i = 0; i < symbol_count; i++) {
-            search_symbol_globals[i].address = NULL;
-            search_symbol_globals[i].search_fail = false;
-        }
-        
-        Event_Wait(&apploader_event_complete);
-        
-        if (apploader_app0_start != NULL) {
-            assert(apploader_app0_end != NULL);
-            assert(apploader_app0_end >= apploader_app0_start);
-            
-            FSM_Run(
-                search_fsm, apploader_app0_start,
-                apploader_app0_end - apploader_app0_start,
-                &Search_SymbolMatch);
-        }
-        
-        FSM_Free(search_fsm);
-        search_fsm = NULL;
-    }
-    
-    Event_Trigger(&search_event_complete);
-    return NULL;
-exit_error:
-    printf("Search_Main: exit_error\n");
-    search_has_error = true;
-    Event_Trigger(&search_event_complete);
-    return NULL;
-}
-
-static void Search_SymbolsLoad(void) {
+/* Runs before anything waiting on module_event_list_loaded, as do the tasks
+ * it makes, so never fails; errors are left in search_has_error. */
+static bool Search_Scan(void *arg) {
     char path[FILENAME_MAX];
 
-    Event_Wait(&main_event_fat_loaded);
-    
     assert(sizeof(path) > sizeof(search_path));
     
+    Trace_Begin("phase", "scan symbols");
     strcpy(path, search_path);
-    
     Search_CheckDirectory(path);
+    Trace_End("phase", "scan symbols");
+    
+    if (!Search_FilesSchedule()) {
+        printf("Search_Scan: Couldn't schedule symbol loading.\n");
+        search_has_error = true;
+    }
+    
+    Sched_Submit(search_sched, search_task_symbols_loaded);
+    return true;
 }
 
 static void Search_CheckDirectory(char *path) {
@@ -194,8 +192,6 @@ static void Search_CheckDirectory(char *path) {
                         strcmp(entry->d_name, "..") == 0)
                         break;
                     
-                    Event_Wait(&apploader_event_disk_id);
-                    
                     /* load directories with a prefix match on the game name:
                      * e.g. load directory RMC for game RMCP. */
                     if (strncmp(os0->disc.gamename, entry->d_name,
@@ -242,69 +238,199 @@ static void Search_CheckFile(const char *path) {
     assert(extension != NULL);
     
     if (strcmp(extension, "xml") == 0) {
-        Search_Load(path);
+        search_file_t *file;
+        
+        if (search_files_count == search_files_capacity) {
+            size_t capacity;
+            void *alloc;
+            
+            capacity = search_files_capacity == 0 ?
+                SEARCH_FILES_CAPACITY_DEFAULT : search_files_capacity * 2;
+            alloc = realloc(search_files, sizeof(search_file_t) * capacity);
+            if (alloc == NULL)
+                goto exit_error;
+            
+            search_files = alloc;
+            search_files_capacity = capacity;
+        }
+        
+        file = search_files + search_files_count;
+        file->path = strdup(path);
+        file->data = NULL;
+        if (file->path == NULL)
+            goto exit_error;
+        search_files_count++;
     }
+    return;
+exit_error:
+    printf("Could not load symbol file %s.\n", path);
+    search_has_info = true;
 }
 
-static void Search_Load(const char *path) {
-    FILE *file = NULL;
+/* Make the read and parse tasks for each file found, and give them to
+ * search_task_symbols_loaded. */
+static bool Search_FilesSchedule(void) {
+    sched_task_t *parse = NULL;
+    sched_task_t *parses[SEARCH_READ_QUEUE_DEPTH];
+    size_t i;
+    bool result = true;
+    
+    /* every task made has to be submitted, so a failure part way just stops
+     * adding files. */
+    for (i = 0; i < search_files_count && result; i++) {
+        sched_task_t *read, *next;
+        
+        read = Sched_Task(search_sched, &Search_FileRead, search_files + i);
+        next = read == NULL ? NULL : Sched_Task(
+            search_sched, &Search_FileParse, search_files + i);
+        if (next == NULL ||
+            (i >= SEARCH_READ_QUEUE_DEPTH && !Sched_Depend(
+                search_sched, read, parses[i % SEARCH_READ_QUEUE_DEPTH])) ||
+            !Sched_Depend(search_sched, next, read) ||
+            (parse != NULL && !Sched_Depend(search_sched, next, parse)))
+            result = false;
+        
+        if (read != NULL)
+            Sched_Submit(search_sched, read);
+        if (next != NULL) {
+            Sched_Submit(search_sched, next);
+            parses[i % SEARCH_READ_QUEUE_DEPTH] = next;
+            parse = next;
+        }
+    }
+    
+    if (parse != NULL &&
+        !Sched_Depend(search_sched, search_task_symbols_loaded, parse))
+        result = false;
+    return result;
+}
+
+static bool Search_FileRead(void *arg) {
+    search_file_t *file = arg;
+    FILE *stream = NULL;
+    long length;
+    
+    Trace_Begin("phase", "read symbols");
     
-    file = fopen(path, "r");
-    if (file == NULL)
+    stream = fopen(file->path, "rb");
+    if (stream == NULL)
         goto exit_error;
     
-    if (!Symbol_ParseFile(file)) {
-        printf("Could not load symbol file %s.\n", path);
-        search_has_info = true;
+    if (fseek(stream, 0, SEEK_END) != 0)
+        goto exit_error;
+    length = ftell(stream);
+    if (length < 0 || fseek(stream, 0, SEEK_SET) != 0)
+        goto exit_error;
+    
+    file->data = malloc(length + 1);
+    if (file->data == NULL)
+        goto exit_error;
+    
+    if (fread(file->data, 1, length, stream) != (size_t)length) {
+        free(file->data);
+        file->data = NULL;
         goto exit_error;
     }
+    file->data[length] = '\0';
     
 exit_error:
-    if (file != NULL)
-        fclose(file);
+    if (stream != NULL)
+        fclose(stream);
+    Trace_End("phase", "read symbols");
+    return true;
 }
 
-static bool Search_BuildFSM(void) {
-    bool result = false;
-    symbol_index_t i;
-    fsm_t *fsm_final = NULL;
+static bool Search_FileParse(void *arg) {
+    search_file_t *file = arg;
+    
+    Trace_Begin("phase", "parse symbols");
+    if (file->data == NULL || !Symbol_ParseString(file->data)) {
+        printf("Could not load symbol file %s.\n", file->path);
+        search_has_info = true;
+    }
+    Trace_End("phase", "parse symbols");
     
-    for (i = 0; i < symbol_count; i++) {
-        fsm_t *fsm;
+    free(file->data);
+    file->data = NULL;
+    return true;
+}
 
-        fsm = FSM_Create(i);
-        if (fsm == NULL)
-            goto exit_error;
+/* The symbols are final, so schedule building the FSM. Like Search_Scan,
+ * never fails. */
+static bool Search_SymbolsLoaded(void *arg) {
+    size_t i;
+    
+    /* if the scan couldn't give this task all the file tasks as inputs, some
+     * may still be running, so the list is left alone. */
+    if (search_has_error)
+        goto exit;
+    
+    for (i = 0; i < search_files_count; i++)
+        free((char *)search_files[i].path);
+    free(search_files);
+    search_files = NULL;
+    search_files_count = 0;
+    search_files_capacity = 0;
+    
+    if (symbol_count > 0) {
+        sched_task_t *build;
+        symbol_index_t j;
         
-        if (fsm_final == NULL) {
-            fsm_final = fsm;
-        } else {
-            fsm_t *fsm_merge;
-            
-            fsm_merge = FSM_Merge(fsm_final, fsm);
-            if (fsm_merge == NULL) {
-                FSM_Free(fsm);
-                goto exit_error;
-            }
-            
-            FSM_Free(fsm);
-            FSM_Free(fsm_final);
-            
-            fsm_final = fsm_merge;
+        search_symbol_globals =
+            malloc(symbol_count * sizeof(*search_symbol_globals));
+        if (search_symbol_globals == NULL) {
+            search_has_error = true;
+            goto exit;
+        }
+        
+        for (j = 0; j < symbol_count; j++) {
+            search_symbol_globals[j].address = NULL;
+            search_symbol_globals[j].search_fail = false;
+        }
+        
+        /* the size index is built on first use, so do that here rather than
+         * in the FSM tasks, which run in parallel. */
+        Symbol_GetSymbolSize(0);
+        
+        Trace_Begin("phase", "schedule fsm");
+        build = FSM_Schedule(search_sched, symbol_count, &search_fsm);
+        Trace_End("phase", "schedule fsm");
+        if (build == NULL ||
+            !Sched_Depend(search_sched, search_task_complete, build)) {
+            printf("Search_SymbolsLoaded: Couldn't schedule the FSM.\n");
+            search_has_error = true;
         }
     }
     
-    /* store the final result and make sure we don't free it!! */
-    search_fsm = fsm_final;
-    fsm_final = NULL;
+exit:
+    Sched_Submit(search_sched, search_task_complete);
+    return true;
+}
+
+static bool Search_Run(void *arg) {
+    if (search_has_error) {
+        printf("Search_Run: exit_error\n");
+        return false;
+    }
     
-    result = true;
-exit_error:
-	if (!result)
-		printf("Search_BuildFSM: exit_error\n");
-    if (fsm_final != NULL)
-        FSM_Free(fsm_final);
-    return result;
+    if (search_fsm == NULL)
+        return true;
+    
+    if (apploader_app0_start != NULL) {
+        assert(apploader_app0_end != NULL);
+        assert(apploader_app0_end >= apploader_app0_start);
+        
+        Trace_Begin("phase", "run fsm");
+        FSM_Run(
+            search_fsm, apploader_app0_start,
+            apploader_app0_end - apploader_app0_start,
+            &Search_SymbolMatch);
+        Trace_End("phase", "run fsm");
+    }
+    
+    FSM_Free(search_fsm);
+    search_fsm = NULL;
+    return true;
 }
 
 static void Search_SymbolMatch(symbol_index_t symbol, uint8_t *addr) {
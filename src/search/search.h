@@ -30,15 +30,20 @@
 
 #include <stdbool.h>
 
-#include "library/event.h"
+#include "library/sched.h"
 
-extern event_t search_event_complete;
+/* the symbol files have been read, so symbol_count is final. */
+extern sched_task_t *search_task_symbols_loaded;
+/* the game has been searched for the symbols; fails if it couldn't be. */
+extern sched_task_t *search_task_complete;
 extern bool search_has_error;
 /* whether or not to delay loading for debug messages. */
 extern bool search_has_info;
 
-bool Search_Init(void);
-bool Search_RunBackground(void);
+/* Make the search's tasks on sched, for the other subsystems to depend on. */
+bool Search_Init(sched_t *sched);
+/* Give them their inputs and submit them, once every subsystem is Init. */
+bool Search_Schedule(void);
 
 bool Search_SymbolAdd(const char *name, void *address);
 bool Search_SymbolReplace(const char *name, void *address);
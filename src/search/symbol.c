@@ -78,6 +78,7 @@ static symbol_t *symbol_globals_free = NULL;
 static symbol_size_index_entry_t *symbol_size_index = NULL;
 static symbol_alphabetical_index_entry_t *symbol_alphabetical_index = NULL;
 
+static bool Symbol_ParseTree(mxml_node_t *xml_tree);
 static symbol_t *Symbol_AllocSymbol(const char *name, size_t name_length);
 static symbol_relocation_t *Symbol_AddRelocation(
     symbol_t *symbol, const char *target,
@@ -92,13 +93,20 @@ symbol_t *Symbol_GetSymbol(symbol_index_t index) {
 }
 
 bool Symbol_ParseFile(FILE *file) {
+    return Symbol_ParseTree(mxmlLoadFile(NULL, file, MXML_TEXT_CALLBACK));
+}
+
+bool Symbol_ParseString(const char *data) {
+    return Symbol_ParseTree(mxmlLoadString(NULL, data, MXML_TEXT_CALLBACK));
+}
+
+/* Takes ownership of xml_tree, which may be NULL if it couldn't be loaded. */
+static bool Symbol_ParseTree(mxml_node_t *xml_tree) {
     bool result = false, set_debug;
-    mxml_node_t *xml_tree = NULL;
     mxml_node_t *xml_symbols = NULL;
     mxml_node_t *xml_symbol = NULL;
     const char *debug;
 
-    xml_tree = mxmlLoadFile(NULL, file, MXML_TEXT_CALLBACK);
     if (xml_tree == NULL)
         goto exit_error;
     /* <symbols> root element */
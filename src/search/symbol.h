@@ -64,5 +64,7 @@ symbol_t *Symbol_GetSymbolSize(symbol_index_t index);
 symbol_t *Symbol_GetSymbolAlphabetical(symbol_alphabetical_index_t index);
 symbol_alphabetical_index_t Symbol_SearchSymbol(const char *name);
 bool Symbol_ParseFile(FILE *file);
+/* As Symbol_ParseFile, for a file already read into memory. */
+bool Symbol_ParseString(const char *data);
 
 #endif /* SYMBOL_H_ */
@@ -32,6 +32,7 @@
 #include <unistd.h>
 
 #include "main.h"
+#include "modules/module.h"
 
 typedef struct settings_fileParseState_t {
   const settings_category_t *category;
@@ -49,11 +50,19 @@ static settings_value_t network_settings[] = {
     { 0, "host_ip", &host_ip, settings_variableType_ip },
     { 0, "port", &port, settings_variableType_int },
 };
+static settings_value_t loader_settings[] = {
+    { 1, "read_queue_depth", &module_read_queue_depth,
+      settings_variableType_int, 1, MODULE_READ_QUEUE_MAX,
+      "Module files read ahead while linking (1 to 8)" },
+    { 1, "trace", &main_trace, settings_variableType_bool, 0, 1,
+      "Write the boot timeline to trace.json (0 or 1)" },
+};
 
 #define SETTINGS_CATEGORY(x) { #x, x ## _settings, sizeof(x ## _settings) / sizeof(settings_value_t) }
 
 const settings_category_t settings_categories[] = {
     SETTINGS_CATEGORY(network),
+    SETTINGS_CATEGORY(loader),
 };
 const unsigned int settings_categoriesCount = sizeof(settings_categories)
     / sizeof(settings_category_t);
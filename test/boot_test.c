@@ -0,0 +1,945 @@
+/* boot_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The boot path from disc to linked modules, run on the host against a disc
+ * image held in memory: the apploader's reads through the DI queue, the
+ * symbol search over the loaded game, and linking modules against what it
+ * found. They run as the same graph of tasks on the scheduler as on the Wii,
+ * and the timeline is recorded with the same phase names, so loader changes
+ * can be measured without a console.
+ *
+ * The game's apploader is PowerPC code, so it is stood in for by reading the
+ * regions a retail apploader asks for: the boot header, the DOL sections and
+ * the FST. BootTest_Image reads a decrypted partition image named by the
+ * BSLUG_DISC_IMAGE environment variable; BSLUG_DISC_LATENCY adds that many
+ * microseconds to each read, and BSLUG_BOOT_TRACE names a file to write the
+ * timeline to as JSON. BSLUG_SD_LATENCY adds microseconds to each module
+ * read, and BSLUG_READ_QUEUE_DEPTH sets how far they run ahead of linking,
+ * as read_queue_depth in config.ini does.
+ */
+
+#include "boot_test.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/apploader/apploader_image.c"
+#include "../src/di/di_queue.h"
+#include "../src/library/sched.h"
+#include "../src/library/trace.h"
+#include "../src/modules/link.h"
+#include "../src/search/fsm.h"
+#include "../src/search/symbol.h"
+#include "link_test.h"
+
+/* FSM_Create reads symbols from here in the regression build; see
+ * fsm_test.c. */
+extern symbol_t fsm_test_symbol[4];
+
+#define BOOT_TEST_SYMBOLS 4
+#define BOOT_TEST_MODULES 16
+#define BOOT_TEST_CALLS 1024
+/* As MAIN_SCHED_THREADS in main.c. */
+#define BOOT_TEST_THREADS 4
+/* As MODULE_READ_QUEUE_DEPTH in module.c. */
+#define BOOT_TEST_READ_QUEUE_DEPTH 2
+
+#define BOOT_TEST_MEM1 0x80000000
+#define BOOT_TEST_MEM1_SIZE 0x01800000
+#define BOOT_TEST_MODULE_SPACE 0x00100000
+
+/* As in apploader.c. */
+#define BOOT_TEST_APPLOADER 0x81200000
+#define BOOT_TEST_APP0_BOUNDARY 0x81200000
+#define BOOT_TEST_APP1_BOUNDARY 0x81400000
+/* Where the test disc keeps its partition info and boot partition. */
+#define BOOT_TEST_PARTITION_INFO_OFFSET 0x00010008
+#define BOOT_TEST_PARTITION 0x00050000
+
+/* The synthetic partition: a 4MiB text and 1MiB data section DOL. */
+#define BOOT_TEST_DOL_OFFSET 0x00020000
+#define BOOT_TEST_TEXT_ADDRESS 0x80004000
+#define BOOT_TEST_TEXT_SIZE 0x00400000
+#define BOOT_TEST_DATA_ADDRESS 0x80404000
+#define BOOT_TEST_DATA_SIZE 0x00100000
+#define BOOT_TEST_FST_SIZE 0x00001000
+#define BOOT_TEST_APPLOADER_SIZE 0x00001800
+
+#define BOOT_TEST_DOL_SECTIONS 18
+
+typedef struct {
+    di_request_t *request;
+    bool unencrypted;
+} boot_test_pending_t;
+
+/* Stands in for IOS and the drive: a thread serving reads in order from the
+ * image. */
+typedef struct {
+    const uint8_t *partition;
+    size_t partition_size;
+    /* the disc's TOC and partition info, at byte 0x40000. */
+    uint8_t header[0x40];
+    unsigned latency;
+    
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    boot_test_pending_t pending[DI_QUEUE_DEPTH];
+    size_t pending_start;
+    size_t pending_count;
+    bool stop;
+    size_t reads;
+    uint64_t bytes;
+} boot_test_disc_t;
+
+typedef struct {
+    const char *name;
+    size_t offset;
+    uint32_t address;
+    bool found;
+} boot_test_deferred_t;
+
+/* Passed through Link_ElfLinkModule to BootTest_Defer. */
+typedef struct {
+    boot_test_deferred_t *next;
+    const uint32_t *addresses;
+} boot_test_link_t;
+
+static boot_test_disc_t boot_test_disc;
+static uint8_t *boot_test_mem1;
+static uint8_t *boot_test_app0_start, *boot_test_app0_end;
+static uint32_t boot_test_found[BOOT_TEST_SYMBOLS];
+static bool boot_test_failed;
+static bool boot_test_check;
+
+static sched_t *boot_test_sched;
+static sched_task_t *boot_test_search_run;
+static di_queue_t boot_test_queue;
+static char *boot_test_symbols;
+static fsm_t *boot_test_fsm;
+static uint8_t *boot_test_modules[BOOT_TEST_MODULES];
+static size_t boot_test_sizes[BOOT_TEST_MODULES];
+static boot_test_deferred_t *boot_test_deferred;
+static boot_test_link_t boot_test_link;
+/* where the next module section goes, from the top of MEM1 down. */
+static uint32_t boot_test_space;
+/* module reads run this many files ahead of linking. */
+static size_t boot_test_read_depth;
+/* the SD card serves one read at a time, each taking this many us. */
+static pthread_mutex_t boot_test_sd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned boot_test_sd_latency;
+/* from the first module read starting to the last link finishing. */
+static uint64_t boot_test_modules_start, boot_test_modules_end;
+
+static const char *const boot_test_symbol_names[BOOT_TEST_SYMBOLS] = {
+    "BootTest_Function0", "BootTest_Function1",
+    "BootTest_Function2", "BootTest_Function3",
+};
+
+static uint64_t BootTest_Clock(void) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint32_t BootTest_Thread(void) {
+    return (uint32_t)(uintptr_t)pthread_self();
+}
+
+static uint8_t *BootTest_Memory(uint32_t address) {
+    return boot_test_mem1 + (address - BOOT_TEST_MEM1);
+}
+
+static bool BootTest_InMemory(uint32_t address, uint32_t size) {
+    return
+        address >= BOOT_TEST_MEM1 &&
+        size <= BOOT_TEST_MEM1_SIZE - BOOT_TEST_MODULE_SPACE &&
+        address - BOOT_TEST_MEM1 <=
+            BOOT_TEST_MEM1_SIZE - BOOT_TEST_MODULE_SPACE - size;
+}
+
+/* The code of each planted function: a prologue, a distinct li r3 and an
+ * epilogue. */
+static void BootTest_SymbolCode(size_t symbol, uint8_t *code) {
+    static const uint32_t words[8] = {
+        0x9421ffe0, 0x7c0802a6, 0x90010024, 0x93e1001c,
+        0x38600000, 0x83e1001c, 0x38210020, 0x4e800020,
+    };
+    size_t i;
+    
+    for (i = 0; i < 8; i++)
+        Link_Write32(code + i * 4, words[i] | (i == 4 ? 0x100 + symbol : 0));
+}
+
+static uint32_t BootTest_SymbolAddress(size_t symbol) {
+    return BOOT_TEST_TEXT_ADDRESS + 0x1230 + symbol * 0xf0000;
+}
+
+static uint8_t *BootTest_ImageBuild(size_t *size) {
+    uint8_t *image, *dol;
+    size_t text_offset, data_offset, fst_offset, i;
+    uint32_t seed = 1;
+    
+    text_offset = BOOT_TEST_DOL_OFFSET + 0x100;
+    data_offset = text_offset + BOOT_TEST_TEXT_SIZE;
+    fst_offset = data_offset + BOOT_TEST_DATA_SIZE;
+    *size = fst_offset + BOOT_TEST_FST_SIZE;
+    
+    image = calloc(1, *size);
+    if (image == NULL)
+        return NULL;
+    
+    memcpy(image, "RBSE01", 6);
+    Link_Write32(image + 0x420, BOOT_TEST_DOL_OFFSET >> 2);
+    Link_Write32(image + 0x424, fst_offset >> 2);
+    Link_Write32(image + 0x428, BOOT_TEST_FST_SIZE >> 2);
+    
+    memcpy(image + 0x2440, "2014/01/01", 10);
+    Link_Write32(image + 0x2450, BOOT_TEST_APPLOADER);
+    Link_Write32(image + 0x2454, BOOT_TEST_APPLOADER_SIZE);
+    memset(image + 0x2460, 0x60, BOOT_TEST_APPLOADER_SIZE);
+    
+    dol = image + BOOT_TEST_DOL_OFFSET;
+    Link_Write32(dol + 0x00, text_offset - BOOT_TEST_DOL_OFFSET);
+    Link_Write32(dol + 0x1c, data_offset - BOOT_TEST_DOL_OFFSET);
+    Link_Write32(dol + 0x48, BOOT_TEST_TEXT_ADDRESS);
+    Link_Write32(dol + 0x64, BOOT_TEST_DATA_ADDRESS);
+    Link_Write32(dol + 0x90, BOOT_TEST_TEXT_SIZE);
+    Link_Write32(dol + 0xac, BOOT_TEST_DATA_SIZE);
+    Link_Write32(dol + 0xe0, BOOT_TEST_TEXT_ADDRESS);
+    
+    /* noise no symbol's pattern will match, then the symbols. */
+    for (i = text_offset; i < fst_offset; i += 4) {
+        seed = seed * 1103515245 + 12345;
+        Link_Write32(image + i, seed);
+    }
+    for (i = 0; i < BOOT_TEST_SYMBOLS; i++)
+        BootTest_SymbolCode(
+            i, image + text_offset +
+                BootTest_SymbolAddress(i) - BOOT_TEST_TEXT_ADDRESS);
+    
+    return image;
+}
+
+static void BootTest_DiscCopy(
+        uint8_t *destination, const uint8_t *source, size_t source_size,
+        uint64_t offset, size_t length) {
+    /* past the end reads as zeros, rather than failing forever. */
+    memset(destination, 0, length);
+    if (offset < source_size) {
+        if (length > source_size - offset)
+            length = source_size - offset;
+        memcpy(destination, source + offset, length);
+    }
+}
+
+static void *BootTest_DiscMain(void *arg) {
+    boot_test_disc_t *disc = arg;
+    
+    pthread_mutex_lock(&disc->mutex);
+    while (1) {
+        boot_test_pending_t pending;
+        di_request_t *request;
+        uint64_t offset;
+        
+        while (disc->pending_count == 0 && !disc->stop)
+            pthread_cond_wait(&disc->cond, &disc->mutex);
+        if (disc->pending_count == 0)
+            break;
+        pending = disc->pending[disc->pending_start];
+        disc->pending_start = (disc->pending_start + 1) % DI_QUEUE_DEPTH;
+        disc->pending_count--;
+        pthread_mutex_unlock(&disc->mutex);
+        
+        request = pending.request;
+        offset = (uint64_t)request->offset << 2;
+        if (disc->latency > 0)
+            usleep(disc->latency);
+        if (pending.unencrypted) {
+            if (offset >= 0x40000)
+                BootTest_DiscCopy(
+                    request->buffer, disc->header, sizeof(disc->header),
+                    offset - 0x40000, request->length);
+            else
+                memset(request->buffer, 0, request->length);
+        } else {
+            BootTest_DiscCopy(
+                request->buffer, disc->partition, disc->partition_size,
+                offset, request->length);
+        }
+        
+        pthread_mutex_lock(&disc->mutex);
+        disc->reads++;
+        disc->bytes += request->length;
+        pthread_mutex_unlock(&disc->mutex);
+        DIQueue_Complete(request, request->length);
+        pthread_mutex_lock(&disc->mutex);
+    }
+    pthread_mutex_unlock(&disc->mutex);
+    
+    return NULL;
+}
+
+static int BootTest_DiscStart(di_request_t *request, bool unencrypted) {
+    boot_test_disc_t *disc = &boot_test_disc;
+    size_t slot;
+    
+    pthread_mutex_lock(&disc->mutex);
+    if (disc->pending_count == DI_QUEUE_DEPTH) {
+        pthread_mutex_unlock(&disc->mutex);
+        return -1;
+    }
+    slot = (disc->pending_start + disc->pending_count) % DI_QUEUE_DEPTH;
+    disc->pending[slot].request = request;
+    disc->pending[slot].unencrypted = unencrypted;
+    disc->pending_count++;
+    pthread_cond_signal(&disc->cond);
+    pthread_mutex_unlock(&disc->mutex);
+    
+    return 0;
+}
+
+static int BootTest_ReadStart(di_request_t *request) {
+    return BootTest_DiscStart(request, false);
+}
+
+static int BootTest_ReadUnencryptedStart(di_request_t *request) {
+    return BootTest_DiscStart(request, true);
+}
+
+/* The emulated drive, in place of IOS; the host has no caches to manage. */
+static const apploader_image_t boot_test_image = {
+    &BootTest_ReadUnencryptedStart, &BootTest_ReadStart, NULL, NULL
+};
+
+/* One region a retail apploader asks for, handled as Apploader_Game does. */
+static void BootTest_ReadGame(
+        di_queue_t *queue, uint8_t *destination, uint32_t length,
+        uint32_t offset) {
+    Trace_Begin("dvd", "read game");
+    ApploaderImage_ReadGame(
+        queue, &boot_test_image, destination, length, offset);
+    Trace_End("dvd", "read game");
+}
+
+/* The apploader's tasks, as in apploader.c: finding and reading the game's
+ * apploader, then the game once the modules are loaded. */
+static bool BootTest_ApploaderLoad(void *arg) {
+    uint32_t partition, entry;
+    
+    if (!DIQueue_Init(&boot_test_queue, boot_test_image.read_unencrypted))
+        goto exit_error;
+    partition = ApploaderImage_BootPartition(
+        &boot_test_queue, &boot_test_image);
+    DIQueue_Destroy(&boot_test_queue);
+    if (partition != BOOT_TEST_PARTITION) {
+        printf("Boot partition at %x.\n", (unsigned)partition);
+        goto exit_error;
+    }
+    
+    if (!DIQueue_Init(&boot_test_queue, boot_test_image.read))
+        goto exit_error;
+    
+    Trace_Begin("dvd", "read apploader");
+    entry = ApploaderImage_ReadApploader(
+        &boot_test_queue, BootTest_Memory(BOOT_TEST_APPLOADER),
+        BOOT_TEST_APP1_BOUNDARY - BOOT_TEST_APPLOADER);
+    Trace_End("dvd", "read apploader");
+    if (entry == 0) {
+        DIQueue_Destroy(&boot_test_queue);
+        goto exit_error;
+    }
+    
+    return true;
+exit_error:
+    printf("BootTest_ApploaderLoad: exit_error\n");
+    return false;
+}
+
+static bool BootTest_ApploaderGame(void *arg) {
+    uint8_t boot[0x440], dol[0x100];
+    uint32_t size, fst_offset, fst_size, fst_address;
+    size_t i;
+    
+    /* what a retail apploader asks for: the boot header, the DOL header,
+     * each DOL section and the FST. */
+    BootTest_ReadGame(&boot_test_queue, boot, sizeof(boot), 0);
+    BootTest_ReadGame(
+        &boot_test_queue, dol, sizeof(dol), Link_Read32(boot + 0x420));
+    
+    for (i = 0; i < BOOT_TEST_DOL_SECTIONS; i++) {
+        uint32_t offset, address;
+        
+        offset = Link_Read32(dol + i * 4);
+        address = Link_Read32(dol + 0x48 + i * 4);
+        size = Link_Read32(dol + 0x90 + i * 4);
+        if (size == 0)
+            continue;
+        if (!BootTest_InMemory(address, size)) {
+            printf("DOL section %u out of range.\n", (unsigned)i);
+            goto exit_error;
+        }
+        
+        if (address < BOOT_TEST_APP0_BOUNDARY)
+            ApploaderImage_Extend(
+                &boot_test_app0_start, &boot_test_app0_end,
+                BootTest_Memory(address), size);
+        BootTest_ReadGame(
+            &boot_test_queue, BootTest_Memory(address), size,
+            Link_Read32(boot + 0x420) + offset / 4);
+    }
+    
+    fst_offset = Link_Read32(boot + 0x424);
+    fst_size = Link_Read32(boot + 0x428) << 2;
+    fst_address = (
+        BOOT_TEST_MEM1 + BOOT_TEST_MEM1_SIZE - BOOT_TEST_MODULE_SPACE -
+        fst_size) & ~31;
+    if (!BootTest_InMemory(fst_address, fst_size)) {
+        printf("FST too large.\n");
+        goto exit_error;
+    }
+    BootTest_ReadGame(
+        &boot_test_queue, BootTest_Memory(fst_address), fst_size, fst_offset);
+    
+    DIQueue_Destroy(&boot_test_queue);
+    return true;
+exit_error:
+    printf("BootTest_ApploaderGame: exit_error\n");
+    DIQueue_Destroy(&boot_test_queue);
+    return false;
+}
+
+/* The symbol file a user would put in symbols/, as XML. */
+static FILE *BootTest_SymbolsFile(void) {
+    FILE *file;
+    size_t i, j;
+    
+    file = tmpfile();
+    if (file == NULL)
+        return NULL;
+    
+    fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<symbols>\n");
+    for (i = 0; i < BOOT_TEST_SYMBOLS; i++) {
+        uint8_t code[32];
+        
+        BootTest_SymbolCode(i, code);
+        fprintf(
+            file, "    <symbol name=\"%s\" size=\"0x20\">\n        <data>",
+            boot_test_symbol_names[i]);
+        for (j = 0; j < sizeof(code); j++)
+            fprintf(file, "%02x", code[j]);
+        fprintf(file, "</data>\n    </symbol>\n");
+    }
+    fprintf(file, "</symbols>\n");
+    rewind(file);
+    
+    return file;
+}
+
+static void BootTest_SymbolMatch(symbol_index_t symbol, uint8_t *addr) {
+    if (symbol < BOOT_TEST_SYMBOLS)
+        boot_test_found[symbol] =
+            BOOT_TEST_MEM1 + (uint32_t)(addr - boot_test_mem1);
+}
+
+/* The search's tasks, as in search.c. Up to boot_test_search_run, they
+ * must not fail, as the last of them submits it; errors are left in
+ * boot_test_failed. */
+static bool BootTest_SymbolsRead(void *arg) {
+    FILE *file;
+    long size;
+    
+    Trace_Begin("phase", "read symbols");
+    file = BootTest_SymbolsFile();
+    if (file != NULL && fseek(file, 0, SEEK_END) == 0 &&
+        (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        boot_test_symbols = malloc(size + 1);
+        if (boot_test_symbols != NULL) {
+            if (fread(boot_test_symbols, 1, size, file) == (size_t)size) {
+                boot_test_symbols[size] = '\0';
+            } else {
+                free(boot_test_symbols);
+                boot_test_symbols = NULL;
+            }
+        }
+    }
+    if (file != NULL)
+        fclose(file);
+    Trace_End("phase", "read symbols");
+    return true;
+}
+
+static bool BootTest_SymbolsParse(void *arg) {
+    Trace_Begin("phase", "parse symbols");
+    if (boot_test_symbols == NULL || !Symbol_ParseString(boot_test_symbols))
+        boot_test_failed = true;
+    Trace_End("phase", "parse symbols");
+    free(boot_test_symbols);
+    boot_test_symbols = NULL;
+    return true;
+}
+
+static bool BootTest_SymbolsLoaded(void *arg) {
+    sched_task_t *build;
+    symbol_index_t i;
+    
+    if (boot_test_failed || symbol_count != BOOT_TEST_SYMBOLS)
+        goto exit_error;
+    for (i = 0; i < symbol_count; i++)
+        fsm_test_symbol[i] = *Symbol_GetSymbol(i);
+    
+    /* as Search_SymbolsLoaded. */
+    build = FSM_Schedule(boot_test_sched, symbol_count, &boot_test_fsm);
+    if (build == NULL ||
+        !Sched_Depend(boot_test_sched, boot_test_search_run, build))
+        goto exit_error;
+    
+    Sched_Submit(boot_test_sched, boot_test_search_run);
+    return true;
+exit_error:
+    printf("BootTest_SymbolsLoaded: exit_error\n");
+    boot_test_failed = true;
+    Sched_Submit(boot_test_sched, boot_test_search_run);
+    return true;
+}
+
+static bool BootTest_SearchRun(void *arg) {
+    if (boot_test_failed)
+        return false;
+    
+    if (boot_test_app0_start != NULL) {
+        Trace_Begin("phase", "run fsm");
+        FSM_Run(
+            boot_test_fsm, boot_test_app0_start,
+            boot_test_app0_end - boot_test_app0_start,
+            &BootTest_SymbolMatch);
+        Trace_End("phase", "run fsm");
+    }
+    
+    FSM_Free(boot_test_fsm);
+    boot_test_fsm = NULL;
+    return true;
+}
+
+/* A module whose .text is BOOT_TEST_CALLS calls to the game's functions. */
+static uint8_t *BootTest_Module(size_t *size) {
+    static const char strtab[] =
+        "\0BootTest_Function0\0BootTest_Function1"
+        "\0BootTest_Function2\0BootTest_Function3";
+    uint8_t text[BOOT_TEST_CALLS * 4];
+    uint8_t rela[BOOT_TEST_CALLS * sizeof(Elf32_Rela)];
+    uint8_t symtab[(1 + BOOT_TEST_SYMBOLS) * sizeof(Elf32_Sym)];
+    size_t i;
+    
+    memset(symtab, 0, sizeof(symtab));
+    for (i = 0; i < BOOT_TEST_SYMBOLS; i++)
+        LinkTest_Sym(
+            symtab, 1 + i, 1 + i * 19, 0,
+            ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE), SHN_UNDEF);
+    for (i = 0; i < BOOT_TEST_CALLS; i++) {
+        Link_Write32(text + i * 4, 0x48000001);
+        LinkTest_Rela(
+            rela, i, i * 4, 1 + i % BOOT_TEST_SYMBOLS, R_PPC_REL24, 0);
+    }
+    
+    {
+        const link_test_section_t sections[] = {
+            /* 1 */ { ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 4,
+                0, 0, 0, text, sizeof(text) },
+            /* 2 */ { ".rela.text", SHT_RELA, 0, 4, 3, 1, sizeof(Elf32_Rela),
+                rela, sizeof(rela) },
+            /* 3 */ { ".symtab", SHT_SYMTAB, 0, 4, 4, 1, sizeof(Elf32_Sym),
+                symtab, sizeof(symtab) },
+            /* 4 */ { ".strtab", SHT_STRTAB, 0, 1, 0, 0, 0,
+                (const uint8_t *)strtab, sizeof(strtab) },
+        };
+        
+        return LinkTest_ElfBuild(
+            sections, sizeof(sections) / sizeof(*sections), size);
+    }
+}
+
+static bool BootTest_Defer(
+        void *arg, size_t shndx, const char *name, size_t offset,
+        unsigned char type, int addend, uint32_t symbol_addr) {
+    boot_test_link_t *link = arg;
+    
+    if (name == NULL || type != R_PPC_REL24)
+        return false;
+    link->next->name = name;
+    link->next->offset = offset;
+    link->next->address = link->addresses[shndx] + offset;
+    link->next++;
+    return true;
+}
+
+/* The modules' tasks, as in module.c: each module is read, standing in for
+ * the SD card, while the ones before it are linked against the game, leaving
+ * calls to game functions until the search has found them. */
+static bool BootTest_ModuleRead(void *arg) {
+    size_t i = (size_t)(uintptr_t)arg;
+    
+    pthread_mutex_lock(&boot_test_sd_mutex);
+    if (i == 0)
+        boot_test_modules_start = BootTest_Clock();
+    Trace_Begin("phase", "read module");
+    if (boot_test_sd_latency > 0)
+        usleep(boot_test_sd_latency);
+    boot_test_modules[i] = BootTest_Module(&boot_test_sizes[i]);
+    Trace_End("phase", "read module");
+    pthread_mutex_unlock(&boot_test_sd_mutex);
+    return boot_test_modules[i] != NULL;
+}
+
+static bool BootTest_ModuleLink(void *arg) {
+    size_t i = (size_t)(uintptr_t)arg;
+    link_elf_t elf;
+    Elf32_Sym *symtab;
+    size_t symtab_count, symtab_strndx, shndx;
+    uint8_t **destinations;
+    uint32_t *addresses;
+    bool ok;
+    
+    if (Link_ElfOpen(
+            &elf, boot_test_modules[i], boot_test_sizes[i]) != LINK_ELF_OK)
+        return false;
+    symtab = Link_ElfLoadSymtab(&elf, &symtab_count, &symtab_strndx);
+    if (symtab == NULL)
+        return false;
+    
+    Trace_Begin("phase", "link module");
+    destinations = calloc(elf.section_count, sizeof(*destinations));
+    addresses = calloc(elf.section_count, sizeof(*addresses));
+    ok = destinations != NULL && addresses != NULL;
+    
+    /* allocated sections go down from the top of MEM1, as
+     * Module_LinkModuleElf places them. */
+    for (shndx = 1; ok && shndx < elf.section_count; shndx++) {
+        Elf32_Shdr shdr;
+        
+        ok = Link_ElfSection(&elf, shndx, &shdr);
+        if (!ok || !(shdr.sh_flags & SHF_ALLOC))
+            continue;
+        boot_test_space -= (shdr.sh_size + 31) & ~31;
+        destinations[shndx] = BootTest_Memory(boot_test_space);
+        addresses[shndx] = boot_test_space;
+    }
+    
+    boot_test_link.addresses = addresses;
+    ok = ok && Link_ElfLoadModule(
+        &elf, destinations, addresses, symtab, symtab_count,
+        NULL, NULL);
+    ok = ok && Link_ElfLinkModule(
+        &elf, destinations, addresses, symtab, symtab_count,
+        symtab_strndx, NULL, &BootTest_Defer, &boot_test_link);
+    free(destinations);
+    free(addresses);
+    free(symtab);
+    Trace_End("phase", "link module");
+    if (i == BOOT_TEST_MODULES - 1)
+        boot_test_modules_end = BootTest_Clock();
+    return ok;
+}
+
+static bool BootTest_ModuleFinal(void *arg) {
+    boot_test_deferred_t *deferred;
+    
+    Trace_Begin("phase", "final link");
+    for (deferred = boot_test_deferred;
+         deferred != boot_test_link.next; deferred++) {
+        symbol_alphabetical_index_t index;
+        uint32_t target;
+        
+        index = Symbol_SearchSymbol(deferred->name);
+        if (index == SYMBOL_NULL)
+            break;
+        target = boot_test_found[Symbol_GetSymbolAlphabetical(index)->index];
+        if (target == 0) {
+            /* not in this image; only the synthetic one must have them. */
+            if (boot_test_check)
+                break;
+            continue;
+        }
+        if (!Link_Relocate(
+                R_PPC_REL24, BootTest_Memory(deferred->address),
+                deferred->address, deferred->offset, 0, target, NULL))
+            break;
+    }
+    Trace_End("phase", "final link");
+    
+    return deferred == boot_test_link.next;
+}
+
+/* The loader's task graph, as main.c builds it from each subsystem's. */
+static bool BootTest_Schedule(sched_t *sched) {
+    sched_task_t *apploader_load, *apploader_game;
+    sched_task_t *symbols_read, *symbols_parse, *symbols_loaded;
+    sched_task_t *modules_loaded, *module_final;
+    sched_task_t *reads[BOOT_TEST_MODULES], *links[BOOT_TEST_MODULES];
+    size_t i;
+    bool ok;
+    
+    boot_test_sched = sched;
+    apploader_load = Sched_Task(sched, &BootTest_ApploaderLoad, NULL);
+    apploader_game = Sched_Task(sched, &BootTest_ApploaderGame, NULL);
+    symbols_read = Sched_Task(sched, &BootTest_SymbolsRead, NULL);
+    symbols_parse = Sched_Task(sched, &BootTest_SymbolsParse, NULL);
+    symbols_loaded = Sched_Task(sched, &BootTest_SymbolsLoaded, NULL);
+    boot_test_search_run = Sched_Task(sched, &BootTest_SearchRun, NULL);
+    modules_loaded = Sched_Join(sched);
+    module_final = Sched_Task(sched, &BootTest_ModuleFinal, NULL);
+    ok =
+        apploader_load != NULL && apploader_game != NULL &&
+        symbols_read != NULL && symbols_parse != NULL &&
+        symbols_loaded != NULL && boot_test_search_run != NULL &&
+        modules_loaded != NULL && module_final != NULL;
+    
+    for (i = 0; ok && i < BOOT_TEST_MODULES; i++) {
+        reads[i] = Sched_Task(
+            sched, &BootTest_ModuleRead, (void *)(uintptr_t)i);
+        links[i] = Sched_Task(
+            sched, &BootTest_ModuleLink, (void *)(uintptr_t)i);
+        ok =
+            reads[i] != NULL && links[i] != NULL &&
+            Sched_Depend(sched, modules_loaded, reads[i]) &&
+            Sched_Depend(sched, links[i], reads[i]) &&
+            (i == 0 || Sched_Depend(sched, links[i], links[i - 1])) &&
+            (i < boot_test_read_depth ||
+             Sched_Depend(
+                sched, reads[i], links[i - boot_test_read_depth]));
+    }
+    
+    ok = ok &&
+        Sched_Depend(sched, apploader_game, apploader_load) &&
+        Sched_Depend(sched, apploader_game, modules_loaded) &&
+        Sched_Depend(sched, symbols_parse, symbols_read) &&
+        Sched_Depend(sched, symbols_loaded, symbols_parse) &&
+        Sched_Depend(sched, boot_test_search_run, apploader_game) &&
+        Sched_Depend(sched, module_final, links[BOOT_TEST_MODULES - 1]) &&
+        Sched_Depend(sched, module_final, boot_test_search_run);
+    /* nothing is submitted yet, so on failure the caller can just destroy
+     * the scheduler. */
+    if (!ok)
+        return false;
+    
+    Sched_Submit(sched, apploader_load);
+    Sched_Submit(sched, apploader_game);
+    Sched_Submit(sched, symbols_read);
+    Sched_Submit(sched, symbols_parse);
+    Sched_Submit(sched, symbols_loaded);
+    Sched_Submit(sched, modules_loaded);
+    Sched_Submit(sched, module_final);
+    for (i = 0; i < BOOT_TEST_MODULES; i++) {
+        Sched_Submit(sched, reads[i]);
+        Sched_Submit(sched, links[i]);
+    }
+    return true;
+}
+
+/* Every call in every module should now reach the function it names. */
+static bool BootTest_Check(void) {
+    uint32_t space;
+    size_t i, j;
+    
+    for (i = 0; i < BOOT_TEST_SYMBOLS; i++)
+        if (boot_test_found[i] != BootTest_SymbolAddress(i))
+            return false;
+    
+    space = BOOT_TEST_MEM1 + BOOT_TEST_MEM1_SIZE;
+    for (i = 0; i < BOOT_TEST_MODULES; i++) {
+        space -= BOOT_TEST_CALLS * 4;
+        for (j = 0; j < BOOT_TEST_CALLS; j++) {
+            uint32_t address, instruction, target;
+            
+            address = space + j * 4;
+            instruction = Link_Read32(BootTest_Memory(address));
+            if ((instruction & 0xfc000003) != 0x48000001)
+                return false;
+            target = address + (((int32_t)(instruction << 6) >> 6) & ~3);
+            if (target != BootTest_SymbolAddress(j % BOOT_TEST_SYMBOLS))
+                return false;
+        }
+    }
+    return true;
+}
+
+static int BootTest_Run(const uint8_t *image, size_t size, bool check) {
+    sched_t *sched;
+    const char *latency, *depth, *trace;
+    uint64_t start;
+    FILE *file;
+    size_t i;
+    int result = 0;
+    
+    memset(&boot_test_disc, 0, sizeof(boot_test_disc));
+    boot_test_disc.partition = image;
+    boot_test_disc.partition_size = size;
+    /* one partition group, at the usual place, holding the boot partition
+     * at word offset 0x50000. */
+    Link_Write32(boot_test_disc.header + 0x00, 1);
+    Link_Write32(
+        boot_test_disc.header + 0x04, BOOT_TEST_PARTITION_INFO_OFFSET);
+    Link_Write32(boot_test_disc.header + 0x20, BOOT_TEST_PARTITION);
+    Link_Write32(boot_test_disc.header + 0x24, 0);
+    latency = getenv("BSLUG_DISC_LATENCY");
+    if (latency != NULL)
+        boot_test_disc.latency = atoi(latency);
+    latency = getenv("BSLUG_SD_LATENCY");
+    boot_test_sd_latency = latency != NULL ? atoi(latency) : 0;
+    depth = getenv("BSLUG_READ_QUEUE_DEPTH");
+    boot_test_read_depth = BOOT_TEST_READ_QUEUE_DEPTH;
+    if (depth != NULL && atoi(depth) > 0)
+        boot_test_read_depth = atoi(depth);
+    if (pthread_mutex_init(&boot_test_disc.mutex, NULL) ||
+        pthread_cond_init(&boot_test_disc.cond, NULL))
+        return 101;
+    
+    boot_test_mem1 = calloc(1, BOOT_TEST_MEM1_SIZE);
+    if (boot_test_mem1 == NULL)
+        return 6;
+    boot_test_app0_start = boot_test_app0_end = NULL;
+    memset(boot_test_found, 0, sizeof(boot_test_found));
+    boot_test_failed = false;
+    boot_test_check = check;
+    boot_test_symbols = NULL;
+    boot_test_fsm = NULL;
+    memset(boot_test_modules, 0, sizeof(boot_test_modules));
+    boot_test_space = BOOT_TEST_MEM1 + BOOT_TEST_MEM1_SIZE;
+    boot_test_deferred = malloc(
+        BOOT_TEST_MODULES * BOOT_TEST_CALLS * sizeof(*boot_test_deferred));
+    if (boot_test_deferred == NULL)
+        return 6;
+    boot_test_link.next = boot_test_deferred;
+    
+    if (!Trace_Init(
+            TRACE_CAPACITY_DEFAULT, &BootTest_Clock, &BootTest_Thread, 1000))
+        return 102;
+    start = BootTest_Clock();
+    
+    if (pthread_create(
+            &boot_test_disc.thread, NULL, &BootTest_DiscMain,
+            &boot_test_disc))
+        return 103;
+    sched = Sched_Create(BOOT_TEST_THREADS);
+    if (sched == NULL || !BootTest_Schedule(sched))
+        result = 103;
+    else if (!Sched_Wait(sched))
+        result = 104;
+    Sched_Destroy(sched);
+    
+    pthread_mutex_lock(&boot_test_disc.mutex);
+    boot_test_disc.stop = true;
+    pthread_cond_signal(&boot_test_disc.cond);
+    pthread_mutex_unlock(&boot_test_disc.mutex);
+    pthread_join(boot_test_disc.thread, NULL);
+    
+    if (result == 0 && boot_test_failed)
+        result = 105;
+    if (result == 0 && check && !BootTest_Check())
+        result = 106;
+    
+    printf(
+        "Boot in %u ms: %u disc reads of %u KiB, %u modules.\n",
+        (unsigned)((BootTest_Clock() - start) / 1000),
+        (unsigned)boot_test_disc.reads,
+        (unsigned)(boot_test_disc.bytes / 1024), BOOT_TEST_MODULES);
+    printf(
+        "Modules read and linked in %u us, reading %u ahead.\n",
+        (unsigned)(boot_test_modules_end - boot_test_modules_start),
+        (unsigned)boot_test_read_depth);
+    Trace_Summary(stdout);
+    trace = getenv("BSLUG_BOOT_TRACE");
+    file = trace != NULL ? fopen(trace, "w") : NULL;
+    if (file != NULL) {
+        Trace_WriteJson(file);
+        fclose(file);
+    }
+    
+    Trace_Free();
+    if (boot_test_fsm != NULL)
+        FSM_Free(boot_test_fsm);
+    for (i = 0; i < BOOT_TEST_MODULES; i++)
+        free(boot_test_modules[i]);
+    free(boot_test_deferred);
+    free(boot_test_mem1);
+    boot_test_mem1 = NULL;
+    pthread_cond_destroy(&boot_test_disc.cond);
+    pthread_mutex_destroy(&boot_test_disc.mutex);
+    return result;
+}
+
+int BootTest_Synthetic(void) {
+    uint8_t *image;
+    size_t size;
+    int result;
+    
+    image = BootTest_ImageBuild(&size);
+    if (image == NULL)
+        return 6;
+    
+    result = BootTest_Run(image, size, true);
+    free(image);
+    return result;
+}
+
+int BootTest_Image(void) {
+    const char *path;
+    uint8_t *image;
+    FILE *file;
+    long size;
+    int result;
+    
+    path = getenv("BSLUG_DISC_IMAGE");
+    if (path == NULL) {
+        printf("BSLUG_DISC_IMAGE not set, skipping.\n");
+        return 0;
+    }
+    
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return 6;
+    if (fseek(file, 0, SEEK_END) || (size = ftell(file)) <= 0 ||
+        fseek(file, 0, SEEK_SET)) {
+        fclose(file);
+        return 6;
+    }
+    image = malloc(size);
+    if (image == NULL || fread(image, 1, size, file) != (size_t)size) {
+        free(image);
+        fclose(file);
+        return 6;
+    }
+    fclose(file);
+    
+    result = BootTest_Run(image, size, false);
+    free(image);
+    return result;
+}
@@ -0,0 +1,259 @@
+/* di_queue_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../src/di/di_queue.c"
+
+#include "di_queue_test.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DI_QUEUE_TEST_READS 64
+#define DI_QUEUE_TEST_LENGTH 256
+
+/* Stands in for IOS: a thread completing the most recently started read
+ * first, so reads finish out of order. */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    di_request_t *pending[DI_QUEUE_DEPTH];
+    size_t pending_count;
+    size_t max_in_flight;
+    unsigned starts;
+    unsigned reads;
+    /* refuse every nth start, as IOS does when its own queue is full. */
+    unsigned fail_start_every;
+    /* fail every nth read, as a scratched disc might. */
+    unsigned fail_read_every;
+    bool stop;
+} di_queue_test_backend_t;
+
+static di_queue_test_backend_t di_queue_test_backend;
+static uint8_t di_queue_test_buffers
+    [DI_QUEUE_TEST_READS][DI_QUEUE_TEST_LENGTH];
+
+static uint8_t DIQueueTest_Byte(uint32_t offset, size_t i) {
+    return (uint8_t)(offset * 4 + i * 7);
+}
+
+static void *DIQueueTest_BackendMain(void *arg) {
+    di_queue_test_backend_t *backend = arg;
+    
+    pthread_mutex_lock(&backend->mutex);
+    while (1) {
+        di_request_t *request;
+        int result;
+        size_t i;
+        
+        while (backend->pending_count == 0 && !backend->stop)
+            pthread_cond_wait(&backend->cond, &backend->mutex);
+        if (backend->pending_count == 0)
+            break;
+        
+        /* give the queue time to fill up. */
+        pthread_mutex_unlock(&backend->mutex);
+        usleep(50);
+        pthread_mutex_lock(&backend->mutex);
+        
+        request = backend->pending[--backend->pending_count];
+        backend->reads++;
+        if (backend->fail_read_every != 0 &&
+            backend->reads % backend->fail_read_every == 0) {
+            result = -1;
+        } else {
+            for (i = 0; i < request->length; i++)
+                ((uint8_t *)request->buffer)[i] =
+                    DIQueueTest_Byte(request->offset, i);
+            result = request->length;
+        }
+        
+        pthread_mutex_unlock(&backend->mutex);
+        DIQueue_Complete(request, result);
+        pthread_mutex_lock(&backend->mutex);
+    }
+    pthread_mutex_unlock(&backend->mutex);
+    
+    return NULL;
+}
+
+static int DIQueueTest_Start(di_request_t *request) {
+    di_queue_test_backend_t *backend = &di_queue_test_backend;
+    int result = 0;
+    
+    pthread_mutex_lock(&backend->mutex);
+    backend->starts++;
+    if (backend->fail_start_every != 0 &&
+        backend->starts % backend->fail_start_every == 0) {
+        result = -1;
+    } else if (backend->pending_count == DI_QUEUE_DEPTH) {
+        /* more in flight than the queue allows. */
+        result = -2;
+    } else {
+        backend->pending[backend->pending_count++] = request;
+        if (backend->pending_count > backend->max_in_flight)
+            backend->max_in_flight = backend->pending_count;
+        pthread_cond_signal(&backend->cond);
+    }
+    pthread_mutex_unlock(&backend->mutex);
+    
+    return result;
+}
+
+static bool DIQueueTest_BackendStart(
+        unsigned fail_start_every, unsigned fail_read_every) {
+    di_queue_test_backend_t *backend = &di_queue_test_backend;
+    
+    memset(backend, 0, sizeof(*backend));
+    memset(di_queue_test_buffers, 0, sizeof(di_queue_test_buffers));
+    backend->fail_start_every = fail_start_every;
+    backend->fail_read_every = fail_read_every;
+    if (pthread_mutex_init(&backend->mutex, NULL))
+        return false;
+    if (pthread_cond_init(&backend->cond, NULL))
+        return false;
+    return pthread_create(
+        &backend->thread, NULL, &DIQueueTest_BackendMain, backend) == 0;
+}
+
+static void DIQueueTest_BackendStop(void) {
+    di_queue_test_backend_t *backend = &di_queue_test_backend;
+    
+    pthread_mutex_lock(&backend->mutex);
+    backend->stop = true;
+    pthread_cond_signal(&backend->cond);
+    pthread_mutex_unlock(&backend->mutex);
+    pthread_join(backend->thread, NULL);
+    pthread_cond_destroy(&backend->cond);
+    pthread_mutex_destroy(&backend->mutex);
+}
+
+static bool DIQueueTest_Check(void) {
+    size_t read, i;
+    
+    for (read = 0; read < DI_QUEUE_TEST_READS; read++) {
+        for (i = 0; i < DI_QUEUE_TEST_LENGTH; i++) {
+            if (di_queue_test_buffers[read][i] !=
+                DIQueueTest_Byte(read * DI_QUEUE_TEST_LENGTH / 4, i))
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Read without waiting, leaving the queue to wait when it fills up. */
+static int DIQueueTest_ReadAll(di_queue_t *queue) {
+    size_t read;
+    
+    for (read = 0; read < DI_QUEUE_TEST_READS; read++) {
+        if (DIQueue_Read(
+                queue, di_queue_test_buffers[read], DI_QUEUE_TEST_LENGTH,
+                read * DI_QUEUE_TEST_LENGTH / 4) == NULL)
+            return 1;
+    }
+    DIQueue_WaitAll(queue);
+    return 0;
+}
+
+int DIQueueTest_Read(void) {
+    di_queue_t queue;
+    int result = 0;
+    
+    if (!DIQueueTest_BackendStart(0, 0))
+        return 101;
+    if (!DIQueue_Init(&queue, &DIQueueTest_Start))
+        return 102;
+    
+    if (DIQueueTest_ReadAll(&queue))
+        result = 103;
+    else if (!DIQueueTest_Check())
+        result = 104;
+    else if (di_queue_test_backend.starts != DI_QUEUE_TEST_READS)
+        result = 105;
+    else if (di_queue_test_backend.max_in_flight < 2)
+        result = 106;
+    
+    DIQueue_Destroy(&queue);
+    DIQueueTest_BackendStop();
+    return result;
+}
+
+int DIQueueTest_Wait(void) {
+    di_request_t *requests[DI_QUEUE_DEPTH];
+    di_queue_t queue;
+    size_t read, i;
+    int result = 0;
+    
+    if (!DIQueueTest_BackendStart(0, 0))
+        return 101;
+    if (!DIQueue_Init(&queue, &DIQueueTest_Start))
+        return 102;
+    
+    /* a full queue at a time, waited for oldest first though the backend
+     * finishes them newest first. */
+    for (read = 0; result == 0 && read < DI_QUEUE_TEST_READS;
+         read += DI_QUEUE_DEPTH) {
+        for (i = 0; i < DI_QUEUE_DEPTH; i++) {
+            requests[i] = DIQueue_Read(
+                &queue, di_queue_test_buffers[read + i],
+                DI_QUEUE_TEST_LENGTH,
+                (read + i) * DI_QUEUE_TEST_LENGTH / 4);
+        }
+        for (i = 0; i < DI_QUEUE_DEPTH; i++) {
+            if (DIQueue_Wait(&queue, requests[i]) != DI_QUEUE_TEST_LENGTH)
+                result = 103;
+        }
+    }
+    if (result == 0 && !DIQueueTest_Check())
+        result = 104;
+    if (result == 0 && di_queue_test_backend.max_in_flight < 2)
+        result = 105;
+    
+    DIQueue_Destroy(&queue);
+    DIQueueTest_BackendStop();
+    return result;
+}
+
+int DIQueueTest_Retry(void) {
+    di_queue_t queue;
+    int result = 0;
+    
+    if (!DIQueueTest_BackendStart(3, 5))
+        return 101;
+    if (!DIQueue_Init(&queue, &DIQueueTest_Start))
+        return 102;
+    
+    if (DIQueueTest_ReadAll(&queue))
+        result = 103;
+    else if (!DIQueueTest_Check())
+        result = 104;
+    else if (di_queue_test_backend.starts <= DI_QUEUE_TEST_READS)
+        result = 105;
+    
+    DIQueue_Destroy(&queue);
+    DIQueueTest_BackendStop();
+    return result;
+}
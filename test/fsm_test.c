@@ -546,3 +546,67 @@ int FSMTest_Run4(void) {
         
     return fsm3 == NULL;
 }
+
+/* FSMTest_Run4, with the FSM built on the scheduler. */
+int FSMTest_Schedule(void) {
+    fsm_t *fsm = NULL;
+    sched_t *sched;
+    sched_task_t *build;
+    symbol_t *sym;
+    bool built;
+    const uint8_t *results1[3];
+    const uint8_t *results2[3];
+    uint8_t data1[] = { 0x00, 0x01, 0x00, 0x00 };
+    uint8_t mask1[] = { 0x00, 0xff, 0xff, 0x00 };
+    uint8_t data2[] = { 0x01, 0x00, 0x00, 0x00 };
+    uint8_t mask2[] = { 0xff, 0x00, 0x00, 0xff };
+    uint8_t test[] = { 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x03 };
+    
+    sym = Symbol_GetSymbol(0);
+    sym->index = 0;
+    sym->data = data1;
+    sym->mask = mask1;
+    sym->data_size = sizeof(data1);
+    sym->offset = 4;
+    sym->name = (const char *)results1;
+    sym->size = 0;
+    
+    sym = Symbol_GetSymbol(1);
+    sym->index = 1;
+    sym->data = data2;
+    sym->mask = mask2;
+    sym->data_size = sizeof(data2);
+    sym->offset = 4;
+    sym->name = (const char *)results2;
+    sym->size = 0;
+    
+    sched = Sched_Create(2);
+    if (sched == NULL)
+        return 108;
+    build = FSM_Schedule(sched, 2, &fsm);
+    built = Sched_Wait(sched);
+    Sched_Destroy(sched);
+    
+    if (build == NULL || !built || fsm == NULL)
+        return 1;
+    
+    FSM_Run(fsm, test, sizeof(test), FSMTest_SymbolDetect);
+    FSM_Free(fsm);
+    
+    if (Symbol_GetSymbol(0)->size != 3)
+        return 101;
+    if (results1[0] != &test[0])
+        return 102;
+    if (results1[1] != &test[3])
+        return 103;
+    if (results1[2] != &test[5])
+        return 104;
+    if (Symbol_GetSymbol(1)->size != 2)
+        return 105;
+    if (results2[0] != &test[0])
+        return 106;
+    if (results2[1] != &test[4])
+        return 107;
+    
+    return 0;
+}
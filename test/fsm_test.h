@@ -37,5 +37,6 @@ int FSMTest_Run1(void);
 int FSMTest_Run2(void);
 int FSMTest_Run3(void);
 int FSMTest_Run4(void);
+int FSMTest_Schedule(void);
 
 #endif /* FSM_TEST_H_ */
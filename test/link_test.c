@@ -0,0 +1,1017 @@
+/* link_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../src/modules/link.c"
+ 
+#include "link_test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* a game-like layout: r13 and r2 bases in MEM1, module code in the module
+ * region at the top of MEM1. */
+#define LINK_TEST_SDA_BASE 0x80400000
+#define LINK_TEST_SDA2_BASE 0x80408000
+#define LINK_TEST_TARGET 0x81700000
+
+static const link_sda_t link_test_sda = {
+    LINK_TEST_SDA_BASE, LINK_TEST_SDA2_BASE
+};
+
+/* A deferred relocation, as recorded by LinkTest_Defer. */
+typedef struct {
+    const char *name;
+    size_t offset;
+    unsigned char type;
+    int addend;
+    size_t count;
+} link_test_deferred_t;
+
+/* Build a big endian relocatable PowerPC ELF file in memory. */
+uint8_t *LinkTest_ElfBuild(
+        const link_test_section_t *sections, size_t count, size_t *size) {
+    uint8_t *elf;
+    size_t i, offset, shstrtab_size, shstrtab_offset, shoff;
+    
+    shstrtab_size = 1 + sizeof(".shstrtab");
+    offset = sizeof(Elf32_Ehdr);
+    for (i = 0; i < count; i++) {
+        shstrtab_size += strlen(sections[i].name) + 1;
+        if (sections[i].type != SHT_NOBITS)
+            offset += (sections[i].size + 3) & ~3;
+    }
+    shstrtab_offset = offset;
+    shoff = (shstrtab_offset + shstrtab_size + 3) & ~3;
+    *size = shoff + (count + 2) * sizeof(Elf32_Shdr);
+    
+    elf = calloc(1, *size);
+    if (elf == NULL)
+        return NULL;
+    
+    elf[EI_MAG0] = ELFMAG0;
+    elf[EI_MAG1] = ELFMAG1;
+    elf[EI_MAG2] = ELFMAG2;
+    elf[EI_MAG3] = ELFMAG3;
+    elf[EI_CLASS] = ELFCLASS32;
+    elf[EI_DATA] = ELFDATA2MSB;
+    elf[EI_VERSION] = EV_CURRENT;
+    Link_Write16(elf + offsetof(Elf32_Ehdr, e_type), ET_REL);
+    Link_Write16(elf + offsetof(Elf32_Ehdr, e_machine), EM_PPC);
+    Link_Write32(elf + offsetof(Elf32_Ehdr, e_version), EV_CURRENT);
+    Link_Write32(elf + offsetof(Elf32_Ehdr, e_shoff), shoff);
+    Link_Write16(elf + offsetof(Elf32_Ehdr, e_ehsize), sizeof(Elf32_Ehdr));
+    Link_Write16(
+        elf + offsetof(Elf32_Ehdr, e_shentsize), sizeof(Elf32_Shdr));
+    Link_Write16(elf + offsetof(Elf32_Ehdr, e_shnum), count + 2);
+    Link_Write16(elf + offsetof(Elf32_Ehdr, e_shstrndx), count + 1);
+    
+    offset = sizeof(Elf32_Ehdr);
+    shstrtab_size = 1;
+    for (i = 0; i <= count; i++) {
+        uint8_t *shdr;
+        const char *name;
+        
+        shdr = elf + shoff + (i + 1) * sizeof(Elf32_Shdr);
+        name = i < count ? sections[i].name : ".shstrtab";
+        
+        strcpy((char *)elf + shstrtab_offset + shstrtab_size, name);
+        Link_Write32(shdr + offsetof(Elf32_Shdr, sh_name), shstrtab_size);
+        shstrtab_size += strlen(name) + 1;
+        
+        if (i == count) {
+            Link_Write32(shdr + offsetof(Elf32_Shdr, sh_type), SHT_STRTAB);
+            Link_Write32(
+                shdr + offsetof(Elf32_Shdr, sh_offset), shstrtab_offset);
+            Link_Write32(
+                shdr + offsetof(Elf32_Shdr, sh_size),
+                shoff - shstrtab_offset);
+            Link_Write32(shdr + offsetof(Elf32_Shdr, sh_addralign), 1);
+            break;
+        }
+        
+        Link_Write32(shdr + offsetof(Elf32_Shdr, sh_type), sections[i].type);
+        Link_Write32(
+            shdr + offsetof(Elf32_Shdr, sh_flags), sections[i].flags);
+        Link_Write32(shdr + offsetof(Elf32_Shdr, sh_offset), offset);
+        Link_Write32(shdr + offsetof(Elf32_Shdr, sh_size), sections[i].size);
+        Link_Write32(shdr + offsetof(Elf32_Shdr, sh_link), sections[i].link);
+        Link_Write32(shdr + offsetof(Elf32_Shdr, sh_info), sections[i].info);
+        Link_Write32(
+            shdr + offsetof(Elf32_Shdr, sh_addralign), sections[i].align);
+        Link_Write32(
+            shdr + offsetof(Elf32_Shdr, sh_entsize), sections[i].entsize);
+        
+        if (sections[i].type != SHT_NOBITS) {
+            if (sections[i].data != NULL)
+                memcpy(elf + offset, sections[i].data, sections[i].size);
+            offset += (sections[i].size + 3) & ~3;
+        }
+    }
+    
+    return elf;
+}
+
+void LinkTest_Sym(
+        uint8_t *symtab, size_t index, uint32_t name, uint32_t value,
+        unsigned char info, uint16_t shndx) {
+    uint8_t *sym;
+    
+    sym = symtab + index * sizeof(Elf32_Sym);
+    Link_Write32(sym + offsetof(Elf32_Sym, st_name), name);
+    Link_Write32(sym + offsetof(Elf32_Sym, st_value), value);
+    Link_Write32(sym + offsetof(Elf32_Sym, st_size), 0);
+    sym[offsetof(Elf32_Sym, st_info)] = info;
+    sym[offsetof(Elf32_Sym, st_other)] = 0;
+    Link_Write16(sym + offsetof(Elf32_Sym, st_shndx), shndx);
+}
+
+void LinkTest_Rela(
+        uint8_t *rela, size_t index, uint32_t offset, uint32_t symbol,
+        unsigned char type, int32_t addend) {
+    uint8_t *entry;
+    
+    entry = rela + index * sizeof(Elf32_Rela);
+    Link_Write32(entry + offsetof(Elf32_Rela, r_offset), offset);
+    Link_Write32(
+        entry + offsetof(Elf32_Rela, r_info), ELF32_R_INFO(symbol, type));
+    Link_Write32(entry + offsetof(Elf32_Rela, r_addend), addend);
+}
+
+static bool LinkTest_Defer(
+        void *arg, size_t shndx, const char *name, size_t offset,
+        unsigned char type, int addend, uint32_t symbol_addr) {
+    link_test_deferred_t *deferred = arg;
+    
+    deferred->name = name;
+    deferred->offset = offset;
+    deferred->type = type;
+    deferred->addend = addend;
+    deferred->count++;
+    
+    return true;
+}
+
+int LinkTest_Relocate0(void) {
+    uint8_t code[4];
+    
+    /* lis r3, 0 */
+    Link_Write32(code, 0x3c600000);
+    if (!Link_Relocate(
+            R_PPC_ADDR16_HA, code + 2, LINK_TEST_TARGET + 2, 2, 0,
+            0x8123c000, NULL))
+        return 101;
+    /* @ha rounds up because the low half is negative */
+    if (Link_Read32(code) != 0x3c608124)
+        return 102;
+    
+    /* addi r3, r3, 0 */
+    Link_Write32(code, 0x38630000);
+    if (!Link_Relocate(
+            R_PPC_ADDR16_LO, code + 2, LINK_TEST_TARGET + 2, 2, 0,
+            0x8123c000, NULL))
+        return 103;
+    if (Link_Read32(code) != 0x3863c000)
+        return 104;
+    
+    /* bl . */
+    Link_Write32(code, 0x48000001);
+    if (!Link_Relocate(
+            R_PPC_REL24, code, LINK_TEST_TARGET, 0, 0,
+            LINK_TEST_TARGET - 0x100, NULL))
+        return 105;
+    if (Link_Read32(code) != 0x4bffff01)
+        return 106;
+    
+    /* unknown types must be refused, not ignored */
+    if (Link_Relocate(0xff, code, LINK_TEST_TARGET, 0, 0, 0, NULL))
+        return 107;
+    
+    /* branches that can't reach are refused, not wrapped: MEM1 to MEM2 */
+    Link_Write32(code, 0x48000001);
+    if (Link_Relocate(
+            R_PPC_REL24, code, LINK_TEST_TARGET, 0, 0, 0x90000000, NULL))
+        return 108;
+    if (!Link_Relocate(
+            R_PPC_REL24, code, LINK_TEST_TARGET, 0, 0,
+            LINK_TEST_TARGET + 0x1fffffc, NULL))
+        return 109;
+    /* bne . */
+    Link_Write32(code, 0x40820000);
+    if (Link_Relocate(
+            R_PPC_REL14, code, LINK_TEST_TARGET, 0, 0,
+            LINK_TEST_TARGET + 0x8000, NULL))
+        return 110;
+    if (!Link_Relocate(
+            R_PPC_REL14, code, LINK_TEST_TARGET, 0, 0,
+            LINK_TEST_TARGET - 0x8000, NULL))
+        return 111;
+    if (Link_Read32(code) != 0x40828000)
+        return 112;
+    if (!Link_RelocateIsBranch(R_PPC_REL24) ||
+            Link_RelocateIsBranch(R_PPC_ADDR32))
+        return 113;
+    
+    return 0;
+}
+
+int LinkTest_Sda21(void) {
+    uint8_t code[4];
+    
+    /* lwz r3, 0(r0) as the compiler emits it before linking */
+    Link_Write32(code, 0x80600000);
+    if (!Link_Relocate(
+            R_PPC_EMB_SDA21, code, LINK_TEST_TARGET, 0, 4,
+            LINK_TEST_SDA_BASE - 0x100, &link_test_sda))
+        return 101;
+    /* lwz r3, -0xfc(r13) */
+    if (Link_Read32(code) != 0x806dff04)
+        return 102;
+    
+    Link_Write32(code, 0x80600000);
+    if (!Link_Relocate(
+            R_PPC_EMB_SDA21, code, LINK_TEST_TARGET, 0, 0,
+            LINK_TEST_SDA2_BASE + 0x7ff0, &link_test_sda))
+        return 103;
+    /* lwz r3, 0x7ff0(r2) */
+    if (Link_Read32(code) != 0x80627ff0)
+        return 104;
+    
+    Link_Write32(code, 0x80600000);
+    if (!Link_Relocate(
+            R_PPC_EMB_SDA21, code, LINK_TEST_TARGET, 0, 0,
+            0x1000, &link_test_sda))
+        return 105;
+    /* lwz r3, 0x1000(0) */
+    if (Link_Read32(code) != 0x80601000)
+        return 106;
+    
+    /* not near either base: must fail and leave the instruction alone */
+    Link_Write32(code, 0x80600000);
+    if (Link_Relocate(
+            R_PPC_EMB_SDA21, code, LINK_TEST_TARGET, 0, 0,
+            LINK_TEST_TARGET, &link_test_sda))
+        return 107;
+    if (Link_Read32(code) != 0x80600000)
+        return 108;
+    
+    /* without known bases only absolute addresses work */
+    if (Link_Relocate(
+            R_PPC_EMB_SDA21, code, LINK_TEST_TARGET, 0, 0,
+            LINK_TEST_SDA_BASE, NULL))
+        return 109;
+    
+    return 0;
+}
+
+int LinkTest_SdaRel16(void) {
+    uint8_t code[4];
+    link_sda_t sda = { 0, 0 };
+    
+    /* addi r3, r13, 0 */
+    Link_Write32(code, 0x386d0000);
+    if (!Link_Relocate(
+            R_PPC_SDAREL16, code + 2, LINK_TEST_TARGET + 2, 2, 0,
+            LINK_TEST_SDA_BASE - 0x8000, &link_test_sda))
+        return 101;
+    if (Link_Read32(code) != 0x386d8000)
+        return 102;
+    
+    if (Link_Relocate(
+            R_PPC_SDAREL16, code + 2, LINK_TEST_TARGET + 2, 2, 0,
+            LINK_TEST_SDA_BASE + 0x8000, &link_test_sda))
+        return 103;
+    
+    if (!Link_Relocate(
+            R_PPC_EMB_SDA2REL, code + 2, LINK_TEST_TARGET + 2, 2, 8,
+            LINK_TEST_SDA2_BASE, &link_test_sda))
+        return 104;
+    if (Link_Read32(code) != 0x386d0008)
+        return 105;
+    
+    if (Link_Relocate(
+            R_PPC_SDAREL16, code + 2, LINK_TEST_TARGET + 2, 2, 0,
+            LINK_TEST_SDA_BASE, &sda))
+        return 106;
+    
+    if (!Link_RelocateNeedsSda(R_PPC_EMB_SDA21))
+        return 107;
+    if (Link_RelocateNeedsSda(R_PPC_ADDR32))
+        return 108;
+    
+    return 0;
+}
+
+int LinkTest_FindSdaBases(void) {
+    /* __start calls __init_hardware then __init_registers, which is the
+     * sequence the Nintendo SDK's start up code uses. */
+    static const uint32_t code[] = {
+        /* 0x80004000 __start */
+        0x48000011, /* bl __init_hardware */
+        0x48000011, /* bl __init_registers */
+        0x48000029, /* bl main */
+        0x48000000, /* b . */
+        /* 0x80004010 __init_hardware */
+        0x4e800020, /* blr */
+        /* 0x80004014 __init_registers */
+        0x3c208040, /* lis r1, 0x8040 */
+        0x60210000, /* ori r1, r1, 0 */
+        0x3c408041, /* lis r2, 0x8041 */
+        0x38428000, /* addi r2, r2, -0x8000 */
+        0x3da08040, /* lis r13, 0x8040 */
+        0x61ad0000, /* ori r13, r13, 0 */
+        0x4e800020, /* blr */
+        /* 0x80004030 main */
+        0x4e800020, /* blr */
+    };
+    uint8_t memory[sizeof(code)];
+    link_sda_t sda = { 0, 0 };
+    size_t i;
+    
+    for (i = 0; i < sizeof(code) / sizeof(*code); i++)
+        Link_Write32(memory + i * 4, code[i]);
+    
+    Link_FindSdaBases(memory, 0x80004000, sizeof(memory), 0x80004000, &sda);
+    
+    if (sda.sda_base != LINK_TEST_SDA_BASE)
+        return 101;
+    if (sda.sda2_base != LINK_TEST_SDA2_BASE)
+        return 102;
+    
+    /* an entry point outside of the code must not be read */
+    sda.sda_base = 1;
+    sda.sda2_base = 2;
+    Link_FindSdaBases(memory, 0x80004000, sizeof(memory), 0x80000000, &sda);
+    
+    if (sda.sda_base != 1 || sda.sda2_base != 2)
+        return 103;
+    
+    return 0;
+}
+
+/* A small module: a .bslug.load entry pointing at func in .text, which
+ * references buf in .bss and game_func from the game. .data is unreferenced. */
+static uint8_t *LinkTest_ElfModule(size_t *size) {
+    static const uint8_t text[] = {
+        0x3c, 0x60, 0x00, 0x00, /* lis r3, buf+4@ha */
+        0x38, 0x63, 0x00, 0x00, /* addi r3, r3, buf+4@l */
+        0x48, 0x00, 0x00, 0x01, /* bl game_func */
+        0x4e, 0x80, 0x00, 0x20, /* blr */
+    };
+    static const uint8_t data[4] = { 0 };
+    static const uint8_t load[12] = { 0 };
+    static const char strtab[] = "\0func\0buf\0game_func\0table";
+    uint8_t rela_text[3 * sizeof(Elf32_Rela)];
+    uint8_t rela_data[1 * sizeof(Elf32_Rela)];
+    uint8_t rela_load[1 * sizeof(Elf32_Rela)];
+    uint8_t symtab[5 * sizeof(Elf32_Sym)];
+    const link_test_section_t sections[] = {
+        /* 1 */ { ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 4,
+            0, 0, 0, text, sizeof(text) },
+        /* 2 */ { ".rela.text", SHT_RELA, 0, 4, 8, 1, sizeof(Elf32_Rela),
+            rela_text, sizeof(rela_text) },
+        /* 3 */ { ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 4,
+            0, 0, 0, data, sizeof(data) },
+        /* 4 */ { ".rela.data", SHT_RELA, 0, 4, 8, 3, sizeof(Elf32_Rela),
+            rela_data, sizeof(rela_data) },
+        /* 5 */ { ".bslug.load", SHT_PROGBITS, SHF_ALLOC, 4,
+            0, 0, 0, load, sizeof(load) },
+        /* 6 */ { ".rela.bslug.load", SHT_RELA, 0, 4, 8, 5,
+            sizeof(Elf32_Rela), rela_load, sizeof(rela_load) },
+        /* 7 */ { ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, 32,
+            0, 0, 0, NULL, 64 },
+        /* 8 */ { ".symtab", SHT_SYMTAB, 0, 4, 9, 3, sizeof(Elf32_Sym),
+            symtab, sizeof(symtab) },
+        /* 9 */ { ".strtab", SHT_STRTAB, 0, 1, 0, 0, 0,
+            (const uint8_t *)strtab, sizeof(strtab) },
+    };
+    
+    memset(symtab, 0, sizeof(symtab));
+    LinkTest_Sym(symtab, 1, 1, 0, ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), 1);
+    LinkTest_Sym(symtab, 2, 6, 0, ELF32_ST_INFO(STB_LOCAL, STT_OBJECT), 7);
+    LinkTest_Sym(
+        symtab, 3, 10, 0, ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE), SHN_UNDEF);
+    LinkTest_Sym(symtab, 4, 20, 0, ELF32_ST_INFO(STB_LOCAL, STT_OBJECT), 3);
+    
+    LinkTest_Rela(rela_text, 0, 2, 2, R_PPC_ADDR16_HA, 4);
+    LinkTest_Rela(rela_text, 1, 6, 2, R_PPC_ADDR16_LO, 4);
+    LinkTest_Rela(rela_text, 2, 8, 3, R_PPC_REL24, 0);
+    LinkTest_Rela(rela_data, 0, 0, 1, R_PPC_ADDR32, 0);
+    LinkTest_Rela(rela_load, 0, 8, 1, R_PPC_ADDR32, 0);
+    
+    return LinkTest_ElfBuild(
+        sections, sizeof(sections) / sizeof(*sections), size);
+}
+
+int LinkTest_Elf0(void) {
+    static const uint8_t cold[16] = { 0 };
+    static const uint8_t hot[8] = { 0 };
+    /* bslug.ld keeps .text.hot as its own output section, ahead of .text;
+     * here it comes second, so the layout has to move it first. */
+    static const link_test_section_t hot_sections[] = {
+        /* 1 */ { ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 4,
+            0, 0, 0, cold, sizeof(cold) },
+        /* 2 */ { ".text.hot", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 4,
+            0, 0, 0, hot, sizeof(hot) },
+    };
+    uint8_t *data;
+    size_t size, symtab_count, symtab_strndx;
+    link_elf_t elf;
+    Elf32_Sym *symtab;
+    bool placed[11];
+    link_layout_t layout;
+    size_t i;
+    
+    data = LinkTest_ElfModule(&size);
+    if (data == NULL)
+        return 6;
+    
+    if (Link_ElfOpen(&elf, data, size) != LINK_ELF_OK)
+        return 101;
+    if (elf.section_count != 11)
+        return 102;
+    if (Link_ElfFindSection(&elf, ".bslug.load") != 5)
+        return 103;
+    if (Link_ElfFindSection(&elf, ".missing") != 0)
+        return 104;
+    
+    symtab = Link_ElfLoadSymtab(&elf, &symtab_count, &symtab_strndx);
+    if (symtab == NULL)
+        return 105;
+    if (symtab_count != 5 || symtab_strndx != 9)
+        return 106;
+    if (strcmp(Link_ElfString(&elf, 9, symtab[3].st_name), "game_func") != 0)
+        return 107;
+    
+    if (!Link_ElfLoadReferences(&elf, 1, symtab, symtab_count))
+        return 111;
+    if (Link_ElfLoadReferences(&elf, 7, symtab, symtab_count))
+        return 112;
+    
+    for (i = 0; i < elf.section_count; i++)
+        placed[i] = i == 1 || i == 7;
+    if (!Link_ElfLayout(&elf, placed, symtab, symtab_count, &layout))
+        return 114;
+    /* the 16 bytes of code come first, then the 32 byte aligned .bss */
+    if (layout.offsets[1] != 0 || layout.offsets[7] != 32)
+        return 115;
+    if (layout.offsets[3] != SIZE_MAX)
+        return 116;
+    if (layout.size != 96 || layout.padding != 16 || layout.align != 32)
+        return 117;
+    if (Link_LayoutRegionSize(&layout) != 96)
+        return 118;
+    
+    /* a little endian file is refused */
+    data[EI_DATA] = ELFDATA2LSB;
+    if (Link_ElfOpen(&elf, data, size) != LINK_ELF_NOT_BIG_ENDIAN)
+        return 119;
+    data[EI_DATA] = ELFDATA2MSB;
+    /* as is a file whose section headers are cut off */
+    if (Link_ElfOpen(&elf, data, size - 1) != LINK_ELF_INVALID_SECTIONS)
+        return 120;
+    
+    free(layout.offsets);
+    free(symtab);
+    free(data);
+    
+    /* hot code goes first even though the bigger .text comes first */
+    data = LinkTest_ElfBuild(
+        hot_sections, sizeof(hot_sections) / sizeof(*hot_sections), &size);
+    if (data == NULL)
+        return 6;
+    if (Link_ElfOpen(&elf, data, size) != LINK_ELF_OK)
+        return 121;
+    for (i = 0; i < elf.section_count; i++)
+        placed[i] = i == 1 || i == 2;
+    if (!Link_ElfLayout(&elf, placed, NULL, 0, &layout))
+        return 122;
+    if (layout.offsets[2] != 0 || layout.offsets[1] != sizeof(hot))
+        return 123;
+    
+    free(layout.offsets);
+    free(data);
+    return 0;
+}
+
+int LinkTest_Elf1(void) {
+    uint8_t *data, region[96];
+    uint8_t load[12];
+    size_t size, symtab_count, symtab_strndx;
+    link_elf_t elf;
+    Elf32_Sym *symtab;
+    Elf32_Shdr shdr;
+    link_test_deferred_t deferred = { NULL, 0, 0, 0, 0 };
+    
+    data = LinkTest_ElfModule(&size);
+    if (data == NULL)
+        return 6;
+    if (Link_ElfOpen(&elf, data, size) != LINK_ELF_OK)
+        return 101;
+    symtab = Link_ElfLoadSymtab(&elf, &symtab_count, &symtab_strndx);
+    if (symtab == NULL)
+        return 102;
+    
+    /* place .text at 0x81000000 and .bss just after, as the layout did. */
+    if (!Link_ElfSection(&elf, 1, &shdr) ||
+        !Link_ElfLoadSection(&elf, 1, &shdr, region))
+        return 103;
+    if (!Link_ElfSection(&elf, 7, &shdr) ||
+        !Link_ElfLoadSection(&elf, 7, &shdr, region + 32))
+        return 104;
+    if (!Link_ElfSection(&elf, 5, &shdr) ||
+        !Link_ElfLoadSection(&elf, 5, &shdr, load))
+        return 105;
+    Link_ElfLoadSymbols(1, 0x81000000, symtab, symtab_count);
+    Link_ElfLoadSymbols(7, 0x81000020, symtab, symtab_count);
+    
+    if (symtab[1].st_value != 0x81000000 || symtab[1].st_other != 1)
+        return 106;
+    
+    if (Link_ElfLinkSection(
+            &elf, 1, region, 0x81000000, symtab, symtab_count,
+            symtab_strndx, NULL, &LinkTest_Defer, &deferred) != 2)
+        return 107;
+    if (Link_Read32(region + 0) != 0x3c608100)
+        return 108;
+    if (Link_Read32(region + 4) != 0x38630024)
+        return 109;
+    /* game_func is left for later */
+    if (Link_Read32(region + 8) != 0x48000001)
+        return 110;
+    if (deferred.count != 1 || deferred.name == NULL ||
+        strcmp(deferred.name, "game_func") != 0 ||
+        deferred.offset != 8 || deferred.type != R_PPC_REL24)
+        return 111;
+    
+    if (Link_ElfLinkSection(
+            &elf, 5, load, 0x80900000, symtab, symtab_count,
+            symtab_strndx, NULL, NULL, NULL) != 1)
+        return 112;
+    if (Link_Read32(load + 8) != 0x81000000)
+        return 113;
+    
+    /* undefined symbols are an error without somewhere to defer them */
+    if (Link_ElfLinkSection(
+            &elf, 1, region, 0x81000000, symtab, symtab_count,
+            symtab_strndx, NULL, NULL, NULL) >= 0)
+        return 114;
+    
+    /* a word relocation 2 bytes from the end of .data would overrun it */
+    if (!Link_ElfSection(&elf, 4, &shdr))
+        return 115;
+    Link_Write32(data + shdr.sh_offset, 2);
+    if (Link_ElfLinkSection(
+            &elf, 3, region + 64, 0x81000040, symtab, symtab_count,
+            symtab_strndx, NULL, NULL, NULL) >= 0)
+        return 116;
+    free(symtab);
+    
+    /* as are references to sections that haven't been placed */
+    symtab = Link_ElfLoadSymtab(&elf, &symtab_count, &symtab_strndx);
+    if (symtab == NULL)
+        return 117;
+    if (Link_ElfLinkSection(
+            &elf, 5, load, 0x80900000, symtab, symtab_count,
+            symtab_strndx, NULL, NULL, NULL) >= 0)
+        return 118;
+    
+    free(symtab);
+    free(data);
+    return 0;
+}
+
+/* What LinkTest_Template returns without its fixtures, which the test
+ * runner reports as a skip rather than a pass; see Makefile. */
+#define LINK_TEST_SKIPPED 77
+
+/* Where the template's sections were placed by powerpc-eabi-ld; see
+ * makefile.mk. */
+static const struct {
+    const char *name;
+    uint32_t address;
+} link_test_template_sections[] = {
+    { ".bslug.meta", 0x81000000 },
+    { ".bslug.load", 0x81100000 },
+    { ".text", 0x81200000 },
+    { ".data", 0x81300000 },
+    { ".rodata", 0x81400000 },
+    { ".bss", 0x81500000 },
+};
+
+/* Where a section being linked is, for LinkTest_Resolve. */
+typedef struct {
+    uint8_t *destination;
+    uint32_t address;
+    bool ok;
+} link_test_resolve_t;
+
+/* Resolve game symbols to 0, as --unresolved-symbols=ignore-all does. */
+static bool LinkTest_Resolve(
+        void *arg, size_t shndx, const char *name, size_t offset,
+        unsigned char type, int addend, uint32_t symbol_addr) {
+    link_test_resolve_t *resolve = arg;
+    
+    if (!Link_Relocate(
+            type, resolve->destination + offset, resolve->address + offset,
+            offset, addend, name == NULL ? symbol_addr : 0, NULL))
+        resolve->ok = false;
+    return true;
+}
+
+static uint8_t *LinkTest_ReadFile(const char *path, size_t *size) {
+    FILE *file;
+    uint8_t *data;
+    long length;
+    
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    data = NULL;
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0 &&
+        fseek(file, 0, SEEK_SET) == 0) {
+        data = malloc(length);
+        if (data != NULL && fread(data, 1, length, file) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+        *size = length;
+    }
+    fclose(file);
+    return data;
+}
+
+/* Compare the linker against powerpc-eabi-ld on modules/template, as its own
+ * makefile builds it. That needs devkitPPC, so without it this is skipped. */
+int LinkTest_Template(void) {
+    uint8_t *object, *expected, *region;
+    size_t object_size, expected_size, symtab_count, symtab_strndx;
+    size_t shndx, i;
+    link_elf_t elf;
+    Elf32_Sym *symtab;
+    Elf32_Shdr shdr;
+    link_test_resolve_t resolve;
+    int result;
+    
+    object = LinkTest_ReadFile("link_test_template.mod", &object_size);
+    expected = LinkTest_ReadFile("link_test_template.bin", &expected_size);
+    if (object == NULL || expected == NULL) {
+        printf("link_test_template.mod not built (needs DEVKITPPC).\n");
+        free(object);
+        free(expected);
+        return LINK_TEST_SKIPPED;
+    }
+    
+    result = 0;
+    symtab = NULL;
+    /* the reference binary spans .bslug.meta to the end of .rodata. */
+    region = calloc(1, expected_size);
+    if (region == NULL) {
+        result = 6;
+        goto exit;
+    }
+    
+    if (Link_ElfOpen(&elf, object, object_size) != LINK_ELF_OK) {
+        result = 101;
+        goto exit;
+    }
+    symtab = Link_ElfLoadSymtab(&elf, &symtab_count, &symtab_strndx);
+    if (symtab == NULL) {
+        result = 102;
+        goto exit;
+    }
+    
+    for (i = 0;
+         i < sizeof(link_test_template_sections) /
+             sizeof(*link_test_template_sections);
+         i++) {
+        shndx = Link_ElfFindSection(&elf, link_test_template_sections[i].name);
+        if (shndx == 0)
+            continue;
+        Link_ElfLoadSymbols(
+            shndx, link_test_template_sections[i].address,
+            symtab, symtab_count);
+    }
+    
+    for (i = 0;
+         i < sizeof(link_test_template_sections) /
+             sizeof(*link_test_template_sections);
+         i++) {
+        shndx = Link_ElfFindSection(&elf, link_test_template_sections[i].name);
+        if (shndx == 0)
+            continue;
+        if (!Link_ElfSection(&elf, shndx, &shdr)) {
+            result = 103;
+            goto exit;
+        }
+        if (shdr.sh_type == SHT_NOBITS)
+            continue;
+        resolve.destination = region + (
+            link_test_template_sections[i].address -
+            link_test_template_sections[0].address);
+        resolve.address = link_test_template_sections[i].address;
+        resolve.ok = true;
+        if (resolve.destination + shdr.sh_size > region + expected_size) {
+            result = 104;
+            goto exit;
+        }
+        if (!Link_ElfLoadSection(
+                &elf, shndx, &shdr, resolve.destination)) {
+            result = 105;
+            goto exit;
+        }
+        if (Link_ElfLinkSection(
+                &elf, shndx, resolve.destination, resolve.address,
+                symtab, symtab_count, symtab_strndx, NULL,
+                &LinkTest_Resolve, &resolve) < 0 || !resolve.ok) {
+            result = 106;
+            goto exit;
+        }
+        if (memcmp(
+                resolve.destination,
+                expected + (resolve.destination - region),
+                shdr.sh_size) != 0) {
+            printf("%s differs from powerpc-eabi-ld.\n",
+                link_test_template_sections[i].name);
+            result = 107 + i;
+            goto exit;
+        }
+    }
+    
+exit:
+    free(symtab);
+    free(region);
+    free(expected);
+    free(object);
+    return result;
+}
+
+/* Build a module whose .text is count instructions, half of them addi with an
+ * ADDR16_LO relocation and half bl with a REL24 one, all against func. */
+static uint8_t *LinkTest_BenchmarkModule(size_t count, size_t *size) {
+    static const uint8_t load[4] = { 0 };
+    static const char strtab[] = "\0func";
+    uint8_t *text, *rela, symtab[2 * sizeof(Elf32_Sym)], *elf;
+    size_t i;
+    uint8_t rela_load[sizeof(Elf32_Rela)];
+    
+    text = malloc(count * 4);
+    rela = malloc(count * sizeof(Elf32_Rela));
+    if (text == NULL || rela == NULL) {
+        free(text);
+        free(rela);
+        return NULL;
+    }
+    
+    for (i = 0; i < count; i++) {
+        if (i & 1) {
+            Link_Write32(text + i * 4, 0x48000001);
+            LinkTest_Rela(rela, i, i * 4, 1, R_PPC_REL24, 0);
+        } else {
+            Link_Write32(text + i * 4, 0x38630000);
+            LinkTest_Rela(rela, i, i * 4 + 2, 1, R_PPC_ADDR16_LO, i);
+        }
+    }
+    memset(symtab, 0, sizeof(symtab));
+    LinkTest_Sym(symtab, 1, 1, 0, ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), 1);
+    LinkTest_Rela(rela_load, 0, 0, 1, R_PPC_ADDR32, 0);
+    
+    {
+        const link_test_section_t sections[] = {
+            /* 1 */ { ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 4,
+                0, 0, 0, text, count * 4 },
+            /* 2 */ { ".rela.text", SHT_RELA, 0, 4, 5, 1, sizeof(Elf32_Rela),
+                rela, count * sizeof(Elf32_Rela) },
+            /* 3 */ { ".bslug.load", SHT_PROGBITS, SHF_ALLOC, 4,
+                0, 0, 0, load, sizeof(load) },
+            /* 4 */ { ".rela.bslug.load", SHT_RELA, 0, 4, 5, 3,
+                sizeof(Elf32_Rela), rela_load, sizeof(rela_load) },
+            /* 5 */ { ".symtab", SHT_SYMTAB, 0, 4, 6, 1, sizeof(Elf32_Sym),
+                symtab, sizeof(symtab) },
+            /* 6 */ { ".strtab", SHT_STRTAB, 0, 1, 0, 0, 0,
+                (const uint8_t *)strtab, sizeof(strtab) },
+        };
+        
+        elf = LinkTest_ElfBuild(
+            sections, sizeof(sections) / sizeof(*sections), size);
+    }
+    
+    free(text);
+    free(rela);
+    return elf;
+}
+
+/* Link 1, 16 and 256 copies of a module the way Module_LinkModuleElf does,
+ * and report the throughput. Only fails if linking does. */
+int LinkTest_Benchmark(void) {
+    static const size_t counts[] = { 1, 16, 256 };
+    const size_t relocations = 4096;
+    uint8_t *data, *region;
+    size_t size, i, j;
+    int result;
+    
+    data = LinkTest_BenchmarkModule(relocations, &size);
+    region = malloc(relocations * 4);
+    if (data == NULL || region == NULL) {
+        free(data);
+        free(region);
+        return 6;
+    }
+    
+    result = 0;
+    for (i = 0; i < sizeof(counts) / sizeof(*counts); i++) {
+        clock_t start, end;
+        double seconds;
+        
+        start = clock();
+        for (j = 0; j < counts[i]; j++) {
+            link_elf_t elf;
+            Elf32_Sym *symtab;
+            size_t symtab_count, symtab_strndx;
+            Elf32_Shdr shdr;
+            uint32_t address;
+            
+            address = 0x81000000 + (j & 0xff) * 0x4000;
+            if (Link_ElfOpen(&elf, data, size) != LINK_ELF_OK) {
+                result = 101;
+                goto exit;
+            }
+            symtab = Link_ElfLoadSymtab(&elf, &symtab_count, &symtab_strndx);
+            if (symtab == NULL) {
+                result = 102;
+                goto exit;
+            }
+            if (!Link_ElfSection(&elf, 1, &shdr) ||
+                !Link_ElfLoadSection(&elf, 1, &shdr, region)) {
+                free(symtab);
+                result = 103;
+                goto exit;
+            }
+            Link_ElfLoadSymbols(1, address, symtab, symtab_count);
+            if (Link_ElfLinkSection(
+                    &elf, 1, region, address, symtab, symtab_count,
+                    symtab_strndx, NULL, NULL, NULL) != (int)relocations) {
+                free(symtab);
+                result = 104;
+                goto exit;
+            }
+            free(symtab);
+        }
+        end = clock();
+        
+        seconds = (double)(end - start) / CLOCKS_PER_SEC;
+        if (seconds > 0)
+            printf(
+                "%u module(s) of %u relocations: %.0f relocations/s, "
+                "%.0f modules/s.\n",
+                (unsigned)counts[i], (unsigned)relocations,
+                counts[i] * relocations / seconds, counts[i] / seconds);
+        else
+            printf(
+                "%u module(s) of %u relocations: too fast to time.\n",
+                (unsigned)counts[i], (unsigned)relocations);
+    }
+    
+exit:
+    free(region);
+    free(data);
+    return result;
+}
+
+int LinkTest_Lz4(void) {
+    /* "abcd", then a 12 byte match 4 back, then 5 literals. */
+    static const uint8_t block0[] = {
+        0x48, 'a', 'b', 'c', 'd', 0x04, 0x00,
+        0x50, 'E', 'N', 'D', '!', '!',
+    };
+    /* 'x', then a 100 byte match 1 back (so overlapping), then 5 literals. */
+    static const uint8_t block1[] = {
+        0x1f, 'x', 0x01, 0x00, 100 - 4 - 15,
+        0x50, 't', 'a', 'i', 'l', '!',
+    };
+    /* a match reaching back before the start of the output. */
+    static const uint8_t block2[] = {
+        0x10, 'x', 0x02, 0x00,
+        0x50, 't', 'a', 'i', 'l', '!',
+    };
+    static const char strtab[] = "\0func";
+    uint8_t output[128], section[LINK_ELF_CHDR_SIZE + sizeof(block1)];
+    uint8_t symtab[2 * sizeof(Elf32_Sym)], load[4] = { 0 };
+    uint8_t rela_load[sizeof(Elf32_Rela)];
+    uint8_t *data;
+    size_t size, i;
+    link_elf_t elf;
+    Elf32_Shdr shdr;
+    
+    if (!Link_Lz4Decompress(block0, sizeof(block0), output, 21))
+        return 101;
+    if (memcmp(output, "abcdabcdabcdabcdEND!!", 21) != 0)
+        return 102;
+    /* the output size must match exactly */
+    if (Link_Lz4Decompress(block0, sizeof(block0), output, 20))
+        return 103;
+    if (Link_Lz4Decompress(block0, sizeof(block0), output, 22))
+        return 104;
+    /* as must the input */
+    if (Link_Lz4Decompress(block0, sizeof(block0) - 1, output, 21))
+        return 105;
+    
+    if (!Link_Lz4Decompress(block1, sizeof(block1), output, 106))
+        return 106;
+    for (i = 0; i < 101; i++)
+        if (output[i] != 'x')
+            return 107;
+    if (memcmp(output + 101, "tail!", 5) != 0)
+        return 108;
+    
+    if (Link_Lz4Decompress(block2, sizeof(block2), output, 8))
+        return 109;
+    
+    /* the same block as a compressed section of a module. */
+    Link_Write32(section, LINK_ELFCOMPRESS_LZ4);
+    Link_Write32(section + 4, 106);
+    Link_Write32(section + 8, 32);
+    memcpy(section + LINK_ELF_CHDR_SIZE, block1, sizeof(block1));
+    memset(symtab, 0, sizeof(symtab));
+    LinkTest_Sym(symtab, 1, 1, 0, ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), 1);
+    LinkTest_Rela(rela_load, 0, 0, 1, R_PPC_ADDR32, 0);
+    
+    {
+        const link_test_section_t sections[] = {
+            /* 1 */ { ".text", SHT_PROGBITS,
+                SHF_ALLOC | SHF_EXECINSTR | SHF_COMPRESSED, 4,
+                0, 0, 0, section, sizeof(section) },
+            /* 2 */ { ".bslug.load", SHT_PROGBITS, SHF_ALLOC, 4,
+                0, 0, 0, load, sizeof(load) },
+            /* 3 */ { ".rela.bslug.load", SHT_RELA, 0, 4, 4, 2,
+                sizeof(Elf32_Rela), rela_load, sizeof(rela_load) },
+            /* 4 */ { ".symtab", SHT_SYMTAB, 0, 4, 5, 1, sizeof(Elf32_Sym),
+                symtab, sizeof(symtab) },
+            /* 5 */ { ".strtab", SHT_STRTAB, 0, 1, 0, 0, 0,
+                (const uint8_t *)strtab, sizeof(strtab) },
+        };
+        
+        data = LinkTest_ElfBuild(
+            sections, sizeof(sections) / sizeof(*sections), &size);
+    }
+    if (data == NULL)
+        return 6;
+    
+    if (Link_ElfOpen(&elf, data, size) != LINK_ELF_OK)
+        return 110;
+    if (!Link_ElfSection(&elf, 1, &shdr))
+        return 111;
+    /* sizes are reported as they will be loaded */
+    if (shdr.sh_size != 106 || shdr.sh_addralign != 32)
+        return 112;
+    if (Link_ElfSectionFileSize(&elf, 1) != sizeof(section))
+        return 113;
+    memset(output, 0, sizeof(output));
+    if (!Link_ElfLoadSection(&elf, 1, &shdr, output))
+        return 114;
+    if (output[100] != 'x' || memcmp(output + 101, "tail!", 5) != 0)
+        return 115;
+    
+    /* a block running past the end of its section is refused, even though
+     * the rest of it is still there in the file. */
+    Link_Write32(
+        data + Link_Read32(data + offsetof(Elf32_Ehdr, e_shoff)) +
+        sizeof(Elf32_Shdr) + offsetof(Elf32_Shdr, sh_size),
+        sizeof(section) - 1);
+    if (Link_ElfOpen(&elf, data, size) != LINK_ELF_OK ||
+        !Link_ElfSection(&elf, 1, &shdr))
+        return 116;
+    if (Link_ElfLoadSection(&elf, 1, &shdr, output))
+        return 117;
+    
+    /* unknown compression is refused when the file is opened */
+    Link_Write32(data + sizeof(Elf32_Ehdr), 1);
+    if (Link_ElfOpen(&elf, data, size) != LINK_ELF_INVALID_SECTIONS)
+        return 118;
+    
+    free(data);
+    return 0;
+}
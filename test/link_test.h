@@ -0,0 +1,64 @@
+/* link_test.h
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LINK_TEST_H_
+#define LINK_TEST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A section for LinkTest_ElfBuild; sections are numbered from 1 in the order
+ * given, and .shstrtab is added after them. */
+typedef struct {
+    const char *name;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t align;
+    uint32_t link;
+    uint32_t info;
+    uint32_t entsize;
+    const uint8_t *data;
+    size_t size;
+} link_test_section_t;
+
+uint8_t *LinkTest_ElfBuild(
+    const link_test_section_t *sections, size_t count, size_t *size);
+void LinkTest_Sym(
+    uint8_t *symtab, size_t index, uint32_t name, uint32_t value,
+    unsigned char info, uint16_t shndx);
+void LinkTest_Rela(
+    uint8_t *rela, size_t index, uint32_t offset, uint32_t symbol,
+    unsigned char type, int32_t addend);
+
+int LinkTest_Relocate0(void);
+int LinkTest_Sda21(void);
+int LinkTest_SdaRel16(void);
+int LinkTest_FindSdaBases(void);
+int LinkTest_Elf0(void);
+int LinkTest_Elf1(void);
+int LinkTest_Template(void);
+int LinkTest_Benchmark(void);
+int LinkTest_Lz4(void);
+
+#endif /* LINK_TEST_H_ */
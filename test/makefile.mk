@@ -3,8 +3,64 @@ WD_SRC := $(WD)
 
 SRC  += $(WD)fsm_test.c
 INC_DIRS += $(WD)../src/linker
-TEST += 0 1 2 3 4 5 6 7 8 9 10 11
+TEST += 0 1 2 3 4 5 6 7 8 9 10 11 12
 SRC  += $(WD)regression.c
 SRC  += $(WD)symbol_test.c
 INC_DIRS += $(WD)../src/libelf
-TEST += 12 13 14 15
+# size_t is wider than int on the host, so symbol.c must scan it as such.
+CFLAGS += -DFMT_SIZE=\"z\"
+TEST += 13 14 15 16
+SRC  += $(WD)link_test.c
+TEST += 17 18 19 20 21 22 23 24 25
+SRC  += $(WD)trace_test.c
+LIBS += pthread
+TEST += 26 27 28 29
+SRC  += $(WD)sched_test.c
+TEST += 30 31 32 33 34
+SRC  += $(WD)di_queue_test.c
+TEST += 35 36 37
+SRC  += $(WD)boot_test.c
+TEST += 38 39
+SRC  += $(WD)netcodec_test.c
+# netslug modules use the bslug headers for Wii types, after the host ones.
+CFLAGS += -idirafter $(WD)../bslug_include
+TEST += 40 41 42
+SRC  += $(WD)netwindow_test.c
+TEST += 43 44 45
+SRC  += $(WD)netframe_test.c
+TEST += 46 47
+SRC  += $(WD)netdelay_test.c
+TEST += 48 49
+SRC  += $(WD)netsnap_test.c
+TEST += 50 51 52
+SRC  += $(WD)netring_test.c
+TEST += 53 54
+SRC  += $(WD)netloop_test.c
+TEST += 55 56 57
+
+# LinkTest_Template links modules/template, built by its own makefile, and
+# compares against powerpc-eabi-ld at the section addresses in
+# link_test_template_sections, so it needs devkitPPC. Without it the test
+# reports a skip.
+ifneq ($(strip $(DEVKITPPC)),)
+TEMPLATE_PREFIX := $(DEVKITPPC)/bin/powerpc-eabi-
+
+link_test_template.mod : $(WD)../modules/template/main.c $(WD)../bslug.ld
+	$(LOG)
+	$Q$(MAKE) -C $(WD)../modules/template \
+	   BUILD=$(CURDIR)/$(BUILD)/template BIN=$(CURDIR) TARGET=$(CURDIR)/$@
+link_test_template.elf : link_test_template.mod
+	$(LOG)
+	$Q$(TEMPLATE_PREFIX)ld --unresolved-symbols=ignore-all -e 0 \
+	   --section-start=.bslug.meta=0x81000000 \
+	   --section-start=.bslug.load=0x81100000 \
+	   --section-start=.text=0x81200000 --section-start=.data=0x81300000 \
+	   --section-start=.rodata=0x81400000 --section-start=.bss=0x81500000 \
+	   $< -o $@
+link_test_template.bin : link_test_template.elf
+	$(LOG)
+	$Q$(TEMPLATE_PREFIX)objcopy -O binary -j .bslug.meta -j .bslug.load \
+	   -j .text -j .data -j .rodata $< $@
+
+test_23 : link_test_template.mod link_test_template.bin
+endif
@@ -0,0 +1,293 @@
+/* netcodec_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../modules/netslug_main/netcodec.c"
+
+#include "netcodec_test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define NETCODEC_TEST_FRAMES 600
+
+static uint32_t netcodec_test_seed;
+
+static unsigned NetCodecTest_Rand(unsigned max) {
+    netcodec_test_seed = netcodec_test_seed * 1664525 + 1013904223;
+    return (netcodec_test_seed >> 16) % max;
+}
+
+/* Two players holding still apart from accelerometer noise, pressing a
+ * button now and then, with the other two slots disconnected as
+ * sendThread_main leaves them. */
+static void NetCodecTest_Frame(
+        struct ctrlPacket *packet, const struct ctrlPacket *previous,
+        int frame) {
+    int i, j;
+    
+    if (previous)
+        *packet = *previous;
+    else
+        memset(packet, 0, sizeof(*packet));
+    packet->frameNumber = frame;
+    packet->frameSeed = NextSeed(packet->frameSeed);
+    packet->callback_sector =
+        NetCodecTest_Rand(20) == 0 ? (frame << 12) | 42 : 0;
+    if (NetCodecTest_Rand(30) == 0)
+        packet->game.SMN.dance_a6ca = NetCodecTest_Rand(256);
+    if (NetCodecTest_Rand(100) == 0)
+        packet->inputDelay = 2 + NetCodecTest_Rand(14);
+    for (i = 0; i < 4; i++) {
+        packet->haveInput[i] = true;
+        if (i >= 2) {
+            packet->status[i] = WPAD_STATUS_DISCONNECTED;
+            continue;
+        }
+        packet->status[i] = WPAD_STATUS_OK;
+        packet->formats[i] = i == 0 ?
+            WPAD_FORMAT_NUNCHUCK_ACC_IR : WPAD_FORMAT_ACC_IR;
+        packet->extension[i] = i == 0 ?
+            WPAD_EXTENSION_NUNCHUCK : WPAD_EXTENSION_NONE;
+        packet->inputs[i].extension = packet->extension[i];
+        if (NetCodecTest_Rand(10) == 0)
+            packet->inputs[i].buttons ^= 1 << NetCodecTest_Rand(16);
+        for (j = 0; j < 3; j++) {
+            if (NetCodecTest_Rand(2))
+                packet->inputs[i].acceleration[j] =
+                    512 + NetCodecTest_Rand(5);
+        }
+        if (NetCodecTest_Rand(4) == 0)
+            packet->inputs[i].ir[0].x = NetCodecTest_Rand(1024);
+        packet->gravityUnit[i][0].acceleration[2] = 100;
+        packet->gravityUnit[i][1].acceleration[2] = 200;
+    }
+}
+
+static bool NetCodecTest_SlotEqual(
+        WPADDataFormat_t format_a, WPADStatus_t status_a,
+        WPADExtension_t extension_a, const WPADData_t *inputs_a,
+        const WPADAccGravityUnit_t gravity_a[2],
+        WPADDataFormat_t format_b, WPADStatus_t status_b,
+        WPADExtension_t extension_b, const WPADData_t *inputs_b,
+        const WPADAccGravityUnit_t gravity_b[2]) {
+    return format_a == format_b && status_a == status_b &&
+        extension_a == extension_b &&
+        memcmp(gravity_a, gravity_b, 2 * sizeof(*gravity_a)) == 0 &&
+        memcmp(inputs_a, inputs_b, WPADDataFormatSize(format_a)) == 0;
+}
+
+static bool NetCodecTest_CtrlEqual(
+        const struct ctrlPacket *a, const struct ctrlPacket *b) {
+    int i;
+    
+    if (a->frameNumber != b->frameNumber || a->frameSeed != b->frameSeed ||
+        a->callback_sector != b->callback_sector ||
+        a->inputDelay != b->inputDelay ||
+        memcmp(&a->game.SMN, &b->game.SMN, sizeof(a->game.SMN)) != 0)
+        return false;
+    for (i = 0; i < 4; i++) {
+        if (a->haveInput[i] != b->haveInput[i])
+            return false;
+        if (!NetCodecTest_SlotEqual(
+                a->formats[i], a->status[i], a->extension[i], &a->inputs[i],
+                a->gravityUnit[i], b->formats[i], b->status[i],
+                b->extension[i], &b->inputs[i], b->gravityUnit[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool NetCodecTest_SendEqual(
+        const struct sendPacket *a, const struct sendPacket *b) {
+    if (a->type != b->type || a->clientNumber != b->clientNumber)
+        return false;
+    if (a->type == 1)
+        return a->data.di_read.sector == b->data.di_read.sector;
+    return a->data.controller.frameNumberToDeliverOn ==
+            b->data.controller.frameNumberToDeliverOn &&
+        a->data.controller.wiimote == b->data.controller.wiimote &&
+        NetCodecTest_SlotEqual(
+            a->data.controller.format, a->data.controller.status,
+            a->data.controller.extension, &a->data.controller.inputs,
+            a->data.controller.gravityUnit,
+            b->data.controller.format, b->data.controller.status,
+            b->data.controller.extension, &b->data.controller.inputs,
+            b->data.controller.gravityUnit);
+}
+
+int NetCodecTest_RoundTrip(void) {
+    static struct ctrlPacket sent[2], received[2];
+    struct sendPacket input, previous_input, decoded, previous_decoded;
+    unsigned char buffer[NETCODEC_CTRL_MAX];
+    int frame, length, i;
+    
+    netcodec_test_seed = 1;
+    for (frame = 0; frame < NETCODEC_TEST_FRAMES; frame++) {
+        struct ctrlPacket *packet = &sent[frame & 1];
+        const struct ctrlPacket *reference =
+            frame == 0 ? NULL : &sent[~frame & 1];
+        
+        NetCodecTest_Frame(packet, reference, frame);
+        /* change format part way, leaving stale bytes past the new size. */
+        if (frame == NETCODEC_TEST_FRAMES / 2) {
+            packet->formats[0] = WPAD_FORMAT_ACC;
+            packet->inputs[1].extension_data.unknown[0x20] = 0x55;
+        }
+        length = NetCodec_EncodeCtrl(packet, reference, buffer, sizeof(buffer));
+        if (length <= 0)
+            return 101;
+        if (NetCodec_Kind(buffer, length) != NETCODEC_KIND_CTRL)
+            return 102;
+        if (NetCodec_DecodeCtrl(
+                buffer, length, frame == 0 ? NULL : &received[~frame & 1],
+                &received[frame & 1]) != length)
+            return 103;
+        if (!NetCodecTest_CtrlEqual(packet, &received[frame & 1]))
+            return 104;
+    }
+    
+    memset(&previous_input, 0, sizeof(previous_input));
+    memset(&previous_decoded, 0, sizeof(previous_decoded));
+    for (frame = 0; frame < NETCODEC_TEST_FRAMES; frame++) {
+        input = previous_input;
+        input.sent = 1;
+        input.type = 0;
+        input.clientNumber = 1;
+        input.data.controller.frameNumberToDeliverOn = frame + 5;
+        input.data.controller.wiimote = 1;
+        input.data.controller.format = WPAD_FORMAT_CLASSIC_ACC;
+        if (NetCodecTest_Rand(3) == 0)
+            input.data.controller.inputs.buttons = NetCodecTest_Rand(0x10000);
+        length = NetCodec_EncodeSend(
+            &input, frame == 0 ? NULL : &previous_input,
+            buffer, sizeof(buffer));
+        if (length <= 0 || length > NETCODEC_SEND_MAX)
+            return 105;
+        if (NetCodec_DecodeSend(
+                buffer, length, frame == 0 ? NULL : &previous_decoded,
+                &decoded) != length)
+            return 106;
+        if (!NetCodecTest_SendEqual(&input, &decoded))
+            return 107;
+        previous_input = input;
+        previous_decoded = decoded;
+        
+        /* DI notifications in between do not disturb the reference. */
+        for (i = 0; i < 2; i++) {
+            struct sendPacket di;
+            
+            memset(&di, 0, sizeof(di));
+            di.type = 1;
+            di.clientNumber = 1;
+            di.data.di_read.sector = (frame << 12) | i;
+            length = NetCodec_EncodeSend(&di, NULL, buffer, sizeof(buffer));
+            if (length <= 0 ||
+                NetCodec_DecodeSend(buffer, length, NULL, &decoded) != length)
+                return 108;
+            if (!NetCodecTest_SendEqual(&di, &decoded))
+                return 109;
+        }
+    }
+    
+    return 0;
+}
+
+int NetCodecTest_Size(void) {
+    static struct ctrlPacket packets[2];
+    unsigned char buffer[NETCODEC_CTRL_MAX];
+    size_t total = 0;
+    int frame, length;
+    
+    netcodec_test_seed = 2;
+    for (frame = 0; frame < NETCODEC_TEST_FRAMES; frame++) {
+        NetCodecTest_Frame(
+            &packets[frame & 1], frame == 0 ? NULL : &packets[~frame & 1],
+            frame);
+        length = NetCodec_EncodeCtrl(
+            &packets[frame & 1], frame == 0 ? NULL : &packets[~frame & 1],
+            buffer, sizeof(buffer));
+        if (length <= 0)
+            return 101;
+        if (frame == 0 && length > NETCODEC_CTRL_MAX)
+            return 102;
+        total += length;
+    }
+    /* noisy play should still average well under an eighth of the struct. */
+    if (total / NETCODEC_TEST_FRAMES > sizeof(struct ctrlPacket) / 8)
+        return 103;
+    
+    /* an idle frame is only the header. */
+    packets[0] = packets[1];
+    packets[0].frameNumber++;
+    packets[0].frameSeed = NextSeed(packets[0].frameSeed);
+    packets[0].callback_sector = 0;
+    length = NetCodec_EncodeCtrl(
+        &packets[0], &packets[1], buffer, sizeof(buffer));
+    if (length != 5)
+        return 104;
+    
+    /* too small a buffer fails rather than truncating. */
+    length = NetCodec_EncodeCtrl(&packets[0], NULL, buffer, sizeof(buffer));
+    if (length <= 5)
+        return 105;
+    if (NetCodec_EncodeCtrl(&packets[0], NULL, buffer, length - 1) != -1)
+        return 106;
+    
+    return 0;
+}
+
+int NetCodecTest_Malformed(void) {
+    static struct ctrlPacket packet, decoded;
+    unsigned char buffer[NETCODEC_CTRL_MAX];
+    int length, i;
+    
+    netcodec_test_seed = 3;
+    NetCodecTest_Frame(&packet, NULL, 7);
+    length = NetCodec_EncodeCtrl(&packet, NULL, buffer, sizeof(buffer));
+    if (length <= 0)
+        return 101;
+    for (i = 0; i < length; i++) {
+        if (NetCodec_DecodeCtrl(buffer, i, NULL, &decoded) != -1)
+            return 102;
+    }
+    
+    buffer[0] = NETCODEC_VERSION + 1;
+    if (NetCodec_Kind(buffer, length) != -1)
+        return 103;
+    if (NetCodec_DecodeCtrl(buffer, length, NULL, &decoded) != -1)
+        return 104;
+    buffer[0] = NETCODEC_VERSION;
+    
+    /* a run past the end of a slot. */
+    buffer[1] = NETCODEC_KIND_CTRL;
+    buffer[2] = NETCODEC_CTRL_FRAME_NEXT | NETCODEC_CTRL_SEED_NEXT;
+    buffer[3] = 1;
+    buffer[4] = 1;
+    memset(buffer + 5, 0xff, 4);
+    buffer[9] = NETCODEC_TOKEN_END;
+    if (NetCodec_DecodeCtrl(buffer, 10, NULL, &decoded) != -1)
+        return 105;
+    
+    return 0;
+}
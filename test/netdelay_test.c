@@ -0,0 +1,127 @@
+/* netdelay_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../modules/netslug_main/netdelay.c"
+
+#include "netdelay_test.h"
+
+#define NETDELAY_TEST_MIN 2
+#define NETDELAY_TEST_MAX 15
+#define NETDELAY_TEST_FRAME_US 16683
+
+int NetDelayTest_Start(void) {
+    netdelay_t delay;
+    int i;
+    
+    NetDelay_Init(
+        &delay, NETDELAY_TEST_MIN, NETDELAY_TEST_MAX, NETDELAY_TEST_FRAME_US);
+    if (delay.delay != NETDELAY_DEFAULT)
+        return 101;
+    
+    /* a LAN needs no more than the minimum. */
+    NetDelay_Sample(&delay, 800);
+    if (delay.delay != NETDELAY_TEST_MIN)
+        return 102;
+    
+    /* over the internet, more, and more for a longer round trip. */
+    NetDelay_Init(
+        &delay, NETDELAY_TEST_MIN, NETDELAY_TEST_MAX, NETDELAY_TEST_FRAME_US);
+    NetDelay_Sample(&delay, 60000);
+    if (delay.delay <= NETDELAY_TEST_MIN || delay.delay >= NETDELAY_TEST_MAX)
+        return 103;
+    i = delay.delay;
+    NetDelay_Init(
+        &delay, NETDELAY_TEST_MIN, NETDELAY_TEST_MAX, NETDELAY_TEST_FRAME_US);
+    NetDelay_Sample(&delay, 100000);
+    if (delay.delay <= i)
+        return 104;
+    
+    /* later samples are smoothed, and steady ones bring the target down as
+     * the variation settles. */
+    for (i = 0; i < 100; i++)
+        NetDelay_Sample(&delay, 100000);
+    if (NetDelay_Target(&delay) >= delay.delay)
+        return 105;
+    if (NetDelay_Target(&delay) !=
+        (50000 + NETDELAY_TEST_FRAME_US - 1) / NETDELAY_TEST_FRAME_US + 1 &&
+        NetDelay_Target(&delay) !=
+        (50000 + NETDELAY_TEST_FRAME_US - 1) / NETDELAY_TEST_FRAME_US + 2)
+        return 106;
+    
+    /* but never past the maximum. */
+    NetDelay_Init(
+        &delay, NETDELAY_TEST_MIN, NETDELAY_TEST_MAX, NETDELAY_TEST_FRAME_US);
+    NetDelay_Sample(&delay, 2000000);
+    if (delay.delay != NETDELAY_TEST_MAX)
+        return 107;
+    return 0;
+}
+
+int NetDelayTest_Adjust(void) {
+    netdelay_t delay;
+    int i, start;
+    
+    NetDelay_Init(
+        &delay, NETDELAY_TEST_MIN, NETDELAY_TEST_MAX, NETDELAY_TEST_FRAME_US);
+    NetDelay_Sample(&delay, 800);
+    start = delay.delay;
+    
+    /* an odd stall now and then is left alone. */
+    for (i = 0; i < NETDELAY_STALL_WINDOW * 10; i++) {
+        if (NetDelay_Frame(&delay, i % NETDELAY_STALL_WINDOW == 0) != start)
+            return 101;
+    }
+    
+    /* a long stall is one stall. */
+    for (i = 0; i < NETDELAY_STALL_WINDOW - 1; i++) {
+        if (NetDelay_Frame(&delay, i < 30) != start)
+            return 102;
+    }
+    NetDelay_Frame(&delay, false);
+    
+    /* repeated stalls add a frame. */
+    for (i = 0; i < NETDELAY_STALL_LIMIT * 2 - 1; i++)
+        NetDelay_Frame(&delay, i % 2 == 0);
+    if (delay.delay != start + 1)
+        return 103;
+    
+    /* a long clean run takes it away again, but no further. */
+    for (i = 0; i < NETDELAY_CLEAN_FRAMES - 1; i++) {
+        if (NetDelay_Frame(&delay, false) != start + 1)
+            return 104;
+    }
+    if (NetDelay_Frame(&delay, false) != start)
+        return 105;
+    for (i = 0; i < NETDELAY_CLEAN_FRAMES * 3; i++) {
+        if (NetDelay_Frame(&delay, false) != start)
+            return 106;
+    }
+    
+    /* persistent stalls stop at the maximum. */
+    for (i = 0; i < NETDELAY_STALL_WINDOW * 100; i++)
+        NetDelay_Frame(&delay, i % 2 == 0);
+    if (delay.delay != NETDELAY_TEST_MAX)
+        return 107;
+    return 0;
+}
@@ -0,0 +1,304 @@
+/* netframe_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../modules/netslug_main/netframe.c"
+
+#include "netframe_test.h"
+
+#include <string.h>
+
+#include "../modules/netslug_main/netcodec.h"
+
+#define NETFRAME_TEST_PEERS 3
+#define NETFRAME_TEST_FRAMES 120
+#define NETFRAME_TEST_TICKS (NETFRAME_TEST_FRAMES + 20)
+#define NETFRAME_TEST_IN_FLIGHT 4096
+/* slot 3 is unused, so the host disconnects it. */
+#define NETFRAME_TEST_HOST_SLOTS ((1 << 0) | (1 << 3))
+
+typedef struct {
+    unsigned deliver_at;
+    int to;
+    bool authority;
+    struct sendPacket input;
+    struct ctrlPacket frame;
+} netframe_test_message_t;
+
+static struct ctrlPacket
+    netframe_test_frames[NETFRAME_TEST_PEERS][NETFRAME_TEST_FRAMES];
+static unsigned
+    netframe_test_complete[NETFRAME_TEST_PEERS][NETFRAME_TEST_FRAMES];
+static netframe_test_message_t
+    netframe_test_in_flight[NETFRAME_TEST_IN_FLIGHT];
+static size_t netframe_test_in_flight_count;
+
+/* the host is far from both guests, which are close to each other. */
+static const unsigned
+    netframe_test_latency[NETFRAME_TEST_PEERS][NETFRAME_TEST_PEERS] = {
+    { 0, 6, 6 },
+    { 6, 0, 1 },
+    { 6, 1, 0 },
+};
+
+static void NetFrameTest_Input(struct sendPacket *input, int peer, int frame) {
+    memset(input, 0, sizeof(*input));
+    input->type = 0;
+    input->clientNumber = peer;
+    input->data.controller.frameNumberToDeliverOn = frame;
+    input->data.controller.wiimote = peer;
+    input->data.controller.format = WPAD_FORMAT_ACC;
+    input->data.controller.status = WPAD_STATUS_OK;
+    input->data.controller.inputs.buttons = frame * 3 + peer;
+    input->data.controller.gravityUnit[0].acceleration[1] = peer;
+}
+
+static bool NetFrameTest_Send(
+        const netframe_test_message_t *message, int from, unsigned tick) {
+    int to;
+    
+    for (to = 0; to < NETFRAME_TEST_PEERS; to++) {
+        netframe_test_message_t *copy;
+        
+        if (to == from)
+            continue;
+        if (message->authority && from != 0)
+            return false;
+        if (netframe_test_in_flight_count == NETFRAME_TEST_IN_FLIGHT)
+            return false;
+        copy = &netframe_test_in_flight[netframe_test_in_flight_count++];
+        *copy = *message;
+        copy->to = to;
+        copy->deliver_at = tick + netframe_test_latency[from][to];
+    }
+    return true;
+}
+
+int NetFrameTest_Direct(void) {
+    static struct ctrlPacket authority, last_authority;
+    unsigned tick;
+    int peer, frame, i;
+    
+    memset(netframe_test_frames, 0, sizeof(netframe_test_frames));
+    memset(netframe_test_complete, 0, sizeof(netframe_test_complete));
+    netframe_test_in_flight_count = 0;
+    
+    for (tick = 0; tick < NETFRAME_TEST_TICKS; tick++) {
+        size_t j = 0;
+        
+        /* every Wii samples its input for this tick's frame and sends it to
+         * every other; the host also sends its authority. */
+        if (tick < NETFRAME_TEST_FRAMES) {
+            frame = tick;
+            for (peer = 0; peer < NETFRAME_TEST_PEERS; peer++) {
+                netframe_test_message_t message;
+                
+                memset(&message, 0, sizeof(message));
+                NetFrameTest_Input(&message.input, peer, frame);
+                NetFrame_MergeInput(
+                    &netframe_test_frames[peer][frame], &message.input);
+                if (!NetFrameTest_Send(&message, peer, tick))
+                    return 101;
+            }
+            
+            netframe_test_frames[0][frame].frameNumber = frame;
+            netframe_test_frames[0][frame].frameSeed = frame * 11;
+            netframe_test_frames[0][frame].callback_sector =
+                frame % 7 == 0 ? frame : 0;
+            netframe_test_frames[0][frame].status[3] =
+                WPAD_STATUS_DISCONNECTED;
+            netframe_test_frames[0][frame].haveInput[3] = true;
+            NetFrame_Authority(
+                &authority, &netframe_test_frames[0][frame],
+                frame == 0 ? NULL : &last_authority,
+                NETFRAME_TEST_HOST_SLOTS);
+            last_authority = authority;
+            NetFrame_MergeAuthority(
+                &netframe_test_frames[0][frame], &authority);
+            {
+                netframe_test_message_t message;
+                
+                memset(&message, 0, sizeof(message));
+                message.authority = true;
+                message.frame = authority;
+                if (!NetFrameTest_Send(&message, 0, tick))
+                    return 102;
+            }
+        }
+        
+        while (j < netframe_test_in_flight_count) {
+            netframe_test_message_t *message = &netframe_test_in_flight[j];
+            
+            if (message->deliver_at > tick) {
+                j++;
+                continue;
+            }
+            if (message->authority) {
+                frame = message->frame.frameNumber;
+                NetFrame_MergeAuthority(
+                    &netframe_test_frames[message->to][frame],
+                    &message->frame);
+            } else {
+                frame = message->input.data.controller.frameNumberToDeliverOn;
+                NetFrame_MergeInput(
+                    &netframe_test_frames[message->to][frame],
+                    &message->input);
+            }
+            *message = netframe_test_in_flight[--netframe_test_in_flight_count];
+        }
+        
+        for (peer = 0; peer < NETFRAME_TEST_PEERS; peer++) {
+            for (frame = 0; frame < NETFRAME_TEST_FRAMES && frame <= tick;
+                 frame++) {
+                if (netframe_test_complete[peer][frame] == 0 &&
+                    NetFrame_Complete(
+                        &netframe_test_frames[peer][frame],
+                        NETFRAME_TEST_PEERS))
+                    netframe_test_complete[peer][frame] = tick + 1;
+            }
+        }
+    }
+    
+    for (frame = 0; frame < NETFRAME_TEST_FRAMES; frame++) {
+        const struct ctrlPacket *host = &netframe_test_frames[0][frame];
+        
+        for (peer = 0; peer < NETFRAME_TEST_PEERS; peer++) {
+            const struct ctrlPacket *mine = &netframe_test_frames[peer][frame];
+            unsigned furthest = 0;
+            
+            if (netframe_test_complete[peer][frame] == 0)
+                return 103;
+            /* complete one way trip from the furthest Wii, not two. */
+            for (i = 0; i < NETFRAME_TEST_PEERS; i++) {
+                if (netframe_test_latency[i][peer] > furthest)
+                    furthest = netframe_test_latency[i][peer];
+            }
+            if (netframe_test_complete[peer][frame] - 1 != frame + furthest)
+                return 104;
+            
+            if (mine->frameNumber != host->frameNumber ||
+                mine->frameSeed != host->frameSeed ||
+                mine->callback_sector != host->callback_sector)
+                return 105;
+            for (i = 0; i < 4; i++) {
+                if (mine->haveInput[i] != host->haveInput[i] ||
+                    mine->status[i] != host->status[i] ||
+                    memcmp(&mine->inputs[i], &host->inputs[i],
+                        sizeof(mine->inputs[i])) != 0 ||
+                    memcmp(mine->gravityUnit[i], host->gravityUnit[i],
+                        sizeof(mine->gravityUnit[i])) != 0)
+                    return 106;
+            }
+        }
+    }
+    /* guests hear each other well before the host could have relayed. */
+    for (frame = 0; frame < NETFRAME_TEST_FRAMES; frame++) {
+        if (!netframe_test_frames[1][frame].haveInput[2])
+            return 107;
+    }
+    return 0;
+}
+
+int NetFrameTest_Authority(void) {
+    static struct ctrlPacket frames[2], authority[2];
+    unsigned char buffer[NETCODEC_CTRL_MAX];
+    struct sendPacket input;
+    int still, moving;
+    
+    memset(frames, 0, sizeof(frames));
+    NetFrameTest_Input(&input, 0, 0);
+    NetFrame_MergeInput(&frames[0], &input);
+    NetFrameTest_Input(&input, 1, 0);
+    NetFrame_MergeInput(&frames[0], &input);
+    frames[1] = frames[0];
+    frames[1].frameNumber = 1;
+    NetFrame_Authority(&authority[0], &frames[0], NULL, 1);
+    
+    /* a guest's slot moving does not cost the host anything to send. */
+    NetFrame_Authority(&authority[1], &frames[1], &authority[0], 1);
+    still = NetCodec_EncodeCtrl(
+        &authority[1], &authority[0], buffer, sizeof(buffer));
+    frames[1].inputs[1].buttons ^= 0xffff;
+    frames[1].inputs[1].acceleration[2] = 99;
+    NetFrame_Authority(&authority[1], &frames[1], &authority[0], 1);
+    moving = NetCodec_EncodeCtrl(
+        &authority[1], &authority[0], buffer, sizeof(buffer));
+    if (still <= 0 || moving != still)
+        return 101;
+    if (authority[1].haveInput[1] || !authority[1].haveInput[0])
+        return 102;
+    
+    /* merging keeps the guest's own slot. */
+    frames[0].haveSentOrRecv = false;
+    frames[0].haveInput[0] = false;
+    NetFrame_MergeAuthority(&frames[0], &authority[1]);
+    if (!NetFrame_Complete(&frames[0], 2))
+        return 103;
+    if (frames[0].inputs[1].buttons != input.data.controller.inputs.buttons)
+        return 104;
+    if (frames[0].frameNumber != 1)
+        return 105;
+    return 0;
+}
+
+int NetFrameTest_Predict(void) {
+    static struct ctrlPacket frames[2], guess;
+    struct sendPacket input;
+    unsigned slots;
+    
+    memset(frames, 0, sizeof(frames));
+    NetFrameTest_Input(&input, 0, 0);
+    NetFrame_MergeInput(&frames[0], &input);
+    NetFrameTest_Input(&input, 1, 0);
+    NetFrame_MergeInput(&frames[0], &input);
+    NetFrameTest_Input(&input, 0, 1);
+    NetFrame_MergeInput(&frames[1], &input);
+    
+    /* the missing slot is held from the last frame, and still missing. */
+    slots = NetFrame_Predict(&frames[1], &frames[0], 2);
+    if (slots != (1 << 1))
+        return 101;
+    if (frames[1].haveInput[1] || !frames[1].haveInput[0])
+        return 102;
+    if (frames[1].inputs[1].buttons != frames[0].inputs[1].buttons)
+        return 103;
+    if (frames[1].inputs[0].buttons != input.data.controller.inputs.buttons)
+        return 104;
+    guess = frames[1];
+    
+    /* held input was guessed right. */
+    input = (struct sendPacket){ 0 };
+    NetFrameTest_Input(&input, 1, 0);
+    input.data.controller.frameNumberToDeliverOn = 1;
+    NetFrame_MergeInput(&frames[1], &input);
+    if (NetFrame_Mispredicted(&frames[1], &guess, slots))
+        return 105;
+    
+    /* a press was not. */
+    frames[1].inputs[1].buttons ^= 1;
+    if (!NetFrame_Mispredicted(&frames[1], &guess, slots))
+        return 106;
+    if (NetFrame_Mispredicted(&frames[1], &guess, 1 << 0))
+        return 107;
+    return 0;
+}
@@ -0,0 +1,582 @@
+/* netloop_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../modules/netslug_main/netloop.c"
+
+#include "netloop_test.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NETLOOP_TEST_BUFFER 1472
+#define NETLOOP_TEST_PINGS 2000
+
+/* a backend over a real UDP socket, the way a host port would do it. */
+typedef struct {
+    netloop_t *loop;
+    int socket;
+    int wake[2];
+    unsigned char *recvBuffer;
+    size_t recvSize;
+    bool recvPending;
+    const unsigned char *sendBuffer;
+    size_t sendLength;
+    bool sendPending;
+} netloop_test_posix_t;
+
+static bool NetLoopTest_StartRecv(
+        void *context, unsigned char *buffer, size_t size) {
+    netloop_test_posix_t *posix = context;
+    
+    posix->recvBuffer = buffer;
+    posix->recvSize = size;
+    posix->recvPending = true;
+    return true;
+}
+
+static bool NetLoopTest_StartSend(
+        void *context, const unsigned char *buffer, size_t length) {
+    netloop_test_posix_t *posix = context;
+    
+    posix->sendBuffer = buffer;
+    posix->sendLength = length;
+    posix->sendPending = true;
+    return true;
+}
+
+static long long NetLoopTest_Now(void *context) {
+    struct timespec now;
+    
+    (void)context;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void NetLoopTest_Wait(void *context, long long until) {
+    netloop_test_posix_t *posix = context;
+    struct pollfd fds[2];
+    unsigned char drain[16];
+    int timeout, length;
+    
+    timeout = -1;
+    if (until >= 0) {
+        long long left = until - NetLoopTest_Now(context);
+        
+        timeout = left <= 0 ? 0 : (int)((left + 999) / 1000);
+    }
+    fds[0].fd = posix->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = posix->socket;
+    fds[1].events =
+        (posix->recvPending ? POLLIN : 0) |
+        (posix->sendPending ? POLLOUT : 0);
+    if (poll(fds, 2, timeout) <= 0)
+        return;
+    
+    if (fds[0].revents & POLLIN)
+        while (read(posix->wake[0], drain, sizeof(drain)) > 0)
+            ;
+    if (fds[1].revents & POLLIN) {
+        length = recv(posix->socket, posix->recvBuffer, posix->recvSize, 0);
+        posix->recvPending = false;
+        NetLoop_Received(posix->loop, length);
+    }
+    if (fds[1].revents & POLLOUT) {
+        length = send(posix->socket, posix->sendBuffer, posix->sendLength, 0);
+        posix->sendPending = false;
+        NetLoop_Sent(posix->loop, length);
+    }
+}
+
+static void NetLoopTest_Wake(void *context) {
+    netloop_test_posix_t *posix = context;
+    unsigned char byte = 0;
+    
+    /* a full pipe is already a pending wake. */
+    if (write(posix->wake[1], &byte, 1) < 0)
+        return;
+}
+
+/* a socket on the loopback interface, and its port. */
+static int NetLoopTest_Socket(uint16_t *port) {
+    struct sockaddr_in address;
+    socklen_t length;
+    int fd;
+    
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    length = sizeof(address);
+    if (bind(fd, (struct sockaddr *)&address, length) ||
+            getsockname(fd, (struct sockaddr *)&address, &length)) {
+        close(fd);
+        return -1;
+    }
+    *port = address.sin_port;
+    return fd;
+}
+
+static int NetLoopTest_Connect(int fd, uint16_t port) {
+    struct sockaddr_in address;
+    
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = port;
+    return connect(fd, (struct sockaddr *)&address, sizeof(address));
+}
+
+static int NetLoopTest_Open(
+        netloop_test_posix_t *posix, netloop_t *loop, int fd) {
+    memset(posix, 0, sizeof(*posix));
+    posix->loop = loop;
+    posix->socket = fd;
+    if (pipe(posix->wake))
+        return -1;
+    fcntl(posix->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(posix->wake[1], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+static void NetLoopTest_Close(netloop_test_posix_t *posix) {
+    close(posix->wake[0]);
+    close(posix->wake[1]);
+    close(posix->socket);
+}
+
+static void NetLoopTest_Backend(
+        netloop_backend_t *backend, netloop_test_posix_t *posix) {
+    backend->context = posix;
+    backend->startRecv = NetLoopTest_StartRecv;
+    backend->startSend = NetLoopTest_StartSend;
+    backend->now = NetLoopTest_Now;
+    backend->wait = NetLoopTest_Wait;
+    backend->wake = NetLoopTest_Wake;
+}
+
+/* the pinging side: one ping in flight, resent if it is lost. */
+typedef struct {
+    netloop_t *loop;
+    uint32_t next;
+    bool waiting;
+    bool resend;
+    int result;
+} netloop_test_pinger_t;
+
+static void NetLoopTest_PingRecv(
+        void *arg, unsigned char *datagram, int length) {
+    netloop_test_pinger_t *pinger = arg;
+    uint32_t sequence;
+    
+    if (length != sizeof(sequence)) {
+        if (pinger->result == 0)
+            pinger->result = 110;
+        return;
+    }
+    memcpy(&sequence, datagram, sizeof(sequence));
+    /* late answers to a resent ping are harmless. */
+    if (sequence != pinger->next)
+        return;
+    pinger->next++;
+    pinger->waiting = false;
+    if (pinger->next == NETLOOP_TEST_PINGS)
+        NetLoop_Stop(pinger->loop);
+    else
+        NetLoop_Poke(pinger->loop);
+}
+
+static int NetLoopTest_PingSend(
+        void *arg, unsigned char *buffer, size_t size) {
+    netloop_test_pinger_t *pinger = arg;
+    
+    if (size < sizeof(pinger->next))
+        return 0;
+    if (pinger->waiting && !pinger->resend)
+        return 0;
+    pinger->waiting = true;
+    pinger->resend = false;
+    memcpy(buffer, &pinger->next, sizeof(pinger->next));
+    return sizeof(pinger->next);
+}
+
+static void NetLoopTest_PingTimer(void *arg) {
+    netloop_test_pinger_t *pinger = arg;
+    
+    if (pinger->waiting) {
+        pinger->resend = true;
+        NetLoop_Poke(pinger->loop);
+    }
+}
+
+/* the echoing side: sends back whatever arrives. */
+typedef struct {
+    netloop_t *loop;
+    unsigned char datagram[NETLOOP_TEST_BUFFER];
+    int length;
+} netloop_test_echo_t;
+
+static void NetLoopTest_EchoRecv(
+        void *arg, unsigned char *datagram, int length) {
+    netloop_test_echo_t *echo = arg;
+    
+    if (length <= 0)
+        return;
+    memcpy(echo->datagram, datagram, length);
+    echo->length = length;
+    NetLoop_Poke(echo->loop);
+}
+
+static int NetLoopTest_EchoSend(
+        void *arg, unsigned char *buffer, size_t size) {
+    netloop_test_echo_t *echo = arg;
+    int length;
+    
+    length = echo->length;
+    if ((size_t)length > size)
+        return 0;
+    memcpy(buffer, echo->datagram, length);
+    echo->length = 0;
+    return length;
+}
+
+static void *NetLoopTest_Run(void *arg) {
+    NetLoop_Run(arg);
+    return NULL;
+}
+
+static unsigned char netloop_test_buffers[4][NETLOOP_TEST_BUFFER];
+
+int NetLoopTest_PingPong(void) {
+    netloop_t pingLoop, echoLoop;
+    netloop_test_posix_t pingPosix, echoPosix;
+    netloop_backend_t backend;
+    netloop_test_pinger_t pinger;
+    netloop_test_echo_t echo;
+    pthread_t thread;
+    uint16_t pingPort, echoPort;
+    int pingFd, echoFd;
+    
+    pingFd = NetLoopTest_Socket(&pingPort);
+    echoFd = NetLoopTest_Socket(&echoPort);
+    if (pingFd < 0 || echoFd < 0)
+        return 101;
+    if (NetLoopTest_Connect(pingFd, echoPort) ||
+            NetLoopTest_Connect(echoFd, pingPort))
+        return 102;
+    if (NetLoopTest_Open(&pingPosix, &pingLoop, pingFd) ||
+            NetLoopTest_Open(&echoPosix, &echoLoop, echoFd))
+        return 103;
+    
+    memset(&pinger, 0, sizeof(pinger));
+    pinger.loop = &pingLoop;
+    NetLoopTest_Backend(&backend, &pingPosix);
+    NetLoop_Init(
+        &pingLoop, &backend,
+        netloop_test_buffers[0], netloop_test_buffers[1], NETLOOP_TEST_BUFFER,
+        NetLoopTest_PingRecv, NetLoopTest_PingSend, &pinger);
+    if (!NetLoop_AddTimer(&pingLoop, 50000, NetLoopTest_PingTimer, &pinger))
+        return 104;
+    
+    memset(&echo, 0, sizeof(echo));
+    echo.loop = &echoLoop;
+    NetLoopTest_Backend(&backend, &echoPosix);
+    NetLoop_Init(
+        &echoLoop, &backend,
+        netloop_test_buffers[2], netloop_test_buffers[3], NETLOOP_TEST_BUFFER,
+        NetLoopTest_EchoRecv, NetLoopTest_EchoSend, &echo);
+    
+    if (pthread_create(&thread, NULL, NetLoopTest_Run, &echoLoop))
+        return 105;
+    NetLoop_Run(&pingLoop);
+    NetLoop_Stop(&echoLoop);
+    pthread_join(thread, NULL);
+    NetLoopTest_Close(&pingPosix);
+    NetLoopTest_Close(&echoPosix);
+    
+    if (pinger.result != 0)
+        return pinger.result;
+    if (pinger.next != NETLOOP_TEST_PINGS)
+        return 106;
+    if (pingLoop.stats.sent < NETLOOP_TEST_PINGS ||
+            pingLoop.stats.received < NETLOOP_TEST_PINGS)
+        return 107;
+    /* the last echo's completion may not be counted before the stop. */
+    if (echoLoop.stats.received < NETLOOP_TEST_PINGS ||
+            echoLoop.stats.sent < NETLOOP_TEST_PINGS - 1)
+        return 108;
+    if (pingLoop.stats.sendErrors || pingLoop.stats.recvErrors ||
+            echoLoop.stats.sendErrors || echoLoop.stats.recvErrors)
+        return 109;
+    /* each side slept between datagrams instead of spinning. */
+    if (pingLoop.stats.waits > NETLOOP_TEST_PINGS * 4)
+        return 111;
+    return 0;
+}
+
+typedef struct {
+    netloop_t *loop;
+    int fast, slow;
+    int filled;
+    long long started, poked, answered;
+} netloop_test_clock_t;
+
+static void NetLoopTest_Fast(void *arg) {
+    netloop_test_clock_t *clock = arg;
+    
+    clock->fast++;
+}
+
+static void NetLoopTest_Slow(void *arg) {
+    netloop_test_clock_t *clock = arg;
+    
+    clock->slow++;
+    if (clock->slow == 10)
+        NetLoop_Stop(clock->loop);
+}
+
+static int NetLoopTest_ClockSend(
+        void *arg, unsigned char *buffer, size_t size) {
+    netloop_test_clock_t *clock = arg;
+    
+    (void)buffer;
+    (void)size;
+    clock->filled++;
+    if (clock->filled == 2) {
+        clock->answered = NetLoopTest_Now(NULL);
+        NetLoop_Stop(clock->loop);
+    }
+    return 0;
+}
+
+static void NetLoopTest_ClockRecv(
+        void *arg, unsigned char *datagram, int length) {
+    (void)arg;
+    (void)datagram;
+    (void)length;
+}
+
+static void *NetLoopTest_Poker(void *arg) {
+    netloop_test_clock_t *clock = arg;
+    struct timespec delay;
+    
+    delay.tv_sec = 0;
+    delay.tv_nsec = 20000000;
+    nanosleep(&delay, NULL);
+    __atomic_store_n(&clock->poked, NetLoopTest_Now(NULL), __ATOMIC_RELEASE);
+    NetLoop_Poke(clock->loop);
+    return NULL;
+}
+
+int NetLoopTest_Timers(void) {
+    netloop_t loop;
+    netloop_test_posix_t posix;
+    netloop_backend_t backend;
+    netloop_test_clock_t clock;
+    pthread_t thread;
+    long long elapsed;
+    uint16_t port;
+    int fd;
+    
+    fd = NetLoopTest_Socket(&port);
+    if (fd < 0 || NetLoopTest_Open(&posix, &loop, fd))
+        return 101;
+    memset(&clock, 0, sizeof(clock));
+    clock.loop = &loop;
+    NetLoopTest_Backend(&backend, &posix);
+    NetLoop_Init(
+        &loop, &backend,
+        netloop_test_buffers[0], netloop_test_buffers[1], NETLOOP_TEST_BUFFER,
+        NetLoopTest_ClockRecv, NetLoopTest_ClockSend, &clock);
+    if (NetLoop_NextDeadline(&loop) != -1)
+        return 102;
+    if (!NetLoop_AddTimer(&loop, 2000, NetLoopTest_Fast, &clock) ||
+            !NetLoop_AddTimer(&loop, 5000, NetLoopTest_Slow, &clock) ||
+            !NetLoop_AddTimer(&loop, 1, NetLoopTest_Fast, &clock) ||
+            !NetLoop_AddTimer(&loop, 1, NetLoopTest_Fast, &clock))
+        return 103;
+    if (NetLoop_AddTimer(&loop, 1, NetLoopTest_Fast, &clock))
+        return 104;
+    loop.timerCount = 2;
+    
+    /* 10 slow ticks take 50ms, in which the fast timer fires about 25 times;
+     * a slow scheduler can only make it fire less often. */
+    clock.started = NetLoopTest_Now(NULL);
+    NetLoop_Run(&loop);
+    elapsed = NetLoopTest_Now(NULL) - clock.started;
+    if (clock.slow != 10)
+        return 105;
+    if (elapsed < 50000)
+        return 106;
+    if (clock.fast < 10 || clock.fast > 25)
+        return 107;
+    if (loop.stats.timersFired != (unsigned)(clock.fast + clock.slow))
+        return 108;
+    
+    /* with only a far timer, a poke from another thread wakes the loop. */
+    loop.stop = false;
+    loop.timerCount = 1;
+    loop.timers[0].period = 10000000;
+    loop.timers[0].deadline = NetLoopTest_Now(NULL) + 10000000;
+    clock.filled = 1;
+    if (pthread_create(&thread, NULL, NetLoopTest_Poker, &clock))
+        return 109;
+    NetLoop_Run(&loop);
+    pthread_join(thread, NULL);
+    NetLoopTest_Close(&posix);
+    if (clock.filled != 2)
+        return 110;
+    if (clock.answered - clock.poked > 1000000)
+        return 111;
+    return 0;
+}
+
+#define NETLOOP_TEST_FLUSH 20000
+
+/* gathers one byte per message into each datagram. */
+typedef struct {
+    netloop_t *loop;
+    unsigned char pending;
+    unsigned char produced;
+    int wakes;
+} netloop_test_batcher_t;
+
+static void NetLoopTest_Produce(void *arg) {
+    netloop_test_batcher_t *batcher = arg;
+    
+    if (batcher->produced == 5)
+        return;
+    batcher->produced++;
+    batcher->pending++;
+    if (batcher->produced == 5)
+        NetLoop_Flush(batcher->loop);
+    else
+        NetLoop_Poke(batcher->loop);
+}
+
+static int NetLoopTest_BatchSend(
+        void *arg, unsigned char *buffer, size_t size) {
+    netloop_test_batcher_t *batcher = arg;
+    int length;
+    
+    length = batcher->pending;
+    memset(buffer, length, length);
+    batcher->pending = 0;
+    return length;
+}
+
+static void NetLoopTest_BatchWake(void *arg) {
+    netloop_test_batcher_t *batcher = arg;
+    
+    batcher->wakes++;
+}
+
+static void NetLoopTest_BatchFlush(void *arg) {
+    netloop_test_batcher_t *batcher = arg;
+    
+    NetLoop_Flush(batcher->loop);
+}
+
+/* runs loop until it has sent sent datagrams, or a second passes. */
+static bool NetLoopTest_RunUntilSent(netloop_t *loop, unsigned sent) {
+    long long until;
+    
+    until = NetLoopTest_Now(NULL) + 1000000;
+    while (loop->stats.sent < sent) {
+        if (NetLoopTest_Now(NULL) > until)
+            return false;
+        NetLoop_RunOnce(loop);
+    }
+    return true;
+}
+
+int NetLoopTest_Batch(void) {
+    netloop_t loop;
+    netloop_test_posix_t posix;
+    netloop_backend_t backend;
+    netloop_test_batcher_t batcher;
+    unsigned char datagram[16];
+    long long started;
+    uint16_t port, peerPort;
+    int fd, peer, length;
+    
+    fd = NetLoopTest_Socket(&port);
+    peer = NetLoopTest_Socket(&peerPort);
+    if (fd < 0 || peer < 0)
+        return 101;
+    if (NetLoopTest_Connect(fd, peerPort) ||
+            NetLoopTest_Open(&posix, &loop, fd))
+        return 102;
+    memset(&batcher, 0, sizeof(batcher));
+    batcher.loop = &loop;
+    NetLoopTest_Backend(&backend, &posix);
+    NetLoop_Init(
+        &loop, &backend,
+        netloop_test_buffers[0], netloop_test_buffers[1], NETLOOP_TEST_BUFFER,
+        NetLoopTest_ClockRecv, NetLoopTest_BatchSend, &batcher);
+    NetLoop_SetBatch(&loop, true);
+    NetLoop_SetWake(&loop, NetLoopTest_BatchWake);
+    NetLoop_AddTimer(&loop, 2000, NetLoopTest_Produce, &batcher);
+    
+    /* five messages leave as one datagram at the flush, along with the poke
+     * from NetLoop_Init. */
+    if (!NetLoopTest_RunUntilSent(&loop, 1))
+        return 103;
+    if (batcher.produced != 5)
+        return 105;
+    length = recv(peer, datagram, sizeof(datagram), MSG_DONTWAIT);
+    if (length != 5 || datagram[0] != 5)
+        return 106;
+    if (batcher.wakes == 0)
+        return 107;
+    
+    /* a lone poke waits for the next flush, however long that is. */
+    loop.timerCount = 0;
+    NetLoop_AddTimer(&loop, NETLOOP_TEST_FLUSH, NetLoopTest_BatchFlush, &batcher);
+    batcher.pending = 1;
+    started = NetLoopTest_Now(NULL);
+    NetLoop_Poke(&loop);
+    if (!NetLoopTest_RunUntilSent(&loop, 2))
+        return 108;
+    if (NetLoopTest_Now(NULL) - started < NETLOOP_TEST_FLUSH)
+        return 109;
+    length = recv(peer, datagram, sizeof(datagram), MSG_DONTWAIT);
+    if (length != 1 || datagram[0] != 1)
+        return 111;
+    if (recv(peer, datagram, sizeof(datagram), MSG_DONTWAIT) >= 0)
+        return 112;
+    
+    NetLoopTest_Close(&posix);
+    close(peer);
+    return 0;
+}
@@ -0,0 +1,162 @@
+/* netring_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../modules/netslug_main/netring.c"
+
+#include "netring_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#define NETRING_TEST_SLOTS 8
+#define NETRING_TEST_ITEMS 1000000
+
+/* big enough that a torn copy would show. */
+typedef struct {
+    uint32_t sequence;
+    uint32_t words[15];
+} netring_test_item_t;
+
+static netring_test_item_t netring_test_slots[NETRING_TEST_SLOTS];
+
+static void NetRingTest_Fill(netring_test_item_t *item, uint32_t sequence) {
+    int i;
+    
+    item->sequence = sequence;
+    for (i = 0; i < 15; i++)
+        item->words[i] = sequence * 2654435761u + i;
+}
+
+static bool NetRingTest_Check(
+        const netring_test_item_t *item, uint32_t sequence) {
+    int i;
+    
+    if (item->sequence != sequence)
+        return false;
+    for (i = 0; i < 15; i++)
+        if (item->words[i] != sequence * 2654435761u + i)
+            return false;
+    return true;
+}
+
+int NetRingTest_Single(void) {
+    netring_t ring;
+    netring_test_item_t *item;
+    uint32_t pushed, popped;
+    
+    if (NetRing_Init(
+            &ring, netring_test_slots, sizeof(netring_test_slots[0]), 6))
+        return 101;
+    if (!NetRing_Init(
+            &ring, netring_test_slots, sizeof(netring_test_slots[0]),
+            NETRING_TEST_SLOTS))
+        return 102;
+    if (NetRing_Peek(&ring) != NULL || NetRing_Count(&ring) != 0)
+        return 103;
+    
+    /* fill, drain part way, and go round several times. */
+    pushed = popped = 0;
+    while (popped < NETRING_TEST_SLOTS * 5) {
+        while ((item = NetRing_Reserve(&ring)) != NULL) {
+            NetRingTest_Fill(item, pushed++);
+            NetRing_Publish(&ring);
+        }
+        if (NetRing_Count(&ring) != NETRING_TEST_SLOTS)
+            return 104;
+        if (pushed - popped != NETRING_TEST_SLOTS)
+            return 105;
+        while (NetRing_Count(&ring) > 3) {
+            item = NetRing_Peek(&ring);
+            if (item == NULL || !NetRingTest_Check(item, popped++))
+                return 106;
+            NetRing_Release(&ring);
+        }
+    }
+    
+    /* the indices wrap. */
+    ring.head = ring.tail = UINT32_MAX - 2;
+    for (pushed = 0; pushed < 6; pushed++) {
+        item = NetRing_Reserve(&ring);
+        if (item == NULL)
+            return 107;
+        NetRingTest_Fill(item, pushed);
+        NetRing_Publish(&ring);
+    }
+    for (popped = 0; popped < 6; popped++) {
+        item = NetRing_Peek(&ring);
+        if (item == NULL || !NetRingTest_Check(item, popped))
+            return 108;
+        NetRing_Release(&ring);
+    }
+    if (NetRing_Peek(&ring) != NULL)
+        return 109;
+    return 0;
+}
+
+static void *NetRingTest_Producer(void *arg) {
+    netring_t *ring = arg;
+    netring_test_item_t *item;
+    uint32_t sequence;
+    
+    for (sequence = 0; sequence < NETRING_TEST_ITEMS; sequence++) {
+        while ((item = NetRing_Reserve(ring)) == NULL)
+            sched_yield();
+        NetRingTest_Fill(item, sequence);
+        NetRing_Publish(ring);
+    }
+    return NULL;
+}
+
+int NetRingTest_Threads(void) {
+    netring_t ring;
+    pthread_t producer;
+    netring_test_item_t *item;
+    uint32_t sequence;
+    int result;
+    
+    NetRing_Init(
+        &ring, netring_test_slots, sizeof(netring_test_slots[0]),
+        NETRING_TEST_SLOTS);
+    if (pthread_create(&producer, NULL, NetRingTest_Producer, &ring))
+        return 101;
+    
+    /* every item is taken even after a failure, so the producer finishes. */
+    result = 0;
+    for (sequence = 0; sequence < NETRING_TEST_ITEMS; sequence++) {
+        while ((item = NetRing_Peek(&ring)) == NULL)
+            sched_yield();
+        if (result == 0 && !NetRingTest_Check(item, sequence))
+            result = 102;
+        /* scribble on the slot, so a producer writing early is caught. */
+        item->sequence = ~sequence;
+        NetRing_Release(&ring);
+    }
+    pthread_join(producer, NULL);
+    if (result != 0)
+        return result;
+    if (NetRing_Count(&ring) != 0)
+        return 103;
+    return 0;
+}
@@ -0,0 +1,199 @@
+/* netsnap_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../modules/netslug_main/netsnap.c"
+
+#include "netsnap_test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* two regions, neither a whole number of pages. */
+#define NETSNAP_TEST_SIZE_A (NETSNAP_PAGE_SIZE * 12 + 100)
+#define NETSNAP_TEST_SIZE_B (NETSNAP_PAGE_SIZE / 2)
+#define NETSNAP_TEST_SIZE (NETSNAP_TEST_SIZE_A + NETSNAP_TEST_SIZE_B)
+#define NETSNAP_TEST_FRAMES 400
+#define NETSNAP_TEST_POOL(pages) \
+    ((pages) * (sizeof(netsnap_record_t) + NETSNAP_PAGE_SIZE))
+
+static unsigned char netsnap_test_memory[NETSNAP_TEST_SIZE];
+static unsigned char netsnap_test_shadow[NETSNAP_TEST_SIZE];
+static unsigned char netsnap_test_pool[NETSNAP_TEST_POOL(128)];
+/* what memory was at each frame. */
+static unsigned char
+    netsnap_test_frames[NETSNAP_TEST_FRAMES][NETSNAP_TEST_SIZE];
+static long long netsnap_test_time;
+static uint32_t netsnap_test_seed;
+
+static unsigned NetSnapTest_Rand(unsigned max) {
+    netsnap_test_seed = netsnap_test_seed * 1664525 + 1013904223;
+    return (netsnap_test_seed >> 16) % max;
+}
+
+static long long NetSnapTest_Clock(void) {
+    return ++netsnap_test_time;
+}
+
+static void NetSnapTest_Init(netsnap_t *snap, size_t pool_pages) {
+    NetSnap_Init(
+        snap, netsnap_test_shadow, sizeof(netsnap_test_shadow),
+        netsnap_test_pool, NETSNAP_TEST_POOL(pool_pages), NetSnapTest_Clock);
+    NetSnap_AddRegion(snap, netsnap_test_memory, NETSNAP_TEST_SIZE_A);
+    NetSnap_AddRegion(
+        snap, netsnap_test_memory + NETSNAP_TEST_SIZE_A, NETSNAP_TEST_SIZE_B);
+}
+
+/* changes a few bytes here and there, as a game frame would. */
+static void NetSnapTest_Run(int changes) {
+    int i;
+    
+    for (i = 0; i < changes; i++)
+        netsnap_test_memory[NetSnapTest_Rand(NETSNAP_TEST_SIZE)] =
+            NetSnapTest_Rand(256);
+}
+
+int NetSnapTest_RoundTrip(void) {
+    static netsnap_t snap;
+    int frame, oldest, rollbacks;
+    
+    netsnap_test_seed = 45;
+    NetSnapTest_Run(NETSNAP_TEST_SIZE);
+    NetSnapTest_Init(&snap, 128);
+    if (NetSnap_AddRegion(&snap, netsnap_test_memory, 1))
+        return 101;
+    
+    oldest = 0;
+    rollbacks = 0;
+    for (frame = 0; frame < NETSNAP_TEST_FRAMES; frame++) {
+        if (!NetSnap_Capture(&snap, frame))
+            return 102;
+        /* rolling back does not bring back frames already forgotten. */
+        if (frame - oldest >= NETSNAP_FRAMES)
+            oldest = frame - NETSNAP_FRAMES + 1;
+        memcpy(netsnap_test_frames[frame], netsnap_test_memory,
+            NETSNAP_TEST_SIZE);
+        NetSnapTest_Run(1 + NetSnapTest_Rand(6));
+        
+        if (NetSnapTest_Rand(10) == 0) {
+            /* roll back a few frames and run them again. */
+            int to = frame - NetSnapTest_Rand(frame - oldest + 1);
+            
+            if (!NetSnap_Has(&snap, to))
+                return 103;
+            if (oldest > 0 && NetSnap_Has(&snap, oldest - 1))
+                return 115;
+            if (!NetSnap_Restore(&snap, to))
+                return 104;
+            if (memcmp(netsnap_test_memory, netsnap_test_frames[to],
+                    NETSNAP_TEST_SIZE) != 0)
+                return 105;
+            if (NetSnap_Has(&snap, to + 1))
+                return 106;
+            frame = to;
+            NetSnapTest_Run(1 + NetSnapTest_Rand(6));
+            rollbacks++;
+        }
+    }
+    if (rollbacks == 0)
+        return 107;
+    
+    /* frames must follow on. */
+    if (NetSnap_Capture(&snap, frame + 1))
+        return 108;
+    if (NetSnap_Has(&snap, oldest - 1))
+        return 109;
+    if (NetSnap_Restore(&snap, oldest - 1))
+        return 110;
+    
+    if (snap.stats.restores != (unsigned)rollbacks)
+        return 111;
+    if (snap.stats.pagesSaved == 0 ||
+        snap.stats.pagesSaved > snap.stats.captures * 6)
+        return 112;
+    if (snap.stats.captureTime <= 0 || snap.stats.restoreTimeMax <= 0)
+        return 113;
+    if (snap.stats.framesDropped != 0)
+        return 114;
+    return 0;
+}
+
+int NetSnapTest_Overflow(void) {
+    static netsnap_t snap;
+    int frame;
+    
+    netsnap_test_seed = 46;
+    NetSnapTest_Run(NETSNAP_TEST_SIZE);
+    NetSnapTest_Init(&snap, 8);
+    
+    /* two pages a frame only fits four frames. */
+    for (frame = 0; frame < 10; frame++) {
+        if (!NetSnap_Capture(&snap, frame))
+            return 101;
+        memcpy(netsnap_test_frames[frame], netsnap_test_memory,
+            NETSNAP_TEST_SIZE);
+        netsnap_test_memory[NETSNAP_PAGE_SIZE * (frame % 6)]++;
+        netsnap_test_memory[NETSNAP_PAGE_SIZE * (frame % 6 + 6)]++;
+    }
+    if (!NetSnap_Capture(&snap, frame))
+        return 102;
+    memcpy(netsnap_test_frames[frame], netsnap_test_memory, NETSNAP_TEST_SIZE);
+    if (NetSnap_Has(&snap, frame - 5) || !NetSnap_Has(&snap, frame - 4))
+        return 103;
+    if (snap.stats.framesDropped == 0)
+        return 104;
+    if (!NetSnap_Restore(&snap, frame - 4))
+        return 105;
+    if (memcmp(netsnap_test_memory, netsnap_test_frames[frame - 4],
+            NETSNAP_TEST_SIZE) != 0)
+        return 106;
+    frame -= 4;
+    
+    /* a frame changing more than the pool holds can't be rolled back over,
+     * but can still be rolled back to. */
+    NetSnapTest_Run(NETSNAP_TEST_SIZE);
+    frame++;
+    if (!NetSnap_Capture(&snap, frame))
+        return 107;
+    memcpy(netsnap_test_frames[frame], netsnap_test_memory, NETSNAP_TEST_SIZE);
+    if (NetSnap_Has(&snap, frame - 1))
+        return 108;
+    NetSnapTest_Run(3);
+    if (!NetSnap_Restore(&snap, frame))
+        return 109;
+    if (memcmp(netsnap_test_memory, netsnap_test_frames[frame],
+            NETSNAP_TEST_SIZE) != 0)
+        return 110;
+    
+    /* and history builds up again after. */
+    netsnap_test_memory[0]++;
+    if (!NetSnap_Capture(&snap, frame + 1))
+        return 111;
+    netsnap_test_memory[0]++;
+    if (!NetSnap_Restore(&snap, frame))
+        return 112;
+    if (memcmp(netsnap_test_memory, netsnap_test_frames[frame],
+            NETSNAP_TEST_SIZE) != 0)
+        return 113;
+    return 0;
+}
@@ -0,0 +1,355 @@
+/* netwindow_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../modules/netslug_main/netwindow.c"
+
+#include "netwindow_test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define NETWINDOW_TEST_TICKS 3000
+#define NETWINDOW_TEST_IN_FLIGHT 64
+
+typedef struct {
+    unsigned deliver_at;
+    size_t length;
+    unsigned char data[NETWINDOW_DATAGRAM_MAX];
+} netwindow_test_datagram_t;
+
+/* One direction of a lossy link that may also reorder datagrams. */
+typedef struct {
+    netwindow_test_datagram_t in_flight[NETWINDOW_TEST_IN_FLIGHT];
+    size_t count;
+    unsigned loss_percent;
+    unsigned max_delay;
+} netwindow_test_link_t;
+
+typedef struct {
+    netwindow_t window;
+    netwindow_test_link_t link;
+    unsigned pushed;
+    unsigned popped;
+    unsigned messages_pushed;
+    unsigned messages_popped;
+    /* ticks from a frame being pushed to being popped at the other end. */
+    unsigned push_tick[NETWINDOW_TEST_TICKS];
+    unsigned max_latency;
+} netwindow_test_peer_t;
+
+static netwindow_test_peer_t netwindow_test_host, netwindow_test_guest;
+static uint32_t netwindow_test_seed;
+static unsigned netwindow_test_tick;
+
+static unsigned NetWindowTest_Rand(unsigned max) {
+    netwindow_test_seed = netwindow_test_seed * 1664525 + 1013904223;
+    return (netwindow_test_seed >> 16) % max;
+}
+
+static void NetWindowTest_Ctrl(struct ctrlPacket *packet, unsigned frame) {
+    memset(packet, 0, sizeof(*packet));
+    packet->frameNumber = frame;
+    packet->frameSeed = frame * 7;
+    packet->haveInput[0] = true;
+    packet->formats[0] = WPAD_FORMAT_ACC;
+    packet->inputs[0].buttons = frame / 10;
+    packet->inputs[0].acceleration[0] = frame % 3;
+    packet->status[2] = packet->status[3] = WPAD_STATUS_DISCONNECTED;
+}
+
+static void NetWindowTest_Input(struct sendPacket *packet, unsigned frame) {
+    memset(packet, 0, sizeof(*packet));
+    packet->type = 0;
+    packet->clientNumber = 1;
+    packet->data.controller.frameNumberToDeliverOn = frame + 5;
+    packet->data.controller.wiimote = 1;
+    packet->data.controller.format = WPAD_FORMAT_ACC_IR;
+    packet->data.controller.inputs.buttons = frame / 7;
+    packet->data.controller.inputs.ir[0].x = frame % 5;
+}
+
+static void NetWindowTest_Message(struct sendPacket *packet, unsigned seq) {
+    memset(packet, 0, sizeof(*packet));
+    packet->type = 1;
+    packet->clientNumber = 1;
+    packet->data.di_read.sector = (seq << 12) | 3;
+}
+
+static void NetWindowTest_Start(
+        int depth, unsigned loss_percent, unsigned max_delay) {
+    memset(&netwindow_test_host, 0, sizeof(netwindow_test_host));
+    memset(&netwindow_test_guest, 0, sizeof(netwindow_test_guest));
+    NetWindow_Init(
+        &netwindow_test_host.window, NETCODEC_KIND_CTRL, NETCODEC_KIND_INPUT,
+        depth);
+    NetWindow_Init(
+        &netwindow_test_guest.window, NETCODEC_KIND_INPUT, NETCODEC_KIND_CTRL,
+        depth);
+    netwindow_test_host.link.loss_percent = loss_percent;
+    netwindow_test_host.link.max_delay = max_delay;
+    netwindow_test_guest.link.loss_percent = loss_percent;
+    netwindow_test_guest.link.max_delay = max_delay;
+    netwindow_test_tick = 0;
+}
+
+/* Sends a datagram from peer if it has anything to say. */
+static int NetWindowTest_Send(netwindow_test_peer_t *peer, unsigned tick) {
+    netwindow_test_link_t *link = &peer->link;
+    netwindow_test_datagram_t *datagram;
+    int length;
+    
+    if (!NetWindow_Pending(&peer->window))
+        return 0;
+    if (link->count == NETWINDOW_TEST_IN_FLIGHT)
+        return 1;
+    datagram = &link->in_flight[link->count];
+    length = NetWindow_Build(
+        &peer->window, datagram->data, sizeof(datagram->data));
+    if (length <= 0)
+        return 1;
+    if (NetWindowTest_Rand(100) < link->loss_percent)
+        return 0;
+    datagram->length = length;
+    datagram->deliver_at =
+        tick + (link->max_delay ? NetWindowTest_Rand(link->max_delay + 1) : 0);
+    link->count++;
+    return 0;
+}
+
+/* Hands everything due on from's link to to, and checks what comes out. */
+static int NetWindowTest_Deliver(
+        netwindow_test_peer_t *from, netwindow_test_peer_t *to,
+        unsigned tick) {
+    netwindow_test_link_t *link = &from->link;
+    size_t i = 0;
+    
+    while (i < link->count) {
+        netwindow_test_datagram_t *datagram = &link->in_flight[i];
+        
+        if (datagram->deliver_at > tick) {
+            i++;
+            continue;
+        }
+        if (NetWindow_Receive(
+                &to->window, datagram->data, datagram->length) < 0)
+            return 1;
+        *datagram = link->in_flight[--link->count];
+    }
+    
+    while (1) {
+        netwindow_item_t item, expected;
+        const void *peeked;
+        
+        peeked = NetWindow_PeekFrame(&to->window);
+        if (!NetWindow_PopFrame(&to->window, &item)) {
+            if (peeked != NULL)
+                return 5;
+            break;
+        }
+        if (peeked == NULL ||
+                memcmp(peeked, &item, ItemSize(to->window.recvKind)) != 0)
+            return 5;
+        if (to->window.recvKind == NETCODEC_KIND_CTRL) {
+            NetWindowTest_Ctrl(&expected.ctrl, to->popped);
+            if (item.ctrl.frameNumber != expected.ctrl.frameNumber ||
+                item.ctrl.frameSeed != expected.ctrl.frameSeed ||
+                memcmp(&item.ctrl.inputs[0], &expected.ctrl.inputs[0],
+                    WPADDataFormatSize(WPAD_FORMAT_ACC)) != 0)
+                return 2;
+        } else {
+            NetWindowTest_Input(&expected.send, to->popped);
+            if (item.send.data.controller.frameNumberToDeliverOn !=
+                    expected.send.data.controller.frameNumberToDeliverOn ||
+                memcmp(&item.send.data.controller.inputs,
+                    &expected.send.data.controller.inputs,
+                    WPADDataFormatSize(WPAD_FORMAT_ACC_IR)) != 0)
+                return 3;
+        }
+        if (tick - from->push_tick[to->popped] > to->max_latency)
+            to->max_latency = tick - from->push_tick[to->popped];
+        to->popped++;
+    }
+    while (1) {
+        struct sendPacket message, expected;
+        const struct sendPacket *peeked;
+        
+        peeked = NetWindow_PeekMessage(&to->window);
+        if (!NetWindow_PopMessage(&to->window, &message)) {
+            if (peeked != NULL)
+                return 6;
+            break;
+        }
+        if (peeked == NULL || memcmp(peeked, &message, sizeof(message)) != 0)
+            return 6;
+        NetWindowTest_Message(&expected, to->messages_popped);
+        if (message.type != 1 ||
+            message.data.di_read.sector != expected.data.di_read.sector)
+            return 4;
+        to->messages_popped++;
+    }
+    return 0;
+}
+
+/* Runs both peers for ticks, pushing a frame each per tick while frames is
+ * non zero, and a message from the guest every message_every ticks. */
+static int NetWindowTest_Run(
+        unsigned ticks, unsigned frames, unsigned message_every) {
+    netwindow_test_peer_t *host = &netwindow_test_host;
+    netwindow_test_peer_t *guest = &netwindow_test_guest;
+    unsigned end = netwindow_test_tick + ticks;
+    unsigned tick;
+    
+    for (tick = netwindow_test_tick; tick < end;
+         tick = ++netwindow_test_tick) {
+        if (host->pushed < frames) {
+            netwindow_item_t item;
+            
+            NetWindowTest_Ctrl(&item.ctrl, host->pushed);
+            host->push_tick[host->pushed] = tick;
+            if (NetWindow_Push(&host->window, &item))
+                host->pushed++;
+        }
+        if (guest->pushed < frames) {
+            netwindow_item_t item;
+            
+            NetWindowTest_Input(&item.send, guest->pushed);
+            guest->push_tick[guest->pushed] = tick;
+            if (NetWindow_Push(&guest->window, &item))
+                guest->pushed++;
+        }
+        if (message_every && tick % message_every == 0) {
+            struct sendPacket message;
+            
+            NetWindowTest_Message(&message, guest->messages_pushed);
+            if (NetWindow_PushMessage(&guest->window, &message))
+                guest->messages_pushed++;
+        }
+        
+        if (NetWindowTest_Send(host, tick))
+            return 101;
+        if (NetWindowTest_Deliver(host, guest, tick))
+            return 102;
+        if (NetWindowTest_Send(guest, tick))
+            return 103;
+        if (NetWindowTest_Deliver(guest, host, tick))
+            return 104;
+    }
+    return 0;
+}
+
+int NetWindowTest_Lossless(void) {
+    int result;
+    
+    netwindow_test_seed = 1;
+    NetWindowTest_Start(8, 0, 0);
+    result = NetWindowTest_Run(NETWINDOW_TEST_TICKS, NETWINDOW_TEST_TICKS, 0);
+    if (result)
+        return result;
+    if (netwindow_test_guest.popped != NETWINDOW_TEST_TICKS ||
+        netwindow_test_host.popped != NETWINDOW_TEST_TICKS)
+        return 105;
+    /* frames arrive the tick they are sent, and acks keep the window to
+     * just the new frame. */
+    if (netwindow_test_guest.max_latency != 0 ||
+        netwindow_test_host.max_latency != 0)
+        return 106;
+    if (netwindow_test_host.window.stats.framesResent != 0 ||
+        netwindow_test_guest.window.stats.framesResent != 0)
+        return 107;
+    if (netwindow_test_host.window.stats.framesDuplicate != 0)
+        return 108;
+    return 0;
+}
+
+int NetWindowTest_Loss(void) {
+    int result;
+    
+    netwindow_test_seed = 2;
+    NetWindowTest_Start(8, 30, 3);
+    result = NetWindowTest_Run(NETWINDOW_TEST_TICKS, NETWINDOW_TEST_TICKS, 0);
+    if (result)
+        return result;
+    /* let the last frames through. */
+    netwindow_test_host.link.loss_percent = 0;
+    netwindow_test_guest.link.loss_percent = 0;
+    result = NetWindowTest_Run(20, 0, 0);
+    if (result)
+        return result;
+    
+    if (netwindow_test_guest.popped != NETWINDOW_TEST_TICKS ||
+        netwindow_test_host.popped != NETWINDOW_TEST_TICKS)
+        return 105;
+    /* redundant copies did the work a retransmit would have. */
+    if (netwindow_test_guest.window.stats.framesDuplicate == 0)
+        return 106;
+    /* a lost datagram costs a tick, not a round trip. */
+    if (netwindow_test_guest.max_latency > 12 ||
+        netwindow_test_host.max_latency > 12)
+        return 107;
+    return 0;
+}
+
+int NetWindowTest_Messages(void) {
+    struct sendPacket message;
+    netwindow_item_t item;
+    unsigned i;
+    int result;
+    
+    netwindow_test_seed = 3;
+    NetWindowTest_Start(4, 50, 2);
+    result = NetWindowTest_Run(NETWINDOW_TEST_TICKS, NETWINDOW_TEST_TICKS, 3);
+    if (result)
+        return result;
+    netwindow_test_host.link.loss_percent = 0;
+    netwindow_test_guest.link.loss_percent = 0;
+    result = NetWindowTest_Run(20, 0, 0);
+    if (result)
+        return result;
+    if (netwindow_test_guest.messages_pushed < NETWINDOW_TEST_TICKS / 3 / 2)
+        return 105;
+    if (netwindow_test_host.messages_popped !=
+        netwindow_test_guest.messages_pushed)
+        return 106;
+    if (netwindow_test_host.popped != netwindow_test_guest.pushed ||
+        netwindow_test_guest.popped != netwindow_test_host.pushed)
+        return 107;
+    
+    /* a silent peer fills the window rather than overwriting its frames. */
+    NetWindowTest_Start(4, 0, 0);
+    for (i = 0; i < NETWINDOW_FRAMES - 1; i++) {
+        NetWindowTest_Ctrl(&item.ctrl, i);
+        if (!NetWindow_Push(&netwindow_test_host.window, &item))
+            return 108;
+    }
+    if (NetWindow_Push(&netwindow_test_host.window, &item))
+        return 109;
+    for (i = 0; i < NETWINDOW_MESSAGES; i++) {
+        NetWindowTest_Message(&message, i);
+        if (!NetWindow_PushMessage(&netwindow_test_guest.window, &message))
+            return 110;
+    }
+    if (NetWindow_PushMessage(&netwindow_test_guest.window, &message))
+        return 111;
+    return 0;
+}
@@ -24,8 +24,20 @@
 
 #include <stdlib.h>
 
+#include "boot_test.h"
+#include "di_queue_test.h"
 #include "fsm_test.h"
+#include "link_test.h"
+#include "netcodec_test.h"
+#include "netdelay_test.h"
+#include "netframe_test.h"
+#include "netring_test.h"
+#include "netloop_test.h"
+#include "netsnap_test.h"
+#include "netwindow_test.h"
+#include "sched_test.h"
 #include "symbol_test.h"
+#include "trace_test.h"
 
 typedef int (*test_t)(void);
 
@@ -42,10 +54,52 @@ test_t tests[] = {
     FSMTest_Run2,
     FSMTest_Run3,
     FSMTest_Run4,
+    FSMTest_Schedule,
     SymbolTest_Parse0,
     SymbolTest_Parse1,
     SymbolTest_Parse2,
     SymbolTest_Parse3,
+    LinkTest_Relocate0,
+    LinkTest_Sda21,
+    LinkTest_SdaRel16,
+    LinkTest_FindSdaBases,
+    LinkTest_Elf0,
+    LinkTest_Elf1,
+    LinkTest_Template,
+    LinkTest_Benchmark,
+    LinkTest_Lz4,
+    TraceTest_Json,
+    TraceTest_Summary,
+    TraceTest_Full,
+    TraceTest_Threads,
+    SchedTest_Chain,
+    SchedTest_Failure,
+    SchedTest_Inline,
+    SchedTest_Benchmark,
+    SchedTest_Spawn,
+    DIQueueTest_Read,
+    DIQueueTest_Wait,
+    DIQueueTest_Retry,
+    BootTest_Synthetic,
+    BootTest_Image,
+    NetCodecTest_RoundTrip,
+    NetCodecTest_Size,
+    NetCodecTest_Malformed,
+    NetWindowTest_Lossless,
+    NetWindowTest_Loss,
+    NetWindowTest_Messages,
+    NetFrameTest_Direct,
+    NetFrameTest_Authority,
+    NetDelayTest_Start,
+    NetDelayTest_Adjust,
+    NetSnapTest_RoundTrip,
+    NetSnapTest_Overflow,
+    NetFrameTest_Predict,
+    NetRingTest_Single,
+    NetRingTest_Threads,
+    NetLoopTest_PingPong,
+    NetLoopTest_Timers,
+    NetLoopTest_Batch,
 };
 
 #define TEST_COUNT (sizeof(tests) / sizeof(*tests))
@@ -0,0 +1,339 @@
+/* sched_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../src/library/sched.c"
+
+#include "sched_test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SCHED_TEST_THREADS 4
+#define SCHED_TEST_CHAIN 100
+#define SCHED_TEST_LEAVES (1 << 16)
+
+typedef struct {
+    size_t index;
+    size_t *order;
+    size_t *order_count;
+    bool fail;
+    bool ran;
+} sched_test_step_t;
+
+/* A node of a tree summing the leaves below it. */
+typedef struct sched_test_node_t {
+    uint64_t sum;
+    const struct sched_test_node_t *left;
+    const struct sched_test_node_t *right;
+} sched_test_node_t;
+
+static bool SchedTest_Step(void *arg) {
+    sched_test_step_t *step = arg;
+    
+    step->ran = true;
+    if (step->order != NULL)
+        step->order[(*step->order_count)++] = step->index;
+    return !step->fail;
+}
+
+/* Work found by a running task, as a directory scan finds files. */
+typedef struct {
+    sched_t *sched;
+    sched_task_t *join;
+    sched_test_step_t *steps;
+    size_t count;
+} sched_test_scan_t;
+
+static bool SchedTest_Scan(void *arg) {
+    sched_test_scan_t *scan = arg;
+    size_t i;
+    
+    for (i = 0; i < scan->count; i++) {
+        sched_task_t *task;
+        
+        task = Sched_Task(scan->sched, &SchedTest_Step, scan->steps + i);
+        if (task == NULL || !Sched_Depend(scan->sched, scan->join, task))
+            return false;
+        Sched_Submit(scan->sched, task);
+    }
+    Sched_Submit(scan->sched, scan->join);
+    return true;
+}
+
+static bool SchedTest_Sum(void *arg) {
+    sched_test_node_t *node = arg;
+    
+    if (node->left != NULL)
+        node->sum = node->left->sum + node->right->sum;
+    return true;
+}
+
+int SchedTest_Chain(void) {
+    sched_test_step_t steps[SCHED_TEST_CHAIN];
+    size_t order[SCHED_TEST_CHAIN], order_count = 0, i;
+    sched_task_t *previous = NULL;
+    sched_t *sched;
+    int result = 0;
+    
+    sched = Sched_Create(SCHED_TEST_THREADS);
+    if (sched == NULL)
+        return 101;
+    
+    /* submitted backwards, so only the dependencies keep them in order. */
+    for (i = 0; i < SCHED_TEST_CHAIN; i++) {
+        sched_task_t *task;
+        
+        steps[i].index = i;
+        steps[i].order = order;
+        steps[i].order_count = &order_count;
+        steps[i].fail = false;
+        steps[i].ran = false;
+        task = Sched_Task(sched, &SchedTest_Step, steps + i);
+        if (task == NULL)
+            return 102;
+        if (previous != NULL) {
+            if (!Sched_Depend(sched, previous, task))
+                return 103;
+            Sched_Submit(sched, previous);
+        }
+        previous = task;
+    }
+    Sched_Submit(sched, previous);
+    
+    if (!Sched_Wait(sched))
+        result = 104;
+    else if (order_count != SCHED_TEST_CHAIN)
+        result = 105;
+    for (i = 0; result == 0 && i < SCHED_TEST_CHAIN; i++)
+        if (order[i] != SCHED_TEST_CHAIN - 1 - i)
+            result = 106;
+    
+    Sched_Destroy(sched);
+    return result;
+}
+
+int SchedTest_Failure(void) {
+    /* 0 fails, 1 needs 0, 2 needs 1, 3 needs nothing. */
+    sched_test_step_t steps[4];
+    sched_task_t *tasks[4];
+    sched_t *sched;
+    size_t i, round;
+    
+    sched = Sched_Create(SCHED_TEST_THREADS);
+    if (sched == NULL)
+        return 101;
+    
+    /* the second round shows a failure doesn't outlive its Sched_Wait. */
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < 4; i++) {
+            steps[i].order = NULL;
+            steps[i].fail = round == 0 && i == 0;
+            steps[i].ran = false;
+            tasks[i] = Sched_Task(sched, &SchedTest_Step, steps + i);
+            if (tasks[i] == NULL)
+                return 102;
+        }
+        if (!Sched_Depend(sched, tasks[1], tasks[0]) ||
+            !Sched_Depend(sched, tasks[2], tasks[1]))
+            return 103;
+        for (i = 0; i < 4; i++)
+            Sched_Submit(sched, tasks[i]);
+        
+        if (Sched_Wait(sched) != (round == 1))
+            return 104;
+        if (!steps[0].ran || !steps[3].ran)
+            return 105;
+        if (steps[1].ran != (round == 1) || steps[2].ran != (round == 1))
+            return 106;
+    }
+    
+    Sched_Destroy(sched);
+    return 0;
+}
+
+/* With no threads of its own, everything runs in Sched_Wait. */
+int SchedTest_Inline(void) {
+    sched_test_step_t steps[3];
+    sched_task_t *tasks[3];
+    size_t order[3], order_count = 0, i;
+    sched_t *sched;
+    
+    sched = Sched_Create(0);
+    if (sched == NULL)
+        return 101;
+    
+    for (i = 0; i < 3; i++) {
+        steps[i].index = i;
+        steps[i].order = order;
+        steps[i].order_count = &order_count;
+        steps[i].fail = false;
+        steps[i].ran = false;
+        tasks[i] = Sched_Task(sched, &SchedTest_Step, steps + i);
+        if (tasks[i] == NULL)
+            return 102;
+    }
+    /* a diamond: 2 needs 0 and 1, which are independent. */
+    if (!Sched_Depend(sched, tasks[2], tasks[0]) ||
+        !Sched_Depend(sched, tasks[2], tasks[1]))
+        return 103;
+    for (i = 0; i < 3; i++)
+        Sched_Submit(sched, tasks[i]);
+    
+    if (order_count != 0)
+        return 104;
+    if (!Sched_Wait(sched))
+        return 105;
+    if (order_count != 3 || order[2] != 2)
+        return 106;
+    
+    Sched_Destroy(sched);
+    return 0;
+}
+
+/* Tasks made by a running task, waited on through a join made up front. */
+int SchedTest_Spawn(void) {
+    static const size_t thread_counts[] = { 0, SCHED_TEST_THREADS };
+    sched_test_step_t steps[SCHED_TEST_CHAIN + 1];
+    size_t order[SCHED_TEST_CHAIN + 1], order_count, i, run;
+    sched_test_scan_t scan;
+    
+    for (run = 0; run < 2; run++) {
+        sched_task_t *task, *last;
+        sched_t *sched;
+        
+        sched = Sched_Create(thread_counts[run]);
+        if (sched == NULL)
+            return 101;
+        
+        order_count = 0;
+        for (i = 0; i <= SCHED_TEST_CHAIN; i++) {
+            steps[i].index = i;
+            steps[i].order = run == 0 ? order : NULL;
+            steps[i].order_count = &order_count;
+            steps[i].fail = false;
+            steps[i].ran = false;
+        }
+        scan.sched = sched;
+        scan.join = Sched_Join(sched);
+        scan.steps = steps;
+        scan.count = SCHED_TEST_CHAIN;
+        task = Sched_Task(sched, &SchedTest_Scan, &scan);
+        last = Sched_Task(sched, &SchedTest_Step, steps + SCHED_TEST_CHAIN);
+        if (scan.join == NULL || task == NULL || last == NULL)
+            return 102;
+        if (!Sched_Depend(sched, last, scan.join))
+            return 103;
+        Sched_Submit(sched, last);
+        Sched_Submit(sched, task);
+        
+        if (!Sched_Wait(sched))
+            return 104;
+        for (i = 0; i <= SCHED_TEST_CHAIN; i++)
+            if (!steps[i].ran)
+                return 105;
+        /* inline, the order is known: the last step waits for the rest. */
+        if (run == 0 && (order_count != SCHED_TEST_CHAIN + 1 ||
+                order[SCHED_TEST_CHAIN] != SCHED_TEST_CHAIN))
+            return 106;
+        Sched_Destroy(sched);
+    }
+    return 0;
+}
+
+static unsigned long SchedTest_Milliseconds(void) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000ul + now.tv_nsec / 1000000;
+}
+
+/* Sum a large tree of tiny tasks to measure the scheduler's overhead. */
+int SchedTest_Benchmark(void) {
+    static const size_t thread_counts[] = { 0, 1, SCHED_TEST_THREADS };
+    sched_test_node_t *nodes;
+    sched_task_t **tasks;
+    size_t i, run, count = 2 * SCHED_TEST_LEAVES - 1;
+    int result = 0;
+    
+    nodes = malloc(sizeof(sched_test_node_t) * count);
+    tasks = malloc(sizeof(sched_task_t *) * count);
+    if (nodes == NULL || tasks == NULL) {
+        free(nodes);
+        free(tasks);
+        return 101;
+    }
+    
+    for (run = 0; result == 0 && run < 3; run++) {
+        sched_t *sched;
+        unsigned long start;
+        
+        sched = Sched_Create(thread_counts[run]);
+        if (sched == NULL) {
+            result = 102;
+            break;
+        }
+        
+        start = SchedTest_Milliseconds();
+        /* leaves first, then node i sums nodes 2i+1 and 2i+2 of the heap. */
+        for (i = count; result == 0 && i-- > 0; ) {
+            if (i >= SCHED_TEST_LEAVES - 1) {
+                nodes[i].sum = i - (SCHED_TEST_LEAVES - 1);
+                nodes[i].left = NULL;
+                nodes[i].right = NULL;
+            } else {
+                nodes[i].left = nodes + 2 * i + 1;
+                nodes[i].right = nodes + 2 * i + 2;
+            }
+            tasks[i] = Sched_Task(sched, &SchedTest_Sum, nodes + i);
+            if (tasks[i] == NULL)
+                result = 103;
+            else if (i < SCHED_TEST_LEAVES - 1 &&
+                (!Sched_Depend(sched, tasks[i], tasks[2 * i + 1]) ||
+                 !Sched_Depend(sched, tasks[i], tasks[2 * i + 2])))
+                result = 104;
+            else
+                Sched_Submit(sched, tasks[i]);
+        }
+        
+        if (!Sched_Wait(sched) && result == 0)
+            result = 105;
+        if (result == 0 && nodes[0].sum !=
+            (uint64_t)SCHED_TEST_LEAVES * (SCHED_TEST_LEAVES - 1) / 2)
+            result = 106;
+        
+        if (result == 0)
+            printf(
+                "%lu tasks on %lu threads: %lu ms\n", (unsigned long)count,
+                (unsigned long)thread_counts[run],
+                SchedTest_Milliseconds() - start);
+        Sched_Destroy(sched);
+    }
+    
+    free(tasks);
+    free(nodes);
+    return result;
+}
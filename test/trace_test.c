@@ -0,0 +1,263 @@
+/* trace_test.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "../src/library/trace.c"
+
+#include "trace_test.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_TEST_THREADS 4
+#define TRACE_TEST_EVENTS 10000
+
+/* a clock under the test's control, counting 1000 ticks per millisecond so
+ * ticks are microseconds. */
+static uint64_t trace_test_time;
+static uint32_t trace_test_thread;
+
+static uint64_t TraceTest_Clock(void) {
+    return trace_test_time;
+}
+
+static uint32_t TraceTest_Thread(void) {
+    return trace_test_thread;
+}
+
+static uint32_t TraceTest_PthreadThread(void) {
+    return (uint32_t)(uintptr_t)pthread_self();
+}
+
+static void *TraceTest_ThreadMain(void *arg) {
+    size_t i;
+    
+    for (i = 0; i < TRACE_TEST_EVENTS; i++)
+        Trace_Instant("test", (const char *)arg);
+    
+    return NULL;
+}
+
+/* The whole of file as a string, which the caller frees. */
+static char *TraceTest_Read(FILE *file) {
+    char *result;
+    long size;
+    
+    if (fseek(file, 0, SEEK_END) != 0)
+        return NULL;
+    size = ftell(file);
+    rewind(file);
+    
+    result = malloc(size + 1);
+    if (result == NULL)
+        return NULL;
+    if (fread(result, 1, size, file) != (size_t)size) {
+        free(result);
+        return NULL;
+    }
+    result[size] = '\0';
+    return result;
+}
+
+int TraceTest_Json(void) {
+    FILE *file;
+    char *json;
+    int result = 0;
+    
+    /* nothing is recorded before Trace_Init. */
+    Trace_Begin("phase", "early");
+    if (Trace_Count() != 0)
+        return 101;
+    
+    trace_test_time = 5000;
+    trace_test_thread = 7;
+    if (!Trace_Init(16, &TraceTest_Clock, &TraceTest_Thread, 1000))
+        return 102;
+    
+    Trace_ThreadName("Module_Main");
+    trace_test_time = 6000;
+    Trace_Begin("phase", "link");
+    trace_test_time = 6500;
+    Trace_Instant("trigger", "say \"hi\"");
+    /* the clock is set back, which must not show in the trace. */
+    Trace_ClockChanged(7000, 100);
+    trace_test_time = 1100;
+    Trace_End("phase", "link");
+    
+    if (Trace_Count() != 4 || Trace_Dropped() != 0)
+        return 103;
+    if (Trace_Events()[3].time != 8000)
+        return 104;
+    
+    file = tmpfile();
+    if (file == NULL)
+        return 105;
+    if (!Trace_WriteJson(file))
+        result = 106;
+    json = TraceTest_Read(file);
+    fclose(file);
+    
+    if (result == 0 && json == NULL)
+        result = 107;
+    if (result == 0 && strncmp(json, "{\"traceEvents\":[\n", 17) != 0)
+        result = 108;
+    if (result == 0 && strstr(json,
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":7,"
+        "\"args\":{\"name\":\"Module_Main\"}},\n") == NULL)
+        result = 109;
+    if (result == 0 && strstr(json,
+        "{\"name\":\"link\",\"cat\":\"phase\",\"ph\":\"B\",\"ts\":1000,"
+        "\"pid\":1,\"tid\":7},\n") == NULL)
+        result = 110;
+    if (result == 0 && strstr(json,
+        "{\"name\":\"say \\\"hi\\\"\",\"cat\":\"trigger\",\"ph\":\"i\","
+        "\"ts\":1500,\"s\":\"t\",\"pid\":1,\"tid\":7},\n") == NULL)
+        result = 111;
+    if (result == 0 && strstr(json,
+        "{\"name\":\"link\",\"cat\":\"phase\",\"ph\":\"E\",\"ts\":3000,"
+        "\"pid\":1,\"tid\":7}\n],\"displayTimeUnit\":\"ms\"}\n") == NULL)
+        result = 112;
+    
+    free(json);
+    Trace_Free();
+    return result;
+}
+
+int TraceTest_Summary(void) {
+    FILE *file;
+    char *summary;
+    int result = 0;
+    
+    trace_test_time = 0;
+    trace_test_thread = 1;
+    if (!Trace_Init(64, &TraceTest_Clock, &TraceTest_Thread, 1000))
+        return 101;
+    
+    /* thread 1: parse twice, with a wait nested in the second. */
+    Trace_Begin("phase", "parse");
+    trace_test_time = 2000;
+    Trace_End("phase", "parse");
+    Trace_Begin("phase", "parse");
+    trace_test_thread = 2;
+    /* thread 2, interleaved: a long link. */
+    Trace_Begin("phase", "link");
+    trace_test_thread = 1;
+    Trace_Begin("wait", "event");
+    trace_test_time = 3000;
+    Trace_End("wait", "event");
+    trace_test_time = 5000;
+    Trace_End("phase", "parse");
+    trace_test_time = 9000;
+    trace_test_thread = 2;
+    Trace_End("phase", "link");
+    /* an unmatched end is ignored. */
+    Trace_End("phase", "stray");
+    
+    file = tmpfile();
+    if (file == NULL)
+        return 102;
+    Trace_Summary(file);
+    summary = TraceTest_Read(file);
+    fclose(file);
+    
+    if (summary == NULL)
+        result = 103;
+    else if (strcmp(summary,
+            "      7 ms    1x phase link\n"
+            "      5 ms    2x phase parse\n"
+            "      1 ms    1x wait event\n") != 0)
+        result = 104;
+    
+    free(summary);
+    Trace_Free();
+    return result;
+}
+
+int TraceTest_Full(void) {
+    size_t i;
+    
+    trace_test_time = 0;
+    trace_test_thread = 1;
+    if (!Trace_Init(8, &TraceTest_Clock, &TraceTest_Thread, 1000))
+        return 101;
+    
+    for (i = 0; i < 20; i++) {
+        trace_test_time = i;
+        Trace_Instant("test", "tick");
+    }
+    
+    if (Trace_Count() != 8 || Trace_Dropped() != 12)
+        return 102;
+    /* the first events are the ones kept. */
+    for (i = 0; i < 8; i++)
+        if (Trace_Events()[i].time != i)
+            return 103;
+    
+    Trace_Free();
+    if (Trace_Count() != 0 || Trace_Dropped() != 0)
+        return 104;
+    
+    return 0;
+}
+
+/* Threads recording at once must each get their own slot. */
+int TraceTest_Threads(void) {
+    static const char *names[TRACE_TEST_THREADS] = { "a", "b", "c", "d" };
+    pthread_t threads[TRACE_TEST_THREADS];
+    size_t counts[TRACE_TEST_THREADS] = { 0 };
+    size_t i, j;
+    
+    if (!Trace_Init(
+            TRACE_TEST_THREADS * TRACE_TEST_EVENTS, &TraceTest_Clock,
+            &TraceTest_PthreadThread, 1000))
+        return 101;
+    
+    for (i = 0; i < TRACE_TEST_THREADS; i++)
+        if (pthread_create(
+                threads + i, NULL, &TraceTest_ThreadMain, (void *)names[i]))
+            return 102;
+    for (i = 0; i < TRACE_TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    
+    if (Trace_Count() != TRACE_TEST_THREADS * TRACE_TEST_EVENTS ||
+        Trace_Dropped() != 0)
+        return 103;
+    
+    for (i = 0; i < Trace_Count(); i++) {
+        for (j = 0; j < TRACE_TEST_THREADS; j++)
+            if (Trace_Events()[i].name == names[j])
+                break;
+        if (j == TRACE_TEST_THREADS)
+            return 104;
+        counts[j]++;
+    }
+    for (j = 0; j < TRACE_TEST_THREADS; j++)
+        if (counts[j] != TRACE_TEST_EVENTS)
+            return 105;
+    
+    Trace_Free();
+    return 0;
+}
@@ -0,0 +1,291 @@
+/* bslug_pack.c
+ *   by Alex Chadwick
+ * 
+ * Copyright (C) 2014, Alex Chadwick
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Host tool to compress the loadable sections of a BrainSlug module.
+ *  usage: bslug_pack input.mod output.mod
+ * Each allocated PROGBITS section that shrinks is replaced by an LZ4 block
+ * behind an Elf32_Chdr and flagged SHF_COMPRESSED (see link.h), which the
+ * loader decompresses straight to the section's final address. Relocations,
+ * symbols and strings are left alone since the loader reads them in place. */
+ 
+#include "modules/link.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* sections smaller than this aren't worth the header. */
+#define PACK_MIN_SIZE 64
+#define PACK_HASH_BITS 12
+/* LZ4 needs the last 5 bytes to be literals and the last match to start at
+ * least 12 bytes from the end. */
+#define PACK_LAST_LITERALS 5
+#define PACK_MATCH_LIMIT 12
+
+static uint8_t *Pack_ReadFile(const char *path, size_t *size);
+static size_t Pack_Lz4Compress(
+    const uint8_t *source, size_t size, uint8_t *destination);
+static uint8_t *Pack_Lz4Length(uint8_t *output, size_t length);
+static uint32_t Pack_Read32Le(const uint8_t *address);
+
+int main(int argc, char *argv[]) {
+    uint8_t *input, *output = NULL, *headers = NULL;
+    size_t input_size, output_size, offset, shoff, shndx;
+    size_t total_before = 0, total_after = 0;
+    link_elf_t elf;
+    FILE *file;
+    int result = 1;
+    
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s input.mod output.mod\n", argv[0]);
+        return 1;
+    }
+    
+    input = Pack_ReadFile(argv[1], &input_size);
+    if (input == NULL) {
+        fprintf(stderr, "%s: could not read.\n", argv[1]);
+        return 1;
+    }
+    if (Link_ElfOpen(&elf, input, input_size) != LINK_ELF_OK) {
+        fprintf(stderr, "%s: not a BrainSlug module.\n", argv[1]);
+        goto exit_error;
+    }
+    
+    shoff = Link_Read32(input + offsetof(Elf32_Ehdr, e_shoff));
+    
+    /* compression never makes a section bigger, since sections that don't
+     * shrink are copied, so the input size plus realigning each section is
+     * enough. */
+    output_size = input_size;
+    for (shndx = 1; shndx < elf.section_count; shndx++) {
+        output_size += 3 + Link_Read32(
+            input + shoff + shndx * sizeof(Elf32_Shdr) +
+            offsetof(Elf32_Shdr, sh_addralign));
+    }
+    output = calloc(1, output_size);
+    headers = calloc(elf.section_count, sizeof(Elf32_Shdr));
+    if (output == NULL || headers == NULL)
+        goto exit_error;
+    
+    memcpy(output, input, sizeof(Elf32_Ehdr));
+    offset = sizeof(Elf32_Ehdr);
+    
+    /* section contents first, then the section headers. */
+    for (shndx = 1; shndx < elf.section_count; shndx++) {
+        Elf32_Shdr shdr;
+        const uint8_t *raw;
+        uint8_t *header;
+        size_t size, align;
+        uint32_t flags;
+        
+        if (!Link_ElfSection(&elf, shndx, &shdr))
+            goto exit_error;
+        
+        raw = input + shoff + shndx * sizeof(Elf32_Shdr);
+        size = Link_ElfSectionFileSize(&elf, shndx);
+        flags = shdr.sh_flags;
+        align = Link_Read32(raw + offsetof(Elf32_Shdr, sh_addralign));
+        if (align < 4)
+            align = 4;
+        
+        header = headers + shndx * sizeof(Elf32_Shdr);
+        memcpy(header, raw, sizeof(Elf32_Shdr));
+        
+        if (shdr.sh_type == SHT_NOBITS || shdr.sh_type == SHT_NULL)
+            continue;
+        
+        offset += -offset & (align - 1);
+        
+        if (shdr.sh_type == SHT_PROGBITS && (flags & SHF_ALLOC) &&
+            !(flags & SHF_COMPRESSED) && size >= PACK_MIN_SIZE) {
+            
+            uint8_t *compressed;
+            size_t compressed_size;
+            
+            /* the worst case for LZ4 is a little over the input size. */
+            compressed = malloc(size + size / 255 + 16);
+            if (compressed == NULL)
+                goto exit_error;
+            compressed_size = Pack_Lz4Compress(
+                input + shdr.sh_offset, size, compressed);
+            
+            if (LINK_ELF_CHDR_SIZE + compressed_size < size) {
+                Link_Write32(output + offset, LINK_ELFCOMPRESS_LZ4);
+                Link_Write32(output + offset + 4, shdr.sh_size);
+                Link_Write32(output + offset + 8, shdr.sh_addralign);
+                memcpy(
+                    output + offset + LINK_ELF_CHDR_SIZE,
+                    compressed, compressed_size);
+                
+                Link_Write32(
+                    header + offsetof(Elf32_Shdr, sh_flags),
+                    flags | SHF_COMPRESSED);
+                Link_Write32(
+                    header + offsetof(Elf32_Shdr, sh_addralign), 4);
+                
+                total_before += size;
+                size = LINK_ELF_CHDR_SIZE + compressed_size;
+                total_after += size;
+                free(compressed);
+                goto placed;
+            }
+            free(compressed);
+        }
+        
+        memcpy(output + offset, input + shdr.sh_offset, size);
+placed:
+        Link_Write32(header + offsetof(Elf32_Shdr, sh_offset), offset);
+        Link_Write32(header + offsetof(Elf32_Shdr, sh_size), size);
+        offset += size;
+    }
+    
+    /* the section headers go just after the contents. */
+    offset += -offset & 3;
+    memcpy(output + offset, headers, elf.section_count * sizeof(Elf32_Shdr));
+    Link_Write32(output + offsetof(Elf32_Ehdr, e_shoff), offset);
+    output_size = offset + elf.section_count * sizeof(Elf32_Shdr);
+    
+    file = fopen(argv[2], "wb");
+    if (file == NULL ||
+        fwrite(output, 1, output_size, file) != output_size) {
+        fprintf(stderr, "%s: could not write.\n", argv[2]);
+        if (file != NULL)
+            fclose(file);
+        goto exit_error;
+    }
+    fclose(file);
+    
+    printf(
+        "%s: %u bytes of sections compressed to %u; file %u bytes.\n",
+        argv[2], (unsigned)total_before, (unsigned)total_after,
+        (unsigned)output_size);
+    
+    result = 0;
+exit_error:
+    free(headers);
+    free(output);
+    free(input);
+    return result;
+}
+
+static uint8_t *Pack_ReadFile(const char *path, size_t *size) {
+    FILE *file;
+    uint8_t *data = NULL;
+    long length;
+    
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0 &&
+        fseek(file, 0, SEEK_SET) == 0) {
+        data = malloc(length);
+        if (data != NULL && fread(data, 1, length, file) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+        *size = length;
+    }
+    fclose(file);
+    return data;
+}
+
+/* Greedy LZ4 block compression with a single entry hash table, which is
+ * plenty for code. Returns the compressed size. */
+static size_t Pack_Lz4Compress(
+        const uint8_t *source, size_t size, uint8_t *destination) {
+    static size_t table[1 << PACK_HASH_BITS];
+    size_t position, anchor, i;
+    uint8_t *output;
+    
+    for (i = 0; i < sizeof(table) / sizeof(*table); i++)
+        table[i] = SIZE_MAX;
+    
+    output = destination;
+    position = 0;
+    anchor = 0;
+    
+    while (size > PACK_MATCH_LIMIT && position < size - PACK_MATCH_LIMIT) {
+        uint32_t sequence, hash;
+        size_t candidate, length;
+        uint8_t *token;
+        
+        sequence = Pack_Read32Le(source + position);
+        hash = (sequence * 2654435761u) >> (32 - PACK_HASH_BITS);
+        candidate = table[hash];
+        table[hash] = position;
+        
+        if (candidate == SIZE_MAX || position - candidate > 0xffff ||
+            Pack_Read32Le(source + candidate) != sequence) {
+            position++;
+            continue;
+        }
+        
+        length = 4;
+        while (position + length < size - PACK_LAST_LITERALS &&
+               source[candidate + length] == source[position + length])
+            length++;
+        
+        token = output++;
+        *token = (position - anchor >= 15 ? 15 : position - anchor) << 4;
+        if (position - anchor >= 15)
+            output = Pack_Lz4Length(output, position - anchor - 15);
+        memcpy(output, source + anchor, position - anchor);
+        output += position - anchor;
+        
+        *output++ = (position - candidate) & 0xff;
+        *output++ = (position - candidate) >> 8;
+        
+        *token |= length - 4 >= 15 ? 15 : length - 4;
+        if (length - 4 >= 15)
+            output = Pack_Lz4Length(output, length - 4 - 15);
+        
+        position += length;
+        anchor = position;
+    }
+    
+    /* the rest are literals. */
+    *output++ = (size - anchor >= 15 ? 15 : size - anchor) << 4;
+    if (size - anchor >= 15)
+        output = Pack_Lz4Length(output, size - anchor - 15);
+    memcpy(output, source + anchor, size - anchor);
+    output += size - anchor;
+    
+    return output - destination;
+}
+
+static uint8_t *Pack_Lz4Length(uint8_t *output, size_t length) {
+    for (; length >= 255; length -= 255)
+        *output++ = 255;
+    *output++ = length;
+    return output;
+}
+
+static uint32_t Pack_Read32Le(const uint8_t *address) {
+    return
+        (uint32_t)address[0] | ((uint32_t)address[1] << 8) |
+        ((uint32_t)address[2] << 16) | ((uint32_t)address[3] << 24);
+}